@@ -41,6 +41,8 @@
 #include "chatty-history.h"
 #include "chatty-utils.h"
 #include "chatty-clock.h"
+#include "chatty-profile.h"
+#include "chatty-stats.h"
 #include "chatty-log.h"
 
 /**
@@ -60,10 +62,18 @@ struct _ChattyApplication
 
   char *uri;
   guint open_uri_id;
+
+  /* The chat to open once its backend has loaded it */
+  GVariant *pending_chat;
+  gulong    pending_chat_id;
+  guint     pending_chat_timeout_id;
 };
 
 G_DEFINE_TYPE (ChattyApplication, chatty_application, ADW_TYPE_APPLICATION)
 
+/* Time to wait for backends to load a chat requested before, in seconds */
+#define PENDING_CHAT_TIMEOUT 60
+
 static gboolean    cmd_verbose_cb   (const char *option_name,
                                      const char *value,
                                      gpointer    data,
@@ -77,6 +87,10 @@ static GOptionEntry cmd_options[] = {
 #endif
   { "verbose", 'v', G_OPTION_FLAG_NO_ARG, G_OPTION_ARG_CALLBACK, cmd_verbose_cb,
     N_("Enable verbose debug messages (repeat option for more verbosity)"), NULL },
+  { "startup-profile", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, NULL,
+    N_("Print the time spent in each startup phase"), NULL },
+  { "stats", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, NULL,
+    N_("Print the performance counters of the running instance"), NULL },
   { NULL }
 };
 
@@ -230,25 +244,20 @@ chatty_application_show_window (GSimpleAction *action,
   g_application_activate (G_APPLICATION (self));
 }
 
-static void
-chatty_application_open_chat (GSimpleAction *action,
-                              GVariant      *parameter,
-                              gpointer       user_data)
+static ChattyChat *
+application_find_chat (ChattyApplication *self,
+                       GVariant          *parameter)
 {
-  ChattyApplication *self = user_data;
   const char *room_id, *account_id;
   ChattyChat *chat;
   ChattyProtocol protocol;
 
-  g_assert (CHATTY_IS_APPLICATION (self));
-
-  g_variant_get (parameter, "(ssi)", &room_id, &account_id, &protocol);
-  g_return_if_fail (room_id && account_id);
+  g_variant_get (parameter, "(&s&si)", &room_id, &account_id, &protocol);
+  g_return_val_if_fail (room_id && account_id, NULL);
 
   chat = chatty_manager_find_chat_with_name (self->manager, protocol, account_id, room_id);
-  g_return_if_fail (chat);
 
-  if (chatty_log_get_verbosity () > 1) {
+  if (chat && chatty_log_get_verbosity () > 1) {
     g_autoptr(GString) str = NULL;
 
     str = g_string_new (NULL);
@@ -259,10 +268,91 @@ chatty_application_open_chat (GSimpleAction *action,
     g_info ("%s", str->str);
   }
 
+  return chat;
+}
+
+static void
+application_clear_pending_chat (ChattyApplication *self)
+{
+  if (!self->pending_chat)
+    return;
+
+  g_clear_signal_handler (&self->pending_chat_id,
+                          chatty_manager_get_chat_list (self->manager));
+  g_clear_handle_id (&self->pending_chat_timeout_id, g_source_remove);
+  g_clear_pointer (&self->pending_chat, g_variant_unref);
+}
+
+static gboolean
+application_pending_chat_timeout_cb (gpointer user_data)
+{
+  ChattyApplication *self = user_data;
+
+  g_assert (CHATTY_IS_APPLICATION (self));
+
+  g_debug ("Chat to open not found");
+  self->pending_chat_timeout_id = 0;
+  application_clear_pending_chat (self);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+application_chat_list_changed_cb (ChattyApplication *self,
+                                  guint              position,
+                                  guint              removed,
+                                  guint              added)
+{
+  ChattyChat *chat;
+
+  g_assert (CHATTY_IS_APPLICATION (self));
+  g_assert (self->pending_chat);
+
+  if (!added)
+    return;
+
+  chat = application_find_chat (self, self->pending_chat);
+
+  if (!chat)
+    return;
+
+  application_clear_pending_chat (self);
   g_application_activate (G_APPLICATION (self));
   chatty_window_open_chat (CHATTY_WINDOW (self->main_window), chat);
 }
 
+static void
+chatty_application_open_chat (GSimpleAction *action,
+                              GVariant      *parameter,
+                              gpointer       user_data)
+{
+  ChattyApplication *self = user_data;
+  ChattyChat *chat;
+
+  g_assert (CHATTY_IS_APPLICATION (self));
+
+  /* This also starts loading the backends if not yet done */
+  g_application_activate (G_APPLICATION (self));
+  application_clear_pending_chat (self);
+
+  chat = application_find_chat (self, parameter);
+
+  if (chat) {
+    chatty_window_open_chat (CHATTY_WINDOW (self->main_window), chat);
+    return;
+  }
+
+  /* When started to open the chat, its backend is still loading */
+  self->pending_chat = g_variant_ref (parameter);
+  self->pending_chat_id = g_signal_connect_object (chatty_manager_get_chat_list (self->manager),
+                                                   "items-changed",
+                                                   G_CALLBACK (application_chat_list_changed_cb),
+                                                   self, G_CONNECT_SWAPPED);
+  self->pending_chat_timeout_id = g_timeout_add_seconds (PENDING_CHAT_TIMEOUT,
+                                                         application_pending_chat_timeout_cb,
+                                                         self);
+}
+
 static void
 main_window_focus_changed_cb (ChattyApplication *self)
 {
@@ -313,6 +403,7 @@ chatty_application_finalize (GObject *object)
   ChattyApplication *self = (ChattyApplication *)object;
 
   g_clear_handle_id (&self->open_uri_id, g_source_remove);
+  application_clear_pending_chat (self);
   g_clear_object (&self->manager);
 
   G_OBJECT_CLASS (chatty_application_parent_class)->finalize (object);
@@ -327,6 +418,10 @@ chatty_application_handle_local_options (GApplication *application,
     return 0;
   }
 
+  /* Local options are handled before startup, so that it can be timed too */
+  if (g_variant_dict_contains (options, "startup-profile"))
+    chatty_profile_init ();
+
   return -1;
 }
 
@@ -341,6 +436,16 @@ chatty_application_command_line (GApplication            *application,
 
   options = g_application_command_line_get_options_dict (command_line);
 
+  /* Handled by the primary instance, printed by the one invoked */
+  if (g_variant_dict_contains (options, "stats")) {
+    g_autofree char *stats = NULL;
+
+    stats = chatty_stats_to_string ();
+    g_application_command_line_print (command_line, "%s", stats);
+
+    return 0;
+  }
+
   if (g_variant_dict_contains (options, "nologin"))
     chatty_manager_disable_auto_login (chatty_manager_get_default (), TRUE);
 
@@ -377,24 +482,37 @@ chatty_application_startup (GApplication *application)
   g_autofree char *db_path = NULL;
   g_autofree char *purple_dir = NULL;
   const char *help_accels[] = { "F1", NULL };
+  guint profile_id;
 
+  profile_id = chatty_profile_begin ("manager");
   self->manager = chatty_manager_get_default ();
+  chatty_profile_end (profile_id);
 
+  profile_id = chatty_profile_begin ("gtk-startup");
   G_APPLICATION_CLASS (chatty_application_parent_class)->startup (application);
+  chatty_profile_end (profile_id);
 
   g_info ("%s %s, git version: %s", PACKAGE_NAME, PACKAGE_VERSION, GIT_VERSION);
 
+  profile_id = chatty_profile_begin ("cmatrix-init");
   cm_init (TRUE);
+  chatty_stats_init ();
+  chatty_profile_end (profile_id);
 
   g_set_application_name (_("Chats"));
 
   if (!gtk_window_get_default_icon_name ())
     gtk_window_set_default_icon_name (CHATTY_APP_ID);
 
+  profile_id = chatty_profile_begin ("history-open");
   purple_dir = chatty_utils_get_purple_dir ();
   db_path =  g_build_filename (purple_dir, "chatty", "db", NULL);
   chatty_history_open (chatty_manager_get_history (self->manager),
                        db_path, "chatty-history.db");
+  chatty_profile_end (profile_id);
+
+  /* So that the chat list can be shown before any backend is loaded */
+  chatty_manager_load_chat_snapshot (self->manager);
 
   self->settings = chatty_settings_get_default ();
   g_signal_connect_object (self->manager, "open-chat",
@@ -418,6 +536,16 @@ chatty_application_startup (GApplication *application)
 }
 
 
+static gboolean
+app_window_first_frame_cb (GtkWidget     *widget,
+                           GdkFrameClock *frame_clock,
+                           gpointer       user_data)
+{
+  chatty_profile_end (GPOINTER_TO_UINT (user_data));
+
+  return G_SOURCE_REMOVE;
+}
+
 static void
 chatty_application_activate (GApplication *application)
 {
@@ -426,18 +554,29 @@ chatty_application_activate (GApplication *application)
 
   g_assert (GTK_IS_APPLICATION (app));
 
-  chatty_manager_load (self->manager);
-
   if (!self->main_window) {
+    guint profile_id;
+
+    profile_id = chatty_profile_begin ("window");
     g_set_weak_pointer (&self->main_window, chatty_window_new (app));
     g_info ("New main window created");
 
     g_signal_connect_object (self->main_window, "notify::has-toplevel-focus",
                              G_CALLBACK (main_window_focus_changed_cb),
                              self, G_CONNECT_SWAPPED);
+    gtk_window_present (GTK_WINDOW (self->main_window));
+    chatty_profile_end (profile_id);
+
+    if (chatty_profile_is_enabled ())
+      gtk_widget_add_tick_callback (self->main_window, app_window_first_frame_cb,
+                                    GUINT_TO_POINTER (chatty_profile_begin ("first-frame")),
+                                    NULL);
+  } else {
+    gtk_window_present (GTK_WINDOW (self->main_window));
   }
 
-  gtk_window_present (GTK_WINDOW (self->main_window));
+  /* Backends are brought up from the main loop once the window is shown */
+  chatty_manager_load (self->manager);
 
   /* Open with some delay so that the modem is ready when not in daemon mode */
   if (self->uri)
@@ -451,6 +590,8 @@ chatty_application_shutdown (GApplication *application)
 {
   ChattyApplication *self = (ChattyApplication *)application;
 
+  chatty_profile_dump ();
+  chatty_manager_save_chat_snapshot (self->manager);
   g_object_unref (chatty_settings_get_default ());
   chatty_history_close (chatty_manager_get_history (self->manager));
 
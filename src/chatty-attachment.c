@@ -191,6 +191,19 @@ attachment_remove_clicked_cb (ChattyAttachment *self)
   g_signal_emit (self, signals[DELETED], 0);
 }
 
+static void
+chatty_attachment_unroot (GtkWidget *widget)
+{
+  ChattyAttachment *self = (ChattyAttachment *)widget;
+
+  /* Pending thumbnails of removed attachments shall not keep the workers busy */
+  g_cancellable_cancel (self->cancellable);
+  g_clear_object (&self->cancellable);
+  self->cancellable = g_cancellable_new ();
+
+  GTK_WIDGET_CLASS (chatty_attachment_parent_class)->unroot (widget);
+}
+
 static void
 chatty_attachment_finalize (GObject *object)
 {
@@ -211,6 +224,8 @@ chatty_attachment_class_init (ChattyAttachmentClass *klass)
 
   object_class->finalize = chatty_attachment_finalize;
 
+  widget_class->unroot = chatty_attachment_unroot;
+
   signals [DELETED] =
     g_signal_new ("deleted",
                   G_TYPE_FROM_CLASS (klass),
@@ -307,7 +322,10 @@ attachment_set_file_query_info_cb (GObject      *object,
     data = g_new0 (AttachmentData, 1);
     data->self = g_object_ref (self);
     data->image = g_object_ref (image);
+    /* Attachments on screen first */
     chatty_utils_create_thumbnail_async (self->file,
+                                         gtk_widget_get_mapped (GTK_WIDGET (self)) ?
+                                         G_PRIORITY_DEFAULT : G_PRIORITY_LOW,
                                          self->cancellable,
                                          file_create_thumbnail_cb,
                                          data);
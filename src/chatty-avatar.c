@@ -27,6 +27,9 @@
  */
 
 #define DEFAULT_SIZE 32
+/* Budget for the textures of all avatars, shared by all widgets */
+#define AVATAR_CACHE_MAX_SIZE (8 * 1024 * 1024)
+
 struct _ChattyAvatar
 {
   AdwBin      parent_instance;
@@ -45,6 +48,179 @@ enum {
 
 static GParamSpec *properties[N_PROPS];
 
+/*
+ * Textures are shared among all widgets showing the same item at the
+ * same size, so that an avatar visible in many rows (eg: a member of
+ * several rooms) is converted and uploaded only once.  A weak
+ * reference to the pixbuf the texture was created from is kept to know
+ * if the entry is stale, which also makes the entry safe if the item
+ * address is reused.  Only the textures are accounted in the budget, so
+ * the entries must not keep the (possibly full size) pixbufs alive.
+ */
+typedef struct {
+  ChattyItem *item;
+  int         size;
+  int         scale;
+
+  GWeakRef    source;
+  GdkTexture *texture;
+  gsize       n_bytes;
+  GList       link;
+} AvatarCacheEntry;
+
+static GHashTable *avatar_cache;
+/* Most recently used entry first */
+static GQueue avatar_cache_lru = G_QUEUE_INIT;
+static gsize avatar_cache_size;
+
+static guint
+avatar_cache_entry_hash (gconstpointer key)
+{
+  const AvatarCacheEntry *entry = key;
+
+  return g_direct_hash (entry->item) ^ (entry->size << 8) ^ entry->scale;
+}
+
+static gboolean
+avatar_cache_entry_equal (gconstpointer a,
+                          gconstpointer b)
+{
+  const AvatarCacheEntry *entry_a = a;
+  const AvatarCacheEntry *entry_b = b;
+
+  return entry_a->item == entry_b->item &&
+    entry_a->size == entry_b->size &&
+    entry_a->scale == entry_b->scale;
+}
+
+static void
+avatar_cache_entry_free (gpointer data)
+{
+  AvatarCacheEntry *entry = data;
+
+  g_queue_unlink (&avatar_cache_lru, &entry->link);
+  avatar_cache_size -= entry->n_bytes;
+
+  g_weak_ref_clear (&entry->source);
+  g_clear_object (&entry->texture);
+  g_free (entry);
+}
+
+/*
+ * Create a texture of at least @pixel_size on the shorter side in
+ * premultiplied BGRA, which is what the renderers upload without
+ * any further conversion.
+ */
+static GdkTexture *
+avatar_texture_new (GdkPixbuf *pixbuf,
+                    int        pixel_size,
+                    gsize     *n_bytes)
+{
+  g_autoptr(GdkPixbuf) scaled = NULL;
+  g_autoptr(GBytes) bytes = NULL;
+  const guchar *pixels;
+  guchar *data;
+  int width, height, rowstride, n_channels;
+  gboolean has_alpha;
+
+  width = gdk_pixbuf_get_width (pixbuf);
+  height = gdk_pixbuf_get_height (pixbuf);
+
+  /* Only scale down, the avatar widget scales up anyway */
+  if (MIN (width, height) > pixel_size) {
+    double ratio;
+
+    ratio = (double)pixel_size / MIN (width, height);
+    width = MAX (1, (int)(width * ratio + 0.5));
+    height = MAX (1, (int)(height * ratio + 0.5));
+    scaled = gdk_pixbuf_scale_simple (pixbuf, width, height, GDK_INTERP_BILINEAR);
+  } else {
+    scaled = g_object_ref (pixbuf);
+  }
+
+  pixels = gdk_pixbuf_read_pixels (scaled);
+  rowstride = gdk_pixbuf_get_rowstride (scaled);
+  n_channels = gdk_pixbuf_get_n_channels (scaled);
+  has_alpha = gdk_pixbuf_get_has_alpha (scaled);
+
+  *n_bytes = (gsize)width * height * 4;
+  data = g_malloc (*n_bytes);
+
+  for (int y = 0; y < height; y++) {
+    const guchar *src = pixels + (gsize)y * rowstride;
+    guchar *dest = data + (gsize)y * width * 4;
+
+    for (int x = 0; x < width; x++) {
+      guint alpha = has_alpha ? src[3] : 0xff;
+
+      dest[0] = (src[2] * alpha + 127) / 255;
+      dest[1] = (src[1] * alpha + 127) / 255;
+      dest[2] = (src[0] * alpha + 127) / 255;
+      dest[3] = alpha;
+
+      src += n_channels;
+      dest += 4;
+    }
+  }
+
+  bytes = g_bytes_new_take (data, *n_bytes);
+
+  return gdk_memory_texture_new (width, height,
+                                 GDK_MEMORY_B8G8R8A8_PREMULTIPLIED,
+                                 bytes, width * 4);
+}
+
+static GdkTexture *
+avatar_cache_lookup (ChattyItem *item,
+                     GdkPixbuf  *pixbuf,
+                     int         size,
+                     int         scale)
+{
+  AvatarCacheEntry key = { .item = item, .size = size, .scale = scale };
+  g_autoptr(GdkPixbuf) source = NULL;
+  AvatarCacheEntry *entry;
+
+  if (!avatar_cache)
+    avatar_cache = g_hash_table_new_full (avatar_cache_entry_hash,
+                                          avatar_cache_entry_equal,
+                                          avatar_cache_entry_free, NULL);
+
+  entry = g_hash_table_lookup (avatar_cache, &key);
+
+  if (entry)
+    source = g_weak_ref_get (&entry->source);
+
+  if (entry && source == pixbuf) {
+    g_queue_unlink (&avatar_cache_lru, &entry->link);
+    g_queue_push_head_link (&avatar_cache_lru, &entry->link);
+
+    return g_object_ref (entry->texture);
+  }
+
+  /* The avatar has changed, drop the old texture */
+  if (entry)
+    g_hash_table_remove (avatar_cache, entry);
+
+  entry = g_new0 (AvatarCacheEntry, 1);
+  entry->item = item;
+  entry->size = size;
+  entry->scale = scale;
+  entry->link.data = entry;
+  g_weak_ref_init (&entry->source, pixbuf);
+  entry->texture = avatar_texture_new (pixbuf, size * scale, &entry->n_bytes);
+
+  g_hash_table_add (avatar_cache, entry);
+  g_queue_push_head_link (&avatar_cache_lru, &entry->link);
+  avatar_cache_size += entry->n_bytes;
+
+  /* Never evict the entry just added, even if it alone exceeds the budget */
+  while (avatar_cache_size > AVATAR_CACHE_MAX_SIZE &&
+         avatar_cache_lru.tail != &entry->link)
+    g_hash_table_remove (avatar_cache, avatar_cache_lru.tail->data);
+
+  return g_object_ref (entry->texture);
+}
+
 static void
 avatar_changed_cb (ChattyAvatar *self)
 {
@@ -61,7 +237,9 @@ avatar_changed_cb (ChattyAvatar *self)
     g_autoptr(GdkTexture) texture = NULL;
 
     if (avatar)
-      texture = gdk_texture_new_for_pixbuf (avatar);
+      texture = avatar_cache_lookup (self->item, avatar,
+                                     adw_avatar_get_size (ADW_AVATAR (self->avatar)),
+                                     gtk_widget_get_scale_factor (GTK_WIDGET (self)));
     adw_avatar_set_custom_image (ADW_AVATAR (self->avatar), (GdkPaintable *) texture);
   }
 }
@@ -111,6 +289,8 @@ chatty_avatar_set_property (GObject      *object,
     {
     case PROP_SIZE:
       adw_avatar_set_size (ADW_AVATAR (self->avatar), g_value_get_int (value));
+      if (self->item)
+        avatar_changed_cb (self);
       break;
 
     default:
@@ -155,6 +335,10 @@ chatty_avatar_init (ChattyAvatar *self)
                                NULL);
 
   adw_bin_set_child (ADW_BIN (self), self->avatar);
+
+  g_signal_connect_object (self, "notify::scale-factor",
+                           G_CALLBACK (avatar_changed_cb), self,
+                           G_CONNECT_SWAPPED);
 }
 
 /**
@@ -0,0 +1,382 @@
+/* chatty-cached-chat.c
+ *
+ * Copyright 2024 Purism SPC
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define G_LOG_DOMAIN "chatty-cached-chat"
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <errno.h>
+#include <glib/gstdio.h>
+
+#include "chatty-message-list.h"
+#include "chatty-cached-chat.h"
+#include "chatty-log.h"
+
+/**
+ * SECTION: chatty-cached-chat
+ * @title: ChattyCachedChat
+ * @short_description: A chat list entry restored from the last run
+ * @include: "chatty-cached-chat.h"
+ *
+ * The chat list shown on the last run is saved as a compact
+ * snapshot, which is memory mapped on the next start so that
+ * the chat list can be shown before any backend has loaded.
+ * Each entry is a #ChattyCachedChat, a read only stand-in that
+ * is replaced by the real chat once its backend brings it up.
+ */
+
+/* Bump when the snapshot format changes, old snapshots are then ignored */
+#define SNAPSHOT_VERSION 1
+/* protocol, account id, chat id, name, last message, last message time, unread count */
+#define SNAPSHOT_CHAT_TYPE "(ussssxu)"
+#define SNAPSHOT_CHAT_FORMAT "(u&s&s&s&sxu)"
+#define SNAPSHOT_TYPE      "(ua" SNAPSHOT_CHAT_TYPE ")"
+
+struct _ChattyCachedChat
+{
+  ChattyChat         parent_instance;
+
+  char              *account_id;
+  char              *chat_id;
+  char              *name;
+  char              *last_message;
+  ChattyMessageList *messages;
+  ChattyProtocol     protocol;
+  guint              unread_count;
+};
+
+G_DEFINE_TYPE (ChattyCachedChat, chatty_cached_chat, CHATTY_TYPE_CHAT)
+
+static const char *
+chatty_cached_chat_get_chat_name (ChattyChat *chat)
+{
+  ChattyCachedChat *self = (ChattyCachedChat *)chat;
+
+  g_assert (CHATTY_IS_CACHED_CHAT (self));
+
+  return self->chat_id;
+}
+
+static GListModel *
+chatty_cached_chat_get_messages (ChattyChat *chat)
+{
+  ChattyCachedChat *self = (ChattyCachedChat *)chat;
+
+  g_assert (CHATTY_IS_CACHED_CHAT (self));
+
+  return G_LIST_MODEL (self->messages);
+}
+
+static const char *
+chatty_cached_chat_get_last_message (ChattyChat *chat)
+{
+  ChattyCachedChat *self = (ChattyCachedChat *)chat;
+
+  g_assert (CHATTY_IS_CACHED_CHAT (self));
+
+  return self->last_message;
+}
+
+static guint
+chatty_cached_chat_get_unread_count (ChattyChat *chat)
+{
+  ChattyCachedChat *self = (ChattyCachedChat *)chat;
+
+  g_assert (CHATTY_IS_CACHED_CHAT (self));
+
+  return self->unread_count;
+}
+
+static void
+chatty_cached_chat_set_unread_count (ChattyChat *chat,
+                                     guint       unread_count)
+{
+  /* Read only, the real chat is updated once loaded */
+}
+
+static const char *
+chatty_cached_chat_get_name (ChattyItem *item)
+{
+  ChattyCachedChat *self = (ChattyCachedChat *)item;
+
+  g_assert (CHATTY_IS_CACHED_CHAT (self));
+
+  return self->name;
+}
+
+static const char *
+chatty_cached_chat_get_username (ChattyItem *item)
+{
+  ChattyCachedChat *self = (ChattyCachedChat *)item;
+
+  g_assert (CHATTY_IS_CACHED_CHAT (self));
+
+  return self->account_id;
+}
+
+static ChattyProtocol
+chatty_cached_chat_get_protocols (ChattyItem *item)
+{
+  ChattyCachedChat *self = (ChattyCachedChat *)item;
+
+  g_assert (CHATTY_IS_CACHED_CHAT (self));
+
+  return self->protocol;
+}
+
+static void
+chatty_cached_chat_finalize (GObject *object)
+{
+  ChattyCachedChat *self = (ChattyCachedChat *)object;
+
+  g_clear_object (&self->messages);
+  g_free (self->account_id);
+  g_free (self->chat_id);
+  g_free (self->name);
+  g_free (self->last_message);
+
+  G_OBJECT_CLASS (chatty_cached_chat_parent_class)->finalize (object);
+}
+
+static void
+chatty_cached_chat_class_init (ChattyCachedChatClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  ChattyItemClass *item_class = CHATTY_ITEM_CLASS (klass);
+  ChattyChatClass *chat_class = CHATTY_CHAT_CLASS (klass);
+
+  object_class->finalize = chatty_cached_chat_finalize;
+
+  item_class->get_name = chatty_cached_chat_get_name;
+  item_class->get_username = chatty_cached_chat_get_username;
+  item_class->get_protocols = chatty_cached_chat_get_protocols;
+
+  chat_class->get_chat_name = chatty_cached_chat_get_chat_name;
+  chat_class->get_messages = chatty_cached_chat_get_messages;
+  chat_class->get_last_message = chatty_cached_chat_get_last_message;
+  chat_class->get_unread_count = chatty_cached_chat_get_unread_count;
+  chat_class->set_unread_count = chatty_cached_chat_set_unread_count;
+}
+
+static void
+chatty_cached_chat_init (ChattyCachedChat *self)
+{
+  self->messages = chatty_message_list_new ();
+}
+
+ChattyCachedChat *
+chatty_cached_chat_new (ChattyProtocol  protocol,
+                        const char     *account_id,
+                        const char     *chat_id,
+                        const char     *name,
+                        const char     *last_message,
+                        gint64          last_msg_time,
+                        guint           unread_count)
+{
+  ChattyCachedChat *self;
+
+  g_return_val_if_fail (chat_id && *chat_id, NULL);
+
+  self = g_object_new (CHATTY_TYPE_CACHED_CHAT, NULL);
+  self->protocol = protocol;
+  self->account_id = g_strdup (account_id ? account_id : "");
+  self->chat_id = g_strdup (chat_id);
+  self->name = g_strdup (name ? name : "");
+  self->last_message = g_strdup (last_message ? last_message : "");
+  self->unread_count = unread_count;
+
+  /* The chat list sorts by the time of the last message */
+  if (last_msg_time > 0) {
+    g_autoptr(ChattyMessage) message = NULL;
+
+    message = chatty_message_new (NULL, self->last_message, NULL, last_msg_time,
+                                  CHATTY_MESSAGE_TEXT, CHATTY_DIRECTION_IN, 0);
+    chatty_message_list_add (self->messages, message);
+  }
+
+  return self;
+}
+
+static const char *
+cached_chat_get_account_id (ChattyChat *chat)
+{
+  ChattyAccount *account;
+
+  if (CHATTY_IS_CACHED_CHAT (chat))
+    return CHATTY_CACHED_CHAT (chat)->account_id;
+
+  account = chatty_chat_get_account (chat);
+  if (account)
+    return chatty_item_get_username (CHATTY_ITEM (account));
+
+  return NULL;
+}
+
+/**
+ * chatty_cached_chat_get_key:
+ * @chat: A #ChattyChat
+ *
+ * Get a key identifying @chat, which is the same
+ * for a #ChattyCachedChat and the chat it stands
+ * in for.
+ *
+ * Returns: (transfer full): The key of @chat
+ */
+char *
+chatty_cached_chat_get_key (ChattyChat *chat)
+{
+  const char *account_id;
+
+  g_return_val_if_fail (CHATTY_IS_CHAT (chat), NULL);
+
+  account_id = cached_chat_get_account_id (chat);
+
+  return g_strdup_printf ("%u\n%s\n%s",
+                          chatty_item_get_protocols (CHATTY_ITEM (chat)),
+                          account_id ? account_id : "",
+                          chatty_chat_get_chat_name (chat));
+}
+
+/**
+ * chatty_cached_chat_load_snapshot:
+ * @file_path: The path of the snapshot
+ *
+ * Load the chats saved with chatty_cached_chat_save_snapshot().
+ * The file is memory mapped, and only the strings of each chat
+ * are copied.
+ *
+ * Returns: (transfer full) (nullable): An array of #ChattyCachedChat,
+ * or %NULL if no valid snapshot exists.
+ */
+GPtrArray *
+chatty_cached_chat_load_snapshot (const char *file_path)
+{
+  g_autoptr(GMappedFile) mapped_file = NULL;
+  g_autoptr(GVariant) snapshot = NULL;
+  g_autoptr(GVariant) chats = NULL;
+  g_autoptr(GBytes) bytes = NULL;
+  g_autoptr(GError) error = NULL;
+  GPtrArray *cached_chats;
+  gsize n_chats;
+  guint version;
+
+  g_return_val_if_fail (file_path && *file_path, NULL);
+
+  mapped_file = g_mapped_file_new (file_path, FALSE, &error);
+
+  if (!mapped_file) {
+    if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+      g_warning ("Failed to map chat list snapshot: %s", error->message);
+
+    return NULL;
+  }
+
+  bytes = g_mapped_file_get_bytes (mapped_file);
+  snapshot = g_variant_new_from_bytes (G_VARIANT_TYPE (SNAPSHOT_TYPE), bytes, FALSE);
+  g_variant_get (snapshot, "(u@a" SNAPSHOT_CHAT_TYPE ")", &version, &chats);
+
+  if (version != SNAPSHOT_VERSION)
+    return NULL;
+
+  n_chats = g_variant_n_children (chats);
+  cached_chats = g_ptr_array_new_full (n_chats, g_object_unref);
+
+  for (gsize i = 0; i < n_chats; i++) {
+    const char *account_id, *chat_id, *name, *last_message;
+    gint64 last_msg_time;
+    guint protocol, unread_count;
+
+    g_variant_get_child (chats, i, SNAPSHOT_CHAT_FORMAT, &protocol, &account_id,
+                         &chat_id, &name, &last_message, &last_msg_time, &unread_count);
+    if (!*chat_id)
+      continue;
+
+    g_ptr_array_add (cached_chats,
+                     chatty_cached_chat_new (protocol, account_id, chat_id, name,
+                                             last_message, last_msg_time, unread_count));
+  }
+
+  CHATTY_TRACE_MSG ("Loaded %u chats from snapshot", cached_chats->len);
+
+  return cached_chats;
+}
+
+/**
+ * chatty_cached_chat_save_snapshot:
+ * @chats: A #GListModel of #ChattyChat
+ * @max_chats: The maximum number of chats to save
+ * @file_path: The path of the snapshot
+ * @error: A #GError
+ *
+ * Save the first @max_chats chats in @chats, as shown
+ * in the chat list, to @file_path.  As the snapshot
+ * has message excerpts, it's readable only by the user.
+ *
+ * Returns: %TRUE if the snapshot was saved
+ */
+gboolean
+chatty_cached_chat_save_snapshot (GListModel  *chats,
+                                  guint        max_chats,
+                                  const char  *file_path,
+                                  GError     **error)
+{
+  g_autoptr(GVariant) snapshot = NULL;
+  g_autofree char *dir = NULL;
+  GVariantBuilder builder;
+  guint n_items;
+
+  g_return_val_if_fail (G_IS_LIST_MODEL (chats), FALSE);
+  g_return_val_if_fail (file_path && *file_path, FALSE);
+  g_return_val_if_fail (!error || !*error, FALSE);
+
+  n_items = MIN (g_list_model_get_n_items (chats), max_chats);
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a" SNAPSHOT_CHAT_TYPE));
+
+  for (guint i = 0; i < n_items; i++) {
+    g_autoptr(ChattyChat) chat = NULL;
+    const char *account_id, *chat_id, *name, *last_message;
+
+    chat = g_list_model_get_item (chats, i);
+    chat_id = chatty_chat_get_chat_name (chat);
+
+    if (!chat_id || !*chat_id)
+      continue;
+
+    account_id = cached_chat_get_account_id (chat);
+    name = chatty_item_get_name (CHATTY_ITEM (chat));
+    last_message = chatty_chat_get_last_message (chat);
+
+    g_variant_builder_add (&builder, SNAPSHOT_CHAT_TYPE,
+                           chatty_item_get_protocols (CHATTY_ITEM (chat)),
+                           account_id ? account_id : "", chat_id,
+                           name ? name : "",
+                           last_message ? last_message : "",
+                           (gint64)chatty_chat_get_last_msg_time (chat),
+                           chatty_chat_get_unread_count (chat));
+  }
+
+  snapshot = g_variant_ref_sink (g_variant_new ("(u@a" SNAPSHOT_CHAT_TYPE ")",
+                                                SNAPSHOT_VERSION,
+                                                g_variant_builder_end (&builder)));
+
+  dir = g_path_get_dirname (file_path);
+  if (g_mkdir_with_parents (dir, 0700) != 0) {
+    int errsv = errno;
+
+    g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errsv),
+                 "Failed to create %s: %s", dir, g_strerror (errsv));
+    return FALSE;
+  }
+
+  return g_file_set_contents_full (file_path,
+                                   g_variant_get_data (snapshot),
+                                   g_variant_get_size (snapshot),
+                                   G_FILE_SET_CONTENTS_CONSISTENT,
+                                   0600, error);
+}
@@ -0,0 +1,34 @@
+/* chatty-cached-chat.h
+ *
+ * Copyright 2024 Purism SPC
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <glib-object.h>
+
+#include "chatty-chat.h"
+
+G_BEGIN_DECLS
+
+#define CHATTY_TYPE_CACHED_CHAT (chatty_cached_chat_get_type ())
+
+G_DECLARE_FINAL_TYPE (ChattyCachedChat, chatty_cached_chat, CHATTY, CACHED_CHAT, ChattyChat)
+
+ChattyCachedChat *chatty_cached_chat_new           (ChattyProtocol  protocol,
+                                                    const char     *account_id,
+                                                    const char     *chat_id,
+                                                    const char     *name,
+                                                    const char     *last_message,
+                                                    gint64          last_msg_time,
+                                                    guint           unread_count);
+char             *chatty_cached_chat_get_key       (ChattyChat     *chat);
+GPtrArray        *chatty_cached_chat_load_snapshot (const char     *file_path);
+gboolean          chatty_cached_chat_save_snapshot (GListModel     *chats,
+                                                    guint           max_chats,
+                                                    const char     *file_path,
+                                                    GError        **error);
+
+G_END_DECLS
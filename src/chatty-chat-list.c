@@ -14,10 +14,12 @@
 # include "config.h"
 #endif
 
+#include <string.h>
 #include <glib/gi18n.h>
 #include <adwaita.h>
 
 #include "chatty-manager.h"
+#include "chatty-cached-chat.h"
 #include "chatty-list-row.h"
 #include "chatty-ma-chat.h"
 #include "chatty-mm-chat.h"
@@ -112,8 +114,7 @@ chat_list_filter_chat (ChattyItem     *item,
       return FALSE;
   }
 
-  return chatty_item_matches (item, self->chat_needle,
-                              self->protocol_filter, TRUE);
+  return chatty_chat_matches_search (CHATTY_CHAT (item), self->chat_needle);
 }
 
 static void
@@ -245,6 +246,10 @@ chat_list_row_activated_cb (ChattyChatList *self,
 
   item = chatty_list_row_get_item (row);
 
+  /* Can't be opened until its backend is loaded */
+  if (CHATTY_IS_CACHED_CHAT (item))
+    return;
+
   g_ptr_array_set_size (self->selected_items, 0);
   g_ptr_array_add (self->selected_items, g_object_ref (item));
 
@@ -432,24 +437,48 @@ void
 chatty_chat_list_filter_protocol (ChattyChatList *self,
                                   ChattyProtocol  protocol)
 {
+  GtkFilterChange change = GTK_FILTER_CHANGE_DIFFERENT;
+
   g_return_if_fail (CHATTY_IS_CHAT_LIST (self));
 
+  if (self->protocol_filter == protocol)
+    return;
+
+  /* Let the filter model check only the items that can change */
+  if ((protocol & self->protocol_filter) == protocol)
+    change = GTK_FILTER_CHANGE_MORE_STRICT;
+  else if ((protocol & self->protocol_filter) == self->protocol_filter)
+    change = GTK_FILTER_CHANGE_LESS_STRICT;
+
   self->protocol_filter = protocol;
-  gtk_filter_changed (GTK_FILTER (self->filter), GTK_FILTER_CHANGE_DIFFERENT);
+  gtk_filter_changed (GTK_FILTER (self->filter), change);
 }
 
 void
 chatty_chat_list_filter_string (ChattyChatList *self,
                                 const char     *needle)
 {
+  g_autofree char *old_needle = NULL;
+  GtkFilterChange change = GTK_FILTER_CHANGE_DIFFERENT;
+
   g_return_if_fail (CHATTY_IS_CHAT_LIST (self));
 
-  g_clear_pointer (&self->chat_needle, g_free);
+  old_needle = g_steal_pointer (&self->chat_needle);
 
   if (needle && *needle)
     self->chat_needle = g_utf8_casefold (needle, -1);
 
-  gtk_filter_changed (GTK_FILTER (self->filter), GTK_FILTER_CHANGE_DIFFERENT);
+  if (g_strcmp0 (old_needle, self->chat_needle) == 0)
+    return;
+
+  /* When typing, the new needle usually extends the old one, so
+   * only the chats that matched before have to be checked again */
+  if (!old_needle || (self->chat_needle && strstr (self->chat_needle, old_needle)))
+    change = GTK_FILTER_CHANGE_MORE_STRICT;
+  else if (!self->chat_needle || strstr (old_needle, self->chat_needle))
+    change = GTK_FILTER_CHANGE_LESS_STRICT;
+
+  gtk_filter_changed (GTK_FILTER (self->filter), change);
 }
 
 void
@@ -20,6 +20,7 @@
 #include "chatty-message-row.h"
 #include "chatty-message-bar.h"
 #include "chatty-chat-page.h"
+#include "chatty-mark.h"
 
 struct _ChattyChatPage
 {
@@ -257,14 +258,18 @@ chat_page_message_row_new (ChattyMessage  *message,
 {
   GtkWidget *row;
   ChattyProtocol protocol;
+  gint64 mark_time;
 
   g_assert (CHATTY_IS_MESSAGE (message));
   g_assert (CHATTY_IS_CHAT_PAGE (self));
 
+  mark_time = CHATTY_MARK_NOW ();
   protocol = chatty_item_get_protocols (CHATTY_ITEM (self->chat));
   row = chatty_message_row_new (message, protocol, chatty_chat_is_im (self->chat));
   chatty_message_row_set_alias (CHATTY_MESSAGE_ROW (row),
                                 chatty_message_get_user_alias (message));
+  CHATTY_MARK (mark_time, "message-row-new", "chat %p: message %s",
+               self->chat, chatty_message_get_uid (message));
 
   return GTK_WIDGET (row);
 }
@@ -371,6 +376,15 @@ chat_page_adjustment_value_changed_cb (ChattyChatPage *self)
     gtk_revealer_set_reveal_child (self->scroll_down_revealer, FALSE); /* avoids flickering the button */
   }
 
+  /* Back to the latest messages, drop the history pages scrolled past */
+  if (is_bottom && !self->is_bottom && self->chat) {
+    ChattySettings *settings;
+
+    settings = chatty_settings_get_default ();
+    chatty_chat_trim_messages (self->chat,
+                               chatty_settings_get_message_cache_pages (settings));
+  }
+
   self->is_bottom = is_bottom;
 }
 
@@ -505,6 +519,9 @@ chatty_chat_page_finalize (GObject *object)
   g_clear_handle_id (&self->osk_id, g_bus_unwatch_name);
   g_clear_handle_id (&self->scroll_bottom_id, g_source_remove);
   g_clear_object (&self->osk_proxy);
+
+  if (self->chat)
+    chatty_chat_set_opened (self->chat, FALSE);
   g_clear_object (&self->chat);
 
   G_OBJECT_CLASS (chatty_chat_page_parent_class)->finalize (object);
@@ -597,10 +614,12 @@ chatty_chat_page_set_chat (ChattyChatPage *self,
                            ChattyChat     *chat)
 {
   GListModel *messages;
+  gint64 mark_time;
 
   g_return_if_fail (CHATTY_IS_CHAT_PAGE (self));
   g_return_if_fail (!chat || CHATTY_IS_CHAT (chat));
 
+  mark_time = CHATTY_MARK_NOW ();
   chatty_message_bar_set_chat (CHATTY_MESSAGE_BAR (self->message_bar), chat);
 
   if (self->chat && chat != self->chat) {
@@ -619,6 +638,7 @@ chatty_chat_page_set_chat (ChattyChatPage *self,
 
     gtk_revealer_set_reveal_child (self->scroll_down_revealer, FALSE);
     g_clear_handle_id (&self->history_load_id, g_source_remove);
+    chatty_chat_set_opened (self->chat, FALSE);
   }
 
   gtk_widget_set_visible (self->no_message_status, !!chat);
@@ -632,6 +652,7 @@ chatty_chat_page_set_chat (ChattyChatPage *self,
     return;
   }
 
+  chatty_chat_set_opened (chat, TRUE);
   messages = chatty_chat_get_messages (chat);
 
   g_signal_connect_object (messages, "items-changed",
@@ -671,6 +692,8 @@ chatty_chat_page_set_chat (ChattyChatPage *self,
   self->history_load_id = g_timeout_add (HISTORY_WAIT_TIMEOUT,
                                          chat_page_history_wait_timeout_cb,
                                          self);
+  CHATTY_MARK (mark_time, "chat-page-set-chat", "chat %p: %u messages",
+               chat, g_list_model_get_n_items (messages));
 }
 
 ChattyChat *
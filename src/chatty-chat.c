@@ -18,10 +18,13 @@
 #include <string.h>
 #include <glib/gi18n.h>
 
+#include "chatty-ma-event-list.h"
 #include "chatty-mm-buddy.h"
 #include "chatty-mm-chat.h"
 #include "chatty-notification.h"
 #include "chatty-history.h"
+#include "chatty-message-list.h"
+#include "chatty-settings.h"
 #include "chatty-chat.h"
 
 /**
@@ -31,6 +34,8 @@
  */
 
 #define LAZY_LOAD_MSGS_LIMIT 20
+/* Time after which a closed chat keeps only its last message, in seconds */
+#define CHAT_IDLE_TIMEOUT    (5 * 60)
 
 typedef struct
 {
@@ -42,6 +47,19 @@ typedef struct
 
   ChattyMessage *last_message;
   ChattyNotification *notification;
+  /* Trimmed outgoing messages that may still get a status update, by uid */
+  GHashTable    *trimmed_messages;
+
+  /* Cached keys for sorting and searching chat lists */
+  char    *search_key;
+  char    *search_key_name;
+  gint64   sort_time;
+  gboolean sort_time_valid;
+
+  /* Monotonic time the chat was last closed, 0 if open or never opened */
+  gint64   closed_time;
+  guint    trim_id;
+  gboolean opened;
 
   gboolean is_im;
 } ChattyChatPrivate;
@@ -510,6 +528,7 @@ chatty_chat_finalize (GObject *object)
   ChattyChat *self = (ChattyChat *)object;
   ChattyChatPrivate *priv = chatty_chat_get_instance_private (self);
 
+  g_clear_handle_id (&priv->trim_id, g_source_remove);
   g_free (priv->chat_name);
   g_free (priv->user_name);
 
@@ -518,6 +537,9 @@ chatty_chat_finalize (GObject *object)
 
   priv->last_message = NULL;
   g_clear_object (&priv->notification);
+  g_clear_pointer (&priv->trimmed_messages, g_hash_table_unref);
+  g_free (priv->search_key);
+  g_free (priv->search_key_name);
 
   G_OBJECT_CLASS (chatty_chat_parent_class)->finalize (object);
 }
@@ -620,9 +642,21 @@ chatty_chat_class_init (ChattyChatClass *klass)
                   G_TYPE_NONE, 0);
 }
 
+static void
+chat_invalidate_sort_key (ChattyChat *self)
+{
+  ChattyChatPrivate *priv = chatty_chat_get_instance_private (self);
+
+  priv->sort_time_valid = FALSE;
+}
+
 static void
 chatty_chat_init (ChattyChat *self)
 {
+  g_signal_connect (self, "notify::last-message-time",
+                    G_CALLBACK (chat_invalidate_sort_key), NULL);
+  g_signal_connect (self, "changed",
+                    G_CALLBACK (chat_invalidate_sort_key), NULL);
 }
 
 ChattyChat *
@@ -790,6 +824,59 @@ chatty_chat_get_messages (ChattyChat *self)
   return CHATTY_CHAT_GET_CLASS (self)->get_messages (self);
 }
 
+/**
+ * chatty_chat_find_message:
+ * @self: A #ChattyChat
+ * @uid: The uid of the message
+ *
+ * Find the message with @uid among the messages
+ * of @self loaded in memory, including the trimmed
+ * ones still waiting for a status update.
+ *
+ * Returns: (transfer full) (nullable): A #ChattyMessage
+ */
+ChattyMessage *
+chatty_chat_find_message (ChattyChat *self,
+                          const char *uid)
+{
+  GListModel *messages;
+  guint n_items;
+
+  g_return_val_if_fail (CHATTY_IS_CHAT (self), NULL);
+  g_return_val_if_fail (uid && *uid, NULL);
+
+  messages = chatty_chat_get_messages (self);
+
+  if (CHATTY_IS_MESSAGE_LIST (messages)) {
+    ChattyChatPrivate *priv = chatty_chat_get_instance_private (self);
+    ChattyMessage *message;
+
+    message = chatty_message_list_find_uid (CHATTY_MESSAGE_LIST (messages), uid);
+
+    if (!message && priv->trimmed_messages)
+      message = g_hash_table_lookup (priv->trimmed_messages, uid);
+
+    return message ? g_object_ref (message) : NULL;
+  }
+
+  if (CHATTY_IS_MA_EVENT_LIST (messages))
+    return chatty_ma_event_list_find_message (CHATTY_MA_EVENT_LIST (messages), uid);
+
+  n_items = g_list_model_get_n_items (messages);
+
+  /* Search from end, the item is more likely to be at the end */
+  for (guint i = n_items; i > 0; i--) {
+    g_autoptr(ChattyMessage) message = NULL;
+
+    message = g_list_model_get_item (messages, i - 1);
+
+    if (g_strcmp0 (uid, chatty_message_get_uid (message)) == 0)
+      return g_steal_pointer (&message);
+  }
+
+  return NULL;
+}
+
 /**
  * chatty_chat_load_past_messages:
  * @self: A #ChattyChat
@@ -819,6 +906,174 @@ chatty_chat_is_loading_history (ChattyChat *self)
   return CHATTY_CHAT_GET_CLASS (self)->is_loading_history (self);
 }
 
+static gboolean
+chat_trim_idle_cb (gpointer user_data)
+{
+  ChattyChat *self = user_data;
+  ChattyChatPrivate *priv = chatty_chat_get_instance_private (self);
+
+  /* Try again later, as past messages are loaded relative to the first one */
+  if (chatty_chat_is_loading_history (self))
+    return G_SOURCE_CONTINUE;
+
+  priv->trim_id = 0;
+  chatty_chat_trim_messages (self, 0);
+
+  return G_SOURCE_REMOVE;
+}
+
+/**
+ * chatty_chat_set_opened:
+ * @self: A #ChattyChat
+ * @opened: Whether the chat is shown to the user
+ *
+ * Mark @self as being shown or no longer shown.
+ * Once closed for a while, the messages of @self
+ * are evicted from memory, see chatty_chat_trim_messages().
+ */
+void
+chatty_chat_set_opened (ChattyChat *self,
+                        gboolean    opened)
+{
+  ChattyChatPrivate *priv = chatty_chat_get_instance_private (self);
+
+  g_return_if_fail (CHATTY_IS_CHAT (self));
+
+  opened = !!opened;
+
+  if (priv->opened == opened)
+    return;
+
+  priv->opened = opened;
+  g_clear_handle_id (&priv->trim_id, g_source_remove);
+
+  if (opened) {
+    priv->closed_time = 0;
+  } else {
+    priv->closed_time = g_get_monotonic_time ();
+    priv->trim_id = g_timeout_add_seconds (CHAT_IDLE_TIMEOUT, chat_trim_idle_cb, self);
+  }
+}
+
+/**
+ * chatty_chat_get_idle_time:
+ * @self: A #ChattyChat
+ *
+ * Get the time in microseconds since @self was
+ * last closed.
+ *
+ * Returns: The idle time, or 0 if @self is open
+ * or was never opened.
+ */
+gint64
+chatty_chat_get_idle_time (ChattyChat *self)
+{
+  ChattyChatPrivate *priv = chatty_chat_get_instance_private (self);
+
+  g_return_val_if_fail (CHATTY_IS_CHAT (self), 0);
+
+  if (!priv->closed_time)
+    return 0;
+
+  return g_get_monotonic_time () - priv->closed_time;
+}
+
+/* Whether @message is outgoing and may still get a status update */
+static gboolean
+chat_message_is_pending (ChattyMessage *message,
+                         gboolean       wait_report)
+{
+  ChattyMsgStatus status;
+
+  if (chatty_message_get_msg_direction (message) != CHATTY_DIRECTION_OUT)
+    return FALSE;
+
+  status = chatty_message_get_status (message);
+
+  return status == CHATTY_STATUS_DRAFT ||
+    status == CHATTY_STATUS_SENDING ||
+    (status == CHATTY_STATUS_SENT && wait_report);
+}
+
+static gboolean
+chat_message_is_done (gpointer key,
+                      gpointer value,
+                      gpointer user_data)
+{
+  return !chat_message_is_pending (value, GPOINTER_TO_INT (user_data));
+}
+
+/**
+ * chatty_chat_trim_messages:
+ * @self: A #ChattyChat
+ * @n_pages: The number of pages to keep
+ *
+ * Evict the oldest messages of @self from memory
+ * so that only the latest @n_pages pages of messages
+ * are kept, or only the last message if @n_pages is
+ * 0.  Unread messages are always kept.  Evicted
+ * outgoing messages that may still get a status
+ * update are kept aside, so that they are found by
+ * chatty_chat_find_message() until they do.
+ * Evicted messages are loaded again from history
+ * by chatty_chat_load_past_messages().
+ *
+ * Returns: The number of messages evicted
+ */
+guint
+chatty_chat_trim_messages (ChattyChat *self,
+                           guint       n_pages)
+{
+  ChattyChatPrivate *priv = chatty_chat_get_instance_private (self);
+  GListModel *messages;
+  guint n_keep, n_items;
+  gboolean wait_report;
+
+  g_return_val_if_fail (CHATTY_IS_CHAT (self), 0);
+
+  messages = chatty_chat_get_messages (self);
+
+  /* Chats that don't own their messages can't evict them */
+  if (!CHATTY_IS_MESSAGE_LIST (messages))
+    return 0;
+
+  /* Past messages are loaded relative to the first message */
+  if (chatty_chat_is_loading_history (self))
+    return 0;
+
+  n_keep = MAX (1, n_pages * LAZY_LOAD_MSGS_LIMIT);
+  n_keep = MAX (n_keep, chatty_chat_get_unread_count (self));
+  n_items = g_list_model_get_n_items (messages);
+  wait_report = chatty_settings_request_sms_delivery_reports (chatty_settings_get_default ());
+
+  /* Those that got their final status no longer need to be kept */
+  if (priv->trimmed_messages)
+    g_hash_table_foreach_remove (priv->trimmed_messages, chat_message_is_done,
+                                 GINT_TO_POINTER (wait_report));
+
+  /* Status updates of outgoing messages are matched against the
+   * messages in memory, and an MMS not found there is deleted.
+   * So keep aside those that haven't reached their final status */
+  for (guint i = 0; i + n_keep < n_items; i++) {
+    g_autoptr(ChattyMessage) message = NULL;
+    const char *uid;
+
+    message = g_list_model_get_item (messages, i);
+    uid = chatty_message_get_uid (message);
+
+    if (!uid || !*uid || !chat_message_is_pending (message, wait_report))
+      continue;
+
+    if (!priv->trimmed_messages)
+      priv->trimmed_messages = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                      g_free, g_object_unref);
+
+    g_hash_table_insert (priv->trimmed_messages, g_strdup (uid), g_object_ref (message));
+  }
+
+  return chatty_message_list_trim (CHATTY_MESSAGE_LIST (messages), n_keep);
+}
+
 GListModel *chatty_chat_get_users (ChattyChat *self)
 {
   g_return_val_if_fail (CHATTY_IS_CHAT (self), NULL);
@@ -891,6 +1146,92 @@ chatty_chat_get_last_msg_time (ChattyChat *self)
   return chatty_message_get_time (message);
 }
 
+/**
+ * chatty_chat_compare:
+ * @a: A #ChattyChat
+ * @b: A #ChattyChat
+ *
+ * Compare @a and @b in the order they should be shown in a
+ * chat list: chats with unknown state first, and then the most
+ * recently active chats.  The time of the last message is cached until the
+ * chat changes, so that sorting a long list of chats doesn't
+ * have to look into the messages of every chat.
+ *
+ * Returns: < 0 if @a comes before @b, 0 if they
+ * compare equal, > 0 if @a comes after @b.
+ */
+int
+chatty_chat_compare (ChattyChat *a,
+                     ChattyChat *b)
+{
+  ChattyChatPrivate *priv_a, *priv_b;
+  gboolean state_a, state_b;
+
+  g_return_val_if_fail (CHATTY_IS_CHAT (a), 0);
+  g_return_val_if_fail (CHATTY_IS_CHAT (b), 0);
+
+  /* Same as the boolean "chat-state" property */
+  state_a = chatty_chat_get_chat_state (a) != CHATTY_CHAT_UNKNOWN;
+  state_b = chatty_chat_get_chat_state (b) != CHATTY_CHAT_UNKNOWN;
+
+  if (state_a != state_b)
+    return state_a < state_b ? -1 : 1;
+
+  priv_a = chatty_chat_get_instance_private (a);
+  priv_b = chatty_chat_get_instance_private (b);
+
+  if (!priv_a->sort_time_valid) {
+    priv_a->sort_time = chatty_chat_get_last_msg_time (a);
+    priv_a->sort_time_valid = TRUE;
+  }
+
+  if (!priv_b->sort_time_valid) {
+    priv_b->sort_time = chatty_chat_get_last_msg_time (b);
+    priv_b->sort_time_valid = TRUE;
+  }
+
+  /* Most recent first */
+  if (priv_a->sort_time != priv_b->sort_time)
+    return priv_a->sort_time > priv_b->sort_time ? -1 : 1;
+
+  return 0;
+}
+
+/**
+ * chatty_chat_matches_search:
+ * @self: A #ChattyChat
+ * @needle: (nullable): A casefolded string
+ *
+ * Check if the name of @self contains @needle.  The
+ * casefolded name is cached until the name changes.
+ *
+ * Returns: %TRUE if @needle is empty or matches @self
+ */
+gboolean
+chatty_chat_matches_search (ChattyChat *self,
+                            const char *needle)
+{
+  ChattyChatPrivate *priv = chatty_chat_get_instance_private (self);
+  const char *name;
+
+  g_return_val_if_fail (CHATTY_IS_CHAT (self), FALSE);
+
+  if (!needle || !*needle)
+    return TRUE;
+
+  name = chatty_item_get_name (CHATTY_ITEM (self));
+
+  /* Names don't change often, comparing is way cheaper than casefolding */
+  if (!priv->search_key || g_strcmp0 (name, priv->search_key_name) != 0) {
+    g_free (priv->search_key);
+    g_free (priv->search_key_name);
+    priv->search_key_name = g_strdup (name);
+    priv->search_key = g_utf8_casefold (name ? name : "", -1);
+  }
+
+  return strstr (priv->search_key, needle) != NULL;
+}
+
 void
 chatty_chat_send_message_async (ChattyChat          *self,
                                 ChattyMessage       *message,
@@ -120,9 +120,16 @@ gboolean            chatty_chat_has_file_upload    (ChattyChat *self);
 const char         *chatty_chat_get_chat_name      (ChattyChat *self);
 ChattyAccount      *chatty_chat_get_account        (ChattyChat *self);
 GListModel         *chatty_chat_get_messages       (ChattyChat *self);
+ChattyMessage      *chatty_chat_find_message       (ChattyChat *self,
+                                                    const char *uid);
 void                chatty_chat_load_past_messages (ChattyChat *self,
                                                     int         count);
 gboolean            chatty_chat_is_loading_history (ChattyChat *self);
+void                chatty_chat_set_opened         (ChattyChat *self,
+                                                    gboolean    opened);
+gint64              chatty_chat_get_idle_time      (ChattyChat *self);
+guint               chatty_chat_trim_messages      (ChattyChat *self,
+                                                    guint       n_pages);
 GListModel         *chatty_chat_get_users          (ChattyChat *self);
 const char         *chatty_chat_get_topic          (ChattyChat *self);
 void                chatty_chat_set_topic          (ChattyChat *self,
@@ -132,6 +139,10 @@ guint               chatty_chat_get_unread_count   (ChattyChat *self);
 void                chatty_chat_set_unread_count   (ChattyChat *self,
                                                     guint       unread_count);
 time_t              chatty_chat_get_last_msg_time  (ChattyChat *self);
+int                 chatty_chat_compare            (ChattyChat *a,
+                                                    ChattyChat *b);
+gboolean            chatty_chat_matches_search     (ChattyChat *self,
+                                                    const char *needle);
 void                chatty_chat_send_message_async (ChattyChat    *chat,
                                                     ChattyMessage *message,
                                                     GAsyncReadyCallback callback,
@@ -35,9 +35,33 @@
  * in focus), which can reduce CPU when not required.
  *
  * This can be used to run actions in relation with clock time.
+ *
+ * Widgets showing a human readable time can add a watch with
+ * chatty_clock_add_watch(), which is run only when the label
+ * for the time actually changes, instead of updating on every
+ * tick.  Formatted labels are cached until they change.
  */
 
 #define EPSILON         2000
+/* Drop the cached labels if there are more than this */
+#define MAX_CACHED_LABELS 2048
+
+typedef struct {
+  guint            id;
+  time_t           unix_time;
+  gboolean         detailed;
+  /* Unix time when the label changes next, 0 if never */
+  gint64           due;
+  ChattyClockFunc  callback;
+  gpointer         user_data;
+  GSequenceIter   *iter;
+} ClockWatch;
+
+typedef struct {
+  gint64  key;
+  char   *label;
+  gint64  valid_until;
+} ClockLabel;
 
 struct _ChattyClock
 {
@@ -48,6 +72,12 @@ struct _ChattyClock
   gint64        last_time;
   guint         sync_timeout_id;
   guint         timeout_id;
+
+  /* Watches sorted by due time */
+  GSequence    *watches;
+  GHashTable   *watch_ids;
+  guint         last_watch_id;
+  GHashTable   *labels;
 };
 
 G_DEFINE_TYPE (ChattyClock, chatty_clock, G_TYPE_OBJECT)
@@ -165,6 +195,155 @@ clock_get_human_time (ChattyClock         *self,
   return g_date_time_format (time, _("%Y-%m-%d"));
 }
 
+/*
+ * Get the unix time after @now when the label for @time changes,
+ * This is the earliest of the boundaries clock_get_human_time()
+ * checks for.  Returns 0 if the label never changes.
+ */
+static gint64
+clock_get_next_change (GDateTime *now,
+                       GDateTime *time,
+                       gboolean   detailed)
+{
+  g_autoptr(GDateTime) today = NULL;
+  gint64 now_s, time_s, candidates[7];
+  GTimeSpan time_span;
+  gint64 due = 0;
+  guint n = 0;
+
+  now_s = g_date_time_to_unix (now);
+  time_s = g_date_time_to_unix (time);
+  time_span = g_date_time_difference (now, time);
+
+  /* Future times are shown as date till they are 5 seconds away */
+  candidates[n++] = time_s - 5;
+  candidates[n++] = time_s + SECONDS_PER_MINUTE;
+
+  if (detailed && time_span >= 0 && time_span < G_TIME_SPAN_HOUR)
+    candidates[n++] = time_s + (time_span / G_TIME_SPAN_MINUTE + 1) * SECONDS_PER_MINUTE;
+
+  candidates[n++] = time_s + SECONDS_PER_DAY + 1;
+  candidates[n++] = time_s + 2 * SECONDS_PER_DAY + 1;
+  candidates[n++] = time_s + SECONDS_PER_WEEK + 1;
+
+  /* Today, yesterday and weekday names change at midnight */
+  if (time_span < G_TIME_SPAN_DAY * 8) {
+    g_autoptr(GDateTime) midnight = NULL;
+
+    today = g_date_time_new (g_date_time_get_timezone (now),
+                             g_date_time_get_year (now),
+                             g_date_time_get_month (now),
+                             g_date_time_get_day_of_month (now),
+                             0, 0, 0);
+    midnight = g_date_time_add_days (today, 1);
+    candidates[n++] = g_date_time_to_unix (midnight);
+  }
+
+  for (guint i = 0; i < n; i++) {
+    if (candidates[i] > now_s && (!due || candidates[i] < due))
+      due = candidates[i];
+  }
+
+  return due;
+}
+
+static int
+clock_watch_compare (gconstpointer a,
+                     gconstpointer b,
+                     gpointer      user_data)
+{
+  const ClockWatch *watch_a = a;
+  const ClockWatch *watch_b = b;
+
+  if (watch_a->due != watch_b->due)
+    return watch_a->due < watch_b->due ? -1 : 1;
+
+  return watch_a->id < watch_b->id ? -1 : watch_a->id > watch_b->id;
+}
+
+static void
+clock_watch_free (gpointer data)
+{
+  ClockWatch *watch = data;
+
+  if (watch->iter)
+    g_sequence_remove (watch->iter);
+
+  g_free (watch);
+}
+
+static void
+clock_watch_schedule (ChattyClock *self,
+                      ClockWatch  *watch,
+                      GDateTime   *now)
+{
+  g_autoptr(GDateTime) local = NULL;
+
+  g_assert (!watch->iter);
+
+  local = g_date_time_new_from_unix_local (watch->unix_time);
+  watch->due = clock_get_next_change (now, local, watch->detailed);
+
+  if (watch->due)
+    watch->iter = g_sequence_insert_sorted (self->watches, watch,
+                                            clock_watch_compare, NULL);
+}
+
+static void
+clock_run_watches (ChattyClock *self,
+                   gboolean     run_all)
+{
+  g_autoptr(GDateTime) now = NULL;
+  g_autoptr(GArray) due_ids = NULL;
+  GSequenceIter *iter;
+  gint64 now_s;
+
+  if (!self->watch_ids || !g_hash_table_size (self->watch_ids))
+    return;
+
+  now = g_date_time_new_now_local ();
+  now_s = g_date_time_to_unix (now);
+  due_ids = g_array_new (FALSE, FALSE, sizeof (guint));
+
+  if (run_all) {
+    GHashTableIter hash_iter;
+    gpointer key;
+
+    g_hash_table_iter_init (&hash_iter, self->watch_ids);
+    while (g_hash_table_iter_next (&hash_iter, &key, NULL))
+      g_array_append_val (due_ids, key);
+  } else {
+    iter = g_sequence_get_begin_iter (self->watches);
+
+    while (!g_sequence_iter_is_end (iter)) {
+      ClockWatch *watch = g_sequence_get (iter);
+
+      if (watch->due > now_s)
+        break;
+
+      g_array_append_val (due_ids, watch->id);
+      iter = g_sequence_iter_next (iter);
+    }
+  }
+
+  /* Callbacks may add or remove watches, so look them up again */
+  for (guint i = 0; i < due_ids->len; i++) {
+    guint id = g_array_index (due_ids, guint, i);
+    ClockWatch *watch;
+
+    watch = g_hash_table_lookup (self->watch_ids, GUINT_TO_POINTER (id));
+    if (!watch)
+      continue;
+
+    g_clear_pointer (&watch->iter, g_sequence_remove);
+    watch->callback (watch->user_data);
+
+    watch = g_hash_table_lookup (self->watch_ids, GUINT_TO_POINTER (id));
+    if (watch && !watch->iter)
+      clock_watch_schedule (self, watch, now);
+  }
+}
+
 static void
 clock_update_time (ChattyClock *self)
 {
@@ -175,6 +354,9 @@ clock_update_time (ChattyClock *self)
 
   g_signal_emit (self, signals[CHANGED], 0);
 
+  /* Re-evaluate every label if the clock was stopped or the time jumped */
+  clock_run_watches (self, ABS (now - old) > G_TIME_SPAN_MINUTE);
+
   if (ABS (now - old) > G_TIME_SPAN_MINUTE - EPSILON)
     g_signal_emit (self, signals[MINUTE_CHANGED], 0);
 
@@ -190,6 +372,10 @@ clock_format_changed_cb (ChattyClock *self)
 {
   g_assert (CHATTY_IS_CLOCK (self));
 
+  self->clock_format = g_settings_get_enum (self->settings, "clock-format");
+  g_hash_table_remove_all (self->labels);
+  clock_run_watches (self, TRUE);
+
   g_signal_emit (self, signals[CHANGED], 0);
   g_signal_emit (self, signals[MINUTE_CHANGED], 0);
   g_signal_emit (self, signals[HOUR_CHANGED], 0);
@@ -254,6 +440,9 @@ chatty_clock_finalize (GObject *object)
   g_clear_handle_id (&self->sync_timeout_id, g_source_remove);
   g_clear_handle_id (&self->timeout_id, g_source_remove);
   g_clear_object (&self->settings);
+  g_clear_pointer (&self->watch_ids, g_hash_table_unref);
+  g_clear_pointer (&self->watches, g_sequence_free);
+  g_clear_pointer (&self->labels, g_hash_table_unref);
 
   G_OBJECT_CLASS (chatty_clock_parent_class)->finalize (object);
 }
@@ -319,9 +508,24 @@ chatty_clock_class_init (ChattyClockClass *klass)
 }
 
 
+static void
+clock_label_free (gpointer data)
+{
+  ClockLabel *label = data;
+
+  g_free (label->label);
+  g_free (label);
+}
+
 static void
 chatty_clock_init (ChattyClock *self)
 {
+  self->watches = g_sequence_new (NULL);
+  self->watch_ids = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                           NULL, clock_watch_free);
+  self->labels = g_hash_table_new_full (g_int64_hash, g_int64_equal,
+                                        NULL, clock_label_free);
+
   self->settings = g_settings_new ("org.gnome.desktop.interface");
   self->clock_format = g_settings_get_enum (self->settings, "clock-format");
 
@@ -349,14 +553,89 @@ chatty_clock_get_human_time (ChattyClock *self,
 {
   g_autoptr(GDateTime) now = NULL;
   g_autoptr(GDateTime) local = NULL;
+  ClockLabel *label;
+  gint64 key, now_s;
 
   g_return_val_if_fail (CHATTY_IS_CLOCK (self), g_strdup (""));
   g_return_val_if_fail (unix_time >= 0, g_strdup (""));
 
+  key = (gint64)unix_time * 2 + !!detailed;
+  now_s = g_get_real_time () / G_USEC_PER_SEC;
+  label = g_hash_table_lookup (self->labels, &key);
+
+  if (label && (!label->valid_until || now_s < label->valid_until))
+    return g_strdup (label->label);
+
   now = g_date_time_new_now_local ();
   local = g_date_time_new_from_unix_local (unix_time);
 
-  return clock_get_human_time (self, now, local, self->clock_format, detailed);
+  if (!label) {
+    if (g_hash_table_size (self->labels) >= MAX_CACHED_LABELS)
+      g_hash_table_remove_all (self->labels);
+
+    label = g_new0 (ClockLabel, 1);
+    label->key = key;
+    g_hash_table_insert (self->labels, &label->key, label);
+  }
+
+  g_free (label->label);
+  label->label = clock_get_human_time (self, now, local, self->clock_format, detailed);
+  label->valid_until = clock_get_next_change (now, local, detailed);
+
+  return g_strdup (label->label);
+}
+
+/**
+ * chatty_clock_add_watch:
+ * @self: A #ChattyClock
+ * @unix_time: The time shown
+ * @detailed: Whether the time is shown detailed
+ * @callback: The function to run
+ * @user_data: The user data for @callback
+ *
+ * Run @callback each time the label returned by
+ * chatty_clock_get_human_time() for @unix_time
+ * changes, which is far less often than the clock
+ * ticks for most times.
+ *
+ * Returns: The id of the watch, to be removed
+ * with chatty_clock_remove_watch()
+ */
+guint
+chatty_clock_add_watch (ChattyClock     *self,
+                        time_t           unix_time,
+                        gboolean         detailed,
+                        ChattyClockFunc  callback,
+                        gpointer         user_data)
+{
+  g_autoptr(GDateTime) now = NULL;
+  ClockWatch *watch;
+
+  g_return_val_if_fail (CHATTY_IS_CLOCK (self), 0);
+  g_return_val_if_fail (callback, 0);
+
+  watch = g_new0 (ClockWatch, 1);
+  watch->id = ++self->last_watch_id;
+  watch->unix_time = unix_time;
+  watch->detailed = !!detailed;
+  watch->callback = callback;
+  watch->user_data = user_data;
+  g_hash_table_insert (self->watch_ids, GUINT_TO_POINTER (watch->id), watch);
+
+  now = g_date_time_new_now_local ();
+  clock_watch_schedule (self, watch, now);
+
+  return watch->id;
+}
+
+void
+chatty_clock_remove_watch (ChattyClock *self,
+                           guint        watch_id)
+{
+  g_return_if_fail (CHATTY_IS_CLOCK (self));
+
+  if (watch_id)
+    g_hash_table_remove (self->watch_ids, GUINT_TO_POINTER (watch_id));
 }
 
 void
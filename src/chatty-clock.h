@@ -23,10 +23,19 @@ G_DECLARE_FINAL_TYPE (ChattyClock, chatty_clock, CHATTY, CLOCK, GObject)
 #define SECONDS_PER_DAY    (24 * SECONDS_PER_HOUR)
 #define SECONDS_PER_WEEK   (7 * SECONDS_PER_DAY)
 
+typedef void (*ChattyClockFunc) (gpointer user_data);
+
 ChattyClock *chatty_clock_get_default         (void);
 char        *chatty_clock_get_human_time      (ChattyClock *self,
                                                time_t       unix_time,
                                                gboolean     detailed);
+guint        chatty_clock_add_watch           (ChattyClock     *self,
+                                               time_t           unix_time,
+                                               gboolean         detailed,
+                                               ChattyClockFunc  callback,
+                                               gpointer         user_data);
+void         chatty_clock_remove_watch        (ChattyClock     *self,
+                                               guint            watch_id);
 void         chatty_clock_start               (ChattyClock *self);
 void         chatty_clock_stop                (ChattyClock *self);
 
@@ -21,6 +21,8 @@
 #include "chatty-contact-list.h"
 
 #define ITEMS_COUNT 50
+/* Wait for typing to pause before filtering again */
+#define FILTER_DELAY_MS 150
 
 struct _ChattyContactList
 {
@@ -41,6 +43,8 @@ struct _ChattyContactList
   GtkSliceListModel  *slice_model;
   GtkCustomFilter    *filter;
   char               *search_str;
+  GtkFilterChange     pending_change;
+  guint               filter_timeout_id;
 
   ChattyManager      *manager;
 
@@ -311,6 +315,20 @@ contact_list_active_protocols_changed_cb (ChattyContactList *self)
   contact_list_changed_cb (self);
 }
 
+static gboolean
+contact_list_filter_timeout_cb (gpointer user_data)
+{
+  ChattyContactList *self = user_data;
+
+  g_assert (CHATTY_IS_CONTACT_LIST (self));
+
+  self->filter_timeout_id = 0;
+  gtk_slice_list_model_set_size (self->slice_model, ITEMS_COUNT);
+  gtk_filter_changed (GTK_FILTER (self->filter), self->pending_change);
+
+  return G_SOURCE_REMOVE;
+}
+
 static void
 contact_list_delete_item (ChattyContactList *self,
                           ChattyListRow     *row)
@@ -326,6 +344,7 @@ chatty_contact_list_finalize (GObject *object)
 {
   ChattyContactList *self = (ChattyContactList *)object;
 
+  g_clear_handle_id (&self->filter_timeout_id, g_source_remove);
   g_clear_object (&self->dummy_contact);
   g_clear_object (&self->slice_model);
   g_clear_object (&self->selection_store);
@@ -400,6 +419,8 @@ chatty_contact_list_init (ChattyContactList *self)
   self->filter = gtk_custom_filter_new ((GtkCustomFilterFunc)contact_list_filter_item_cb, self, NULL);
   filter_model = gtk_filter_list_model_new (G_LIST_MODEL (sort_model),
                                             g_object_ref (GTK_FILTER (self->filter)));
+  /* Filter in chunks so that typing isn't blocked by long contact lists */
+  gtk_filter_list_model_set_incremental (filter_model, TRUE);
 
   self->slice_model = gtk_slice_list_model_new (G_LIST_MODEL (filter_model), 0, ITEMS_COUNT);
   g_signal_connect_object (self->slice_model, "items-changed",
@@ -509,13 +530,32 @@ chatty_contact_list_set_filter (ChattyContactList *self,
                                 ChattyProtocol     protocol,
                                 const char        *needle)
 {
+  g_autofree char *old_needle = NULL;
+  GtkFilterChange change = GTK_FILTER_CHANGE_DIFFERENT;
+
   g_return_if_fail (CHATTY_IS_CONTACT_LIST (self));
 
-  self->filter_protocols = protocol;
-  g_free (self->search_str);
+  old_needle = g_steal_pointer (&self->search_str);
   self->search_str = g_utf8_casefold (needle, -1);
 
+  /* When typing, only the items that matched before have to be checked again */
+  if (protocol == self->filter_protocols && old_needle) {
+    if (strstr (self->search_str, old_needle))
+      change = GTK_FILTER_CHANGE_MORE_STRICT;
+    else if (strstr (old_needle, self->search_str))
+      change = GTK_FILTER_CHANGE_LESS_STRICT;
+  }
+
+  self->filter_protocols = protocol;
   update_new_contact_row (self);
-  gtk_slice_list_model_set_size (self->slice_model, ITEMS_COUNT);
-  gtk_filter_changed (GTK_FILTER (self->filter), GTK_FILTER_CHANGE_DIFFERENT);
+
+  /* Merge with the change not yet applied */
+  if (self->filter_timeout_id && self->pending_change != change)
+    change = GTK_FILTER_CHANGE_DIFFERENT;
+
+  self->pending_change = change;
+  g_clear_handle_id (&self->filter_timeout_id, g_source_remove);
+  self->filter_timeout_id = g_timeout_add (FILTER_DELAY_MS,
+                                           contact_list_filter_timeout_cb,
+                                           self);
 }
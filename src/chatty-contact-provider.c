@@ -16,6 +16,7 @@
 
 #include <libebook/libebook.h>
 
+#include "chatty-settings.h"
 #include "chatty-contact-private.h"
 #include "chatty-contact-provider.h"
 #include "chatty-log.h"
@@ -301,22 +302,70 @@ chatty_eds_objects_removed_cb (ChattyEds       *self,
 }
 
 static void
-chatty_eds_load_complete_cb (ChattyEds *self)
+eds_build_search_keys (GTask        *task,
+                       gpointer      source_object,
+                       gpointer      task_data,
+                       GCancellable *cancellable)
 {
-  g_autoptr(GPtrArray) array = NULL;
+  GPtrArray *array = task_data;
+  const char *country;
 
-  g_log (G_LOG_DOMAIN, CHATTY_LOG_LEVEL_TRACE, "Loading eds complete");
+  country = g_object_get_data (G_OBJECT (task), "country");
 
-  if (self->contacts_array && (self->contacts_array->len > 0)) {
-    array = g_steal_pointer (&self->contacts_array);
-    g_list_store_splice (self->contacts_list, 0, 0, array->pdata, array->len);
-  }
+  /* The contacts aren't in any list yet, so no one else can access them */
+  for (guint i = 0; i < array->len; i++)
+    chatty_contact_build_search_keys (array->pdata[i], country);
+
+  g_task_return_boolean (task, TRUE);
+}
+
+static void
+eds_search_keys_built_cb (GObject      *object,
+                          GAsyncResult *result,
+                          gpointer      user_data)
+{
+  ChattyEds *self = (ChattyEds *)object;
+  GPtrArray *array;
+
+  g_assert (CHATTY_IS_EDS (self));
+
+  array = g_task_get_task_data (G_TASK (result));
+  g_list_store_splice (self->contacts_list, 0, 0, array->pdata, array->len);
 
   /* Notify that eds is ready even is there are no contacts */
   self->is_ready = TRUE;
   g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_IS_READY]);
 }
 
+static void
+chatty_eds_load_complete_cb (ChattyEds *self)
+{
+  g_autoptr(GTask) task = NULL;
+  ChattySettings *settings;
+
+  g_log (G_LOG_DOMAIN, CHATTY_LOG_LEVEL_TRACE, "Loading eds complete");
+
+  if (!self->contacts_array || self->contacts_array->len == 0) {
+    g_clear_pointer (&self->contacts_array, g_ptr_array_unref);
+
+    /* Notify that eds is ready even is there are no contacts */
+    self->is_ready = TRUE;
+    g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_IS_READY]);
+
+    return;
+  }
+
+  /* Parsing phone numbers is slow, do it once and off the main thread */
+  settings = chatty_settings_get_default ();
+  task = g_task_new (self, NULL, eds_search_keys_built_cb, NULL);
+  g_task_set_task_data (task, g_steal_pointer (&self->contacts_array),
+                        (GDestroyNotify)g_ptr_array_unref);
+  g_object_set_data_full (G_OBJECT (task), "country",
+                          g_strdup (chatty_settings_get_country_iso_code (settings)),
+                          g_free);
+  g_task_run_in_thread (task, eds_build_search_keys);
+}
+
 static void
 chatty_eds_get_view_cb (GObject      *object,
                         GAsyncResult *result,
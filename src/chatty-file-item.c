@@ -41,6 +41,7 @@ struct _ChattyFileItem
   GdkPixbufAnimation     *pixbuf_animation;
   GdkPixbufAnimationIter *animation_iter;
   guint                   animation_id;
+  GCancellable           *cancellable;
 };
 
 G_DEFINE_TYPE (ChattyFileItem, chatty_file_item, ADW_TYPE_BIN)
@@ -78,6 +79,37 @@ image_item_paint (ChattyFileItem *self,
   }
 }
 
+static int
+file_item_get_io_priority (ChattyFileItem *self)
+{
+  /* Images on screen first */
+  if (gtk_widget_get_mapped (GTK_WIDGET (self)))
+    return G_PRIORITY_DEFAULT;
+
+  return G_PRIORITY_LOW;
+}
+
+static void
+image_item_decode_cb (GObject      *object,
+                      GAsyncResult *result,
+                      gpointer      user_data)
+{
+  g_autoptr(ChattyFileItem) self = user_data;
+  g_autoptr(GdkPixbuf) pixbuf = NULL;
+  g_autoptr(GError) error = NULL;
+
+  pixbuf = chatty_utils_decode_image_finish (result, &error);
+
+  if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED) ||
+      gtk_widget_in_destruction (GTK_WIDGET (self)))
+    return;
+
+  if (error)
+    g_debug ("Error decoding image: %s", error->message);
+
+  image_item_paint (self, pixbuf);
+}
+
 static void
 image_item_get_stream_cb (GObject      *object,
                           GAsyncResult *result,
@@ -85,7 +117,6 @@ image_item_get_stream_cb (GObject      *object,
 {
   g_autoptr(ChattyFileItem) self = user_data;
   g_autoptr(GInputStream) stream = NULL;
-  g_autoptr(GdkPixbuf) pixbuf = NULL;
   int scale_factor;
 
   if (gtk_widget_in_destruction (GTK_WIDGET (self)))
@@ -96,10 +127,13 @@ image_item_get_stream_cb (GObject      *object,
   if (!stream)
     return;
 
+  /* Decoding big photos takes long, don't block the UI */
   scale_factor = gtk_widget_get_scale_factor (GTK_WIDGET (self));
-  pixbuf = gdk_pixbuf_new_from_stream_at_scale (stream, 200 * scale_factor,
-                                                -1, TRUE, NULL, NULL);
-  image_item_paint (self, pixbuf);
+  chatty_utils_decode_image_async (stream, 200 * scale_factor,
+                                   file_item_get_io_priority (self),
+                                   self->cancellable,
+                                   image_item_decode_cb,
+                                   g_steal_pointer (&self));
 }
 
 static gboolean
@@ -130,6 +164,83 @@ image_item_update_animation_cb (gpointer user_data)
   return G_SOURCE_REMOVE;
 }
 
+static void
+image_item_decode_animation_cb (GObject      *object,
+                                GAsyncResult *result,
+                                gpointer      user_data)
+{
+  g_autoptr(ChattyFileItem) self = user_data;
+  g_autoptr(GError) error = NULL;
+  GdkPixbuf *pixbuf;
+  int timeout = 0;
+
+  self->pixbuf_animation = chatty_utils_decode_animation_finish (result, &error);
+
+  if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED) ||
+      gtk_widget_in_destruction (GTK_WIDGET (self)))
+    return;
+
+  if (error)
+    g_warning ("Error getting animation from file: '%s'", error->message);
+
+  if (!self->pixbuf_animation ||
+      gdk_pixbuf_animation_is_static_image (self->pixbuf_animation)) {
+    g_clear_object (&self->pixbuf_animation);
+
+    chatty_file_get_stream_async (self->file, NULL,
+                                  error ? file_item_get_stream_cb : image_item_get_stream_cb,
+                                  g_object_ref (self));
+    return;
+  }
+
+  gtk_widget_remove_css_class (self->file_widget, "dim-label");
+
+  self->animation_iter = gdk_pixbuf_animation_get_iter (self->pixbuf_animation, NULL);
+  pixbuf = gdk_pixbuf_animation_iter_get_pixbuf (self->animation_iter);
+  gtk_image_set_from_gicon (GTK_IMAGE (self->file_widget), G_ICON (pixbuf));
+  gtk_image_set_pixel_size (GTK_IMAGE (self->file_widget), 200);
+
+  timeout = gdk_pixbuf_animation_iter_get_delay_time (self->animation_iter);
+  if (timeout > 0)
+    self->animation_id = g_timeout_add (timeout,
+                                        image_item_update_animation_cb,
+                                        self);
+  /*
+   * chatty_file_get_stream_async () breaks the animation, so don't let
+   * it run
+   */
+}
+
+static void
+image_item_read_cb (GObject      *object,
+                    GAsyncResult *result,
+                    gpointer      user_data)
+{
+  g_autoptr(ChattyFileItem) self = user_data;
+  g_autoptr(GFileInputStream) stream = NULL;
+  g_autoptr(GError) error = NULL;
+
+  stream = g_file_read_finish (G_FILE (object), result, &error);
+
+  if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED) ||
+      gtk_widget_in_destruction (GTK_WIDGET (self)))
+    return;
+
+  if (!stream) {
+    g_warning ("Error getting animation from file: '%s'", error->message);
+    chatty_file_get_stream_async (self->file, NULL,
+                                  file_item_get_stream_cb,
+                                  g_object_ref (self));
+    return;
+  }
+
+  chatty_utils_decode_animation_async (G_INPUT_STREAM (stream),
+                                       file_item_get_io_priority (self),
+                                       self->cancellable,
+                                       image_item_decode_animation_cb,
+                                       g_steal_pointer (&self));
+}
+
 static void
 process_vcard (ChattyFileItem *self)
 {
@@ -314,39 +425,22 @@ item_set_file (gpointer user_data)
     else
       path = g_build_path (G_DIR_SEPARATOR_S, g_get_user_data_dir (), "chatty", chatty_file_get_path (self->file), NULL);
 
-    self->pixbuf_animation = gdk_pixbuf_animation_new_from_file (path, &error);
-    if (!error && !gdk_pixbuf_animation_is_static_image (self->pixbuf_animation)) {
-      GdkPixbuf *pixbuf;
-      int timeout = 0;
-
-      gtk_widget_remove_css_class (self->file_widget, "dim-label");
-
-      self->animation_iter = gdk_pixbuf_animation_get_iter (self->pixbuf_animation, NULL);
-      pixbuf = gdk_pixbuf_animation_iter_get_pixbuf (self->animation_iter);
-      gtk_image_set_from_gicon (GTK_IMAGE (self->file_widget), G_ICON (pixbuf));
-      gtk_image_set_pixel_size (GTK_IMAGE (self->file_widget), 200);
-
-      timeout = gdk_pixbuf_animation_iter_get_delay_time (self->animation_iter);
-      if (timeout > 0)
-        self->animation_id = g_timeout_add (timeout,
-                                            image_item_update_animation_cb,
-                                            self);
-      /*
-       * chatty_file_get_stream_async () breaks the animation, so don't let
-       * it run
-       */
-      return G_SOURCE_REMOVE;
-
-    } else if (gdk_pixbuf_animation_is_static_image (self->pixbuf_animation)) {
-      g_clear_object (&self->pixbuf_animation);
+    /* Only animations need all the frames decoded */
+    if (file_mime_type && g_str_equal (file_mime_type, "image/gif")) {
+      g_autoptr(GFile) image_file = NULL;
 
+      image_file = g_file_new_for_path (path);
+      g_file_read_async (image_file, file_item_get_io_priority (self),
+                         self->cancellable,
+                         image_item_read_cb,
+                         g_object_ref (self));
+    } else {
       chatty_file_get_stream_async (self->file, NULL,
                                     image_item_get_stream_cb,
                                     g_object_ref (self));
+    }
 
-      return G_SOURCE_REMOVE;
-    } else if (error)
-      g_warning ("Error getting animation from file: '%s'", error->message);
+    return G_SOURCE_REMOVE;
   /*
    * For some reason, with gstreamer 1.22.10, some webm videos don't work with GtkVideo
    * on the Librem5 nor Pinephone Pro (arm64), but work fine on my laptop (amd64). Per:
@@ -435,6 +529,22 @@ file_item_update_message (ChattyFileItem *self)
     g_idle_add (item_set_file, self);
 }
 
+static void
+file_item_update_progress (ChattyFileItem *self)
+{
+  double progress;
+
+  g_assert (CHATTY_IS_FILE_ITEM (self));
+  g_assert (self->file);
+
+  progress = chatty_file_get_progress (self->file);
+
+  if (progress < 0.0)
+    chatty_progress_button_pulse (CHATTY_PROGRESS_BUTTON (self->progress_button));
+  else
+    chatty_progress_button_set_fraction (CHATTY_PROGRESS_BUTTON (self->progress_button), progress);
+}
+
 static void
 save_dialog_finished (GObject         *dialog,
                       GAsyncResult    *response,
@@ -588,6 +698,8 @@ chatty_file_item_dispose (GObject *object)
   ChattyFileItem *self = (ChattyFileItem *)object;
   GtkMediaStream *media_stream;
 
+  g_cancellable_cancel (self->cancellable);
+  g_clear_object (&self->cancellable);
   g_clear_object (&self->message);
   g_clear_object (&self->file);
   g_clear_object (&self->pixbuf_animation);
@@ -639,6 +751,8 @@ static void
 chatty_file_item_init (ChattyFileItem *self)
 {
   gtk_widget_init_template (GTK_WIDGET (self));
+
+  self->cancellable = g_cancellable_new ();
 }
 
 GtkWidget *
@@ -676,6 +790,9 @@ chatty_file_item_new (ChattyMessage *message,
   g_signal_connect_object (file, "status-changed",
                            G_CALLBACK (file_item_update_message),
                            self, G_CONNECT_SWAPPED);
+  g_signal_connect_object (file, "progress-changed",
+                           G_CALLBACK (file_item_update_progress),
+                           self, G_CONNECT_SWAPPED);
   g_signal_connect_object (self, "notify::scale-factor",
                            G_CALLBACK (file_item_update_message),
                            self, G_CONNECT_SWAPPED);
@@ -18,7 +18,17 @@
 #include <cmatrix.h>
 
 #include "chatty-enums.h"
+#include "chatty-manager.h"
+#include "chatty-media-cache.h"
 #include "chatty-file.h"
+#include "chatty-log.h"
+
+/* Maximum size of the contents kept in memory among all ChattyFiles */
+#define MAX_LOADED_SIZE  (4 * 1024 * 1024)
+/* Maximum number of mapped files kept among all ChattyFiles */
+#define MAX_MAPPED_FILES 64
+/* Local files larger than this are mapped instead of read */
+#define MMAP_MIN_SIZE    (256 * 1024)
 
 /**
  * SECTION: chatty-file
@@ -27,6 +37,19 @@
  * @include: "chatty-file.h"
  *
  * An abstraction for message attachments.
+ *
+ * The content of a file is kept loaded only while the file is
+ * among the most recently used ones, so that the memory used
+ * doesn't grow with the number of attachments ever shown.
+ * Large files are mapped, and don't count against the size
+ * of the contents kept in memory.  The content is loaded
+ * again when requested.  Every request gets a stream of its own over the
+ * content, so that streams can be read from different threads
+ * at the same time.
+ *
+ * Downloaded matrix files are loaded from the downloaded file,
+ * which is then kept in the media cache, and are downloaded
+ * again only if evicted from there.
  */
 
 struct _ChattyFile
@@ -34,7 +57,13 @@ struct _ChattyFile
   GObject             parent_instance;
 
   CmRoomMessageEvent *cm_event;
-  GInputStream       *stream;
+  GBytes             *bytes;
+  /* Whether @bytes is mapped from the file instead of in memory */
+  gboolean            mapped;
+  /* Tasks waiting for the content being loaded */
+  GPtrArray          *pending_tasks;
+  GCancellable       *load_cancellable;
+  GList               lru_link;
   GFile              *file;
   char               *file_name;
   char               *url;
@@ -48,6 +77,10 @@ struct _ChattyFile
   /* for audio and video files */
   gsize               duration;
 
+  /* Bytes transferred, for files being downloaded or uploaded */
+  goffset             progress_current;
+  goffset             progress_total;
+
   ChattyFileStatus    status;
 };
 
@@ -55,16 +88,79 @@ G_DEFINE_TYPE (ChattyFile, chatty_file, G_TYPE_OBJECT)
 
 enum {
   STATUS_CHANGED,
+  PROGRESS_CHANGED,
   N_SIGNALS
 };
 
 static guint signals[N_SIGNALS];
 
+/* ChattyFiles with their content loaded, most recently used first */
+static GQueue loaded_files = G_QUEUE_INIT;
+/* The size of the loaded contents that aren't mapped */
+static gsize loaded_size;
+static guint n_mapped_files;
+
+static void
+file_bytes_release (ChattyFile *self)
+{
+  if (!self->bytes)
+    return;
+
+  if (self->lru_link.data) {
+    if (self->mapped)
+      n_mapped_files--;
+    else
+      loaded_size -= g_bytes_get_size (self->bytes);
+  }
+
+  g_queue_unlink (&loaded_files, &self->lru_link);
+  self->lru_link.data = NULL;
+  g_clear_pointer (&self->bytes, g_bytes_unref);
+}
+
+/*
+ * Mark @self as most recently used and release the
+ * least recently used contents above the limits.
+ * Streams still being read keep their content alive.
+ */
+static void
+file_bytes_touch (ChattyFile *self)
+{
+  g_assert (self->bytes);
+
+  if (self->lru_link.data) {
+    g_queue_unlink (&loaded_files, &self->lru_link);
+  } else if (self->mapped) {
+    n_mapped_files++;
+  } else {
+    loaded_size += g_bytes_get_size (self->bytes);
+  }
+
+  self->lru_link.data = self;
+  g_queue_push_head_link (&loaded_files, &self->lru_link);
+
+  /* The most recently used content is kept even if it's above the limit alone */
+  while (loaded_files.length > 1 &&
+         (loaded_size > MAX_LOADED_SIZE || n_mapped_files > MAX_MAPPED_FILES)) {
+    ChattyFile *file = loaded_files.tail->data;
+
+    CHATTY_TRACE_MSG ("Releasing content of %s", file->file_name);
+    file_bytes_release (file);
+  }
+}
+
 static void
 chatty_file_finalize (GObject *object)
 {
   ChattyFile *self = (ChattyFile *)object;
 
+  g_assert (!self->pending_tasks);
+
+  file_bytes_release (self);
+  g_clear_object (&self->load_cancellable);
+  g_clear_object (&self->file);
+  g_clear_object (&self->cm_event);
+
   g_clear_pointer (&self->file_name, g_free);
   g_clear_pointer (&self->mime_type, g_free);
   g_clear_pointer (&self->path, g_free);
@@ -86,6 +182,13 @@ chatty_file_class_init (ChattyFileClass *klass)
                   G_SIGNAL_RUN_LAST,
                   0, NULL, NULL, NULL,
                   G_TYPE_NONE, 0);
+
+  signals [PROGRESS_CHANGED] =
+    g_signal_new ("progress-changed",
+                  G_TYPE_FROM_CLASS (klass),
+                  G_SIGNAL_RUN_LAST,
+                  0, NULL, NULL, NULL,
+                  G_TYPE_NONE, 0);
 }
 
 static void
@@ -203,7 +306,8 @@ chatty_file_get_path (ChattyFile *self)
 {
   g_return_val_if_fail (CHATTY_IS_FILE (self), NULL);
 
-  if (self->cm_event)
+  /* path is set once the downloaded file is cached */
+  if (self->cm_event && !self->path)
     return cm_room_message_event_get_file_path (self->cm_event);
 
   return self->path;
@@ -246,24 +350,361 @@ chatty_file_get_status (ChattyFile *self)
   return self->status;
 }
 
+/**
+ * chatty_file_set_progress:
+ * @self: A #ChattyFile
+ * @current: The number of bytes transferred
+ * @total: The total number of bytes, or 0 if unknown
+ *
+ * Update the progress of the file being downloaded
+ * or uploaded.
+ */
+void
+chatty_file_set_progress (ChattyFile *self,
+                          goffset     current,
+                          goffset     total)
+{
+  g_return_if_fail (CHATTY_IS_FILE (self));
+
+  self->progress_current = current;
+  self->progress_total = total;
+  g_signal_emit (self, signals[PROGRESS_CHANGED], 0);
+}
+
+/**
+ * chatty_file_get_progress:
+ * @self: A #ChattyFile
+ *
+ * Get the fraction of the file transferred.
+ *
+ * Returns: A value between 0.0 and 1.0, or
+ * -1.0 if the progress is not known.
+ */
+double
+chatty_file_get_progress (ChattyFile *self)
+{
+  g_return_val_if_fail (CHATTY_IS_FILE (self), -1.0);
+
+  if (self->progress_total <= 0)
+    return -1.0;
+
+  return CLAMP ((double)self->progress_current / self->progress_total, 0.0, 1.0);
+}
+
 static void
-file_get_file_stream_cb (GObject      *object,
-                         GAsyncResult *result,
-                         gpointer      user_data)
+file_progress_cb (goffset  current_num_bytes,
+                  goffset  total_num_bytes,
+                  gpointer user_data)
+{
+  chatty_file_set_progress (user_data, current_num_bytes, total_num_bytes);
+}
+
+static void
+file_waiter_disconnect (GTask *task)
+{
+  gulong handler_id;
+
+  handler_id = GPOINTER_TO_SIZE (g_object_steal_data (G_OBJECT (task), "cancelled-id"));
+
+  if (handler_id)
+    g_cancellable_disconnect (g_task_get_cancellable (task), handler_id);
+}
+
+static void
+file_return_bytes (ChattyFile *self,
+                   GBytes     *bytes,
+                   gboolean    mapped,
+                   GError     *error)
+{
+  g_autoptr(GPtrArray) tasks = NULL;
+
+  g_assert (CHATTY_IS_FILE (self));
+
+  tasks = g_steal_pointer (&self->pending_tasks);
+  g_clear_object (&self->load_cancellable);
+  file_bytes_release (self);
+
+  if (bytes) {
+    self->bytes = g_bytes_ref (bytes);
+    self->mapped = mapped;
+    file_bytes_touch (self);
+  }
+
+  for (guint i = 0; i < tasks->len; i++) {
+    GTask *task = tasks->pdata[i];
+
+    file_waiter_disconnect (task);
+
+    if (g_task_return_error_if_cancelled (task))
+      continue;
+
+    if (error)
+      g_task_return_error (task, g_error_copy (error));
+    else if (bytes)
+      g_task_return_pointer (task, g_memory_input_stream_new_from_bytes (bytes),
+                             g_object_unref);
+    else
+      g_task_return_pointer (task, NULL, NULL);
+  }
+}
+
+static gboolean
+file_waiter_cancelled_idle (gpointer user_data)
 {
+  GTask *task = user_data;
   ChattyFile *self;
-  g_autoptr(GTask) task = user_data;
+  guint index;
+
+  self = g_task_get_source_object (task);
+
+  /* The content was loaded meanwhile */
+  if (!self->pending_tasks ||
+      !g_ptr_array_find (self->pending_tasks, task, &index))
+    return G_SOURCE_REMOVE;
+
+  file_waiter_disconnect (task);
+  g_task_return_error_if_cancelled (task);
+  g_ptr_array_remove_index (self->pending_tasks, index);
+
+  /* Cancel the load only if no one else is waiting for it */
+  if (self->pending_tasks->len == 0) {
+    g_clear_pointer (&self->pending_tasks, g_ptr_array_unref);
+    g_cancellable_cancel (self->load_cancellable);
+    g_clear_object (&self->load_cancellable);
+
+    if (chatty_file_get_status (self) == CHATTY_FILE_DOWNLOADING)
+      chatty_file_set_status (self, CHATTY_FILE_UNKNOWN);
+  }
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+file_waiter_cancelled_cb (GCancellable *cancellable,
+                          GTask        *task)
+{
+  /* This can be run from g_cancellable_connect(), where the
+   * handler can't be disconnected, so handle it from an idle */
+  g_idle_add_full (G_PRIORITY_DEFAULT, file_waiter_cancelled_idle,
+                   g_object_ref (task), g_object_unref);
+}
+
+static void
+file_add_waiter (ChattyFile *self,
+                 GTask      *task)
+{
+  GCancellable *cancellable;
+
+  g_assert (self->pending_tasks);
+
+  g_ptr_array_add (self->pending_tasks, task);
+  cancellable = g_task_get_cancellable (task);
+
+  if (cancellable) {
+    gulong handler_id;
+
+    handler_id = g_cancellable_connect (cancellable,
+                                        G_CALLBACK (file_waiter_cancelled_cb),
+                                        task, NULL);
+    g_object_set_data (G_OBJECT (task), "cancelled-id", GSIZE_TO_POINTER (handler_id));
+  }
+}
+
+static GBytes *
+file_load_file (GFile         *file,
+                gboolean      *mapped,
+                GCancellable  *cancellable,
+                GError       **error)
+{
+  g_autoptr(GFileInfo) file_info = NULL;
+  char *contents;
+  gsize length;
+
+  file_info = g_file_query_info (file, G_FILE_ATTRIBUTE_STANDARD_SIZE,
+                                 G_FILE_QUERY_INFO_NONE, cancellable, NULL);
+
+  /* Mapped files don't need the file descriptor kept open */
+  if (file_info && g_file_info_get_size (file_info) >= MMAP_MIN_SIZE) {
+    g_autoptr(GMappedFile) mapped_file = NULL;
+    g_autofree char *path = NULL;
+
+    path = g_file_get_path (file);
+
+    if (path)
+      mapped_file = g_mapped_file_new (path, FALSE, NULL);
+
+    if (mapped_file) {
+      *mapped = TRUE;
+      return g_mapped_file_get_bytes (mapped_file);
+    }
+  }
+
+  if (!g_file_load_contents (file, cancellable, &contents, &length, NULL, error))
+    return NULL;
+
+  return g_bytes_new_take (contents, length);
+}
+
+static GBytes *
+file_load_stream (GInputStream  *stream,
+                  GCancellable  *cancellable,
+                  GError       **error)
+{
+  g_autoptr(GOutputStream) output = NULL;
+
+  output = g_memory_output_stream_new_resizable ();
+
+  if (g_output_stream_splice (output, stream,
+                              G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE |
+                              G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+                              cancellable, error) < 0)
+    return NULL;
+
+  return g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (output));
+}
+
+static void
+file_load_thread (GTask        *task,
+                  gpointer      source_object,
+                  gpointer      task_data,
+                  GCancellable *cancellable)
+{
+  GBytes *bytes;
   GError *error = NULL;
+  gboolean mapped = FALSE;
 
-  g_assert (G_IS_TASK (task));
+  if (G_IS_FILE (task_data))
+    bytes = file_load_file (task_data, &mapped, cancellable, &error);
+  else
+    bytes = file_load_stream (task_data, cancellable, &error);
+
+  /* Set before returning, as the task is then used from the main thread */
+  if (mapped)
+    g_object_set_data (G_OBJECT (task), "mapped", GINT_TO_POINTER (TRUE));
+
+  if (bytes)
+    g_task_return_pointer (task, bytes, (GDestroyNotify)g_bytes_unref);
+  else
+    g_task_return_error (task, error);
+}
+
+static void file_download (ChattyFile *self);
+static void file_cache_download (ChattyFile *self);
+
+static void
+file_load_cb (GObject      *object,
+              GAsyncResult *result,
+              gpointer      user_data)
+{
+  ChattyFile *self = CHATTY_FILE (object);
+  g_autoptr(GBytes) bytes = NULL;
+  g_autoptr(GError) error = NULL;
+
+  bytes = g_task_propagate_pointer (G_TASK (result), &error);
+
+  /* Every waiter cancelled, and the content may have been requested again */
+  if (g_task_get_cancellable (G_TASK (result)) != self->load_cancellable)
+    return;
+
+  /* The cached file has been evicted, download it again */
+  if (self->cm_event && g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND)) {
+    g_clear_object (&self->file);
+    g_clear_pointer (&self->path, g_free);
+    file_download (self);
+    return;
+  }
+
+  if (bytes)
+    chatty_file_set_status (self, CHATTY_FILE_DOWNLOADED);
+  else
+    chatty_file_set_status (self, CHATTY_FILE_ERROR);
+
+  /* Cache the downloaded file only once loaded, as it's moved to the cache */
+  if (bytes && self->cm_event && !self->file &&
+      cm_room_message_event_get_file_path (self->cm_event))
+    file_cache_download (self);
+
+  file_return_bytes (self, bytes,
+                     GPOINTER_TO_INT (g_object_get_data (G_OBJECT (result), "mapped")),
+                     error);
+}
+
+static void
+file_load_async (ChattyFile *self,
+                 gpointer    source)
+{
+  g_autoptr(GTask) task = NULL;
+
+  g_assert (G_IS_FILE (source) || G_IS_INPUT_STREAM (source));
+
+  /* self is kept alive by the task until the content is loaded */
+  task = g_task_new (self, self->load_cancellable, file_load_cb, NULL);
+  g_task_set_task_data (task, g_object_ref (source), g_object_unref);
+  g_task_run_in_thread (task, file_load_thread);
+}
+
+static void
+file_cached_cb (GObject      *object,
+                GAsyncResult *result,
+                gpointer      user_data)
+{
+  ChattyMediaCache *cache = CHATTY_MEDIA_CACHE (object);
+  g_autoptr(ChattyFile) self = user_data;
+  g_autoptr(GError) error = NULL;
+  g_autofree char *path = NULL;
 
-  self = g_task_get_source_object (task);
   g_assert (CHATTY_IS_FILE (self));
 
-  g_clear_object (&self->stream);
-  self->stream = cm_room_message_event_get_file_finish (self->cm_event, result, &error);
+  path = chatty_media_cache_add_finish (cache, result, &error);
+  g_clear_object (&self->file);
 
-  if (self->stream)
+  /* On failure, reload the downloaded file directly the next time */
+  if (!path) {
+    g_warning ("Failed to cache file %s: %s", self->file_name, error->message);
+    self->file = g_file_new_for_path (cm_room_message_event_get_file_path (self->cm_event));
+    return;
+  }
+
+  self->file = g_file_new_build_filename (chatty_media_cache_get_base_dir (cache), path, NULL);
+  g_free (self->path);
+  self->path = g_file_get_path (self->file);
+}
+
+static void
+file_cache_download (ChattyFile *self)
+{
+  g_autoptr(GFile) file = NULL;
+  ChattyMediaCache *cache;
+
+  g_assert (CHATTY_IS_FILE (self));
+
+  /* The file can be downloaded again, so it can be evicted */
+  cache = chatty_manager_get_media_cache (chatty_manager_get_default ());
+  file = g_file_new_for_path (cm_room_message_event_get_file_path (self->cm_event));
+  chatty_media_cache_add_async (cache, file,
+                                cm_room_message_event_get_file_url (self->cm_event),
+                                TRUE, NULL,
+                                file_cached_cb, g_object_ref (self));
+}
+
+static void
+file_get_file_stream_cb (GObject      *object,
+                         GAsyncResult *result,
+                         gpointer      user_data)
+{
+  g_autoptr(ChattyFile) self = user_data;
+  g_autoptr(GInputStream) stream = NULL;
+  g_autoptr(GError) error = NULL;
+
+  g_assert (CHATTY_IS_FILE (self));
+
+  stream = cm_room_message_event_get_file_finish (self->cm_event, result, &error);
+
+  /* Every waiter cancelled, and the file may have been requested again */
+  if (g_task_get_cancellable (G_TASK (result)) != self->load_cancellable)
+    return;
+
+  if (stream)
     chatty_file_set_status (self, CHATTY_FILE_DOWNLOADED);
   else if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED) ||
            g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NETWORK_UNREACHABLE) ||
@@ -272,12 +713,74 @@ file_get_file_stream_cb (GObject      *object,
   else
     chatty_file_set_status (self, CHATTY_FILE_ERROR);
 
-  if (error)
-    g_task_return_error (task, error);
+  if (!stream) {
+    file_return_bytes (self, NULL, FALSE, error);
+  } else if (cm_room_message_event_get_file_path (self->cm_event)) {
+    g_autoptr(GFile) file = NULL;
+
+    /* Load from the downloaded file, so that large files are mapped */
+    g_input_stream_close (stream, NULL, NULL);
+    file = g_file_new_for_path (cm_room_message_event_get_file_path (self->cm_event));
+    file_load_async (self, file);
+  } else {
+    file_load_async (self, stream);
+  }
+}
+
+static void
+file_download (ChattyFile *self)
+{
+  g_assert (CHATTY_IS_FILE (self));
+  g_assert (self->cm_event);
+
+  chatty_file_set_status (self, CHATTY_FILE_DOWNLOADING);
+  cm_room_message_event_get_file_async (self->cm_event,
+                                        self->load_cancellable,
+                                        file_progress_cb, self,
+                                        file_get_file_stream_cb,
+                                        g_object_ref (self));
+}
+
+static void
+file_lookup_cb (GObject      *object,
+                GAsyncResult *result,
+                gpointer      user_data)
+{
+  g_autoptr(ChattyFile) self = user_data;
+  g_autoptr(GFile) file = NULL;
+
+  g_assert (CHATTY_IS_FILE (self));
+
+  file = chatty_media_cache_lookup_finish (CHATTY_MEDIA_CACHE (object), result, NULL);
+
+  /* Every waiter cancelled, and the file may have been requested again */
+  if (g_task_get_cancellable (G_TASK (result)) != self->load_cancellable)
+    return;
+
+  if (file && !self->file) {
+    self->file = g_object_ref (file);
+    g_free (self->path);
+    self->path = g_file_get_path (file);
+  }
+
+  if (self->file)
+    file_load_async (self, self->file);
   else
-    g_task_return_pointer (task, g_object_ref (self->stream), g_object_unref);
+    file_download (self);
 }
 
+/**
+ * chatty_file_get_stream_async:
+ * @self: A #ChattyFile
+ * @cancellable: (nullable): A #GCancellable
+ * @callback: A #GAsyncReadyCallback
+ * @user_data: The user data for @callback
+ *
+ * Get a new stream to the content of @self, downloading
+ * the file if required.  Concurrent requests share the
+ * same download, which is cancelled only when all of
+ * them are.
+ */
 void
 chatty_file_get_stream_async (ChattyFile          *self,
                               GCancellable        *cancellable,
@@ -303,23 +806,35 @@ chatty_file_get_stream_async (ChattyFile          *self,
     return;
   }
 
-  if (self->stream) {
-    g_seekable_seek (G_SEEKABLE (self->stream), 0, G_SEEK_SET, NULL, NULL);
-    g_task_return_pointer (task, g_object_ref (self->stream), g_object_unref);
+  if (self->bytes) {
+    file_bytes_touch (self);
+    g_task_return_pointer (task, g_memory_input_stream_new_from_bytes (self->bytes),
+                           g_object_unref);
     return;
   }
 
-  chatty_file_set_status (self, CHATTY_FILE_DOWNLOADING);
+  /* The content is already being loaded, wait for it */
+  if (self->pending_tasks) {
+    file_add_waiter (self, g_steal_pointer (&task));
+    return;
+  }
 
-  if (self->cm_event) {
-    cm_room_message_event_get_file_async (self->cm_event,
-                                          cancellable,
-                                          NULL, NULL,
-                                          file_get_file_stream_cb,
-                                          g_steal_pointer (&task));
-  } else {
-    GError *error = NULL;
+  self->pending_tasks = g_ptr_array_new_with_free_func (g_object_unref);
+  self->load_cancellable = g_cancellable_new ();
+  file_add_waiter (self, g_steal_pointer (&task));
+
+  if (self->cm_event && !self->file) {
+    const char *url;
+
+    url = cm_room_message_event_get_file_url (self->cm_event);
 
+    if (url)
+      chatty_media_cache_lookup_async (chatty_manager_get_media_cache (chatty_manager_get_default ()),
+                                       url, self->load_cancellable,
+                                       file_lookup_cb, g_object_ref (self));
+    else
+      file_download (self);
+  } else {
     if (!self->file) {
       g_autofree char *path = NULL;
 
@@ -327,14 +842,7 @@ chatty_file_get_stream_async (ChattyFile          *self,
       self->file = g_file_new_for_path (path);
     }
 
-    self->stream = (gpointer)g_file_read (self->file, NULL, &error);
-    if (self->stream) {
-      g_task_return_pointer (task, g_object_ref (self->stream), g_object_unref);
-      chatty_file_set_status (self, CHATTY_FILE_DOWNLOADED);
-    } else {
-      chatty_file_set_status (self, CHATTY_FILE_ERROR);
-      g_task_return_error (task, error);
-    }
+    file_load_async (self, self->file);
   }
 }
 
@@ -40,6 +40,10 @@ gsize             chatty_file_get_size           (ChattyFile          *self);
 void              chatty_file_set_status         (ChattyFile          *self,
                                                   ChattyFileStatus     status);
 ChattyFileStatus  chatty_file_get_status         (ChattyFile          *self);
+void              chatty_file_set_progress       (ChattyFile          *self,
+                                                  goffset              current,
+                                                  goffset              total);
+double            chatty_file_get_progress       (ChattyFile          *self);
 void              chatty_file_get_stream_async   (ChattyFile          *self,
                                                   GCancellable        *cancellable,
                                                   GAsyncReadyCallback  callback,
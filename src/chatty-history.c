@@ -24,6 +24,8 @@
 #include "chatty-utils.h"
 #include "chatty-file.h"
 #include "chatty-settings.h"
+#include "chatty-stats.h"
+#include "chatty-mark.h"
 #include "chatty-mm-account.h"
 #include "chatty-mm-buddy.h"
 #include "chatty-mm-chat.h"
@@ -36,7 +38,7 @@
 #define STRING_VALUE(arg) #arg
 
 /* increment when DB changes */
-#define HISTORY_VERSION 4
+#define HISTORY_VERSION 6
 
 /* Shouldn't be modified, new values should be appended */
 #define MESSAGE_DIRECTION_OUT    -1
@@ -117,6 +119,8 @@ struct _ChattyHistory
   GThread     *worker_thread;
   sqlite3     *db;
   char        *db_path;
+  /* The task being run in @worker_thread */
+  GTask       *current_task;
 };
 
 /*
@@ -470,6 +474,18 @@ history_bind_int (sqlite3_stmt *statement,
   warn_if_sql_error (status, message);
 }
 
+static void
+history_bind_int64 (sqlite3_stmt *statement,
+                    guint         position,
+                    gint64        bind_value,
+                    const char   *message)
+{
+  guint status;
+
+  status = sqlite3_bind_int64 (statement, position, bind_value);
+  warn_if_sql_error (status, message);
+}
+
 
 static int
 chatty_history_get_db_version (ChattyHistory *self,
@@ -636,6 +652,39 @@ chatty_history_create_schema (ChattyHistory *self,
     /* Introduced in Version 4 */
     "ALTER TABLE threads ADD COLUMN notification INTEGER NOT NULL DEFAULT 1;"
 
+    /* Introduced in Version 5 */
+    "CREATE TABLE IF NOT EXISTS media_cache ("
+    "id INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT, "
+    /* sha256 of the file content */
+    "checksum TEXT NOT NULL UNIQUE, "
+    /* relative to $XDG_DATA_HOME/chatty */
+    "path TEXT NOT NULL, "
+    "size INTEGER NOT NULL, "
+    /* Files that can't be fetched again (eg: MMS) are never evicted */
+    "evictable INTEGER NOT NULL DEFAULT 1, "
+    /* Unix time in microseconds */
+    "last_access INTEGER NOT NULL, "
+    /* The url the file was last fetched from, if any */
+    "url TEXT);"
+    "CREATE INDEX IF NOT EXISTS media_cache_url_index ON media_cache(url);"
+
+    /* Introduced in Version 5 */
+    "ALTER TABLE files ADD COLUMN cache_id INTEGER REFERENCES media_cache(id) ON DELETE SET NULL;"
+
+    /* Introduced in Version 6 */
+    "CREATE TABLE IF NOT EXISTS sms_queue ("
+    "id INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT, "
+    "message_id INTEGER NOT NULL REFERENCES messages(id) ON DELETE CASCADE, "
+    /* The number the message is sent to */
+    "number TEXT NOT NULL, "
+    /* The equipment identifier of the modem to send with, if known */
+    "device_id TEXT, "
+    /* The number of failed attempts to send */
+    "attempts INTEGER NOT NULL DEFAULT 0, "
+    /* Unix time to not try sending again before */
+    "next_attempt INTEGER NOT NULL DEFAULT 0, "
+    "UNIQUE (message_id, number));"
+
     "INSERT OR IGNORE INTO accounts(user_id,protocol) "
     "SELECT users.id,"STRING (PROTOCOL_MMS_SMS)" "
     "FROM users "
@@ -1322,7 +1371,8 @@ chatty_history_migrate_db_to_v1_to_v3 (ChattyHistory *self,
                          "AND chatty_chat.who IS NULL or chatty_chat.who GLOB '@?*:?*' "
                          "ORDER BY timestamp ASC, chatty_chat.id ASC;"
 
-                         "PRAGMA user_version = 4;",
+                         /* The schema created above is always the latest one */
+                         "PRAGMA user_version = " STRING (HISTORY_VERSION) ";",
                          NULL, NULL, &error);
 
   if (!e_phone_number_is_supported ())
@@ -1887,6 +1937,87 @@ chatty_history_migrate_db_to_v4 (ChattyHistory *self,
   return FALSE;
 }
 
+/* For migrating from v4 to v5 */
+static gboolean
+chatty_history_migrate_db_to_v5 (ChattyHistory *self,
+                                 GTask         *task)
+{
+  char *error = NULL;
+  int status;
+
+  g_assert (CHATTY_IS_HISTORY (self));
+  g_assert (G_IS_TASK (task));
+  g_assert (g_thread_self () == self->worker_thread);
+
+  chatty_history_backup (self);
+
+  status = sqlite3_exec (self->db,
+                         "CREATE TABLE IF NOT EXISTS media_cache ("
+                         "id INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT, "
+                         "checksum TEXT NOT NULL UNIQUE, "
+                         "path TEXT NOT NULL, "
+                         "size INTEGER NOT NULL, "
+                         "evictable INTEGER NOT NULL DEFAULT 1, "
+                         "last_access INTEGER NOT NULL, "
+                         "url TEXT);"
+                         "CREATE INDEX IF NOT EXISTS media_cache_url_index ON media_cache(url);"
+
+                         "ALTER TABLE files ADD COLUMN cache_id INTEGER REFERENCES media_cache(id) ON DELETE SET NULL;"
+
+                         "PRAGMA user_version = 5;",
+                         NULL, NULL, &error);
+
+  if (status == SQLITE_OK || status == SQLITE_DONE)
+    return TRUE;
+
+  g_task_return_new_error (task,
+                           G_IO_ERROR,
+                           G_IO_ERROR_FAILED,
+                           "Couldn't set db version. errno: %d, desc: %s. %s",
+                           status, sqlite3_errstr (status), error);
+  sqlite3_free (error);
+
+  return FALSE;
+}
+
+/* For migrating from v5 to v6 */
+static gboolean
+chatty_history_migrate_db_to_v6 (ChattyHistory *self,
+                                 GTask         *task)
+{
+  char *error = NULL;
+  int status;
+
+  g_assert (CHATTY_IS_HISTORY (self));
+  g_assert (G_IS_TASK (task));
+  g_assert (g_thread_self () == self->worker_thread);
+
+  status = sqlite3_exec (self->db,
+                         "CREATE TABLE IF NOT EXISTS sms_queue ("
+                         "id INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT, "
+                         "message_id INTEGER NOT NULL REFERENCES messages(id) ON DELETE CASCADE, "
+                         "number TEXT NOT NULL, "
+                         "device_id TEXT, "
+                         "attempts INTEGER NOT NULL DEFAULT 0, "
+                         "next_attempt INTEGER NOT NULL DEFAULT 0, "
+                         "UNIQUE (message_id, number));"
+
+                         "PRAGMA user_version = 6;",
+                         NULL, NULL, &error);
+
+  if (status == SQLITE_OK || status == SQLITE_DONE)
+    return TRUE;
+
+  g_task_return_new_error (task,
+                           G_IO_ERROR,
+                           G_IO_ERROR_FAILED,
+                           "Couldn't set db version. errno: %d, desc: %s. %s",
+                           status, sqlite3_errstr (status), error);
+  sqlite3_free (error);
+
+  return FALSE;
+}
+
 static gboolean
 chatty_history_migrate (ChattyHistory *self,
                         GTask         *task)
@@ -1925,6 +2056,16 @@ chatty_history_migrate (ChattyHistory *self,
   case 3:
     if (!chatty_history_migrate_db_to_v4 (self, task))
       return FALSE;
+    /* fallthrough */
+
+  case 4:
+    if (!chatty_history_migrate_db_to_v5 (self, task))
+      return FALSE;
+    /* fallthrough */
+
+  case 5:
+    if (!chatty_history_migrate_db_to_v6 (self, task))
+      return FALSE;
     break;
 
   default:
@@ -1939,6 +2080,26 @@ chatty_history_migrate (ChattyHistory *self,
   return TRUE;
 }
 
+#ifdef HAVE_SYSPROF
+static int
+history_trace_cb (unsigned int  type,
+                  void         *ctx,
+                  void         *p,
+                  void         *x)
+{
+  ChattyHistory *self = ctx;
+  gint64 duration;
+
+  /* Time taken by the statement @p, in nanoseconds */
+  duration = *(sqlite3_int64 *)x;
+  sysprof_collector_mark_printf (SYSPROF_CAPTURE_CURRENT_TIME - duration, duration,
+                                 "chatty", "history-sql", "task %p: %s",
+                                 self->current_task, sqlite3_sql (p));
+
+  return 0;
+}
+#endif
+
 static void
 history_open_db (ChattyHistory *self,
                  GTask         *task)
@@ -1966,6 +2127,9 @@ history_open_db (ChattyHistory *self,
 
   if (status == SQLITE_OK) {
     self->db = db;
+#ifdef HAVE_SYSPROF
+    sqlite3_trace_v2 (self->db, SQLITE_TRACE_PROFILE, history_trace_cb, self);
+#endif
 
     sqlite3_exec (self->db, "PRAGMA foreign_keys = OFF;", NULL, NULL, NULL);
     sqlite3_exec (self->db, "BEGIN TRANSACTION;", NULL, NULL, NULL);
@@ -2067,6 +2231,20 @@ history_get_files (ChattyHistory *self,
 
   sqlite3_finalize (stmt);
 
+  /* Loading a message counts as an access to its cached media */
+  if (files) {
+    sqlite3_prepare_v2 (self->db,
+                        "UPDATE media_cache SET last_access=?1 "
+                        "WHERE id IN (SELECT files.cache_id FROM files "
+                        "INNER JOIN message_files ON message_files.file_id=files.id "
+                        "WHERE message_files.message_id=?2);",
+                        -1, &stmt, NULL);
+    history_bind_int64 (stmt, 1, g_get_real_time (), "binding when updating media access");
+    history_bind_int (stmt, 2, message_id, "binding when updating media access");
+    sqlite3_step (stmt);
+    sqlite3_finalize (stmt);
+  }
+
   return files;
 }
 
@@ -2366,6 +2544,17 @@ add_file_info (ChattyHistory *self,
   sqlite3_step (stmt);
   sqlite3_finalize (stmt);
 
+  if (chatty_file_get_path (file)) {
+    sqlite3_prepare_v2 (self->db,
+                        "UPDATE files SET cache_id=(SELECT id FROM media_cache WHERE path=?1) "
+                        "WHERE url=?2;",
+                        -1, &stmt, NULL);
+    history_bind_text (stmt, 1, chatty_file_get_path (file), "binding when linking file");
+    history_bind_text (stmt, 2, chatty_file_get_url (file), "binding when linking file");
+    sqlite3_step (stmt);
+    sqlite3_finalize (stmt);
+  }
+
   if (file_id)
     return file_id;
 
@@ -2458,12 +2647,17 @@ get_chat_draft_id (ChattyHistory *self,
   return message_id;
 }
 
-static void
-history_add_message (ChattyHistory *self,
-                     GTask         *task)
+/*
+ * Store @message without starting a transaction, so that
+ * several messages can share one.  Returns %FALSE if @task
+ * has been returned with an error.
+ */
+static gboolean
+history_insert_message (ChattyHistory *self,
+                        ChattyChat    *chat,
+                        ChattyMessage *message,
+                        GTask         *task)
 {
-  ChattyMessage *message;
-  ChattyChat *chat;
   sqlite3_stmt *stmt;
   const char *who, *uid, *msg, *alias;
   ChattyMsgDirection direction;
@@ -2475,16 +2669,6 @@ history_add_message (ChattyHistory *self,
   g_assert (CHATTY_IS_HISTORY (self));
   g_assert (G_IS_TASK (task));
   g_assert (g_thread_self () == self->worker_thread);
-
-  if (!self->db) {
-    g_task_return_new_error (task,
-                             G_IO_ERROR, G_IO_ERROR_FAILED,
-                             "Database not opened");
-    return;
-  }
-
-  chat = g_object_get_data (G_OBJECT (task), "chat");
-  message = g_object_get_data (G_OBJECT (task), "message");
   g_assert (CHATTY_IS_CHAT (chat));
   g_assert (CHATTY_IS_MESSAGE (message));
 
@@ -2504,11 +2688,13 @@ history_add_message (ChattyHistory *self,
   if ((!who || !*who) && direction == CHATTY_DIRECTION_IN && chatty_chat_is_im (chat))
     who = chatty_chat_get_chat_name (chat);
 
-  sqlite3_exec (self->db, "BEGIN TRANSACTION;", NULL, NULL, NULL);
   thread_id = insert_or_ignore_thread (self, chat, task);
   if (!thread_id) {
-    sqlite3_exec (self->db, "END TRANSACTION;", NULL, NULL, NULL);
-    return;
+    if (!g_task_had_error (task))
+      g_task_return_new_error (task,
+                               G_IO_ERROR, G_IO_ERROR_FAILED,
+                               "Failed to add thread");
+    return FALSE;
   }
 
   sender_id = insert_or_ignore_user (self, chatty_item_get_protocols (CHATTY_ITEM (chat)), who, alias, task);
@@ -2517,11 +2703,8 @@ history_add_message (ChattyHistory *self,
       msg_status == MESSAGE_STATUS_DRAFT) {
     int message_id = 0;
 
-    if (!msg) {
-      sqlite3_exec (self->db, "END TRANSACTION;", NULL, NULL, NULL);
-      g_task_return_boolean (task, TRUE);
-      return;
-    }
+    if (!msg)
+      return TRUE;
 
     message_id = get_chat_draft_id (self, thread_id);
 
@@ -2548,16 +2731,15 @@ history_add_message (ChattyHistory *self,
 
     status = sqlite3_step (stmt);
     sqlite3_finalize (stmt);
-    sqlite3_exec (self->db, "END TRANSACTION;", NULL, NULL, NULL);
 
     if (status == SQLITE_DONE)
-      g_task_return_boolean (task, TRUE);
-    else
-      g_task_return_new_error (task,
-                               G_IO_ERROR, G_IO_ERROR_FAILED,
-                               "Failed to save message. errno: %d, desc: %s",
-                               status, sqlite3_errmsg (self->db));
-    return;
+      return TRUE;
+
+    g_task_return_new_error (task,
+                             G_IO_ERROR, G_IO_ERROR_FAILED,
+                             "Failed to save message. errno: %d, desc: %s",
+                             status, sqlite3_errmsg (self->db));
+    return FALSE;
   }
 
   if (sender_id && direction == CHATTY_DIRECTION_IN) {
@@ -2608,15 +2790,80 @@ history_add_message (ChattyHistory *self,
   if (status == SQLITE_ROW)
     history_add_files (self, message, sqlite3_column_int (stmt, 0));
   sqlite3_finalize (stmt);
-  sqlite3_exec (self->db, "END TRANSACTION;", NULL, NULL, NULL);
 
   if (status == SQLITE_DONE || status == SQLITE_ROW)
+    return TRUE;
+
+  g_task_return_new_error (task,
+                           G_IO_ERROR, G_IO_ERROR_FAILED,
+                           "Failed to save message. errno: %d, desc: %s",
+                           status, sqlite3_errmsg (self->db));
+  return FALSE;
+}
+
+static void
+history_add_message (ChattyHistory *self,
+                     GTask         *task)
+{
+  ChattyMessage *message;
+  ChattyChat *chat;
+  gboolean success;
+
+  g_assert (CHATTY_IS_HISTORY (self));
+  g_assert (G_IS_TASK (task));
+  g_assert (g_thread_self () == self->worker_thread);
+
+  if (!self->db) {
+    g_task_return_new_error (task,
+                             G_IO_ERROR, G_IO_ERROR_FAILED,
+                             "Database not opened");
+    return;
+  }
+
+  chat = g_object_get_data (G_OBJECT (task), "chat");
+  message = g_object_get_data (G_OBJECT (task), "message");
+
+  sqlite3_exec (self->db, "BEGIN TRANSACTION;", NULL, NULL, NULL);
+  success = history_insert_message (self, chat, message, task);
+  sqlite3_exec (self->db, "END TRANSACTION;", NULL, NULL, NULL);
+
+  if (success)
     g_task_return_boolean (task, TRUE);
-  else
+}
+
+static void
+history_add_messages (ChattyHistory *self,
+                      GTask         *task)
+{
+  GPtrArray *chats, *messages;
+
+  g_assert (CHATTY_IS_HISTORY (self));
+  g_assert (G_IS_TASK (task));
+  g_assert (g_thread_self () == self->worker_thread);
+
+  if (!self->db) {
     g_task_return_new_error (task,
                              G_IO_ERROR, G_IO_ERROR_FAILED,
-                             "Failed to save message. errno: %d, desc: %s",
-                             status, sqlite3_errmsg (self->db));
+                             "Database not opened");
+    return;
+  }
+
+  chats = g_object_get_data (G_OBJECT (task), "chats");
+  messages = g_object_get_data (G_OBJECT (task), "messages");
+  g_assert (chats->len == messages->len);
+
+  /* Either all messages are stored, or none */
+  sqlite3_exec (self->db, "BEGIN TRANSACTION;", NULL, NULL, NULL);
+
+  for (guint i = 0; i < messages->len; i++) {
+    if (!history_insert_message (self, chats->pdata[i], messages->pdata[i], task)) {
+      sqlite3_exec (self->db, "ROLLBACK;", NULL, NULL, NULL);
+      return;
+    }
+  }
+
+  sqlite3_exec (self->db, "COMMIT;", NULL, NULL, NULL);
+  g_task_return_boolean (task, TRUE);
 }
 
 static GPtrArray *
@@ -2898,13 +3145,15 @@ history_delete_chat (ChattyHistory *self,
 }
 
 static void
-history_load_account (ChattyHistory *self,
-                      GTask         *task)
+history_add_media (ChattyHistory *self,
+                   GTask         *task)
 {
-  ChattyAccount *account;
+  GPtrArray *evicted;
   sqlite3_stmt *stmt;
-  const char *user_name;
-  int status;
+  const char *checksum, *path, *url;
+  gint64 size, max_size, total = 0;
+  gboolean evictable;
+  int cache_id = 0, status;
 
   g_assert (CHATTY_IS_HISTORY (self));
   g_assert (G_IS_TASK (task));
@@ -2917,56 +3166,413 @@ history_load_account (ChattyHistory *self,
     return;
   }
 
-  account = g_object_get_data (G_OBJECT (task), "account");
-  g_assert (CHATTY_IS_ACCOUNT (account));
+  checksum = g_object_get_data (G_OBJECT (task), "checksum");
+  path = g_object_get_data (G_OBJECT (task), "path");
+  url = g_object_get_data (G_OBJECT (task), "url");
+  size = *(gint64 *)g_object_get_data (G_OBJECT (task), "size");
+  max_size = *(gint64 *)g_object_get_data (G_OBJECT (task), "max-size");
+  evictable = GPOINTER_TO_INT (g_object_get_data (G_OBJECT (task), "evictable"));
 
-  user_name = chatty_item_get_username (CHATTY_ITEM (account));
+  sqlite3_exec (self->db, "BEGIN TRANSACTION;", NULL, NULL, NULL);
 
-  if (!user_name || !*user_name) {
+  /* A file once marked non-evictable shall stay so */
+  sqlite3_prepare_v2 (self->db,
+                      "INSERT INTO media_cache(checksum,path,size,evictable,last_access,url) "
+                      "VALUES(?1,?2,?3,?4,?5,?6) "
+                      "ON CONFLICT(checksum) DO UPDATE SET last_access=?5, "
+                      "evictable=MIN(evictable,?4), url=COALESCE(?6,url);",
+                      -1, &stmt, NULL);
+  history_bind_text (stmt, 1, checksum, "binding when adding media");
+  history_bind_text (stmt, 2, path, "binding when adding media");
+  history_bind_int64 (stmt, 3, size, "binding when adding media");
+  history_bind_int (stmt, 4, !!evictable, "binding when adding media");
+  history_bind_int64 (stmt, 5, g_get_real_time (), "binding when adding media");
+  if (url)
+    history_bind_text (stmt, 6, url, "binding when adding media");
+  status = sqlite3_step (stmt);
+  sqlite3_finalize (stmt);
+
+  if (status != SQLITE_DONE) {
+    sqlite3_exec (self->db, "ROLLBACK;", NULL, NULL, NULL);
     g_task_return_new_error (task,
-                             G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
-                             "Username name is empty");
+                             G_IO_ERROR, G_IO_ERROR_FAILED,
+                             "Failed to add media. errno: %d, desc: %s",
+                             status, sqlite3_errmsg (self->db));
     return;
   }
 
-  sqlite3_prepare_v2 (self->db, "SELECT users.alias,files.url,files.path FROM users "
-                      "LEFT JOIN files ON files.id=users.avatar_id "
-                      "WHERE users.username=? LIMIT 1;", -1, &stmt, NULL);
-  history_bind_text (stmt, 1, user_name, "binding when getting user details");
-
+  sqlite3_prepare_v2 (self->db, "SELECT id,path FROM media_cache WHERE checksum=?;",
+                      -1, &stmt, NULL);
+  history_bind_text (stmt, 1, checksum, "binding when getting media");
   if (sqlite3_step (stmt) == SQLITE_ROW) {
-    const char *name, *avatar_url, *avatar_path;
-    GObject *object;
+    cache_id = sqlite3_column_int (stmt, 0);
+    /* The content may already be cached in a different path */
+    g_object_set_data_full (G_OBJECT (task), "cache-path",
+                            g_strdup ((const char *)sqlite3_column_text (stmt, 1)),
+                            g_free);
+  }
+  sqlite3_finalize (stmt);
 
-    name = (char *)sqlite3_column_text (stmt, 0);
-    avatar_url = (char *)sqlite3_column_text (stmt, 1);
-    avatar_path = (char *)sqlite3_column_text (stmt, 2);
+  sqlite3_prepare_v2 (self->db, "UPDATE files SET cache_id=?1 WHERE path=?2;",
+                      -1, &stmt, NULL);
+  history_bind_int (stmt, 1, cache_id, "binding when linking media");
+  history_bind_text (stmt, 2, path, "binding when linking media");
+  sqlite3_step (stmt);
+  sqlite3_finalize (stmt);
 
-    object = G_OBJECT (task);
-    g_object_set_data_full (object, "name", g_strdup (name), g_free);
-    g_object_set_data_full (object, "avatar-url", g_strdup (avatar_url), g_free);
-    g_object_set_data_full (object, "avatar-path", g_strdup (avatar_path), g_free);
-  }
+  /* Pinned files don't count against the budget, they can't be evicted */
+  sqlite3_prepare_v2 (self->db, "SELECT SUM(size) FROM media_cache WHERE evictable=1;",
+                      -1, &stmt, NULL);
+  if (sqlite3_step (stmt) == SQLITE_ROW)
+    total = sqlite3_column_int64 (stmt, 0);
+  sqlite3_finalize (stmt);
 
-  status = sqlite3_finalize (stmt);
-  warn_if_sql_error (status, "finalizing when getting user details");
+  evicted = g_ptr_array_new_with_free_func (g_free);
 
-  g_task_return_boolean (task, TRUE);
-}
+  if (max_size > 0 && total > max_size) {
+    g_autoptr(GArray) ids = NULL;
 
-static void
-history_set_last_read_msg (ChattyHistory *self,
-                           GTask         *task)
-{
-  ChattyMessage *message;
-  sqlite3_stmt *stmt;
-  ChattyChat *chat;
-  const char *uid = NULL;
-  int thread_id, message_id = 0;
+    ids = g_array_new (FALSE, FALSE, sizeof (int));
 
-  g_assert (CHATTY_IS_HISTORY (self));
-  g_assert (G_IS_TASK (task));
-  g_assert (g_thread_self () == self->worker_thread);
+    /* Least recently used first */
+    sqlite3_prepare_v2 (self->db,
+                        "SELECT id,path,size FROM media_cache "
+                        "WHERE evictable=1 AND id!=? "
+                        "ORDER BY last_access ASC, id ASC;",
+                        -1, &stmt, NULL);
+    history_bind_int (stmt, 1, cache_id, "binding when evicting media");
+
+    while (total > max_size && sqlite3_step (stmt) == SQLITE_ROW) {
+      int id;
+
+      id = sqlite3_column_int (stmt, 0);
+      g_array_append_val (ids, id);
+      g_ptr_array_add (evicted, g_strdup ((const char *)sqlite3_column_text (stmt, 1)));
+      total -= sqlite3_column_int64 (stmt, 2);
+    }
+    sqlite3_finalize (stmt);
+
+    for (guint i = 0; i < ids->len; i++) {
+      int id = g_array_index (ids, int, i);
+
+      sqlite3_prepare_v2 (self->db,
+                          "UPDATE files SET status=" STRING (FILE_STATUS_MISSING) ", "
+                          "cache_id=NULL WHERE cache_id=?;",
+                          -1, &stmt, NULL);
+      history_bind_int (stmt, 1, id, "binding when evicting media");
+      sqlite3_step (stmt);
+      sqlite3_finalize (stmt);
+
+      sqlite3_prepare_v2 (self->db, "DELETE FROM media_cache WHERE id=?;",
+                          -1, &stmt, NULL);
+      history_bind_int (stmt, 1, id, "binding when evicting media");
+      sqlite3_step (stmt);
+      sqlite3_finalize (stmt);
+    }
+  }
+
+  sqlite3_exec (self->db, "COMMIT;", NULL, NULL, NULL);
+
+  g_task_return_pointer (task, evicted, (GDestroyNotify)g_ptr_array_unref);
+}
+
+static void
+history_lookup_media (ChattyHistory *self,
+                      GTask         *task)
+{
+  sqlite3_stmt *stmt;
+  const char *url;
+  char *path = NULL;
+  int cache_id = 0;
+
+  g_assert (CHATTY_IS_HISTORY (self));
+  g_assert (G_IS_TASK (task));
+  g_assert (g_thread_self () == self->worker_thread);
+
+  if (!self->db) {
+    g_task_return_new_error (task,
+                             G_IO_ERROR, G_IO_ERROR_FAILED,
+                             "Database not opened");
+    return;
+  }
+
+  url = g_object_get_data (G_OBJECT (task), "url");
+
+  sqlite3_prepare_v2 (self->db, "SELECT id,path FROM media_cache WHERE url=?;",
+                      -1, &stmt, NULL);
+  history_bind_text (stmt, 1, url, "binding when looking up media");
+  if (sqlite3_step (stmt) == SQLITE_ROW) {
+    cache_id = sqlite3_column_int (stmt, 0);
+    path = g_strdup ((const char *)sqlite3_column_text (stmt, 1));
+  }
+  sqlite3_finalize (stmt);
+
+  /* A lookup counts as an access */
+  if (cache_id) {
+    sqlite3_prepare_v2 (self->db, "UPDATE media_cache SET last_access=?1 WHERE id=?2;",
+                        -1, &stmt, NULL);
+    history_bind_int64 (stmt, 1, g_get_real_time (), "binding when updating media access");
+    history_bind_int (stmt, 2, cache_id, "binding when updating media access");
+    sqlite3_step (stmt);
+    sqlite3_finalize (stmt);
+  }
+
+  g_task_return_pointer (task, path, g_free);
+}
+
+static void
+history_queue_sms (ChattyHistory *self,
+                   GTask         *task)
+{
+  ChattyMessage *message;
+  ChattyChat *chat;
+  sqlite3_stmt *stmt;
+  const char *number, *device_id;
+  int message_id = 0, id = 0;
+
+  g_assert (CHATTY_IS_HISTORY (self));
+  g_assert (G_IS_TASK (task));
+  g_assert (g_thread_self () == self->worker_thread);
+
+  if (!self->db) {
+    g_task_return_new_error (task,
+                             G_IO_ERROR, G_IO_ERROR_FAILED,
+                             "Database not opened");
+    return;
+  }
+
+  chat = g_object_get_data (G_OBJECT (task), "chat");
+  message = g_object_get_data (G_OBJECT (task), "message");
+  number = g_object_get_data (G_OBJECT (task), "number");
+  device_id = g_object_get_data (G_OBJECT (task), "device-id");
+
+  /* The message is stored along with the queue item, so that both survive a restart */
+  sqlite3_exec (self->db, "BEGIN TRANSACTION;", NULL, NULL, NULL);
+
+  if (!history_insert_message (self, chat, message, task)) {
+    sqlite3_exec (self->db, "ROLLBACK;", NULL, NULL, NULL);
+    return;
+  }
+
+  sqlite3_prepare_v2 (self->db,
+                      "SELECT messages.id FROM messages "
+                      "WHERE messages.uid=?;",
+                      -1, &stmt, NULL);
+  history_bind_text (stmt, 1, chatty_message_get_uid (message), "binding when queueing sms");
+  if (sqlite3_step (stmt) == SQLITE_ROW)
+    message_id = sqlite3_column_int (stmt, 0);
+  sqlite3_finalize (stmt);
+
+  if (message_id) {
+    sqlite3_prepare_v2 (self->db,
+                        "INSERT OR IGNORE INTO sms_queue(message_id,number,device_id) "
+                        "VALUES(?1,?2,?3);",
+                        -1, &stmt, NULL);
+    history_bind_int (stmt, 1, message_id, "binding when queueing sms");
+    history_bind_text (stmt, 2, number, "binding when queueing sms");
+    if (device_id)
+      history_bind_text (stmt, 3, device_id, "binding when queueing sms");
+    sqlite3_step (stmt);
+    sqlite3_finalize (stmt);
+
+    sqlite3_prepare_v2 (self->db,
+                        "SELECT id FROM sms_queue "
+                        "WHERE message_id=? AND number=?;",
+                        -1, &stmt, NULL);
+    history_bind_int (stmt, 1, message_id, "binding when getting sms queue id");
+    history_bind_text (stmt, 2, number, "binding when getting sms queue id");
+    if (sqlite3_step (stmt) == SQLITE_ROW)
+      id = sqlite3_column_int (stmt, 0);
+    sqlite3_finalize (stmt);
+  }
+
+  if (!id) {
+    sqlite3_exec (self->db, "ROLLBACK;", NULL, NULL, NULL);
+    g_task_return_new_error (task,
+                             G_IO_ERROR, G_IO_ERROR_FAILED,
+                             "Failed to queue sms. desc: %s",
+                             sqlite3_errmsg (self->db));
+    return;
+  }
+
+  sqlite3_exec (self->db, "COMMIT;", NULL, NULL, NULL);
+  g_task_return_int (task, id);
+}
+
+static void
+history_get_sms_queue (ChattyHistory *self,
+                       GTask         *task)
+{
+  g_autoptr(GPtrArray) items = NULL;
+  sqlite3_stmt *stmt;
+
+  g_assert (CHATTY_IS_HISTORY (self));
+  g_assert (G_IS_TASK (task));
+  g_assert (g_thread_self () == self->worker_thread);
+
+  if (!self->db) {
+    g_task_return_new_error (task,
+                             G_IO_ERROR, G_IO_ERROR_FAILED,
+                             "Database not opened");
+    return;
+  }
+
+  items = g_ptr_array_new_with_free_func ((GDestroyNotify)chatty_sms_queue_item_free);
+  sqlite3_prepare_v2 (self->db,
+                      "SELECT sms_queue.id,threads.name,sms_queue.number,messages.uid,"
+                      "messages.body,messages.time,sms_queue.attempts,sms_queue.next_attempt,"
+                      "sms_queue.device_id "
+                      "FROM sms_queue "
+                      "INNER JOIN messages ON messages.id=sms_queue.message_id "
+                      "INNER JOIN threads ON threads.id=messages.thread_id "
+                      "ORDER BY sms_queue.id ASC;",
+                      -1, &stmt, NULL);
+
+  while (sqlite3_step (stmt) == SQLITE_ROW) {
+    ChattySmsQueueItem *item;
+
+    item = g_new0 (ChattySmsQueueItem, 1);
+    item->id = sqlite3_column_int (stmt, 0);
+    item->chat_name = g_strdup ((const char *)sqlite3_column_text (stmt, 1));
+    item->number = g_strdup ((const char *)sqlite3_column_text (stmt, 2));
+    item->message = chatty_message_new (NULL,
+                                        (const char *)sqlite3_column_text (stmt, 4),
+                                        (const char *)sqlite3_column_text (stmt, 3),
+                                        sqlite3_column_int64 (stmt, 5),
+                                        CHATTY_MESSAGE_TEXT,
+                                        CHATTY_DIRECTION_OUT,
+                                        CHATTY_STATUS_SENDING);
+    item->attempts = sqlite3_column_int (stmt, 6);
+    item->next_attempt = sqlite3_column_int64 (stmt, 7);
+    item->device_id = g_strdup ((const char *)sqlite3_column_text (stmt, 8));
+    g_ptr_array_add (items, item);
+  }
+
+  sqlite3_finalize (stmt);
+
+  g_task_return_pointer (task, g_steal_pointer (&items), (GDestroyNotify)g_ptr_array_unref);
+}
+
+static void
+history_update_sms_queue (ChattyHistory *self,
+                          GTask         *task)
+{
+  sqlite3_stmt *stmt;
+  gint64 *next_attempt;
+  int id, attempts, status;
+
+  g_assert (CHATTY_IS_HISTORY (self));
+  g_assert (G_IS_TASK (task));
+  g_assert (g_thread_self () == self->worker_thread);
+
+  if (!self->db) {
+    g_task_return_new_error (task,
+                             G_IO_ERROR, G_IO_ERROR_FAILED,
+                             "Database not opened");
+    return;
+  }
+
+  id = GPOINTER_TO_INT (g_object_get_data (G_OBJECT (task), "id"));
+  attempts = GPOINTER_TO_INT (g_object_get_data (G_OBJECT (task), "attempts"));
+  next_attempt = g_object_get_data (G_OBJECT (task), "next-attempt");
+
+  /* A negative count of attempts removes the item */
+  if (attempts < 0) {
+    sqlite3_prepare_v2 (self->db, "DELETE FROM sms_queue WHERE id=?;",
+                        -1, &stmt, NULL);
+    history_bind_int (stmt, 1, id, "binding when removing from sms queue");
+  } else {
+    sqlite3_prepare_v2 (self->db,
+                        "UPDATE sms_queue SET attempts=?2,next_attempt=?3 "
+                        "WHERE id=?1;",
+                        -1, &stmt, NULL);
+    history_bind_int (stmt, 1, id, "binding when updating sms queue");
+    history_bind_int (stmt, 2, attempts, "binding when updating sms queue");
+    history_bind_int (stmt, 3, *next_attempt, "binding when updating sms queue");
+  }
+
+  status = sqlite3_step (stmt);
+  sqlite3_finalize (stmt);
+
+  if (status == SQLITE_DONE)
+    g_task_return_boolean (task, TRUE);
+  else
+    g_task_return_new_error (task,
+                             G_IO_ERROR, G_IO_ERROR_FAILED,
+                             "Failed to update sms queue. errno: %d, desc: %s",
+                             status, sqlite3_errmsg (self->db));
+}
+
+static void
+history_load_account (ChattyHistory *self,
+                      GTask         *task)
+{
+  ChattyAccount *account;
+  sqlite3_stmt *stmt;
+  const char *user_name;
+  int status;
+
+  g_assert (CHATTY_IS_HISTORY (self));
+  g_assert (G_IS_TASK (task));
+  g_assert (g_thread_self () == self->worker_thread);
+
+  if (!self->db) {
+    g_task_return_new_error (task,
+                             G_IO_ERROR, G_IO_ERROR_FAILED,
+                             "Database not opened");
+    return;
+  }
+
+  account = g_object_get_data (G_OBJECT (task), "account");
+  g_assert (CHATTY_IS_ACCOUNT (account));
+
+  user_name = chatty_item_get_username (CHATTY_ITEM (account));
+
+  if (!user_name || !*user_name) {
+    g_task_return_new_error (task,
+                             G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                             "Username name is empty");
+    return;
+  }
+
+  sqlite3_prepare_v2 (self->db, "SELECT users.alias,files.url,files.path FROM users "
+                      "LEFT JOIN files ON files.id=users.avatar_id "
+                      "WHERE users.username=? LIMIT 1;", -1, &stmt, NULL);
+  history_bind_text (stmt, 1, user_name, "binding when getting user details");
+
+  if (sqlite3_step (stmt) == SQLITE_ROW) {
+    const char *name, *avatar_url, *avatar_path;
+    GObject *object;
+
+    name = (char *)sqlite3_column_text (stmt, 0);
+    avatar_url = (char *)sqlite3_column_text (stmt, 1);
+    avatar_path = (char *)sqlite3_column_text (stmt, 2);
+
+    object = G_OBJECT (task);
+    g_object_set_data_full (object, "name", g_strdup (name), g_free);
+    g_object_set_data_full (object, "avatar-url", g_strdup (avatar_url), g_free);
+    g_object_set_data_full (object, "avatar-path", g_strdup (avatar_path), g_free);
+  }
+
+  status = sqlite3_finalize (stmt);
+  warn_if_sql_error (status, "finalizing when getting user details");
+
+  g_task_return_boolean (task, TRUE);
+}
+
+static void
+history_set_last_read_msg (ChattyHistory *self,
+                           GTask         *task)
+{
+  ChattyMessage *message;
+  sqlite3_stmt *stmt;
+  ChattyChat *chat;
+  const char *uid = NULL;
+  int thread_id, message_id = 0;
+
+  g_assert (CHATTY_IS_HISTORY (self));
+  g_assert (G_IS_TASK (task));
+  g_assert (g_thread_self () == self->worker_thread);
 
   if (!self->db) {
     g_task_return_new_error (task,
@@ -3164,6 +3770,24 @@ history_exists (ChattyHistory *self,
   g_task_return_boolean (task, found);
 }
 
+/*
+ * history_queue_task:
+ * @task: (transfer full)
+ * @urgent: Whether to run @task before the queued ones
+ */
+static void
+history_queue_task (ChattyHistory *self,
+                    GTask         *task,
+                    gboolean       urgent)
+{
+  CHATTY_MARK_INSTANT ("history-enqueue", "task %p: %s", task, g_task_get_name (task));
+
+  if (urgent)
+    g_async_queue_push_front (self->queue, task);
+  else
+    g_async_queue_push (self->queue, task);
+}
+
 static gpointer
 chatty_history_worker (gpointer user_data)
 {
@@ -3174,10 +3798,20 @@ chatty_history_worker (gpointer user_data)
   do {
     ChattyCallback callback;
     g_autoptr(GTask) task = g_async_queue_pop (self->queue);
+    gint64 begin_time, mark_time;
 
     g_assert (task);
+    /* Including the task popped */
+    chatty_stats_record (CHATTY_STAT_HISTORY_QUEUE_DEPTH,
+                         g_async_queue_length (self->queue) + 1);
     callback = g_task_get_task_data (task);
+    begin_time = g_get_monotonic_time ();
+    mark_time = CHATTY_MARK_NOW ();
+    self->current_task = task;
     callback (self, task);
+    self->current_task = NULL;
+    chatty_stats_record_since (CHATTY_STAT_HISTORY_TASK, begin_time);
+    CHATTY_MARK (mark_time, "history-task", "task %p: %s", task, g_task_get_name (task));
 
     if (callback == history_close_db)
       break;
@@ -3284,7 +3918,7 @@ chatty_history_open_async (ChattyHistory       *self,
   g_object_set_data_full (G_OBJECT (task), "file-name", g_strdup (file_name), g_free);
   g_object_set_data_full (G_OBJECT (task), "country-code", g_strdup (country), g_free);
 
-  g_async_queue_push (self->queue, g_steal_pointer (&task));
+  history_queue_task (self, g_steal_pointer (&task), FALSE);
 }
 
 /**
@@ -3359,7 +3993,7 @@ chatty_history_close_async (ChattyHistory       *self,
   g_task_set_source_tag (task, chatty_history_close_async);
   g_task_set_task_data (task, history_close_db, NULL);
 
-  g_async_queue_push (self->queue, g_steal_pointer (&task));
+  history_queue_task (self, g_steal_pointer (&task), FALSE);
 }
 
 /**
@@ -3427,7 +4061,7 @@ chatty_history_get_messages_async  (ChattyHistory       *self,
   g_object_set_data_full (G_OBJECT (task), "message", start, g_object_unref);
   g_object_set_data (G_OBJECT (task), "limit", GINT_TO_POINTER (limit));
 
-  g_async_queue_push (self->queue, g_steal_pointer (&task));
+  history_queue_task (self, g_steal_pointer (&task), FALSE);
 }
 
 /**
@@ -3471,7 +4105,7 @@ chatty_history_get_draft_async (ChattyHistory       *self,
   g_task_set_task_data (task, history_get_chat_draft_message, NULL);
   g_object_set_data_full (G_OBJECT (task), "chat", g_object_ref (chat), g_object_unref);
 
-  g_async_queue_push_front (self->queue, g_steal_pointer (&task));
+  history_queue_task (self, g_steal_pointer (&task), TRUE);
 }
 
 char *
@@ -3515,7 +4149,7 @@ chatty_history_add_message_async (ChattyHistory       *self,
   g_object_set_data_full (G_OBJECT (task), "chat", g_object_ref (chat), g_object_unref);
   g_object_set_data_full (G_OBJECT (task), "message", g_object_ref (message), g_object_unref);
 
-  g_async_queue_push (self->queue, g_steal_pointer (&task));
+  history_queue_task (self, g_steal_pointer (&task), FALSE);
 }
 
 /**
@@ -3541,6 +4175,55 @@ chatty_history_add_message_finish  (ChattyHistory  *self,
   return g_task_propagate_boolean (G_TASK (result), error);
 }
 
+/**
+ * chatty_history_add_messages_async:
+ * @self: a #ChattyHistory
+ * @chats: A #GPtrArray of #ChattyChat
+ * @messages: A #GPtrArray of #ChattyMessage
+ * @callback: a #GAsyncReadyCallback, or %NULL
+ * @user_data: closure data for @callback
+ *
+ * Store every message in @messages to database in a
+ * single transaction, the nth message belonging to
+ * the nth chat in @chats.  If any of them fails, none
+ * of the messages are stored.
+ */
+void
+chatty_history_add_messages_async (ChattyHistory       *self,
+                                   GPtrArray           *chats,
+                                   GPtrArray           *messages,
+                                   GAsyncReadyCallback  callback,
+                                   gpointer             user_data)
+{
+  g_autoptr (GTask) task = NULL;
+
+  g_return_if_fail (CHATTY_IS_HISTORY (self));
+  g_return_if_fail (chats && messages);
+  g_return_if_fail (chats->len == messages->len);
+
+  task = g_task_new (self, NULL, callback, user_data);
+  g_task_set_source_tag (task, chatty_history_add_messages_async);
+  g_task_set_task_data (task, history_add_messages, NULL);
+  g_object_set_data_full (G_OBJECT (task), "chats", g_ptr_array_ref (chats),
+                          (GDestroyNotify)g_ptr_array_unref);
+  g_object_set_data_full (G_OBJECT (task), "messages", g_ptr_array_ref (messages),
+                          (GDestroyNotify)g_ptr_array_unref);
+
+  history_queue_task (self, g_steal_pointer (&task), FALSE);
+}
+
+gboolean
+chatty_history_add_messages_finish (ChattyHistory  *self,
+                                    GAsyncResult   *result,
+                                    GError        **error)
+{
+  g_return_val_if_fail (CHATTY_IS_HISTORY (self), FALSE);
+  g_return_val_if_fail (G_IS_TASK (result), FALSE);
+  g_return_val_if_fail (!error || !*error, FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
+
 void
 chatty_history_get_chats_async (ChattyHistory       *self,
                                 ChattyAccount       *account,
@@ -3563,7 +4246,7 @@ chatty_history_get_chats_async (ChattyHistory       *self,
   g_task_set_task_data (task, history_get_chats, NULL);
   g_object_set_data_full (G_OBJECT (task), "account", g_object_ref (account), g_object_unref);
 
-  g_async_queue_push (self->queue, g_steal_pointer (&task));
+  history_queue_task (self, g_steal_pointer (&task), FALSE);
 }
 
 GPtrArray *
@@ -3594,7 +4277,7 @@ chatty_history_update_chat (ChattyHistory *self,
   g_task_set_task_data (task, history_update_chat, NULL);
   g_object_set_data_full (G_OBJECT (task), "chat", g_object_ref (chat), g_object_unref);
 
-  g_async_queue_push (self->queue, g_object_ref (task));
+  history_queue_task (self, g_object_ref (task), FALSE);
 
   history_db_wait_for_completion (task);
 
@@ -3622,7 +4305,7 @@ chatty_history_update_user (ChattyHistory *self,
   g_task_set_task_data (task, history_update_user, NULL);
   g_object_set_data_full (G_OBJECT (task), "account", g_object_ref (account), g_object_unref);
 
-  g_async_queue_push (self->queue, g_object_ref (task));
+  history_queue_task (self, g_object_ref (task), FALSE);
 
   history_db_wait_for_completion (task);
 
@@ -3661,7 +4344,7 @@ chatty_history_delete_chat_async (ChattyHistory       *self,
   g_task_set_task_data (task, history_delete_chat, NULL);
   g_object_set_data_full (G_OBJECT (task), "chat", g_object_ref (chat), g_object_unref);
 
-  g_async_queue_push (self->queue, g_steal_pointer (&task));
+  history_queue_task (self, g_steal_pointer (&task), FALSE);
 }
 
 /**
@@ -3687,6 +4370,145 @@ chatty_history_delete_chat_finish (ChattyHistory  *self,
   return g_task_propagate_boolean (G_TASK (result), error);
 }
 
+/**
+ * chatty_history_add_media_async:
+ * @self: a #ChattyHistory
+ * @checksum: The sha256 checksum of the file content
+ * @path: The path of the file relative to the data directory
+ * @url: (nullable): The url the file was fetched from
+ * @size: The size of the file in bytes
+ * @evictable: Whether the file can be fetched again
+ * @max_size: The size budget of evictable media in bytes,
+ *   or 0 for no limit
+ * @callback: a #GAsyncReadyCallback, or %NULL
+ * @user_data: closure data for @callback
+ *
+ * Record the media file @path in the media cache and
+ * evict least recently used files until the evictable
+ * files fit in @max_size.  Files that aren't @evictable
+ * are never evicted and don't count against @max_size.
+ * If @url is set, the file can be found later with
+ * chatty_history_lookup_media_async().  The caller is
+ * responsible for deleting the evicted files from disk.
+ * Finish with chatty_history_add_media_finish()
+ */
+void
+chatty_history_add_media_async (ChattyHistory       *self,
+                                const char          *checksum,
+                                const char          *path,
+                                const char          *url,
+                                goffset              size,
+                                gboolean             evictable,
+                                goffset              max_size,
+                                GAsyncReadyCallback  callback,
+                                gpointer             user_data)
+{
+  g_autoptr (GTask) task = NULL;
+
+  g_return_if_fail (CHATTY_IS_HISTORY (self));
+  g_return_if_fail (checksum && *checksum);
+  g_return_if_fail (path && *path);
+
+  task = g_task_new (self, NULL, callback, user_data);
+  g_task_set_source_tag (task, chatty_history_add_media_async);
+  g_task_set_task_data (task, history_add_media, NULL);
+  g_object_set_data_full (G_OBJECT (task), "checksum", g_strdup (checksum), g_free);
+  g_object_set_data_full (G_OBJECT (task), "path", g_strdup (path), g_free);
+  g_object_set_data_full (G_OBJECT (task), "url", g_strdup (url), g_free);
+  g_object_set_data_full (G_OBJECT (task), "size",
+                          g_memdup2 (&(gint64){size}, sizeof (gint64)), g_free);
+  g_object_set_data_full (G_OBJECT (task), "max-size",
+                          g_memdup2 (&(gint64){max_size}, sizeof (gint64)), g_free);
+  g_object_set_data (G_OBJECT (task), "evictable", GINT_TO_POINTER (evictable));
+
+  history_queue_task (self, g_steal_pointer (&task), FALSE);
+}
+
+/**
+ * chatty_history_add_media_finish:
+ * @self: a #ChattyHistory
+ * @result: a #GAsyncResult provided to callback
+ * @cache_path: (out) (optional): The path the content is cached at
+ * @error: a location for a #GError or %NULL
+ *
+ * Completes chatty_history_add_media_async() call.
+ * @cache_path differs from the path added if the same
+ * content was already in the cache.
+ *
+ * Returns: (transfer full): A #GPtrArray of paths of
+ * evicted files relative to the data directory, or
+ * %NULL with @error set.
+ */
+GPtrArray *
+chatty_history_add_media_finish (ChattyHistory  *self,
+                                 GAsyncResult   *result,
+                                 char          **cache_path,
+                                 GError        **error)
+{
+  g_return_val_if_fail (CHATTY_IS_HISTORY (self), NULL);
+  g_return_val_if_fail (G_IS_TASK (result), NULL);
+  g_return_val_if_fail (!error || !*error, NULL);
+
+  if (cache_path)
+    *cache_path = g_strdup (g_object_get_data (G_OBJECT (result), "cache-path"));
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+/**
+ * chatty_history_lookup_media_async:
+ * @self: a #ChattyHistory
+ * @url: The url a media file was fetched from
+ * @callback: a #GAsyncReadyCallback, or %NULL
+ * @user_data: closure data for @callback
+ *
+ * Find the cached media file fetched from @url, and
+ * mark it as recently used.  Finish with
+ * chatty_history_lookup_media_finish()
+ */
+void
+chatty_history_lookup_media_async (ChattyHistory       *self,
+                                   const char          *url,
+                                   GAsyncReadyCallback  callback,
+                                   gpointer             user_data)
+{
+  g_autoptr (GTask) task = NULL;
+
+  g_return_if_fail (CHATTY_IS_HISTORY (self));
+  g_return_if_fail (url && *url);
+
+  task = g_task_new (self, NULL, callback, user_data);
+  g_task_set_source_tag (task, chatty_history_lookup_media_async);
+  g_task_set_task_data (task, history_lookup_media, NULL);
+  g_object_set_data_full (G_OBJECT (task), "url", g_strdup (url), g_free);
+
+  history_queue_task (self, g_steal_pointer (&task), FALSE);
+}
+
+/**
+ * chatty_history_lookup_media_finish:
+ * @self: a #ChattyHistory
+ * @result: a #GAsyncResult provided to callback
+ * @error: a location for a #GError or %NULL
+ *
+ * Completes chatty_history_lookup_media_async() call.
+ *
+ * Returns: (transfer full) (nullable): The path of the
+ * file relative to the data directory, or %NULL if
+ * the file isn't cached or on error.
+ */
+char *
+chatty_history_lookup_media_finish (ChattyHistory  *self,
+                                    GAsyncResult   *result,
+                                    GError        **error)
+{
+  g_return_val_if_fail (CHATTY_IS_HISTORY (self), NULL);
+  g_return_val_if_fail (G_IS_TASK (result), NULL);
+  g_return_val_if_fail (!error || !*error, NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
 void
 chatty_history_load_account_async (ChattyHistory       *self,
                                    ChattyAccount       *account,
@@ -3704,7 +4526,7 @@ chatty_history_load_account_async (ChattyHistory       *self,
   g_task_set_task_data (task, history_load_account, NULL);
   g_object_set_data_full (G_OBJECT (task), "account", g_object_ref (account), g_object_unref);
 
-  g_async_queue_push (self->queue, g_steal_pointer (&task));
+  history_queue_task (self, g_steal_pointer (&task), FALSE);
 }
 
 gboolean
@@ -3719,6 +4541,189 @@ chatty_history_load_account_finish (ChattyHistory  *self,
   return g_task_propagate_boolean (G_TASK (result), error);
 }
 
+/**
+ * chatty_history_queue_sms_async:
+ * @self: a #ChattyHistory
+ * @chat: the #ChattyChat @message belongs to
+ * @message: A #ChattyMessage to send
+ * @number: The number to send @message to
+ * @device_id: (nullable): The equipment identifier of
+ *   the modem to send @message with
+ * @callback: a #GAsyncReadyCallback
+ * @user_data: closure data for @callback
+ *
+ * Store @message to database and add it to the queue
+ * of SMS to send to @number, so that it's sent even if
+ * chatty is restarted before that.
+ */
+void
+chatty_history_queue_sms_async (ChattyHistory       *self,
+                                ChattyChat          *chat,
+                                ChattyMessage       *message,
+                                const char          *number,
+                                const char          *device_id,
+                                GAsyncReadyCallback  callback,
+                                gpointer             user_data)
+{
+  g_autoptr (GTask) task = NULL;
+
+  g_return_if_fail (CHATTY_IS_HISTORY (self));
+  g_return_if_fail (CHATTY_IS_CHAT (chat));
+  g_return_if_fail (CHATTY_IS_MESSAGE (message));
+  g_return_if_fail (number && *number);
+
+  task = g_task_new (self, NULL, callback, user_data);
+  g_task_set_source_tag (task, chatty_history_queue_sms_async);
+  g_task_set_task_data (task, history_queue_sms, NULL);
+  g_object_set_data_full (G_OBJECT (task), "chat", g_object_ref (chat), g_object_unref);
+  g_object_set_data_full (G_OBJECT (task), "message", g_object_ref (message), g_object_unref);
+  g_object_set_data_full (G_OBJECT (task), "number", g_strdup (number), g_free);
+  g_object_set_data_full (G_OBJECT (task), "device-id", g_strdup (device_id), g_free);
+
+  history_queue_task (self, g_steal_pointer (&task), FALSE);
+}
+
+/**
+ * chatty_history_queue_sms_finish:
+ * @self: a #ChattyHistory
+ * @result: a #GAsyncResult provided to callback
+ * @error: a location for a #GError or %NULL
+ *
+ * Completes chatty_history_queue_sms_async() call.
+ *
+ * Returns: The id of the queued item, or 0 with
+ * @error set.
+ */
+int
+chatty_history_queue_sms_finish (ChattyHistory  *self,
+                                 GAsyncResult   *result,
+                                 GError        **error)
+{
+  gssize id;
+
+  g_return_val_if_fail (CHATTY_IS_HISTORY (self), 0);
+  g_return_val_if_fail (G_IS_TASK (result), 0);
+  g_return_val_if_fail (!error || !*error, 0);
+
+  id = g_task_propagate_int (G_TASK (result), error);
+
+  return MAX (id, 0);
+}
+
+void
+chatty_history_get_sms_queue_async (ChattyHistory       *self,
+                                    GAsyncReadyCallback  callback,
+                                    gpointer             user_data)
+{
+  g_autoptr (GTask) task = NULL;
+
+  g_return_if_fail (CHATTY_IS_HISTORY (self));
+  g_return_if_fail (callback);
+
+  task = g_task_new (self, NULL, callback, user_data);
+  g_task_set_source_tag (task, chatty_history_get_sms_queue_async);
+  g_task_set_task_data (task, history_get_sms_queue, NULL);
+
+  history_queue_task (self, g_steal_pointer (&task), FALSE);
+}
+
+/**
+ * chatty_history_get_sms_queue_finish:
+ * @self: a #ChattyHistory
+ * @result: a #GAsyncResult provided to callback
+ * @error: a location for a #GError or %NULL
+ *
+ * Completes chatty_history_get_sms_queue_async() call.
+ *
+ * Returns: (transfer full): A #GPtrArray of
+ * #ChattySmsQueueItem in the order they were queued,
+ * or %NULL with @error set.
+ */
+GPtrArray *
+chatty_history_get_sms_queue_finish (ChattyHistory  *self,
+                                     GAsyncResult   *result,
+                                     GError        **error)
+{
+  g_return_val_if_fail (CHATTY_IS_HISTORY (self), NULL);
+  g_return_val_if_fail (G_IS_TASK (result), NULL);
+  g_return_val_if_fail (!error || !*error, NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+static void
+history_push_sms_queue_update (ChattyHistory *self,
+                               int            id,
+                               int            attempts,
+                               gint64         next_attempt)
+{
+  g_autoptr (GTask) task = NULL;
+
+  task = g_task_new (self, NULL, NULL, NULL);
+  g_task_set_task_data (task, history_update_sms_queue, NULL);
+  g_object_set_data (G_OBJECT (task), "id", GINT_TO_POINTER (id));
+  g_object_set_data (G_OBJECT (task), "attempts", GINT_TO_POINTER (attempts));
+  g_object_set_data_full (G_OBJECT (task), "next-attempt",
+                          g_memdup2 (&next_attempt, sizeof (gint64)), g_free);
+
+  history_queue_task (self, g_steal_pointer (&task), FALSE);
+}
+
+/**
+ * chatty_history_update_sms_queue:
+ * @self: a #ChattyHistory
+ * @id: The id of a queued SMS
+ * @attempts: The number of failed attempts to send
+ * @next_attempt: The unix time to try again after
+ *
+ * Store the retry state of the queued SMS @id.
+ * This doesn't wait for the database to be updated.
+ */
+void
+chatty_history_update_sms_queue (ChattyHistory *self,
+                                 int            id,
+                                 int            attempts,
+                                 gint64         next_attempt)
+{
+  g_return_if_fail (CHATTY_IS_HISTORY (self));
+  g_return_if_fail (id > 0);
+  g_return_if_fail (attempts >= 0);
+
+  history_push_sms_queue_update (self, id, attempts, next_attempt);
+}
+
+/**
+ * chatty_history_remove_queued_sms:
+ * @self: a #ChattyHistory
+ * @id: The id of a queued SMS
+ *
+ * Remove SMS @id from the queue once it's sent or
+ * given up on.  This doesn't wait for the database
+ * to be updated.
+ */
+void
+chatty_history_remove_queued_sms (ChattyHistory *self,
+                                  int            id)
+{
+  g_return_if_fail (CHATTY_IS_HISTORY (self));
+  g_return_if_fail (id > 0);
+
+  history_push_sms_queue_update (self, id, -1, 0);
+}
+
+void
+chatty_sms_queue_item_free (ChattySmsQueueItem *item)
+{
+  if (!item)
+    return;
+
+  g_free (item->chat_name);
+  g_free (item->number);
+  g_free (item->device_id);
+  g_clear_object (&item->message);
+  g_free (item);
+}
+
 void
 chatty_history_set_last_read_msg (ChattyHistory *self,
                                   ChattyChat    *chat,
@@ -3739,7 +4744,7 @@ chatty_history_set_last_read_msg (ChattyHistory *self,
   g_object_set_data_full (G_OBJECT (task), "chat", g_object_ref (chat), g_object_unref);
   g_object_set_data_full (G_OBJECT (task), "message", message, g_object_unref);
 
-  g_async_queue_push (self->queue, g_object_ref (task));
+  history_queue_task (self, g_object_ref (task), FALSE);
 
   history_db_wait_for_completion (task);
 }
@@ -3842,7 +4847,7 @@ chatty_history_get_chat_timestamp (ChattyHistory *self,
   g_object_set_data_full (G_OBJECT (task), "uuid", g_strdup (uuid), g_free);
   g_object_set_data_full (G_OBJECT (task), "room", g_strdup (room), g_free);
 
-  g_async_queue_push (self->queue, g_object_ref (task));
+  history_queue_task (self, g_object_ref (task), FALSE);
 
   history_db_wait_for_completion (task);
 
@@ -3890,7 +4895,7 @@ chatty_history_get_im_timestamp (ChattyHistory *self,
   g_object_set_data_full (G_OBJECT (task), "uuid", g_strdup (uuid), g_free);
   g_object_set_data_full (G_OBJECT (task), "account", g_strdup (account), g_free);
 
-  g_async_queue_push (self->queue, g_object_ref (task));
+  history_queue_task (self, g_object_ref (task), FALSE);
 
   history_db_wait_for_completion (task);
 
@@ -3938,7 +4943,7 @@ chatty_history_get_last_message_time (ChattyHistory *self,
   g_object_set_data_full (G_OBJECT (task), "account", g_strdup (account), g_free);
   g_object_set_data_full (G_OBJECT (task), "room", g_strdup (room), g_free);
 
-  g_async_queue_push (self->queue, g_object_ref (task));
+  history_queue_task (self, g_object_ref (task), FALSE);
 
   history_db_wait_for_completion (task);
 
@@ -3992,7 +4997,7 @@ chatty_history_exists (ChattyHistory *self,
   g_object_set_data_full (G_OBJECT (task), "room", g_strdup (room), g_free);
   g_object_set_data_full (G_OBJECT (task), "who", g_strdup (who), g_free);
 
-  g_async_queue_push (self->queue, g_object_ref (task));
+  history_queue_task (self, g_object_ref (task), FALSE);
 
   history_db_wait_for_completion (task);
 
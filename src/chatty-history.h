@@ -21,6 +21,20 @@ G_BEGIN_DECLS
 
 G_DECLARE_FINAL_TYPE (ChattyHistory, chatty_history, CHATTY, HISTORY, GObject)
 
+typedef struct _ChattySmsQueueItem {
+  int            id;
+  /* The name of the chat the message belongs to */
+  char          *chat_name;
+  char          *number;
+  /* The equipment identifier of the modem to send with, or %NULL */
+  char          *device_id;
+  ChattyMessage *message;
+  int            attempts;
+  gint64         next_attempt;
+} ChattySmsQueueItem;
+
+void           chatty_sms_queue_item_free         (ChattySmsQueueItem   *item);
+
 ChattyHistory *chatty_history_new                 (void);
 void           chatty_history_open_async          (ChattyHistory        *self,
                                                    char                 *dir,
@@ -61,6 +75,14 @@ void           chatty_history_add_message_async   (ChattyHistory        *self,
 gboolean       chatty_history_add_message_finish  (ChattyHistory        *self,
                                                    GAsyncResult         *result,
                                                    GError              **error);
+void           chatty_history_add_messages_async  (ChattyHistory        *self,
+                                                   GPtrArray            *chats,
+                                                   GPtrArray            *messages,
+                                                   GAsyncReadyCallback   callback,
+                                                   gpointer              user_data);
+gboolean       chatty_history_add_messages_finish (ChattyHistory        *self,
+                                                   GAsyncResult         *result,
+                                                   GError              **error);
 void           chatty_history_get_chats_async     (ChattyHistory       *self,
                                                    ChattyAccount       *account,
                                                    GAsyncReadyCallback  callback,
@@ -79,6 +101,26 @@ void           chatty_history_delete_chat_async   (ChattyHistory        *self,
 gboolean       chatty_history_delete_chat_finish  (ChattyHistory        *self,
                                                    GAsyncResult         *result,
                                                    GError              **error);
+void           chatty_history_add_media_async     (ChattyHistory        *self,
+                                                   const char           *checksum,
+                                                   const char           *path,
+                                                   const char           *url,
+                                                   goffset               size,
+                                                   gboolean              evictable,
+                                                   goffset               max_size,
+                                                   GAsyncReadyCallback   callback,
+                                                   gpointer              user_data);
+GPtrArray     *chatty_history_add_media_finish    (ChattyHistory        *self,
+                                                   GAsyncResult         *result,
+                                                   char                **cache_path,
+                                                   GError              **error);
+void           chatty_history_lookup_media_async  (ChattyHistory        *self,
+                                                   const char           *url,
+                                                   GAsyncReadyCallback   callback,
+                                                   gpointer              user_data);
+char          *chatty_history_lookup_media_finish (ChattyHistory        *self,
+                                                   GAsyncResult         *result,
+                                                   GError              **error);
 void           chatty_history_load_account_async  (ChattyHistory       *self,
                                                    ChattyAccount       *account,
                                                    GAsyncReadyCallback  callback,
@@ -89,6 +131,28 @@ gboolean       chatty_history_load_account_finish (ChattyHistory        *self,
 void           chatty_history_set_last_read_msg   (ChattyHistory        *self,
                                                    ChattyChat           *chat,
                                                    ChattyMessage        *message);
+void           chatty_history_queue_sms_async     (ChattyHistory        *self,
+                                                   ChattyChat           *chat,
+                                                   ChattyMessage        *message,
+                                                   const char           *number,
+                                                   const char           *device_id,
+                                                   GAsyncReadyCallback   callback,
+                                                   gpointer              user_data);
+int            chatty_history_queue_sms_finish    (ChattyHistory        *self,
+                                                   GAsyncResult         *result,
+                                                   GError              **error);
+void           chatty_history_get_sms_queue_async (ChattyHistory        *self,
+                                                   GAsyncReadyCallback   callback,
+                                                   gpointer              user_data);
+GPtrArray     *chatty_history_get_sms_queue_finish (ChattyHistory       *self,
+                                                    GAsyncResult        *result,
+                                                    GError             **error);
+void           chatty_history_update_sms_queue    (ChattyHistory        *self,
+                                                   int                   id,
+                                                   int                   attempts,
+                                                   gint64                next_attempt);
+void           chatty_history_remove_queued_sms   (ChattyHistory        *self,
+                                                   int                   id);
 
 /* old APIs */
 void           chatty_history_open                (ChattyHistory         *self,
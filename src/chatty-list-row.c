@@ -46,7 +46,10 @@ struct _ChattyListRow
   GtkPopover    *popover;
   ChattyItem    *item;
   gboolean       hide_chat_details;
-  gulong         clock_id;
+  guint          clock_watch_id;
+  time_t         watch_time;
+  /* The time label changed while the row wasn't mapped */
+  gboolean       time_dirty;
 };
 
 G_DEFINE_TYPE (ChattyListRow, chatty_list_row, GTK_TYPE_LIST_BOX_ROW)
@@ -61,34 +64,44 @@ chatty_list_row_item_is_valid (ChattyItem *item)
     CHATTY_IS_CHAT (item);
 }
 
-static const char *
-list_row_get_clock_signal (time_t time_stamp)
+static void chatty_list_row_update_last_modified (ChattyListRow *self);
+
+static void
+list_row_clock_changed_cb (gpointer user_data)
 {
-  double diff;
+  ChattyListRow *self = user_data;
 
-  diff = difftime (time (NULL), time_stamp);
+  g_assert (CHATTY_IS_LIST_ROW (self));
 
-  if (diff >= - SECONDS_PER_MINUTE &&
-      diff < SECONDS_PER_WEEK)
-    return g_intern_static_string ("day-changed");
+  /* The row may have been reused for an item that isn't a chat */
+  if (!CHATTY_IS_CHAT (self->item)) {
+    chatty_clock_remove_watch (chatty_clock_get_default (), self->clock_watch_id);
+    self->clock_watch_id = 0;
+    return;
+  }
 
-  return NULL;
+  /* Relabel rows scrolled out of view only when they are shown again */
+  if (gtk_widget_get_mapped (GTK_WIDGET (self)))
+    chatty_list_row_update_last_modified (self);
+  else
+    self->time_dirty = TRUE;
 }
 
-static gboolean
+static void
 chatty_list_row_update_last_modified (ChattyListRow *self)
 {
   ChattyChat *item;
   g_autofree char *str = NULL;
-  const char *time_signal;
   time_t last_message_time;
 
+  self->time_dirty = FALSE;
   item = CHATTY_CHAT (self->item);
   last_message_time = chatty_chat_get_last_msg_time (item);
   if (!last_message_time) {
-    g_clear_signal_handler (&self->clock_id, chatty_clock_get_default ());
+    chatty_clock_remove_watch (chatty_clock_get_default (), self->clock_watch_id);
+    self->clock_watch_id = 0;
 
-    return G_SOURCE_REMOVE;
+    return;
   }
 
   str = chatty_clock_get_human_time (chatty_clock_get_default (),
@@ -96,20 +109,14 @@ chatty_list_row_update_last_modified (ChattyListRow *self)
   if (str)
     gtk_label_set_label (GTK_LABEL (self->last_modified), str);
 
-  time_signal = list_row_get_clock_signal (last_message_time);
-
-  if (time_signal != g_object_get_data (G_OBJECT (self), "time-signal")) {
-    g_clear_signal_handler (&self->clock_id, chatty_clock_get_default ());
-    g_object_set_data (G_OBJECT (self), "time-signal", (gpointer)time_signal);
-
-    if (time_signal)
-      self->clock_id = g_signal_connect_object (chatty_clock_get_default (), time_signal,
-                                                G_CALLBACK (chatty_list_row_update_last_modified),
-                                                self, G_CONNECT_SWAPPED);
-    return G_SOURCE_REMOVE;
+  if (!self->clock_watch_id || self->watch_time != last_message_time) {
+    chatty_clock_remove_watch (chatty_clock_get_default (), self->clock_watch_id);
+    self->watch_time = last_message_time;
+    self->clock_watch_id = chatty_clock_add_watch (chatty_clock_get_default (),
+                                                   last_message_time, FALSE,
+                                                   list_row_clock_changed_cb,
+                                                   self);
   }
-
-  return G_SOURCE_CONTINUE;
 }
 
 #ifdef PURPLE_ENABLED
@@ -399,11 +406,24 @@ chatty_list_row_call_button_clicked_cb (ChattyListRow *self)
   gtk_uri_launcher_launch (uri_launcher, window, NULL, NULL, NULL);
 }
 
+static void
+chatty_list_row_map (GtkWidget *widget)
+{
+  ChattyListRow *self = (ChattyListRow *)widget;
+
+  GTK_WIDGET_CLASS (chatty_list_row_parent_class)->map (widget);
+
+  if (self->time_dirty && CHATTY_IS_CHAT (self->item))
+    chatty_list_row_update_last_modified (self);
+}
+
 static void
 chatty_list_row_finalize (GObject *object)
 {
   ChattyListRow *self = (ChattyListRow *)object;
 
+  if (self->clock_watch_id)
+    chatty_clock_remove_watch (chatty_clock_get_default (), self->clock_watch_id);
   g_clear_object (&self->item);
 
   G_OBJECT_CLASS (chatty_list_row_parent_class)->finalize (object);
@@ -417,6 +437,8 @@ chatty_list_row_class_init (ChattyListRowClass *klass)
 
   object_class->finalize = chatty_list_row_finalize;
 
+  widget_class->map = chatty_list_row_map;
+
   gtk_widget_class_set_template_from_resource (widget_class,
                                                "/sm/puri/Chatty/"
                                                "ui/chatty-list-row.ui");
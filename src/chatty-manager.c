@@ -25,10 +25,13 @@
 #include "chatty-mm-account.h"
 #include "chatty-ma-account.h"
 #include "chatty-chat.h"
+#include "chatty-cached-chat.h"
 #include "chatty-history.h"
 #include "chatty-matrix.h"
 #include "chatty-purple.h"
 #include "chatty-manager.h"
+#include "chatty-profile.h"
+#include "chatty-stats.h"
 #include "chatty-log.h"
 
 /**
@@ -38,11 +41,19 @@
  * @include: "chatty-manager.h"
  */
 
+/* Number of chats saved in the chat list snapshot, enough to fill the screen */
+#define SNAPSHOT_MAX_CHATS 64
+/* Delay before saving the chat list snapshot after a change, in seconds */
+#define SNAPSHOT_SAVE_DELAY 10
+/* Time after all backends are loaded to drop chats that no longer exist, in seconds */
+#define SNAPSHOT_EXPIRE_TIMEOUT 30
+
 struct _ChattyManager
 {
   GObject          parent_instance;
 
   ChattyHistory   *history;
+  ChattyMediaCache *media_cache;
   ChattyEds       *chatty_eds;
 
   GtkFlattenListModel *accounts;
@@ -53,6 +64,14 @@ struct _ChattyManager
   GtkFilterListModel  *filtered_chat_list;
   GtkSortListModel    *sorted_chat_list;
 
+  /* Chats from the last run, shown until their backend is loaded */
+  GListStore          *cached_chats;
+  /* chatty_cached_chat_get_key() to ChattyCachedChat, unowned */
+  GHashTable          *cached_chat_table;
+  guint                reconcile_id;
+  guint                snapshot_save_id;
+  guint                snapshot_expire_id;
+
   ChattyMatrix    *matrix;
 #ifdef PURPLE_ENABLED
   ChattyPurple    *purple;
@@ -60,6 +79,10 @@ struct _ChattyManager
   /* We have exactly one MM account */
   ChattyMmAccount *mm_account;
 
+  /* Backends are brought up one per main loop iteration */
+  guint            load_id;
+  guint            load_phase;
+
   gboolean         disable_auto_login;
   gboolean         has_loaded;
 };
@@ -112,6 +135,10 @@ manager_filter_chat_item (ChattyItem *item)
   if (protocol & (CHATTY_PROTOCOL_MMS_SMS | CHATTY_PROTOCOL_MMS))
     return TRUE;
 
+  /* Shown until the backend is loaded, as they were last run */
+  if (CHATTY_IS_CACHED_CHAT (item))
+    return TRUE;
+
 #ifdef PURPLE_ENABLED
   if (CHATTY_IS_PP_CHAT (item) &&
       !chatty_pp_chat_get_auto_join (CHATTY_PP_CHAT (item)))
@@ -134,6 +161,120 @@ manager_filter_chat_item (ChattyItem *item)
   return TRUE;
 }
 
+static char *
+manager_get_snapshot_path (void)
+{
+  return g_build_filename (g_get_user_cache_dir (), "chatty", "chat-list-snapshot", NULL);
+}
+
+static gboolean
+manager_reconcile_snapshot_cb (gpointer user_data)
+{
+  ChattyManager *self = user_data;
+  g_autoptr(GPtrArray) loaded = NULL;
+  GListModel *chats;
+  guint n_items;
+
+  g_assert (CHATTY_IS_MANAGER (self));
+
+  self->reconcile_id = 0;
+  chats = G_LIST_MODEL (self->chat_list);
+  n_items = g_list_model_get_n_items (chats);
+  loaded = g_ptr_array_new ();
+
+  for (guint i = 0; i < n_items; i++) {
+    g_autoptr(ChattyChat) chat = NULL;
+    g_autofree char *key = NULL;
+    ChattyCachedChat *cached_chat;
+
+    chat = g_list_model_get_item (chats, i);
+
+    if (CHATTY_IS_CACHED_CHAT (chat))
+      continue;
+
+    key = chatty_cached_chat_get_key (chat);
+    cached_chat = g_hash_table_lookup (self->cached_chat_table, key);
+
+    if (cached_chat) {
+      g_hash_table_remove (self->cached_chat_table, key);
+      g_ptr_array_add (loaded, cached_chat);
+    }
+  }
+
+  /* Removed only now, as that changes the chat list */
+  for (guint i = 0; i < loaded->len; i++)
+    chatty_utils_remove_list_item (self->cached_chats, loaded->pdata[i]);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+manager_chat_list_changed_cb (ChattyManager *self,
+                              guint          position,
+                              guint          removed,
+                              guint          added)
+{
+  g_assert (CHATTY_IS_MANAGER (self));
+
+  if (added && !self->reconcile_id &&
+      g_hash_table_size (self->cached_chat_table))
+    self->reconcile_id = g_idle_add (manager_reconcile_snapshot_cb, self);
+}
+
+static gboolean
+manager_save_snapshot_cb (gpointer user_data)
+{
+  ChattyManager *self = user_data;
+
+  g_assert (CHATTY_IS_MANAGER (self));
+
+  self->snapshot_save_id = 0;
+  chatty_manager_save_chat_snapshot (self);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+manager_sorted_chat_list_changed_cb (ChattyManager *self,
+                                     guint          position,
+                                     guint          removed,
+                                     guint          added)
+{
+  g_assert (CHATTY_IS_MANAGER (self));
+
+  chatty_stats_record (CHATTY_STAT_CHAT_LIST_CHANGE, added);
+
+  if (!self->snapshot_save_id)
+    self->snapshot_save_id = g_timeout_add_seconds (SNAPSHOT_SAVE_DELAY,
+                                                    manager_save_snapshot_cb,
+                                                    self);
+}
+
+static int
+manager_chat_compare (ChattyChat *a,
+                      ChattyChat *b)
+{
+  chatty_stats_record (CHATTY_STAT_CHAT_COMPARE, 1);
+
+  return chatty_chat_compare (a, b);
+}
+
+static gboolean
+manager_expire_snapshot_cb (gpointer user_data)
+{
+  ChattyManager *self = user_data;
+
+  g_assert (CHATTY_IS_MANAGER (self));
+
+  self->snapshot_expire_id = 0;
+
+  /* What's left doesn't exist anymore */
+  g_hash_table_remove_all (self->cached_chat_table);
+  g_list_store_remove_all (self->cached_chats);
+
+  return G_SOURCE_REMOVE;
+}
+
 static void
 manager_active_protocols_changed_cb (ChattyManager *self)
 {
@@ -186,10 +327,21 @@ chatty_manager_dispose (GObject *object)
 {
   ChattyManager *self = (ChattyManager *)object;
 
+  g_clear_handle_id (&self->load_id, g_source_remove);
+  g_clear_handle_id (&self->reconcile_id, g_source_remove);
+  g_clear_handle_id (&self->snapshot_save_id, g_source_remove);
+  g_clear_handle_id (&self->snapshot_expire_id, g_source_remove);
+
+  /* SMS waiting to be sent hold the account */
+  if (self->mm_account)
+    g_object_run_dispose (G_OBJECT (self->mm_account));
+  g_clear_object (&self->mm_account);
   g_clear_object (&self->chatty_eds);
   g_clear_object (&self->chat_list);
   g_clear_object (&self->filtered_chat_list);
   g_clear_object (&self->sorted_chat_list);
+  g_clear_object (&self->cached_chats);
+  g_clear_pointer (&self->cached_chat_table, g_hash_table_unref);
 
   g_clear_object (&self->contact_list);
   g_clear_object (&self->accounts);
@@ -202,6 +354,7 @@ chatty_manager_finalize (GObject *object)
 {
   ChattyManager *self = (ChattyManager *)object;
 
+  g_clear_object (&self->media_cache);
   g_clear_object (&self->history);
   g_clear_object (&self->matrix);
 
@@ -280,7 +433,11 @@ manager_mm_account_changed_cb (ChattyManager *self)
 static void
 chatty_manager_init (ChattyManager *self)
 {
+  guint profile_id;
+
+  profile_id = chatty_profile_begin ("eds");
   self->chatty_eds = chatty_eds_new (CHATTY_PROTOCOL_MMS_SMS);
+  chatty_profile_end (profile_id);
   self->mm_account = chatty_mm_account_new ();
 
   g_signal_connect_object (self->mm_account, "notify::status",
@@ -294,34 +451,32 @@ chatty_manager_init (ChattyManager *self)
   self->accounts = manager_new_flatten_list (CHATTY_TYPE_ACCOUNT);
   self->contact_list = manager_new_flatten_list (G_TYPE_OBJECT);
   self->chat_list = manager_new_flatten_list (CHATTY_TYPE_CHAT);
+  self->cached_chats = g_list_store_new (CHATTY_TYPE_CHAT);
+  self->cached_chat_table = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  manager_add_to_flat_model (self->chat_list, G_LIST_MODEL (self->cached_chats));
+  g_signal_connect_object (self->chat_list, "items-changed",
+                           G_CALLBACK (manager_chat_list_changed_cb),
+                           self, G_CONNECT_SWAPPED);
   manager_add_to_flat_model (self->contact_list, chatty_eds_get_model (self->chatty_eds));
 
   self->chat_filter = gtk_custom_filter_new ((GtkCustomFilterFunc)manager_filter_chat_item, NULL, NULL);
   self->filtered_chat_list = gtk_filter_list_model_new (g_object_ref (G_LIST_MODEL (self->chat_list)),
                                                         g_object_ref (GTK_FILTER (self->chat_filter)));
   {
-    GtkMultiSorter *multi_sorter;
-    GtkNumericSorter *sorter;
-    GtkExpression *exp;
+    GtkCustomSorter *sorter;
     GListModel *chats;
 
-    multi_sorter = gtk_multi_sorter_new ();
-
-    /* The order if sorters added matters */
-    /* We need to sort by chat-state first and then the message time */
-    exp = gtk_property_expression_new (CHATTY_TYPE_CHAT, NULL, "chat-state");
-    sorter = gtk_numeric_sorter_new (exp);
-    gtk_multi_sorter_append (multi_sorter, GTK_SORTER (sorter));
-
-    exp = gtk_property_expression_new (CHATTY_TYPE_CHAT, NULL, "last-message-time");
-    sorter = gtk_numeric_sorter_new (exp);
-    gtk_numeric_sorter_set_sort_order (sorter, GTK_SORT_DESCENDING);
-    gtk_multi_sorter_append (multi_sorter, GTK_SORTER (sorter));
-
+    /* Compare cached keys directly instead of evaluating property
+     * expressions, which is expensive with thousands of chats */
+    sorter = gtk_custom_sorter_new ((GCompareDataFunc)manager_chat_compare, NULL, NULL);
     chats = g_object_ref (G_LIST_MODEL (self->filtered_chat_list));
-    self->sorted_chat_list = gtk_sort_list_model_new (chats, GTK_SORTER (multi_sorter));
+    self->sorted_chat_list = gtk_sort_list_model_new (chats, GTK_SORTER (sorter));
   }
 
+  g_signal_connect_object (self->sorted_chat_list, "items-changed",
+                           G_CALLBACK (manager_sorted_chat_list_changed_cb),
+                           self, G_CONNECT_SWAPPED);
+
   g_signal_connect_object (self, "notify::active-protocols",
                            G_CALLBACK (manager_active_protocols_changed_cb),
                            self, G_CONNECT_SWAPPED);
@@ -341,54 +496,200 @@ chatty_manager_get_default (void)
   return self;
 }
 
-void
-chatty_manager_load (ChattyManager *self)
+static void
+manager_mm_load_cb (GObject      *object,
+                    GAsyncResult *result,
+                    gpointer      user_data)
 {
-  g_autoptr(GListStore) accounts = NULL;
+  g_autoptr(GError) error = NULL;
 
-  g_return_if_fail (CHATTY_IS_MANAGER (self));
+  if (!chatty_mm_account_load_finish (CHATTY_MM_ACCOUNT (object), result, &error) &&
+      !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    g_warning ("Failed to load modem manager: %s", error->message);
 
-  if (self->has_loaded)
-    return;
-
-  self->has_loaded = TRUE;
+  chatty_profile_end (GPOINTER_TO_UINT (user_data));
+}
 
-#ifdef PURPLE_ENABLED
-  if (!self->purple) {
-    self->purple = chatty_purple_get_default ();
-    manager_add_to_flat_model (self->accounts,
-                               chatty_purple_get_accounts (self->purple));
-    manager_add_to_flat_model (self->chat_list,
-                               chatty_purple_get_chat_list (self->purple));
-    manager_add_to_flat_model (self->contact_list,
-                               chatty_purple_get_chat_list (self->purple));
-    manager_add_to_flat_model (self->contact_list,
-                               chatty_purple_get_user_list (self->purple));
-    chatty_purple_set_history_db (self->purple, self->history);
-    chatty_purple_load (self->purple, self->disable_auto_login);
-  }
-#endif
+static void
+manager_load_mm (ChattyManager *self)
+{
+  guint profile_id;
 
+  profile_id = chatty_profile_begin ("mm-load");
   chatty_mm_account_set_history_db (self->mm_account,
                                     chatty_manager_get_history (self));
   manager_add_to_flat_model (self->chat_list,
                              chatty_mm_account_get_chat_list (self->mm_account));
 
-  chatty_mm_account_load_async (self->mm_account, NULL, NULL);
+  chatty_mm_account_load_async (self->mm_account, manager_mm_load_cb,
+                                GUINT_TO_POINTER (profile_id));
+}
 
-  /* Matrix Setup */
+static void
+manager_load_matrix (ChattyManager *self)
+{
+  guint profile_id;
+
+  profile_id = chatty_profile_begin ("matrix-load");
   self->matrix = chatty_matrix_new (self->disable_auto_login);
   manager_add_to_flat_model (self->accounts,
                              chatty_matrix_get_account_list (self->matrix));
   manager_add_to_flat_model (self->chat_list,
                              chatty_matrix_get_chat_list (self->matrix));
   chatty_matrix_load (self->matrix);
+  chatty_profile_end (profile_id);
+}
+
+#ifdef PURPLE_ENABLED
+static void
+manager_load_purple (ChattyManager *self)
+{
+  guint profile_id;
+
+  if (self->purple)
+    return;
+
+  profile_id = chatty_profile_begin ("purple-load");
+  self->purple = chatty_purple_get_default ();
+  manager_add_to_flat_model (self->accounts,
+                             chatty_purple_get_accounts (self->purple));
+  manager_add_to_flat_model (self->chat_list,
+                             chatty_purple_get_chat_list (self->purple));
+  manager_add_to_flat_model (self->contact_list,
+                             chatty_purple_get_chat_list (self->purple));
+  manager_add_to_flat_model (self->contact_list,
+                             chatty_purple_get_user_list (self->purple));
+  chatty_purple_set_history_db (self->purple, self->history);
+  chatty_purple_load (self->purple, self->disable_auto_login);
+  chatty_profile_end (profile_id);
+}
+#endif
+
+static void
+manager_load_accounts (ChattyManager *self)
+{
+  g_autoptr(GListStore) accounts = NULL;
 
   accounts = g_list_store_new (CHATTY_TYPE_ACCOUNT);
   g_list_store_append (accounts, self->mm_account);
   manager_add_to_flat_model (self->accounts, G_LIST_MODEL (accounts));
 }
 
+static gboolean
+manager_load_next_cb (gpointer user_data)
+{
+  ChattyManager *self = user_data;
+  /* SMS first, as that's what most users on phones wait for */
+  static void (* const load_funcs[]) (ChattyManager *self) = {
+    manager_load_mm,
+    manager_load_matrix,
+#ifdef PURPLE_ENABLED
+    manager_load_purple,
+#endif
+    manager_load_accounts,
+  };
+
+  g_assert (CHATTY_IS_MANAGER (self));
+
+  load_funcs[self->load_phase++] (self);
+
+  if (self->load_phase < G_N_ELEMENTS (load_funcs))
+    return G_SOURCE_CONTINUE;
+
+  self->load_id = 0;
+
+  if (g_hash_table_size (self->cached_chat_table))
+    self->snapshot_expire_id = g_timeout_add_seconds (SNAPSHOT_EXPIRE_TIMEOUT,
+                                                      manager_expire_snapshot_cb,
+                                                      self);
+
+  return G_SOURCE_REMOVE;
+}
+
+/**
+ * chatty_manager_load:
+ * @self: A #ChattyManager
+ *
+ * Load all backends.  Each backend is brought up
+ * in a separate main loop iteration so that the
+ * window stays responsive while they load.
+ */
+void
+chatty_manager_load (ChattyManager *self)
+{
+  g_return_if_fail (CHATTY_IS_MANAGER (self));
+
+  if (self->has_loaded)
+    return;
+
+  self->has_loaded = TRUE;
+  self->load_id = g_idle_add (manager_load_next_cb, self);
+}
+
+/**
+ * chatty_manager_load_chat_snapshot:
+ * @self: A #ChattyManager
+ *
+ * Show the chats saved on the last run in the
+ * chat list, until their backends are loaded.
+ * This should be called before the window is
+ * shown, and before chatty_manager_load().
+ */
+void
+chatty_manager_load_chat_snapshot (ChattyManager *self)
+{
+  g_autoptr(GPtrArray) chats = NULL;
+  g_autofree char *path = NULL;
+  guint profile_id;
+
+  g_return_if_fail (CHATTY_IS_MANAGER (self));
+  g_return_if_fail (!self->has_loaded);
+
+  profile_id = chatty_profile_begin ("chat-snapshot");
+  path = manager_get_snapshot_path ();
+  chats = chatty_cached_chat_load_snapshot (path);
+
+  if (chats) {
+    for (guint i = 0; i < chats->len; i++)
+      g_hash_table_insert (self->cached_chat_table,
+                           chatty_cached_chat_get_key (chats->pdata[i]),
+                           chats->pdata[i]);
+
+    g_list_store_splice (self->cached_chats, 0, 0, chats->pdata, chats->len);
+  }
+
+  chatty_profile_end (profile_id);
+}
+
+/**
+ * chatty_manager_save_chat_snapshot:
+ * @self: A #ChattyManager
+ *
+ * Save the top of the chat list, so that it can be
+ * shown on the next run before backends are loaded.
+ * This is also done after the chat list changes.
+ */
+void
+chatty_manager_save_chat_snapshot (ChattyManager *self)
+{
+  g_autoptr(GError) error = NULL;
+  g_autofree char *path = NULL;
+
+  g_return_if_fail (CHATTY_IS_MANAGER (self));
+
+  g_clear_handle_id (&self->snapshot_save_id, g_source_remove);
+
+  /* Don't overwrite the snapshot with an empty list */
+  if (!self->has_loaded)
+    return;
+
+  path = manager_get_snapshot_path ();
+
+  if (!chatty_cached_chat_save_snapshot (G_LIST_MODEL (self->sorted_chat_list),
+                                         SNAPSHOT_MAX_CHATS, path, &error))
+    g_warning ("Failed to save chat list snapshot: %s", error->message);
+}
+
 GListModel *
 chatty_manager_get_accounts (ChattyManager *self)
 {
@@ -620,9 +921,12 @@ chatty_manager_find_account_with_name (ChattyManager  *self,
   g_return_val_if_fail (account_id && *account_id, NULL);
 
   if (protocol & CHATTY_PROTOCOL_MATRIX)
-    return chatty_matrix_find_account_with_name (self->matrix, account_id);
+    return self->matrix ? chatty_matrix_find_account_with_name (self->matrix, account_id) : NULL;
 
 #ifdef PURPLE_ENABLED
+  if (!self->purple)
+    return NULL;
+
   return chatty_purple_find_account_with_name (self->purple, protocol, account_id);
 #else
   return NULL;
@@ -642,12 +946,13 @@ chatty_manager_find_chat_with_name (ChattyManager  *self,
     return chatty_mm_account_find_chat (self->mm_account, chat_id);
 
 #ifdef PURPLE_ENABLED
+  /* Don't bring up purple early just to look for a chat */
   if (protocol & (CHATTY_PROTOCOL_XMPP | CHATTY_PROTOCOL_TELEGRAM))
-    return chatty_purple_find_chat_with_name (chatty_purple_get_default (),
-                                              protocol, account_id, chat_id);
+    return self->purple ? chatty_purple_find_chat_with_name (self->purple, protocol,
+                                                             account_id, chat_id) : NULL;
 #endif
 
-  if (protocol == CHATTY_PROTOCOL_MATRIX)
+  if (protocol == CHATTY_PROTOCOL_MATRIX && self->matrix)
     return chatty_matrix_find_chat_with_name (self->matrix, protocol, account_id, chat_id);
 
   return NULL;
@@ -707,6 +1012,33 @@ chatty_manager_get_history (ChattyManager *self)
   return self->history;
 }
 
+/**
+ * chatty_manager_get_media_cache:
+ * @self: A #ChattyManager
+ *
+ * Get the media cache shared by all accounts.  Cached
+ * paths are relative to $XDG_DATA_HOME/chatty, same
+ * as paths of files stored in history.
+ *
+ * Returns: (transfer none): A #ChattyMediaCache
+ */
+ChattyMediaCache *
+chatty_manager_get_media_cache (ChattyManager *self)
+{
+  g_return_val_if_fail (CHATTY_IS_MANAGER (self), NULL);
+
+  if (!self->media_cache) {
+    g_autofree char *dir = NULL;
+
+    dir = g_build_filename (g_get_user_data_dir (), "chatty", NULL);
+    self->media_cache = chatty_media_cache_new (chatty_manager_get_history (self), dir);
+    chatty_media_cache_set_max_size (self->media_cache,
+                                     chatty_settings_get_media_cache_size (chatty_settings_get_default ()));
+  }
+
+  return self->media_cache;
+}
+
 gpointer
 chatty_manager_matrix_client_new (ChattyManager *self)
 {
@@ -14,6 +14,7 @@
 
 #include "chatty-contact-provider.h"
 #include "chatty-history.h"
+#include "chatty-media-cache.h"
 #include "chatty-chat.h"
 
 G_BEGIN_DECLS
@@ -24,6 +25,8 @@ G_DECLARE_FINAL_TYPE (ChattyManager, chatty_manager, CHATTY, MANAGER, GObject)
 
 ChattyManager  *chatty_manager_get_default        (void);
 void            chatty_manager_load               (ChattyManager *self);
+void            chatty_manager_load_chat_snapshot (ChattyManager *self);
+void            chatty_manager_save_chat_snapshot (ChattyManager *self);
 GListModel     *chatty_manager_get_accounts       (ChattyManager *self);
 GListModel     *chatty_manager_get_contact_list      (ChattyManager *self);
 GListModel     *chatty_manager_get_chat_list         (ChattyManager *self);
@@ -61,6 +64,7 @@ gboolean        chatty_manager_set_uri                (ChattyManager      *self,
                                                        const char         *uri,
                                                        const char         *name);
 ChattyHistory  *chatty_manager_get_history            (ChattyManager      *self);
+ChattyMediaCache *chatty_manager_get_media_cache      (ChattyManager      *self);
 gpointer        chatty_manager_matrix_client_new      (ChattyManager      *self);
 gboolean        chatty_manager_has_matrix_with_id     (ChattyManager *self,
                                                          const char    *user_id);
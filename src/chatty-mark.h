@@ -0,0 +1,36 @@
+/* chatty-mark.h
+ *
+ * Copyright 2024 Purism SPC
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <glib.h>
+
+#ifdef HAVE_SYSPROF
+# include <sysprof-capture.h>
+#endif
+
+G_BEGIN_DECLS
+
+/*
+ * Capture marks for sysprof, enabled with the sysprof build
+ * option.  Marks of the same work share the pointer of the
+ * task, chat or message they belong to, so that they can be
+ * followed across threads.  Arguments after @name are not
+ * evaluated when marks are disabled.
+ */
+#ifdef HAVE_SYSPROF
+# define CHATTY_MARK_NOW() SYSPROF_CAPTURE_CURRENT_TIME
+# define CHATTY_MARK(_begin, name, ...)                                 \
+  sysprof_collector_mark_printf (_begin, SYSPROF_CAPTURE_CURRENT_TIME - (_begin), \
+                                 "chatty", name, __VA_ARGS__)
+#else
+# define CHATTY_MARK_NOW() G_GINT64_CONSTANT (0)
+# define CHATTY_MARK(_begin, name, ...) G_STMT_START { (void)(_begin); } G_STMT_END
+#endif
+#define CHATTY_MARK_INSTANT(name, ...) CHATTY_MARK (CHATTY_MARK_NOW (), name, __VA_ARGS__)
+
+G_END_DECLS
@@ -0,0 +1,691 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* chatty-media-cache.c
+ *
+ * Copyright 2024 Purism SPC
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define G_LOG_DOMAIN "chatty-media-cache"
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <string.h>
+
+#include "chatty-media-cache.h"
+#include "chatty-utils.h"
+#include "chatty-log.h"
+
+/* Read in chunks so that huge files don't have to be in memory */
+#define HASH_CHUNK_SIZE (64 * 1024)
+
+/**
+ * SECTION: chatty-media-cache
+ * @title: ChattyMediaCache
+ * @short_description: Content addressed store for media files
+ * @include: "chatty-media-cache.h"
+ *
+ * Media files are stored in the `media` directory of the base
+ * directory, named after the sha256 checksum of their content.
+ * So the same file received in several chats is stored only once.
+ *
+ * Every file is indexed in the history database, and the least
+ * recently used files are removed when the size of all files exceeds
+ * the maximum size set.  Files that can't be fetched again (eg: MMS
+ * attachments) are never removed.  Files that can be fetched again
+ * (eg: matrix media) are indexed with their url, so that they can
+ * be found with chatty_media_cache_lookup_async() instead of being
+ * fetched again.
+ *
+ * Files are added one at a time.  A file evicted by one add is deleted
+ * before the next add starts, so an add of the same content never sees
+ * a file that is about to be deleted.
+ */
+
+struct _ChattyMediaCache
+{
+  GObject        parent_instance;
+
+  ChattyHistory *history;
+  char          *base_dir;
+  goffset        max_size;
+
+  /* Adds waiting for the current one to finish */
+  GQueue        *add_queue;
+  gboolean       adding;
+};
+
+G_DEFINE_TYPE (ChattyMediaCache, chatty_media_cache, G_TYPE_OBJECT)
+
+typedef struct {
+  GFile    *file;
+  char     *url;
+  char     *checksum;
+  /* relative to base_dir */
+  char     *path;
+  goffset   size;
+  gboolean  evictable;
+} AddData;
+
+static void
+add_data_free (gpointer user_data)
+{
+  AddData *data = user_data;
+
+  g_clear_object (&data->file);
+  g_free (data->url);
+  g_free (data->checksum);
+  g_free (data->path);
+  g_free (data);
+}
+
+static char *
+media_cache_hash_file (GFile         *file,
+                       goffset       *size,
+                       GCancellable  *cancellable,
+                       GError       **error)
+{
+  g_autoptr(GFileInputStream) stream = NULL;
+  g_autoptr(GChecksum) checksum = NULL;
+  g_autofree guchar *buffer = NULL;
+  gssize n_read;
+
+  g_assert (G_IS_FILE (file));
+
+  stream = g_file_read (file, cancellable, error);
+
+  if (!stream)
+    return NULL;
+
+  checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  buffer = g_malloc (HASH_CHUNK_SIZE);
+  *size = 0;
+
+  while ((n_read = g_input_stream_read (G_INPUT_STREAM (stream), buffer,
+                                        HASH_CHUNK_SIZE, cancellable, error)) > 0) {
+    g_checksum_update (checksum, buffer, n_read);
+    *size += n_read;
+  }
+
+  if (n_read < 0)
+    return NULL;
+
+  return g_strdup (g_checksum_get_string (checksum));
+}
+
+static void
+media_cache_store_thread (GTask        *task,
+                          gpointer      source_object,
+                          gpointer      task_data,
+                          GCancellable *cancellable)
+{
+  ChattyMediaCache *self = source_object;
+  AddData *data = task_data;
+  g_autoptr(GFile) target = NULL;
+  g_autoptr(GFile) parent = NULL;
+  g_autofree char *basename = NULL;
+  g_autofree char *dir_name = NULL;
+  GError *error = NULL;
+  const char *extension;
+
+  g_assert (CHATTY_IS_MEDIA_CACHE (self));
+
+  data->checksum = media_cache_hash_file (data->file, &data->size, cancellable, &error);
+
+  if (!data->checksum) {
+    g_task_return_error (task, error);
+    return;
+  }
+
+  /* Keep the extension so that the file type can still be guessed from the name */
+  basename = g_file_get_basename (data->file);
+  extension = strrchr (basename, '.');
+  dir_name = g_strndup (data->checksum, 2);
+  data->path = g_strconcat ("media", G_DIR_SEPARATOR_S, dir_name, G_DIR_SEPARATOR_S,
+                            data->checksum, extension ? extension : "", NULL);
+
+  target = g_file_new_build_filename (self->base_dir, data->path, NULL);
+
+  if (g_file_equal (target, data->file)) {
+    g_task_return_boolean (task, TRUE);
+    return;
+  }
+
+  parent = g_file_get_parent (target);
+
+  if (!g_file_make_directory_with_parents (parent, cancellable, &error) &&
+      !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_EXISTS)) {
+    g_task_return_error (task, error);
+    return;
+  }
+
+  g_clear_error (&error);
+
+  if (g_file_query_exists (target, cancellable)) {
+    CHATTY_TRACE_MSG ("File %s already cached", data->path);
+    g_file_delete (data->file, cancellable, NULL);
+  } else if (!g_file_move (data->file, target, G_FILE_COPY_NONE,
+                           cancellable, NULL, NULL, &error)) {
+    g_task_return_error (task, error);
+    return;
+  }
+
+  g_task_return_boolean (task, TRUE);
+}
+
+static void
+media_cache_delete_thread (GTask        *task,
+                           gpointer      source_object,
+                           gpointer      task_data,
+                           GCancellable *cancellable)
+{
+  ChattyMediaCache *self = source_object;
+  GPtrArray *evicted = task_data;
+
+  g_assert (CHATTY_IS_MEDIA_CACHE (self));
+
+  for (guint i = 0; i < evicted->len; i++) {
+    g_autoptr(GFile) file = NULL;
+    g_autoptr(GError) error = NULL;
+
+    file = g_file_new_build_filename (self->base_dir, evicted->pdata[i], NULL);
+
+    if (!g_file_delete (file, cancellable, &error) &&
+        !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+      g_warning ("Failed to delete evicted file '%s': %s",
+                 (char *)evicted->pdata[i], error->message);
+  }
+
+  g_task_return_boolean (task, TRUE);
+}
+
+static void media_cache_add_next (ChattyMediaCache *self);
+
+static void
+media_cache_add_done (GTask  *task,
+                      char   *path,
+                      GError *error)
+{
+  ChattyMediaCache *self;
+
+  self = g_task_get_source_object (task);
+  g_assert (CHATTY_IS_MEDIA_CACHE (self));
+
+  if (error)
+    g_task_return_error (task, error);
+  else
+    g_task_return_pointer (task, path, g_free);
+
+  self->adding = FALSE;
+  media_cache_add_next (self);
+}
+
+static void
+media_cache_deleted_cb (GObject      *object,
+                        GAsyncResult *result,
+                        gpointer      user_data)
+{
+  g_autoptr(GTask) task = user_data;
+  char *path;
+
+  path = g_object_steal_data (G_OBJECT (task), "cache-path");
+  media_cache_add_done (task, path, NULL);
+}
+
+static void
+media_cache_history_added_cb (GObject      *object,
+                              GAsyncResult *result,
+                              gpointer      user_data)
+{
+  g_autoptr(GTask) task = user_data;
+  g_autoptr(GPtrArray) evicted = NULL;
+  g_autofree char *cache_path = NULL;
+  ChattyMediaCache *self;
+  GError *error = NULL;
+  AddData *data;
+
+  self = g_task_get_source_object (task);
+  data = g_task_get_task_data (task);
+  g_assert (CHATTY_IS_MEDIA_CACHE (self));
+
+  evicted = chatty_history_add_media_finish (self->history, result, &cache_path, &error);
+
+  if (!evicted) {
+    media_cache_add_done (task, NULL, error);
+    return;
+  }
+
+  /* The same content may already be stored with a different extension */
+  if (cache_path && g_strcmp0 (cache_path, data->path) != 0) {
+    g_autoptr(GFile) file = NULL;
+
+    file = g_file_new_build_filename (self->base_dir, data->path, NULL);
+    g_file_delete (file, NULL, NULL);
+  } else {
+    g_free (cache_path);
+    cache_path = g_strdup (data->path);
+  }
+
+  if (evicted->len) {
+    g_autoptr(GTask) delete_task = NULL;
+
+    CHATTY_DEBUG_MSG ("Evicting %u media files", evicted->len);
+
+    /* Finish the add only after the files are gone, see the SECTION docs */
+    g_object_set_data_full (G_OBJECT (task), "cache-path",
+                            g_steal_pointer (&cache_path), g_free);
+    delete_task = g_task_new (self, NULL, media_cache_deleted_cb, g_steal_pointer (&task));
+    g_task_set_task_data (delete_task, g_ptr_array_ref (evicted),
+                          (GDestroyNotify)g_ptr_array_unref);
+    g_task_run_in_thread (delete_task, media_cache_delete_thread);
+    return;
+  }
+
+  media_cache_add_done (task, g_steal_pointer (&cache_path), NULL);
+}
+
+static void
+media_cache_store_cb (GObject      *object,
+                      GAsyncResult *result,
+                      gpointer      user_data)
+{
+  g_autoptr(GTask) task = user_data;
+  ChattyMediaCache *self = CHATTY_MEDIA_CACHE (object);
+  GError *error = NULL;
+  AddData *data;
+
+  if (!g_task_propagate_boolean (G_TASK (result), &error)) {
+    media_cache_add_done (task, NULL, error);
+    return;
+  }
+
+  data = g_task_get_task_data (task);
+  chatty_history_add_media_async (self->history, data->checksum, data->path,
+                                  data->url, data->size, data->evictable, self->max_size,
+                                  media_cache_history_added_cb,
+                                  g_steal_pointer (&task));
+}
+
+static void
+media_cache_add_next (ChattyMediaCache *self)
+{
+  g_autoptr(GTask) store_task = NULL;
+  GTask *task;
+
+  g_assert (CHATTY_IS_MEDIA_CACHE (self));
+
+  if (self->adding)
+    return;
+
+  task = g_queue_pop_head (self->add_queue);
+
+  if (!task)
+    return;
+
+  self->adding = TRUE;
+
+  store_task = g_task_new (self, g_task_get_cancellable (task), media_cache_store_cb, task);
+  /* The data is owned by the outer task, which outlives this one */
+  g_task_set_task_data (store_task, g_task_get_task_data (task), NULL);
+  g_task_run_in_thread (store_task, media_cache_store_thread);
+}
+
+static void
+media_cache_lookup_cb (GObject      *object,
+                       GAsyncResult *result,
+                       gpointer      user_data)
+{
+  g_autoptr(GTask) task = user_data;
+  g_autofree char *path = NULL;
+  ChattyMediaCache *self;
+  GError *error = NULL;
+
+  self = g_task_get_source_object (task);
+  g_assert (CHATTY_IS_MEDIA_CACHE (self));
+
+  path = chatty_history_lookup_media_finish (self->history, result, &error);
+
+  if (error)
+    g_task_return_error (task, error);
+  else if (path)
+    g_task_return_pointer (task, g_file_new_build_filename (self->base_dir, path, NULL),
+                           g_object_unref);
+  else
+    g_task_return_pointer (task, NULL, NULL);
+}
+
+static void
+media_cache_image_decoded_cb (GObject      *object,
+                              GAsyncResult *result,
+                              gpointer      user_data)
+{
+  g_autoptr(GTask) task = user_data;
+  GdkPixbuf *pixbuf;
+  GError *error = NULL;
+
+  pixbuf = chatty_utils_decode_image_finish (result, &error);
+
+  if (error)
+    g_task_return_error (task, error);
+  else
+    g_task_return_pointer (task, pixbuf, g_object_unref);
+}
+
+static void
+media_cache_image_read_cb (GObject      *object,
+                           GAsyncResult *result,
+                           gpointer      user_data)
+{
+  g_autoptr(GTask) task = user_data;
+  g_autoptr(GFileInputStream) stream = NULL;
+
+  stream = g_file_read_finish (G_FILE (object), result, NULL);
+
+  /* Evicted after the lookup */
+  if (!stream) {
+    g_task_return_pointer (task, NULL, NULL);
+    return;
+  }
+
+  chatty_utils_decode_image_async (G_INPUT_STREAM (stream),
+                                   GPOINTER_TO_INT (g_task_get_task_data (task)),
+                                   G_PRIORITY_DEFAULT,
+                                   g_task_get_cancellable (task),
+                                   media_cache_image_decoded_cb,
+                                   g_object_ref (task));
+}
+
+static void
+media_cache_image_lookup_cb (GObject      *object,
+                             GAsyncResult *result,
+                             gpointer      user_data)
+{
+  g_autoptr(GTask) task = user_data;
+  g_autoptr(GFile) file = NULL;
+  GError *error = NULL;
+
+  file = chatty_media_cache_lookup_finish (CHATTY_MEDIA_CACHE (object), result, &error);
+
+  if (error) {
+    g_task_return_error (task, error);
+    return;
+  }
+
+  if (!file) {
+    g_task_return_pointer (task, NULL, NULL);
+    return;
+  }
+
+  g_file_read_async (file, G_PRIORITY_DEFAULT,
+                     g_task_get_cancellable (task),
+                     media_cache_image_read_cb,
+                     g_object_ref (task));
+}
+
+static void
+chatty_media_cache_finalize (GObject *object)
+{
+  ChattyMediaCache *self = (ChattyMediaCache *)object;
+
+  /* Every queued task holds a reference on us */
+  g_assert (g_queue_is_empty (self->add_queue));
+  g_queue_free (self->add_queue);
+  g_clear_object (&self->history);
+  g_clear_pointer (&self->base_dir, g_free);
+
+  G_OBJECT_CLASS (chatty_media_cache_parent_class)->finalize (object);
+}
+
+static void
+chatty_media_cache_class_init (ChattyMediaCacheClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = chatty_media_cache_finalize;
+}
+
+static void
+chatty_media_cache_init (ChattyMediaCache *self)
+{
+  self->add_queue = g_queue_new ();
+}
+
+/**
+ * chatty_media_cache_new:
+ * @history: A #ChattyHistory
+ * @base_dir: The directory paths are relative to
+ *
+ * Create a new media cache that stores files in
+ * @base_dir and indexes them in @history.
+ *
+ * Returns: (transfer full): A #ChattyMediaCache
+ */
+ChattyMediaCache *
+chatty_media_cache_new (ChattyHistory *history,
+                        const char    *base_dir)
+{
+  ChattyMediaCache *self;
+
+  g_return_val_if_fail (CHATTY_IS_HISTORY (history), NULL);
+  g_return_val_if_fail (base_dir && *base_dir, NULL);
+
+  self = g_object_new (CHATTY_TYPE_MEDIA_CACHE, NULL);
+  self->history = g_object_ref (history);
+  self->base_dir = g_strdup (base_dir);
+
+  return self;
+}
+
+const char *
+chatty_media_cache_get_base_dir (ChattyMediaCache *self)
+{
+  g_return_val_if_fail (CHATTY_IS_MEDIA_CACHE (self), NULL);
+
+  return self->base_dir;
+}
+
+/**
+ * chatty_media_cache_set_max_size:
+ * @self: A #ChattyMediaCache
+ * @max_size: The maximum size in bytes, or 0
+ *
+ * Set the size budget of evictable files.  The limit
+ * is enforced the next time a file is added.  Set
+ * 0 to never evict files.
+ */
+void
+chatty_media_cache_set_max_size (ChattyMediaCache *self,
+                                 goffset           max_size)
+{
+  g_return_if_fail (CHATTY_IS_MEDIA_CACHE (self));
+  g_return_if_fail (max_size >= 0);
+
+  self->max_size = max_size;
+}
+
+/**
+ * chatty_media_cache_add_async:
+ * @self: A #ChattyMediaCache
+ * @file: A local #GFile
+ * @url: (nullable): The url @file was fetched from
+ * @evictable: Whether @file can be fetched again
+ * @cancellable: (nullable): A #GCancellable
+ * @callback: A #GAsyncReadyCallback
+ * @user_data: The user data for @callback
+ *
+ * Move @file into the cache.  If a file with the same
+ * content is already cached, @file is deleted and the
+ * cached file is reused.  Finish with
+ * chatty_media_cache_add_finish() to get the new path.
+ *
+ * @url should be set for @evictable files, so that they
+ * can be found again with chatty_media_cache_lookup_async().
+ */
+void
+chatty_media_cache_add_async (ChattyMediaCache    *self,
+                              GFile               *file,
+                              const char          *url,
+                              gboolean             evictable,
+                              GCancellable        *cancellable,
+                              GAsyncReadyCallback  callback,
+                              gpointer             user_data)
+{
+  GTask *task;
+  AddData *data;
+
+  g_return_if_fail (CHATTY_IS_MEDIA_CACHE (self));
+  g_return_if_fail (G_IS_FILE (file));
+
+  data = g_new0 (AddData, 1);
+  data->file = g_object_ref (file);
+  data->url = g_strdup (url);
+  data->evictable = !!evictable;
+
+  task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, chatty_media_cache_add_async);
+  g_task_set_task_data (task, data, add_data_free);
+
+  g_queue_push_tail (self->add_queue, task);
+  media_cache_add_next (self);
+}
+
+/**
+ * chatty_media_cache_add_finish:
+ * @self: A #ChattyMediaCache
+ * @result: A #GAsyncResult
+ * @error: A #GError
+ *
+ * Finish operation started by chatty_media_cache_add_async()
+ *
+ * Returns: (transfer full): The path of the cached file
+ * relative to the base directory, or %NULL on error.
+ */
+char *
+chatty_media_cache_add_finish (ChattyMediaCache  *self,
+                               GAsyncResult      *result,
+                               GError           **error)
+{
+  g_return_val_if_fail (CHATTY_IS_MEDIA_CACHE (self), NULL);
+  g_return_val_if_fail (G_IS_TASK (result), NULL);
+  g_return_val_if_fail (!error || !*error, NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+/**
+ * chatty_media_cache_lookup_async:
+ * @self: A #ChattyMediaCache
+ * @url: The url a file was fetched from
+ * @cancellable: (nullable): A #GCancellable
+ * @callback: A #GAsyncReadyCallback
+ * @user_data: The user data for @callback
+ *
+ * Find the file cached for @url, and mark it as
+ * recently used, so that it's evicted last.  Finish
+ * with chatty_media_cache_lookup_finish().
+ */
+void
+chatty_media_cache_lookup_async (ChattyMediaCache    *self,
+                                 const char          *url,
+                                 GCancellable        *cancellable,
+                                 GAsyncReadyCallback  callback,
+                                 gpointer             user_data)
+{
+  g_autoptr(GTask) task = NULL;
+
+  g_return_if_fail (CHATTY_IS_MEDIA_CACHE (self));
+  g_return_if_fail (url && *url);
+
+  task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, chatty_media_cache_lookup_async);
+
+  chatty_history_lookup_media_async (self->history, url,
+                                     media_cache_lookup_cb,
+                                     g_steal_pointer (&task));
+}
+
+/**
+ * chatty_media_cache_lookup_finish:
+ * @self: A #ChattyMediaCache
+ * @result: A #GAsyncResult
+ * @error: A #GError
+ *
+ * Finish operation started by chatty_media_cache_lookup_async().
+ * The file may have been removed since, so reading it
+ * can still fail.
+ *
+ * Returns: (transfer full) (nullable): The cached file,
+ * or %NULL if nothing is cached for the url or on error.
+ */
+GFile *
+chatty_media_cache_lookup_finish (ChattyMediaCache  *self,
+                                  GAsyncResult      *result,
+                                  GError           **error)
+{
+  g_return_val_if_fail (CHATTY_IS_MEDIA_CACHE (self), NULL);
+  g_return_val_if_fail (G_IS_TASK (result), NULL);
+  g_return_val_if_fail (!error || !*error, NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+/**
+ * chatty_media_cache_load_image_async:
+ * @self: A #ChattyMediaCache
+ * @url: The url an image was fetched from
+ * @width: The width to scale the image to, or -1
+ * @cancellable: (nullable): A #GCancellable
+ * @callback: A #GAsyncReadyCallback
+ * @user_data: The user data for @callback
+ *
+ * Find the image cached for @url and decode it in a
+ * worker thread.  Finish with
+ * chatty_media_cache_load_image_finish().
+ */
+void
+chatty_media_cache_load_image_async (ChattyMediaCache    *self,
+                                     const char          *url,
+                                     int                  width,
+                                     GCancellable        *cancellable,
+                                     GAsyncReadyCallback  callback,
+                                     gpointer             user_data)
+{
+  g_autoptr(GTask) task = NULL;
+
+  g_return_if_fail (CHATTY_IS_MEDIA_CACHE (self));
+  g_return_if_fail (url && *url);
+
+  task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, chatty_media_cache_load_image_async);
+  g_task_set_task_data (task, GINT_TO_POINTER (width), NULL);
+
+  chatty_media_cache_lookup_async (self, url, cancellable,
+                                   media_cache_image_lookup_cb,
+                                   g_steal_pointer (&task));
+}
+
+/**
+ * chatty_media_cache_load_image_finish:
+ * @self: A #ChattyMediaCache
+ * @result: A #GAsyncResult
+ * @error: A #GError
+ *
+ * Finish operation started by chatty_media_cache_load_image_async().
+ *
+ * Returns: (transfer full) (nullable): The decoded image.
+ * %NULL without @error set if nothing is cached for the
+ * url, so that the caller can fetch it again.
+ */
+GdkPixbuf *
+chatty_media_cache_load_image_finish (ChattyMediaCache  *self,
+                                      GAsyncResult      *result,
+                                      GError           **error)
+{
+  g_return_val_if_fail (CHATTY_IS_MEDIA_CACHE (self), NULL);
+  g_return_val_if_fail (G_IS_TASK (result), NULL);
+  g_return_val_if_fail (!error || !*error, NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
@@ -0,0 +1,53 @@
+/* chatty-media-cache.h
+ *
+ * Copyright 2024 Purism SPC
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <gtk/gtk.h>
+
+#include "chatty-history.h"
+
+G_BEGIN_DECLS
+
+#define CHATTY_TYPE_MEDIA_CACHE (chatty_media_cache_get_type ())
+
+G_DECLARE_FINAL_TYPE (ChattyMediaCache, chatty_media_cache, CHATTY, MEDIA_CACHE, GObject)
+
+ChattyMediaCache *chatty_media_cache_new               (ChattyHistory        *history,
+                                                        const char           *base_dir);
+const char       *chatty_media_cache_get_base_dir      (ChattyMediaCache     *self);
+void              chatty_media_cache_set_max_size      (ChattyMediaCache     *self,
+                                                        goffset               max_size);
+void              chatty_media_cache_add_async         (ChattyMediaCache     *self,
+                                                        GFile                *file,
+                                                        const char           *url,
+                                                        gboolean              evictable,
+                                                        GCancellable         *cancellable,
+                                                        GAsyncReadyCallback   callback,
+                                                        gpointer              user_data);
+char             *chatty_media_cache_add_finish        (ChattyMediaCache     *self,
+                                                        GAsyncResult         *result,
+                                                        GError              **error);
+void              chatty_media_cache_lookup_async      (ChattyMediaCache     *self,
+                                                        const char           *url,
+                                                        GCancellable         *cancellable,
+                                                        GAsyncReadyCallback   callback,
+                                                        gpointer              user_data);
+GFile            *chatty_media_cache_lookup_finish     (ChattyMediaCache     *self,
+                                                        GAsyncResult         *result,
+                                                        GError              **error);
+void              chatty_media_cache_load_image_async  (ChattyMediaCache     *self,
+                                                        const char           *url,
+                                                        int                   width,
+                                                        GCancellable         *cancellable,
+                                                        GAsyncReadyCallback   callback,
+                                                        gpointer              user_data);
+GdkPixbuf        *chatty_media_cache_load_image_finish (ChattyMediaCache     *self,
+                                                        GAsyncResult         *result,
+                                                        GError              **error);
+
+G_END_DECLS
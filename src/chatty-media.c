@@ -152,7 +152,7 @@ chatty_media_scale_image_to_size_sync (ChattyFile *input_file,
     if (use_temp_file) {
       path = g_string_new (g_build_filename (g_get_tmp_dir (), "chatty/", NULL));
     } else {
-      path = g_string_new (g_build_filename (g_get_user_cache_dir (), "chatty/", NULL));
+      path = g_string_new (g_build_filename (g_get_user_cache_dir (), "chatty", "resized/", NULL));
     }
 
     CHATTY_TRACE_MSG ("New Directory Path: %s", path->str);
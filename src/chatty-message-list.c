@@ -0,0 +1,448 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* chatty-message-list.c
+ *
+ * Copyright 2024 Purism SPC
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define G_LOG_DOMAIN "chatty-message-list"
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "chatty-message-list.h"
+#include "chatty-log.h"
+
+/**
+ * SECTION: chatty-message-list
+ * @title: ChattyMessageList
+ * @short_description: A list of messages sorted by time
+ * @include: "chatty-message-list.h"
+ *
+ * #ChattyMessageList keeps messages sorted by their time,
+ * so that messages received late (eg: offline messages)
+ * are shown at the right place.  Messages with the same
+ * time are kept in the order they were added.
+ *
+ * The messages are stored in a #GSequence, so that adding
+ * a message anywhere in the list and getting an item at
+ * any position is O(log n).
+ */
+
+struct _ChattyMessageList
+{
+  GObject        parent_instance;
+
+  GSequence     *messages;
+  /* uid to GSequenceIter */
+  GHashTable    *uid_table;
+
+  /* Speed up sequential access, as done by list widgets */
+  GSequenceIter *last_iter;
+  guint          last_position;
+  gboolean       last_position_valid;
+};
+
+static void chatty_message_list_model_init (GListModelInterface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (ChattyMessageList, chatty_message_list, G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (G_TYPE_LIST_MODEL,
+                                                chatty_message_list_model_init))
+
+/*
+ * GSequence inserts and searches after the last equal item, so
+ * messages with the same time stay in the order they were added.
+ */
+static int
+message_list_compare (gconstpointer a,
+                      gconstpointer b,
+                      gpointer      user_data)
+{
+  time_t time_a, time_b;
+
+  time_a = chatty_message_get_time ((ChattyMessage *)a);
+  time_b = chatty_message_get_time ((ChattyMessage *)b);
+
+  return (time_a > time_b) - (time_a < time_b);
+}
+
+static void
+message_list_items_changed (ChattyMessageList *self,
+                            guint              position,
+                            guint              removed,
+                            guint              added)
+{
+  self->last_position_valid = FALSE;
+  self->last_iter = NULL;
+
+  g_list_model_items_changed (G_LIST_MODEL (self), position, removed, added);
+}
+
+static void
+message_list_index (ChattyMessageList *self,
+                    GSequenceIter     *iter)
+{
+  const char *uid;
+
+  uid = chatty_message_get_uid (g_sequence_get (iter));
+
+  if (uid && *uid)
+    g_hash_table_insert (self->uid_table, g_strdup (uid), iter);
+}
+
+static void
+message_list_unindex (ChattyMessageList *self,
+                      GSequenceIter     *iter)
+{
+  const char *uid;
+
+  uid = chatty_message_get_uid (g_sequence_get (iter));
+
+  if (uid && g_hash_table_lookup (self->uid_table, uid) == iter)
+    g_hash_table_remove (self->uid_table, uid);
+}
+
+static gboolean
+messages_are_sorted (GPtrArray *messages)
+{
+  for (guint i = 1; i < messages->len; i++)
+    if (chatty_message_get_time (messages->pdata[i - 1]) >
+        chatty_message_get_time (messages->pdata[i]))
+      return FALSE;
+
+  return TRUE;
+}
+
+static GType
+chatty_message_list_get_item_type (GListModel *model)
+{
+  return CHATTY_TYPE_MESSAGE;
+}
+
+static guint
+chatty_message_list_get_n_items (GListModel *model)
+{
+  ChattyMessageList *self = CHATTY_MESSAGE_LIST (model);
+
+  return g_sequence_get_length (self->messages);
+}
+
+static gpointer
+chatty_message_list_get_item (GListModel *model,
+                              guint       position)
+{
+  ChattyMessageList *self = CHATTY_MESSAGE_LIST (model);
+  GSequenceIter *iter = NULL;
+
+  if (self->last_position_valid) {
+    if (position + 1 == self->last_position)
+      iter = g_sequence_iter_prev (self->last_iter);
+    else if (position == self->last_position)
+      iter = self->last_iter;
+    else if (position == self->last_position + 1)
+      iter = g_sequence_iter_next (self->last_iter);
+  }
+
+  if (!iter)
+    iter = g_sequence_get_iter_at_pos (self->messages, position);
+
+  if (g_sequence_iter_is_end (iter))
+    return NULL;
+
+  self->last_iter = iter;
+  self->last_position = position;
+  self->last_position_valid = TRUE;
+
+  return g_object_ref (g_sequence_get (iter));
+}
+
+static void
+chatty_message_list_model_init (GListModelInterface *iface)
+{
+  iface->get_item_type = chatty_message_list_get_item_type;
+  iface->get_n_items = chatty_message_list_get_n_items;
+  iface->get_item = chatty_message_list_get_item;
+}
+
+static void
+chatty_message_list_finalize (GObject *object)
+{
+  ChattyMessageList *self = (ChattyMessageList *)object;
+
+  g_clear_pointer (&self->uid_table, g_hash_table_unref);
+  g_clear_pointer (&self->messages, g_sequence_free);
+
+  G_OBJECT_CLASS (chatty_message_list_parent_class)->finalize (object);
+}
+
+static void
+chatty_message_list_class_init (ChattyMessageListClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = chatty_message_list_finalize;
+}
+
+static void
+chatty_message_list_init (ChattyMessageList *self)
+{
+  self->messages = g_sequence_new (g_object_unref);
+  self->uid_table = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+}
+
+ChattyMessageList *
+chatty_message_list_new (void)
+{
+  return g_object_new (CHATTY_TYPE_MESSAGE_LIST, NULL);
+}
+
+/**
+ * chatty_message_list_add:
+ * @self: A #ChattyMessageList
+ * @message: A #ChattyMessage
+ *
+ * Add @message to @self at the position of its time.
+ */
+void
+chatty_message_list_add (ChattyMessageList *self,
+                         ChattyMessage     *message)
+{
+  GSequenceIter *iter;
+
+  g_return_if_fail (CHATTY_IS_MESSAGE_LIST (self));
+  g_return_if_fail (CHATTY_IS_MESSAGE (message));
+
+  iter = g_sequence_insert_sorted (self->messages, g_object_ref (message),
+                                   message_list_compare, NULL);
+  message_list_index (self, iter);
+  message_list_items_changed (self, g_sequence_iter_get_position (iter), 0, 1);
+}
+
+/**
+ * chatty_message_list_add_many:
+ * @self: A #ChattyMessageList
+ * @messages: An array of #ChattyMessage
+ *
+ * Add all @messages to @self.  If @messages are sorted
+ * and are all older or all newer than the messages in
+ * @self (eg: when loading history), they are added with
+ * a single #GListModel::items-changed emission.
+ */
+void
+chatty_message_list_add_many (ChattyMessageList *self,
+                              GPtrArray         *messages)
+{
+  GSequenceIter *iter;
+  guint n_items, position;
+
+  g_return_if_fail (CHATTY_IS_MESSAGE_LIST (self));
+
+  if (!messages || !messages->len)
+    return;
+
+  n_items = g_sequence_get_length (self->messages);
+
+  if (!messages_are_sorted (messages)) {
+    for (guint i = 0; i < messages->len; i++)
+      chatty_message_list_add (self, messages->pdata[i]);
+
+    return;
+  }
+
+  if (n_items == 0 ||
+      chatty_message_get_time (messages->pdata[messages->len - 1]) <=
+      chatty_message_get_time (g_sequence_get (g_sequence_get_begin_iter (self->messages)))) {
+    iter = g_sequence_get_begin_iter (self->messages);
+    position = 0;
+  } else if (chatty_message_get_time (messages->pdata[0]) >=
+             chatty_message_get_time (g_sequence_get (g_sequence_iter_prev (g_sequence_get_end_iter (self->messages))))) {
+    iter = g_sequence_get_end_iter (self->messages);
+    position = n_items;
+  } else {
+    for (guint i = 0; i < messages->len; i++)
+      chatty_message_list_add (self, messages->pdata[i]);
+
+    return;
+  }
+
+  for (guint i = 0; i < messages->len; i++) {
+    GSequenceIter *new_iter;
+
+    new_iter = g_sequence_insert_before (iter, g_object_ref (messages->pdata[i]));
+    message_list_index (self, new_iter);
+  }
+
+  message_list_items_changed (self, position, 0, messages->len);
+}
+
+/**
+ * chatty_message_list_remove:
+ * @self: A #ChattyMessageList
+ * @message: A #ChattyMessage
+ *
+ * Remove @message from @self, if present.
+ */
+void
+chatty_message_list_remove (ChattyMessageList *self,
+                            ChattyMessage     *message)
+{
+  GSequenceIter *iter = NULL;
+  const char *uid;
+  guint position;
+
+  g_return_if_fail (CHATTY_IS_MESSAGE_LIST (self));
+  g_return_if_fail (CHATTY_IS_MESSAGE (message));
+
+  uid = chatty_message_get_uid (message);
+
+  if (uid)
+    iter = g_hash_table_lookup (self->uid_table, uid);
+
+  if (!iter || g_sequence_get (iter) != message) {
+    GSequenceIter *it;
+
+    iter = NULL;
+    it = g_sequence_search (self->messages, message, message_list_compare, NULL);
+
+    /* @it is after the last message with the same time, walk back over those */
+    while (!g_sequence_iter_is_begin (it)) {
+      it = g_sequence_iter_prev (it);
+
+      if (message_list_compare (g_sequence_get (it), message, NULL) != 0)
+        break;
+
+      if (g_sequence_get (it) == message) {
+        iter = it;
+        break;
+      }
+    }
+  }
+
+  if (!iter)
+    return;
+
+  position = g_sequence_iter_get_position (iter);
+  message_list_unindex (self, iter);
+  g_sequence_remove (iter);
+  message_list_items_changed (self, position, 1, 0);
+}
+
+void
+chatty_message_list_remove_all (ChattyMessageList *self)
+{
+  guint n_items;
+
+  g_return_if_fail (CHATTY_IS_MESSAGE_LIST (self));
+
+  n_items = g_sequence_get_length (self->messages);
+
+  if (!n_items)
+    return;
+
+  g_hash_table_remove_all (self->uid_table);
+  g_sequence_remove_range (g_sequence_get_begin_iter (self->messages),
+                           g_sequence_get_end_iter (self->messages));
+  message_list_items_changed (self, 0, n_items, 0);
+}
+
+/**
+ * chatty_message_list_trim:
+ * @self: A #ChattyMessageList
+ * @n_keep: The number of messages to keep
+ *
+ * Remove the oldest messages so that only the
+ * newest @n_keep messages are kept.
+ *
+ * Returns: The number of messages removed
+ */
+guint
+chatty_message_list_trim (ChattyMessageList *self,
+                          guint              n_keep)
+{
+  GSequenceIter *begin, *end;
+  guint n_items, n_removed;
+
+  g_return_val_if_fail (CHATTY_IS_MESSAGE_LIST (self), 0);
+
+  n_items = g_sequence_get_length (self->messages);
+
+  if (n_items <= n_keep)
+    return 0;
+
+  n_removed = n_items - n_keep;
+  begin = g_sequence_get_begin_iter (self->messages);
+  end = g_sequence_get_iter_at_pos (self->messages, n_removed);
+
+  for (GSequenceIter *iter = begin; iter != end; iter = g_sequence_iter_next (iter))
+    message_list_unindex (self, iter);
+
+  g_sequence_remove_range (begin, end);
+  message_list_items_changed (self, 0, n_removed, 0);
+
+  return n_removed;
+}
+
+/**
+ * chatty_message_list_find_uid:
+ * @self: A #ChattyMessageList
+ * @uid: A message uid
+ *
+ * Returns: (transfer none) (nullable): The message with
+ * @uid, or %NULL if not found.
+ */
+ChattyMessage *
+chatty_message_list_find_uid (ChattyMessageList *self,
+                              const char        *uid)
+{
+  GSequenceIter *iter;
+
+  g_return_val_if_fail (CHATTY_IS_MESSAGE_LIST (self), NULL);
+
+  if (!uid || !*uid)
+    return NULL;
+
+  iter = g_hash_table_lookup (self->uid_table, uid);
+
+  if (iter)
+    return g_sequence_get (iter);
+
+  return NULL;
+}
+
+/**
+ * chatty_message_list_find_time:
+ * @self: A #ChattyMessageList
+ * @time: A UNIX time
+ *
+ * Returns: The position of the first message not
+ * older than @time, or the number of items if all
+ * messages are older.
+ */
+guint
+chatty_message_list_find_time (ChattyMessageList *self,
+                               time_t             time)
+{
+  guint low, high;
+
+  g_return_val_if_fail (CHATTY_IS_MESSAGE_LIST (self), 0);
+
+  low = 0;
+  high = g_sequence_get_length (self->messages);
+
+  while (low < high) {
+    GSequenceIter *iter;
+    guint mid;
+
+    mid = low + (high - low) / 2;
+    iter = g_sequence_get_iter_at_pos (self->messages, mid);
+
+    if (chatty_message_get_time (g_sequence_get (iter)) < time)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+
+  return low;
+}
@@ -0,0 +1,35 @@
+/* chatty-message-list.h
+ *
+ * Copyright 2024 Purism SPC
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+
+#include "chatty-message.h"
+
+G_BEGIN_DECLS
+
+#define CHATTY_TYPE_MESSAGE_LIST (chatty_message_list_get_type ())
+
+G_DECLARE_FINAL_TYPE (ChattyMessageList, chatty_message_list, CHATTY, MESSAGE_LIST, GObject)
+
+ChattyMessageList *chatty_message_list_new        (void);
+void               chatty_message_list_add        (ChattyMessageList *self,
+                                                   ChattyMessage     *message);
+void               chatty_message_list_add_many   (ChattyMessageList *self,
+                                                   GPtrArray         *messages);
+void               chatty_message_list_remove     (ChattyMessageList *self,
+                                                   ChattyMessage     *message);
+void               chatty_message_list_remove_all (ChattyMessageList *self);
+guint              chatty_message_list_trim       (ChattyMessageList *self,
+                                                   guint              n_keep);
+ChattyMessage     *chatty_message_list_find_uid   (ChattyMessageList *self,
+                                                   const char        *uid);
+guint              chatty_message_list_find_time  (ChattyMessageList *self,
+                                                   time_t             time);
+
+G_END_DECLS
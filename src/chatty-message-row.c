@@ -49,7 +49,10 @@ struct _ChattyMessageRow
 
   ChattyMessage *message;
   ChattyProtocol protocol;
-  gulong         clock_id;
+  guint          clock_watch_id;
+  time_t         watch_time;
+  /* The time label changed while the row wasn't mapped */
+  gboolean       footer_dirty;
   gboolean       is_im;
   gboolean       force_hide_footer;
   gboolean       show_avatar;
@@ -182,43 +185,40 @@ text_item_update_quotes (ChattyMessageRow *self)
   } while (quote && *quote);
 }
 
-static const char *
-message_row_get_clock_signal (time_t time_stamp)
-{
-  double diff;
-
-  diff = difftime (time (NULL), time_stamp);
-
-  if (diff >= - SECONDS_PER_MINUTE &&
-      diff <= SECONDS_PER_HOUR)
-    return g_intern_static_string ("changed");
+static void chatty_message_row_update_footer (ChattyMessageRow *self);
 
-  if (diff < 0)
-    return NULL;
+static void
+message_row_clock_changed_cb (gpointer user_data)
+{
+  ChattyMessageRow *self = user_data;
 
-  if (diff < SECONDS_PER_WEEK)
-    return g_intern_static_string ("day-changed");
+  g_assert (CHATTY_IS_MESSAGE_ROW (self));
 
-  return NULL;
+  /* Relabel rows scrolled out of view only when they are shown again */
+  if (gtk_widget_get_mapped (GTK_WIDGET (self)))
+    chatty_message_row_update_footer (self);
+  else
+    self->footer_dirty = TRUE;
 }
 
-static gboolean
+static void
 chatty_message_row_update_footer (ChattyMessageRow *self)
 {
   g_autofree char *time_str = NULL;
   g_autofree char *footer = NULL;
-  const char *status_str = "", *time_signal;
+  const char *status_str = "";
   ChattyMsgStatus status;
   time_t time_stamp;
 
   g_assert (CHATTY_IS_MESSAGE_ROW (self));
   g_assert (self->message);
 
-  if (self->force_hide_footer) {
-    g_clear_signal_handler (&self->clock_id, chatty_clock_get_default ());
-    g_object_set_data (G_OBJECT (self), "time-signal", NULL);
+  self->footer_dirty = FALSE;
 
-    return G_SOURCE_REMOVE;
+  if (self->force_hide_footer) {
+    chatty_clock_remove_watch (chatty_clock_get_default (), self->clock_watch_id);
+    self->clock_watch_id = 0;
+    return;
   }
 
   status = chatty_message_get_status (self->message);
@@ -238,20 +238,14 @@ chatty_message_row_update_footer (ChattyMessageRow *self)
   gtk_label_set_markup (GTK_LABEL (self->footer_label), footer);
   gtk_widget_set_visible (self->footer_label, footer && *footer);
 
-  time_signal = message_row_get_clock_signal (time_stamp);
-
-  if (time_signal != g_object_get_data (G_OBJECT (self), "time-signal")) {
-    g_clear_signal_handler (&self->clock_id, chatty_clock_get_default ());
-    g_object_set_data (G_OBJECT (self), "time-signal", (gpointer)time_signal);
-
-    if (time_signal)
-      self->clock_id = g_signal_connect_object (chatty_clock_get_default (), time_signal,
-                                                G_CALLBACK (chatty_message_row_update_footer),
-                                                self, G_CONNECT_SWAPPED);
-    return G_SOURCE_REMOVE;
+  if (!self->clock_watch_id || self->watch_time != time_stamp) {
+    chatty_clock_remove_watch (chatty_clock_get_default (), self->clock_watch_id);
+    self->watch_time = time_stamp;
+    self->clock_watch_id = chatty_clock_add_watch (chatty_clock_get_default (),
+                                                   time_stamp, TRUE,
+                                                   message_row_clock_changed_cb,
+                                                   self);
   }
-
-  return G_SOURCE_CONTINUE;
 }
 
 static void
@@ -344,11 +338,25 @@ message_row_update_message (ChattyMessageRow *self)
   }
 }
 
+static void
+chatty_message_row_map (GtkWidget *widget)
+{
+  ChattyMessageRow *self = (ChattyMessageRow *)widget;
+
+  GTK_WIDGET_CLASS (chatty_message_row_parent_class)->map (widget);
+
+  if (self->footer_dirty && self->message)
+    chatty_message_row_update_footer (self);
+}
+
 static void
 chatty_message_row_dispose (GObject *object)
 {
   ChattyMessageRow *self = (ChattyMessageRow *)object;
 
+  if (self->clock_watch_id)
+    chatty_clock_remove_watch (chatty_clock_get_default (), self->clock_watch_id);
+  self->clock_watch_id = 0;
   g_clear_object (&self->message);
 
   G_OBJECT_CLASS (chatty_message_row_parent_class)->dispose (object);
@@ -362,6 +370,8 @@ chatty_message_row_class_init (ChattyMessageRowClass *klass)
 
   object_class->dispose = chatty_message_row_dispose;
 
+  widget_class->map = chatty_message_row_map;
+
   gtk_widget_class_set_template_from_resource (widget_class,
                                                "/sm/puri/Chatty/"
                                                "ui/chatty-message-row.ui");
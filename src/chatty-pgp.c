@@ -270,6 +270,14 @@ chatty_pgp_encrypt_stream (const char     *contents_to_encrypt,
   if (!recipients || !*recipients)
     return NULL;
 
+  /* Fail early instead of making gpg fail with the whole message */
+  for (int i = 0; recipients[i] != NULL; i++) {
+    if (!chatty_pgp_can_encrypt_to (recipients[i])) {
+      g_warning ("No valid PGP key to encrypt to %s", recipients[i]);
+      return NULL;
+    }
+  }
+
   session = chatty_pgp_create_camel_session ();
 
   ctx = chatty_pgp_create_camel_ctx (session);
@@ -593,77 +601,384 @@ chatty_gpg_get_exec (void)
   return NULL;
 }
 
-/* This functionality doesn't exist in libcamel, so we have to make it ourselves */
-char *
-chatty_pgp_get_pub_fingerprint (const char *signing_id,
-                                gboolean    pretty_format)
+/*
+ * Listing keys needs a gpg process to be run, so the whole keyring
+ * is listed once and kept in memory.  When a file in the GnuPG home
+ * directory changes, the keyring is listed again in a thread, and
+ * lookups use the previous listing meanwhile.
+ */
+typedef struct {
+  char     *fingerprint;
+  char     *key_id;
+  GStrv     uids;
+  /* Unix time, 0 if the key never expires */
+  gint64    expires;
+  gboolean  usable;
+  gboolean  can_encrypt;
+} PgpKey;
+
+G_LOCK_DEFINE_STATIC (keyring);
+static GPtrArray *keyring;
+/* Bumped each time the keys are listed, to keep the latest listing */
+static guint keyring_serial;
+static guint keyring_loaded_serial;
+/* Whether the keyring changed since it was last listed */
+static gboolean keyring_stale;
+/* Used only from the main thread */
+static GFileMonitor *keyring_monitor;
+static gboolean keyring_refreshing;
+
+static void
+pgp_key_free (gpointer data)
 {
-  g_autoptr(GError) error = NULL;
-  g_autofree char *directory = NULL;
+  PgpKey *key = data;
+
+  g_free (key->fingerprint);
+  g_free (key->key_id);
+  g_strfreev (key->uids);
+  g_free (key);
+}
+
+static void pgp_keyring_refreshed_cb (GObject      *object,
+                                      GAsyncResult *result,
+                                      gpointer      user_data);
+
+/* Refresh the keyring, unless a refresh is already running */
+static void
+pgp_keyring_refresh (void)
+{
+  if (keyring_refreshing)
+    return;
+
+  keyring_refreshing = TRUE;
+  chatty_pgp_load_keyring_async (pgp_keyring_refreshed_cb, NULL);
+}
+
+static void
+pgp_keyring_refreshed_cb (GObject      *object,
+                          GAsyncResult *result,
+                          gpointer      user_data)
+{
+  gboolean stale;
+
+  keyring_refreshing = FALSE;
+
+  G_LOCK (keyring);
+  stale = keyring_stale;
+  G_UNLOCK (keyring);
+
+  /* The keyring changed again while being listed */
+  if (stale)
+    pgp_keyring_refresh ();
+}
+
+static void
+pgp_keyring_changed_cb (GFileMonitor      *monitor,
+                        GFile             *file,
+                        GFile             *other_file,
+                        GFileMonitorEvent  event_type,
+                        gpointer           user_data)
+{
+  g_autofree char *basename = NULL;
+
+  basename = g_file_get_basename (file);
+
+  /* gpg writes lock and temporary files, ignore them */
+  if (!g_str_has_prefix (basename, "pubring") &&
+      !g_str_has_prefix (basename, "trustdb") &&
+      !g_str_equal (basename, "private-keys-v1.d"))
+    return;
+
+  CHATTY_TRACE_MSG ("Keyring changed, %s modified", basename);
+
+  G_LOCK (keyring);
+  keyring_stale = TRUE;
+  G_UNLOCK (keyring);
+
+  pgp_keyring_refresh ();
+}
+
+/* The monitor signals are emitted in the main context, so create it only from there */
+static void
+pgp_keyring_ensure_monitor (void)
+{
+  g_autoptr(GFile) home = NULL;
   g_autofree char *path = NULL;
-  g_autoptr(GFile) fingerprint_file = NULL;
-  g_autofree char *system_args = NULL;
-  g_autofree char *file_contents = NULL;
-  gsize content_length = 0;
-  const char *gpg_exec = NULL;
-  char **fpr_tokens = NULL;
-  char *fingerprint = NULL;
-  int i = 0;
-  gboolean success = FALSE;
+
+  if (keyring_monitor || !g_main_context_is_owner (g_main_context_default ()))
+    return;
+
+  if (g_getenv ("GNUPGHOME"))
+    path = g_strdup (g_getenv ("GNUPGHOME"));
+  else
+    path = g_build_filename (g_get_home_dir (), ".gnupg", NULL);
+
+  home = g_file_new_for_path (path);
+  keyring_monitor = g_file_monitor_directory (home, G_FILE_MONITOR_NONE, NULL, NULL);
+
+  if (keyring_monitor)
+    g_signal_connect (keyring_monitor, "changed",
+                      G_CALLBACK (pgp_keyring_changed_cb), NULL);
+}
+
+/* https://github.com/gpg/gnupg/blob/master/doc/DETAILS */
+static GPtrArray *
+pgp_keyring_parse (const char *colons)
+{
+  g_auto(GStrv) lines = NULL;
+  g_autoptr(GPtrArray) uids = NULL;
+  GPtrArray *keys;
+  PgpKey *key = NULL;
+
+  keys = g_ptr_array_new_with_free_func (pgp_key_free);
+  lines = g_strsplit (colons, "\n", -1);
+
+  for (guint i = 0; lines[i]; i++) {
+    g_auto(GStrv) fields = NULL;
+
+    fields = g_strsplit (lines[i], ":", -1);
+
+    if (g_strv_length (fields) < 12)
+      continue;
+
+    if (g_str_equal (fields[0], "pub")) {
+      if (key) {
+        g_ptr_array_add (uids, NULL);
+        key->uids = (GStrv)g_ptr_array_free (g_steal_pointer (&uids), FALSE);
+      }
+
+      key = g_new0 (PgpKey, 1);
+      g_ptr_array_add (keys, key);
+      uids = g_ptr_array_new ();
+
+      key->key_id = g_strdup (fields[4]);
+      key->expires = g_ascii_strtoll (fields[6], NULL, 10);
+      /* revoked, expired, invalid or disabled */
+      key->usable = !strpbrk (fields[1], "reid") && !strchr (fields[11], 'D');
+      /* Capitals are the capabilities of the key with its subkeys */
+      key->can_encrypt = strchr (fields[11], 'E') != NULL;
+    } else if (!key) {
+      continue;
+    } else if (g_str_equal (fields[0], "fpr") && !key->fingerprint) {
+      key->fingerprint = g_strdup (fields[9]);
+    } else if (g_str_equal (fields[0], "uid") && *fields[9]) {
+      /* The uid is escaped as C strings, which g_strcompress () undoes */
+      g_ptr_array_add (uids, g_strcompress (fields[9]));
+    }
+  }
+
+  if (key) {
+    g_ptr_array_add (uids, NULL);
+    key->uids = (GStrv)g_ptr_array_free (g_steal_pointer (&uids), FALSE);
+  }
+
+  return keys;
+}
+
+static GPtrArray *
+pgp_keyring_load (GError **error)
+{
+  g_autoptr(GSubprocess) process = NULL;
+  g_autofree char *colons = NULL;
+  const char *gpg_exec;
 
   gpg_exec = chatty_gpg_get_exec ();
-  if (!gpg_exec || !*gpg_exec)
+  if (!gpg_exec) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "gpg not found");
     return NULL;
+  }
 
-  directory = chatty_pgp_get_tmp_dir ();
-  path = g_build_filename (directory, "fingerprint.txt", NULL);
-  unlink (path);
+  process = g_subprocess_new (G_SUBPROCESS_FLAGS_STDOUT_PIPE | G_SUBPROCESS_FLAGS_STDERR_SILENCE,
+                              error, gpg_exec, "--batch", "--with-colons",
+                              "--fixed-list-mode", "--list-keys", NULL);
 
-  /* https://devhints.io/gnupg */
-  system_args = g_strdup_printf ("%s --with-colons --list-keys %s > %s", gpg_exec, signing_id, path);
-  success = system (system_args);
+  if (!process)
+    return NULL;
 
-  if (success != 0) {
-    g_debug ("Exporting getting fingerprint error: %d", success);
+  if (!g_subprocess_communicate_utf8 (process, NULL, NULL, &colons, NULL, error))
     return NULL;
-  }
 
-  fingerprint_file = g_file_new_for_path (path);
-  g_file_load_contents (fingerprint_file, NULL, &file_contents, &content_length, NULL, &error);
-  if (error) {
-    g_warning ("Getting file contents failed: '%s'", error->message);
+  return pgp_keyring_parse (colons ? colons : "");
+}
+
+/*
+ * List the keys and keep them as the keyring, unless a
+ * listing started later has been kept meanwhile.
+ * May be called from any thread.
+ */
+static GPtrArray *
+pgp_keyring_reload (void)
+{
+  g_autoptr(GError) error = NULL;
+  GPtrArray *keys;
+  guint serial;
+
+  G_LOCK (keyring);
+  serial = ++keyring_serial;
+  keyring_stale = FALSE;
+  G_UNLOCK (keyring);
+
+  keys = pgp_keyring_load (&error);
+
+  if (!keys) {
+    g_debug ("Error listing PGP keys: %s", error->message);
     return NULL;
   }
 
-  fpr_tokens = g_strsplit_set (file_contents, ":\r\n", -1);
-  /* First look for "pub": Public Key */
-  for (i = 0; fpr_tokens[i] != NULL; i++) {
-      if (strstr (fpr_tokens[i], "pub"))
-        break;
+  G_LOCK (keyring);
+  if (serial > keyring_loaded_serial) {
+    g_clear_pointer (&keyring, g_ptr_array_unref);
+    keyring = g_ptr_array_ref (keys);
+    keyring_loaded_serial = serial;
   }
+  G_UNLOCK (keyring);
+
+  return keys;
+}
 
-  /* Then look for "fpr": fingerprint */
-  for ( ; fpr_tokens[i] != NULL; i++) {
-     if (strstr (fpr_tokens[i], "fpr")) {
-       i++;
-       break;
-     }
+/*
+ * Get the keyring, listing the keys only if they were never
+ * listed.  The keyring may be outdated while it's refreshed.
+ * May be called from any thread.
+ */
+static GPtrArray *
+pgp_keyring_get (void)
+{
+  GPtrArray *keys;
+
+  pgp_keyring_ensure_monitor ();
+
+  G_LOCK (keyring);
+  keys = keyring ? g_ptr_array_ref (keyring) : NULL;
+  G_UNLOCK (keyring);
+
+  if (keys)
+    return keys;
+
+  return pgp_keyring_reload ();
+}
+
+static gboolean
+pgp_key_matches (PgpKey     *key,
+                 const char *signing_id)
+{
+  const char *id = signing_id;
+  g_autofree char *needle = NULL;
+
+  /* Same as gpg, 0x may prefix key ids and fingerprints */
+  if (g_str_has_prefix (id, "0x") || g_str_has_prefix (id, "0X"))
+    id += 2;
+
+  if (key->fingerprint && g_ascii_strcasecmp (key->fingerprint, id) == 0)
+    return TRUE;
+
+  if (key->key_id && g_str_has_suffix (key->key_id, id) &&
+      strlen (id) >= 8 && strspn (id, "0123456789abcdefABCDEF") == strlen (id))
+    return TRUE;
+
+  needle = g_utf8_casefold (signing_id, -1);
+
+  /* Otherwise gpg looks for a substring in user ids */
+  for (guint i = 0; key->uids && key->uids[i]; i++) {
+    g_autofree char *uid = NULL;
+
+    uid = g_utf8_casefold (key->uids[i], -1);
+
+    if (strstr (uid, needle))
+      return TRUE;
   }
 
-  /* The next non-empty value is the fingerprint */
-  for ( ; fpr_tokens[i] != NULL; i++) {
-     if (*fpr_tokens[i]) {
-       fingerprint = g_strdup (fpr_tokens[i]);
-       break;
-     }
+  return FALSE;
+}
+
+static PgpKey *
+pgp_keyring_find (GPtrArray  *keys,
+                  const char *signing_id)
+{
+  PgpKey *found = NULL;
+
+  if (!keys || !signing_id || !*signing_id)
+    return NULL;
+
+  for (guint i = 0; i < keys->len; i++) {
+    PgpKey *key = keys->pdata[i];
+
+    if (!pgp_key_matches (key, signing_id))
+      continue;
+
+    /* Prefer a usable key over a revoked or an expired one */
+    if (key->usable)
+      return key;
+
+    if (!found)
+      found = key;
   }
-  g_strfreev (fpr_tokens);
 
-  g_file_delete (fingerprint_file, NULL, &error);
-  if (error)
-    g_warning ("Error deleting file: %s", error->message);
+  return found;
+}
+
+static void
+pgp_load_keyring (GTask        *task,
+                  gpointer      source_object,
+                  gpointer      task_data,
+                  GCancellable *cancellable)
+{
+  g_autoptr(GPtrArray) keys = NULL;
+  gboolean stale;
+
+  G_LOCK (keyring);
+  stale = !keyring || keyring_stale;
+  G_UNLOCK (keyring);
+
+  if (stale)
+    keys = pgp_keyring_reload ();
+  else
+    keys = pgp_keyring_get ();
 
-  if (fingerprint && pretty_format) {
+  g_task_return_boolean (task, !!keys);
+}
+
+/**
+ * chatty_pgp_load_keyring_async:
+ * @callback: (nullable): A #GAsyncReadyCallback
+ * @user_data: The user data for @callback
+ *
+ * List the keys in the keyring in a thread, so that
+ * the following lookups don't block.  The keyring is
+ * listed again only if it changed since it was listed.
+ */
+void
+chatty_pgp_load_keyring_async (GAsyncReadyCallback callback,
+                               gpointer            user_data)
+{
+  g_autoptr(GTask) task = NULL;
+
+  pgp_keyring_ensure_monitor ();
+
+  task = g_task_new (NULL, NULL, callback, user_data);
+  g_task_run_in_thread (task, pgp_load_keyring);
+}
+
+char *
+chatty_pgp_get_pub_fingerprint (const char *signing_id,
+                                gboolean    pretty_format)
+{
+  g_autoptr(GPtrArray) keys = NULL;
+  char *fingerprint = NULL;
+  PgpKey *key;
+
+  if (!signing_id || !*signing_id)
+    return NULL;
+
+  keys = pgp_keyring_get ();
+  key = pgp_keyring_find (keys, signing_id);
+
+  if (!key || !key->fingerprint)
+    return NULL;
+
+  fingerprint = g_strdup (key->fingerprint);
+
+  if (pretty_format) {
     unsigned int fingerprint_length = strlen (fingerprint);
     GString *str = NULL;
 
@@ -680,22 +995,46 @@ chatty_pgp_get_pub_fingerprint (const char *signing_id,
   return fingerprint;
 }
 
+/**
+ * chatty_pgp_can_encrypt_to:
+ * @recipient: The user id, key id or fingerprint
+ *
+ * Check if the keyring has a valid key to
+ * encrypt to @recipient.
+ *
+ * Returns: %TRUE if messages can be encrypted to @recipient
+ */
+gboolean
+chatty_pgp_can_encrypt_to (const char *recipient)
+{
+  g_autoptr(GPtrArray) keys = NULL;
+  PgpKey *key;
+
+  keys = pgp_keyring_get ();
+  key = pgp_keyring_find (keys, recipient);
+
+  if (!key || !key->usable || !key->can_encrypt)
+    return FALSE;
+
+  return !key->expires || key->expires > g_get_real_time () / G_USEC_PER_SEC;
+}
+
 /* This functionality doesn't exist in libcamel, so we have to make it ourselves */
 GFile *
 chatty_pgp_get_pub_key (const char *signing_id,
                         const char *save_directory)
 {
-  g_autofree char *system_args = NULL;
+  g_autoptr(GSubprocess) process = NULL;
+  g_autoptr(GError) error = NULL;
   g_autofree char *path = NULL;
   g_autofree char *directory = NULL;
   g_autofree char *random_file_name = NULL;
   const char *gpg_exec = NULL;
-  int return_code = 0;
 
   if (!signing_id || !*signing_id)
     return NULL;
 
-  if (save_directory || *save_directory)
+  if (save_directory && *save_directory)
     directory = g_strdup (save_directory);
   else
     directory = chatty_pgp_get_tmp_dir ();
@@ -715,11 +1054,12 @@ chatty_pgp_get_pub_key (const char *signing_id,
   if (!gpg_exec || !*gpg_exec)
     return NULL;
 
-  system_args = g_strdup_printf ("%s --armor --output %s --export %s", gpg_exec, path, signing_id);
-  return_code = system (system_args);
+  process = g_subprocess_new (G_SUBPROCESS_FLAGS_NONE, &error,
+                              gpg_exec, "--batch", "--armor", "--output", path,
+                              "--export", signing_id, NULL);
 
-  if (return_code != 0) {
-    g_warning ("Exporting Public key error: %d", return_code);
+  if (!process || !g_subprocess_wait_check (process, NULL, &error)) {
+    g_warning ("Exporting Public key error: %s", error->message);
     return NULL;
   }
 
@@ -738,11 +1078,9 @@ pgp_create_key (GTask        *task,
   g_autofree char *name_email = NULL;
   g_autofree char *passphrase = NULL;
   g_autofree char *options = NULL;
-  g_autofree char *system_args = NULL;
-  g_autofree char *pretty_fingerprint = NULL;
-  g_autoptr(GFile) text_file = NULL;
-  GFileIOStream *iostream;
-  gboolean success = FALSE;
+  g_autoptr(GSubprocess) process = NULL;
+  g_autoptr(GPtrArray) keys = NULL;
+  const char *gpg_exec;
   GError *error = NULL;
 
   key_data_tokens = g_strsplit (key_data, "\n", -1);
@@ -751,55 +1089,33 @@ pgp_create_key (GTask        *task,
   passphrase = g_strdup (key_data_tokens[2]);
   g_strfreev (key_data_tokens);
 
-  /* https://www.gnupg.org/documentation/manuals/gnupg/Unattended-GPG-key-generation.html */
-  /* I know gpgme exists, but I can't really figure out how to use it */
-  options = g_strdup_printf ("Key-Type: RSA\nKey-Usage: sign\nKey-Length: 2048\nSubkey-Type: RSA\nSubkey-Usage: encrypt\nSubkey-Length: 2048\nName-Real: %s\nName-Email: %s\nExpire-Date: 0\nPassphrase: %s\n%%commit",
-                              name_real, name_email, passphrase);
-
-  text_file = g_file_new_tmp ("chatty-pgp-key-options.XXXXXX.txt", &iostream, &error);
-  if (error) {
-    g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED, "Error creating Temp file: %s", error->message);
-    g_warning ("Error creating Temp file: %s", error->message);
-    g_error_free (error);
-
-    g_task_return_boolean (task, FALSE);
-    return;
-  }
-
-  if (!g_file_replace_contents (text_file, options, strlen (options), NULL, FALSE,
-                                G_FILE_CREATE_NONE, NULL, NULL, &error)) {
-    g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED, "Failed to write to file %s: %s",
-                             g_file_peek_path (text_file), error->message);
-    g_warning ("Failed to write to file %s: %s",
-               g_file_peek_path (text_file), error->message);
-    g_error_free (error);
-
-    g_task_return_boolean (task, FALSE);
+  gpg_exec = chatty_gpg_get_exec ();
+  if (!gpg_exec) {
+    g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "gpg not found");
     return;
   }
 
-  /* https://devhints.io/gnupg */
-  system_args = g_strdup_printf ("gpg --batch --generate-key %s", g_file_peek_path (text_file));
-  success = system (system_args);
+  /* https://www.gnupg.org/documentation/manuals/gnupg/Unattended-GPG-key-generation.html */
+  options = g_strdup_printf ("Key-Type: RSA\nKey-Usage: sign\nKey-Length: 2048\nSubkey-Type: RSA\nSubkey-Usage: encrypt\nSubkey-Length: 2048\nName-Real: %s\nName-Email: %s\nExpire-Date: 0\nPassphrase: %s\n%%commit\n",
+                              name_real, name_email, passphrase);
 
-  if (success != 0) {
-    g_warning ("Error Creating Key: %d", success);
-    g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED, "Error Creating Key in gpg %d", success);
-    g_task_return_boolean (task, FALSE);
+  /* Pass the options through stdin so that the passphrase never hits the disk */
+  process = g_subprocess_new (G_SUBPROCESS_FLAGS_STDIN_PIPE, &error,
+                              gpg_exec, "--batch", "--generate-key", NULL);
+
+  if (!process ||
+      !g_subprocess_communicate_utf8 (process, options, cancellable, NULL, NULL, &error) ||
+      !g_subprocess_get_successful (process)) {
+    if (!error)
+      error = g_error_new (G_IO_ERROR, G_IO_ERROR_FAILED, "Error Creating Key in gpg %d",
+                           g_subprocess_get_exit_status (process));
+    g_warning ("Error Creating Key: %s", error->message);
+    g_task_return_error (task, error);
     return;
   }
 
-  if (!g_file_delete (text_file,NULL,&error)) {
-
-    g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED, "Failed to write to file %s: %s",
-                             g_file_peek_path (text_file), error->message);
-    g_warning ("Failed to write to file %s: %s",
-               g_file_peek_path (text_file), error->message);
-    g_error_free (error);
-    g_task_return_boolean (task, FALSE);
-
-    return;
-  }
+  /* Refresh the cache so that the new key can be looked up right away */
+  keys = pgp_keyring_reload ();
 
   g_task_return_boolean (task, TRUE);
 }
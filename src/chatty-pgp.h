@@ -65,8 +65,11 @@ char                *chatty_pgp_get_content (CamelMimePart *mime_part,
 char                *chatty_pgp_get_recipients (CamelMimePart *mime_part);
 GFile               *chatty_pgp_get_pub_key    (const char *signing_id,
                                                 const char *save_directory);
+void                 chatty_pgp_load_keyring_async  (GAsyncReadyCallback  callback,
+                                                     gpointer             user_data);
 char                *chatty_pgp_get_pub_fingerprint (const char *signing_id,
                                                      gboolean    pretty_format);
+gboolean             chatty_pgp_can_encrypt_to      (const char *recipient);
 gboolean             chatty_pgp_create_key_async (const char          *name_real,
                                                   const char          *name_email,
                                                   const char          *passphrase,
@@ -0,0 +1,170 @@
+/* chatty-profile.c
+ *
+ * Copyright 2024 Purism SPC
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define G_LOG_DOMAIN "chatty-profile"
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "chatty-profile.h"
+
+/**
+ * SECTION: chatty-profile
+ * @title: chatty-profile
+ * @short_description: Record the time spent in startup phases
+ * @include: "chatty-profile.h"
+ *
+ * When enabled with chatty_profile_init(), the time spent in
+ * each phase between chatty_profile_begin() and chatty_profile_end()
+ * is recorded.  Once no phase has begun or ended for a second,
+ * the timeline is printed, with phases still running marked so.  When not enabled, recording a phase
+ * costs a single check.
+ */
+
+/* Time to wait for more phases before printing the timeline */
+#define DUMP_TIMEOUT 1
+
+typedef struct {
+  const char *name;
+  gint64      begin;
+  gint64      end;
+} ProfilePhase;
+
+static GArray *phases;
+static gint64 start_time;
+static guint dump_id;
+/* Whether phases changed since the timeline was last printed */
+static gboolean changed;
+
+static gboolean
+profile_dump_cb (gpointer user_data)
+{
+  dump_id = 0;
+  chatty_profile_dump ();
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+profile_changed (void)
+{
+  changed = TRUE;
+
+  g_clear_handle_id (&dump_id, g_source_remove);
+  dump_id = g_timeout_add_seconds (DUMP_TIMEOUT, profile_dump_cb, NULL);
+}
+
+/**
+ * chatty_profile_init:
+ *
+ * Enable recording startup phases.  The timeline
+ * starts at the time this function is called.
+ */
+void
+chatty_profile_init (void)
+{
+  if (phases)
+    return;
+
+  phases = g_array_new (FALSE, TRUE, sizeof (ProfilePhase));
+  start_time = g_get_monotonic_time ();
+}
+
+gboolean
+chatty_profile_is_enabled (void)
+{
+  return phases != NULL;
+}
+
+/**
+ * chatty_profile_begin:
+ * @phase: (transfer none): A static string naming the phase
+ *
+ * Mark the beginning of @phase.
+ *
+ * Returns: An id to pass to chatty_profile_end(), or 0
+ * if profiling is not enabled
+ */
+guint
+chatty_profile_begin (const char *phase)
+{
+  ProfilePhase entry = { 0 };
+
+  if (!phases)
+    return 0;
+
+  g_return_val_if_fail (phase && *phase, 0);
+
+  entry.name = phase;
+  entry.begin = g_get_monotonic_time ();
+  g_array_append_val (phases, entry);
+  profile_changed ();
+
+  return phases->len;
+}
+
+/**
+ * chatty_profile_end:
+ * @id: The id returned by chatty_profile_begin()
+ *
+ * Mark the end of the phase with @id.  Does
+ * nothing if @id is 0.
+ */
+void
+chatty_profile_end (guint id)
+{
+  ProfilePhase *entry;
+
+  if (!phases || !id)
+    return;
+
+  g_return_if_fail (id <= phases->len);
+
+  entry = &g_array_index (phases, ProfilePhase, id - 1);
+  g_return_if_fail (!entry->end);
+
+  entry->end = g_get_monotonic_time ();
+  profile_changed ();
+}
+
+/**
+ * chatty_profile_dump:
+ *
+ * Print the recorded phases, with the time they began
+ * relative to chatty_profile_init() and their duration.
+ * Nothing is printed if no phase changed since the
+ * timeline was last printed.
+ */
+void
+chatty_profile_dump (void)
+{
+  g_autoptr(GString) str = NULL;
+
+  if (!phases || !changed)
+    return;
+
+  g_clear_handle_id (&dump_id, g_source_remove);
+  changed = FALSE;
+  str = g_string_new ("Startup profile:\n");
+  g_string_append_printf (str, "  %10s  %10s  %s\n", "start (ms)", "time (ms)", "phase");
+
+  for (guint i = 0; i < phases->len; i++) {
+    ProfilePhase *entry = &g_array_index (phases, ProfilePhase, i);
+
+    g_string_append_printf (str, "  %10.1f  ", (entry->begin - start_time) / 1000.0);
+
+    if (entry->end)
+      g_string_append_printf (str, "%10.1f  ", (entry->end - entry->begin) / 1000.0);
+    else
+      g_string_append_printf (str, "%10s  ", "running");
+
+    g_string_append_printf (str, "%s\n", entry->name);
+  }
+
+  g_print ("%s", str->str);
+}
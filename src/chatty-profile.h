@@ -0,0 +1,20 @@
+/* chatty-profile.h
+ *
+ * Copyright 2024 Purism SPC
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+void      chatty_profile_init       (void);
+gboolean  chatty_profile_is_enabled (void);
+guint     chatty_profile_begin      (const char *phase);
+void      chatty_profile_end        (guint       id);
+void      chatty_profile_dump       (void);
+
+G_END_DECLS
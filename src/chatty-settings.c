@@ -809,6 +809,39 @@ chatty_settings_request_sms_delivery_reports (ChattySettings *self)
                                  "request-sms-delivery-reports");
 }
 
+/**
+ * chatty_settings_get_media_cache_size:
+ * @self: A #ChattySettings
+ *
+ * Get the size budget of the media cache.
+ *
+ * Returns: The maximum size in bytes, or 0 for no limit
+ */
+goffset
+chatty_settings_get_media_cache_size (ChattySettings *self)
+{
+  g_return_val_if_fail (CHATTY_IS_SETTINGS (self), 0);
+
+  return (goffset)g_settings_get_uint (G_SETTINGS (self->settings), "media-cache-size") * 1024 * 1024;
+}
+
+/**
+ * chatty_settings_get_message_cache_pages:
+ * @self: A #ChattySettings
+ *
+ * Get the number of pages of past messages
+ * a chat keeps in memory.
+ *
+ * Returns: The number of pages
+ */
+guint
+chatty_settings_get_message_cache_pages (ChattySettings *self)
+{
+  g_return_val_if_fail (CHATTY_IS_SETTINGS (self), 0);
+
+  return g_settings_get_uint (G_SETTINGS (self->settings), "message-cache-pages");
+}
+
 gboolean
 chatty_settings_get_experimental_features (ChattySettings *self)
 {
@@ -67,6 +67,8 @@ gboolean        chatty_settings_request_sms_delivery_reports (ChattySettings *se
 gboolean        chatty_settings_get_clear_out_stuck_sms      (ChattySettings *self);
 void            chatty_settings_set_clear_out_stuck_sms      (ChattySettings *self,
                                                               gboolean clear_sms);
+goffset         chatty_settings_get_media_cache_size         (ChattySettings *self);
+guint           chatty_settings_get_message_cache_pages      (ChattySettings *self);
 gboolean        chatty_settings_get_experimental_features    (ChattySettings *self);
 void            chatty_settings_enable_experimental_features (ChattySettings *self,
                                                               gboolean        enable);
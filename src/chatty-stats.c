@@ -0,0 +1,246 @@
+/* chatty-stats.c
+ *
+ * Copyright 2024 Purism SPC
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define G_LOG_DOMAIN "chatty-stats"
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#define CMATRIX_USE_EXPERIMENTAL_API
+#include <cmatrix.h>
+
+#include "chatty-stats.h"
+
+/**
+ * SECTION: chatty-stats
+ * @title: chatty-stats
+ * @short_description: Counters and histograms of hot paths
+ * @include: "chatty-stats.h"
+ *
+ * Each #ChattyStat keeps a count, a sum, a maximum and a
+ * histogram of the values recorded with chatty_stats_record(),
+ * with one bucket per power of two.  Recording takes a few
+ * atomic operations and no lock, so it can be done from any
+ * thread and is always enabled.  Percentiles are estimated
+ * from the histogram, and so are rounded up to the next
+ * power of two.
+ */
+
+#define N_BUCKETS 32
+
+typedef enum {
+  STAT_UNIT_USEC,
+  STAT_UNIT_ITEMS,
+  STAT_UNIT_COUNT,
+} StatUnit;
+
+typedef struct {
+  const char *name;
+  StatUnit    unit;
+} StatInfo;
+
+typedef struct {
+  guint  count;
+  gssize sum;
+  gint   max;
+  guint  buckets[N_BUCKETS];
+} StatData;
+
+static const StatInfo stat_info[CHATTY_N_STATS] = {
+  [CHATTY_STAT_HISTORY_QUEUE_DEPTH] = { "history-queue-depth", STAT_UNIT_ITEMS },
+  [CHATTY_STAT_HISTORY_TASK] = { "history-task", STAT_UNIT_USEC },
+  [CHATTY_STAT_SMS_RECEIVE] = { "sms-receive-to-display", STAT_UNIT_USEC },
+  [CHATTY_STAT_MATRIX_SYNC] = { "matrix-sync", STAT_UNIT_USEC },
+  [CHATTY_STAT_MATRIX_PARSE] = { "matrix-json-parse", STAT_UNIT_USEC },
+  [CHATTY_STAT_MATRIX_SYNC_HANDLE] = { "matrix-sync-handle", STAT_UNIT_USEC },
+  [CHATTY_STAT_MATRIX_DECRYPT] = { "matrix-decrypt", STAT_UNIT_USEC },
+  [CHATTY_STAT_IMAGE_DECODE] = { "image-decode", STAT_UNIT_USEC },
+  [CHATTY_STAT_CHAT_LIST_CHANGE] = { "chat-list-change", STAT_UNIT_ITEMS },
+  [CHATTY_STAT_CHAT_COMPARE] = { "chat-compare", STAT_UNIT_COUNT },
+};
+
+static StatData stats[CHATTY_N_STATS];
+
+static void
+stats_matrix_cb (CmStat   stat,
+                 gint64   usec,
+                 gpointer user_data)
+{
+  switch (stat)
+    {
+    case CM_STAT_SYNC:
+      chatty_stats_record (CHATTY_STAT_MATRIX_SYNC, usec);
+      break;
+
+    case CM_STAT_JSON_PARSE:
+      chatty_stats_record (CHATTY_STAT_MATRIX_PARSE, usec);
+      break;
+
+    case CM_STAT_SYNC_HANDLE:
+      chatty_stats_record (CHATTY_STAT_MATRIX_SYNC_HANDLE, usec);
+      break;
+
+    case CM_STAT_DECRYPT:
+      chatty_stats_record (CHATTY_STAT_MATRIX_DECRYPT, usec);
+      break;
+
+    default:
+      break;
+    }
+}
+
+/* The upper bound of the bucket the p-th value falls in */
+static gint64
+stats_get_percentile (StatData *data,
+                      guint     count,
+                      double    p)
+{
+  guint target, total = 0;
+
+  target = MAX (1, (guint)(count * p + 0.5));
+
+  for (guint i = 0; i < N_BUCKETS; i++) {
+    total += g_atomic_int_get (&data->buckets[i]);
+
+    if (total >= target)
+      return MIN (((gint64)1 << i) - 1, g_atomic_int_get (&data->max));
+  }
+
+  return g_atomic_int_get (&data->max);
+}
+
+static void
+stats_append_value (GString  *str,
+                    StatUnit  unit,
+                    double    value)
+{
+  if (unit == STAT_UNIT_USEC)
+    g_string_append_printf (str, " %10.2f", value / 1000.0);
+  else
+    g_string_append_printf (str, " %10.0f", value);
+}
+
+/**
+ * chatty_stats_init:
+ *
+ * Forward the timings of libcmatrix to the
+ * matrix stats.  Should be called once, after
+ * cm_init().
+ */
+void
+chatty_stats_init (void)
+{
+  cm_utils_set_stats_func (stats_matrix_cb, NULL);
+}
+
+/**
+ * chatty_stats_record:
+ * @stat: A #ChattyStat
+ * @value: The value to record, in microseconds for timings
+ *
+ * Record @value for @stat.  Negative values are
+ * recorded as 0.  This can be called from any thread.
+ */
+void
+chatty_stats_record (ChattyStat stat,
+                     gint64     value)
+{
+  StatData *data;
+  gint old_max;
+  guint bucket;
+
+  g_return_if_fail (stat < CHATTY_N_STATS);
+
+  data = &stats[stat];
+  value = CLAMP (value, 0, G_MAXINT);
+  bucket = MIN (g_bit_storage (value), N_BUCKETS - 1);
+
+  g_atomic_int_inc (&data->count);
+  g_atomic_pointer_add (&data->sum, value);
+  g_atomic_int_inc (&data->buckets[bucket]);
+
+  old_max = g_atomic_int_get (&data->max);
+  while (value > old_max &&
+         !g_atomic_int_compare_and_exchange_full (&data->max, old_max, (gint)value, &old_max))
+    ;
+}
+
+/**
+ * chatty_stats_record_since:
+ * @stat: A #ChattyStat
+ * @begin_time: A time from g_get_monotonic_time()
+ *
+ * Record the time elapsed since @begin_time for @stat.
+ */
+void
+chatty_stats_record_since (ChattyStat stat,
+                           gint64     begin_time)
+{
+  chatty_stats_record (stat, g_get_monotonic_time () - begin_time);
+}
+
+/**
+ * chatty_stats_reset:
+ *
+ * Forget all values recorded.  Values recorded
+ * from other threads meanwhile may be partially
+ * kept.
+ */
+void
+chatty_stats_reset (void)
+{
+  for (guint i = 0; i < CHATTY_N_STATS; i++) {
+    StatData *data = &stats[i];
+
+    g_atomic_int_set (&data->count, 0);
+    g_atomic_pointer_set (&data->sum, 0);
+    g_atomic_int_set (&data->max, 0);
+
+    for (guint j = 0; j < N_BUCKETS; j++)
+      g_atomic_int_set (&data->buckets[j], 0);
+  }
+}
+
+/**
+ * chatty_stats_to_string:
+ *
+ * Get a table of the recorded stats, one line each.
+ * Timings are in milliseconds.
+ *
+ * Returns: (transfer full): A newly allocated string
+ */
+char *
+chatty_stats_to_string (void)
+{
+  GString *str;
+
+  str = g_string_new (NULL);
+  g_string_append_printf (str, "%-24s %10s %10s %10s %10s %10s %10s\n",
+                          "stat", "count", "mean", "p50", "p90", "p99", "max");
+
+  for (guint i = 0; i < CHATTY_N_STATS; i++) {
+    StatData *data = &stats[i];
+    const StatInfo *info = &stat_info[i];
+    guint count;
+
+    count = g_atomic_int_get (&data->count);
+    g_string_append_printf (str, "%-24s %10u", info->name, count);
+
+    if (info->unit != STAT_UNIT_COUNT && count) {
+      stats_append_value (str, info->unit, (double)(gssize)g_atomic_pointer_get (&data->sum) / count);
+      stats_append_value (str, info->unit, stats_get_percentile (data, count, 0.5));
+      stats_append_value (str, info->unit, stats_get_percentile (data, count, 0.9));
+      stats_append_value (str, info->unit, stats_get_percentile (data, count, 0.99));
+      stats_append_value (str, info->unit, g_atomic_int_get (&data->max));
+    }
+
+    g_string_append_c (str, '\n');
+  }
+
+  return g_string_free (str, FALSE);
+}
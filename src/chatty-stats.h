@@ -0,0 +1,36 @@
+/* chatty-stats.h
+ *
+ * Copyright 2024 Purism SPC
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+  CHATTY_STAT_HISTORY_QUEUE_DEPTH,
+  CHATTY_STAT_HISTORY_TASK,
+  CHATTY_STAT_SMS_RECEIVE,
+  CHATTY_STAT_MATRIX_SYNC,
+  CHATTY_STAT_MATRIX_PARSE,
+  CHATTY_STAT_MATRIX_SYNC_HANDLE,
+  CHATTY_STAT_MATRIX_DECRYPT,
+  CHATTY_STAT_IMAGE_DECODE,
+  CHATTY_STAT_CHAT_LIST_CHANGE,
+  CHATTY_STAT_CHAT_COMPARE,
+  CHATTY_N_STATS
+} ChattyStat;
+
+void   chatty_stats_init         (void);
+void   chatty_stats_record       (ChattyStat  stat,
+                                  gint64      value);
+void   chatty_stats_record_since (ChattyStat  stat,
+                                  gint64      begin_time);
+void   chatty_stats_reset        (void);
+char  *chatty_stats_to_string    (void);
+
+G_END_DECLS
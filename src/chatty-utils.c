@@ -18,6 +18,7 @@
 
 #include "chatty-manager.h"
 #include "chatty-settings.h"
+#include "chatty-stats.h"
 #include "chatty-phone-utils.h"
 #include "chatty-utils.h"
 #include <libebook-contacts/libebook-contacts.h>
@@ -787,19 +788,52 @@ chatty_utils_get_pixbuf_from_data (const guchar *buf,
   return g_object_ref (pixbuf);
 }
 
+/* Thumbnailing is CPU heavy, don't let it starve the rest */
+#define MAX_THUMBNAIL_THREADS 2
+
+typedef struct {
+  GFile     *file;
+  char      *uri;
+  /* GTasks waiting for the thumbnail */
+  GPtrArray *tasks;
+  int        io_priority;
+} ThumbnailJob;
+
+/* All access to thumbnail_jobs and the tasks of a job shall be locked */
+G_LOCK_DEFINE_STATIC (thumbnail_jobs);
+static GHashTable *thumbnail_jobs;
+static GThreadPool *thumbnail_pool;
+static GnomeDesktopThumbnailFactory *thumbnail_factory;
+
 static void
-utils_create_thumbnail (GTask        *task,
-                        gpointer      source_object,
-                        gpointer      task_data,
-                        GCancellable *cancellable)
+thumbnail_job_free (ThumbnailJob *job)
+{
+  g_clear_object (&job->file);
+  g_clear_pointer (&job->tasks, g_ptr_array_unref);
+  g_free (job->uri);
+  g_free (job);
+}
+
+static int
+thumbnail_job_compare (gconstpointer a,
+                       gconstpointer b,
+                       gpointer      user_data)
+{
+  const ThumbnailJob *job_a = a;
+  const ThumbnailJob *job_b = b;
+
+  /* Lower value means more urgent, as with GLib priorities */
+  return (job_a->io_priority > job_b->io_priority) - (job_a->io_priority < job_b->io_priority);
+}
+
+static gboolean
+utils_create_thumbnail (GFile   *file,
+                        GError **error)
 {
-  g_autoptr(GnomeDesktopThumbnailFactory) factory = NULL;
   g_autoptr(GdkPixbuf) thumbnail = NULL;
   g_autoptr(GFileInfo) file_info = NULL;
   g_autofree char *uri = NULL;
-  GFile *file = task_data;
   const char *content_type;
-  GError *error = NULL;
   gboolean thumbnail_valid, thumbnail_failed;
   time_t mtime;
 
@@ -809,76 +843,151 @@ utils_create_thumbnail (GTask        *task,
                                  G_FILE_ATTRIBUTE_TIME_MODIFIED ","
                                  G_FILE_ATTRIBUTE_STANDARD_FAST_CONTENT_TYPE,
                                  G_FILE_QUERY_INFO_NONE,
-                                 NULL, &error);
-  if (error) {
-    g_task_return_error (task, error);
-    return;
-  }
+                                 NULL, error);
+  if (!file_info)
+    return FALSE;
 
   thumbnail_valid = g_file_info_get_attribute_boolean (file_info, G_FILE_ATTRIBUTE_THUMBNAIL_IS_VALID);
   thumbnail_failed = g_file_info_get_attribute_boolean (file_info, G_FILE_ATTRIBUTE_THUMBNAILING_FAILED);
 
-  if (thumbnail_valid && thumbnail_failed) {
-    g_task_return_boolean (task, TRUE);
-    return;
-  }
+  if (thumbnail_valid && thumbnail_failed)
+    return TRUE;
 
   uri = g_file_get_uri (file);
-  factory = gnome_desktop_thumbnail_factory_new (GNOME_DESKTOP_THUMBNAIL_SIZE_LARGE);
   content_type = g_file_info_get_attribute_string (file_info, G_FILE_ATTRIBUTE_STANDARD_FAST_CONTENT_TYPE);
   mtime = g_file_info_get_attribute_uint64 (file_info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
 
-  if (!gnome_desktop_thumbnail_factory_can_thumbnail (factory, uri, content_type, mtime)) {
-    g_task_return_boolean (task, FALSE);
-    return;
-  }
+  if (!gnome_desktop_thumbnail_factory_can_thumbnail (thumbnail_factory, uri, content_type, mtime))
+    return FALSE;
 
-  if (gnome_desktop_thumbnail_factory_has_valid_failed_thumbnail (factory, uri, mtime)) {
-    g_task_return_boolean (task, FALSE);
-    return;
-  }
+  if (gnome_desktop_thumbnail_factory_has_valid_failed_thumbnail (thumbnail_factory, uri, mtime))
+    return FALSE;
 
   if (!content_type) {
-    g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
-                             "NULL content type");
-    return;
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                 "NULL content type");
+    return FALSE;
   }
 
-  thumbnail = gnome_desktop_thumbnail_factory_generate_thumbnail (factory, uri, content_type, NULL, &error);
+  thumbnail = gnome_desktop_thumbnail_factory_generate_thumbnail (thumbnail_factory, uri, content_type, NULL, error);
   if (!thumbnail) {
-    g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED, "Failed to create thumbnail for file: %s (%s)", uri, error->message);
-
+    g_prefix_error (error, "Failed to create thumbnail for file: %s ", uri);
     g_warning ("Failed to create thumbnail for file: %s", uri);
 
-    g_error_free (error);
-    return;
+    return FALSE;
   }
 
-  gnome_desktop_thumbnail_factory_save_thumbnail (factory, thumbnail, uri, mtime, NULL, &error);
-  if (error) {
-    g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED, "Failed to create thumbnail for file: %s (%s)", uri, error->message);
-    g_error_free (error);
-    return;
+  if (!gnome_desktop_thumbnail_factory_save_thumbnail (thumbnail_factory, thumbnail, uri, mtime, NULL, error)) {
+    g_prefix_error (error, "Failed to create thumbnail for file: %s ", uri);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static void
+thumbnail_pool_func (gpointer data,
+                     gpointer user_data)
+{
+  ThumbnailJob *job = data;
+  g_autoptr(GPtrArray) tasks = NULL;
+  GError *error = NULL;
+  gboolean cancelled = TRUE, success = FALSE;
+
+  /* Don't waste time on files no one waits for anymore, eg: rows scrolled away */
+  G_LOCK (thumbnail_jobs);
+  for (guint i = 0; i < job->tasks->len; i++)
+    cancelled &= g_cancellable_is_cancelled (g_task_get_cancellable (job->tasks->pdata[i]));
+  G_UNLOCK (thumbnail_jobs);
+
+  if (!cancelled)
+    success = utils_create_thumbnail (job->file, &error);
+
+  /* Requests for the same file done until now shall share the result */
+  G_LOCK (thumbnail_jobs);
+  g_hash_table_steal (thumbnail_jobs, job->uri);
+  tasks = g_steal_pointer (&job->tasks);
+  G_UNLOCK (thumbnail_jobs);
+
+  for (guint i = 0; i < tasks->len; i++) {
+    GTask *task = tasks->pdata[i];
+
+    if (error)
+      g_task_return_error (task, g_error_copy (error));
+    else if (cancelled)
+      g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                               "Thumbnail request cancelled");
+    else
+      g_task_return_boolean (task, success);
   }
 
-  g_task_return_boolean (task, TRUE);
+  g_clear_error (&error);
+  thumbnail_job_free (job);
 }
 
+/**
+ * chatty_utils_create_thumbnail_async:
+ * @file: A #GFile
+ * @io_priority: The I/O priority of the request
+ * @cancellable: (nullable): A #GCancellable
+ * @callback: A #GAsyncReadyCallback
+ * @user_data: The user data for @callback
+ *
+ * Create the thumbnail for @file and store it in the
+ * thumbnail cache.  Requests are run in a small shared
+ * thread pool, more urgent @io_priority first.  Requests
+ * for the same file while one is pending are coalesced.
+ * Requests cancelled before started are skipped.
+ */
 void
 chatty_utils_create_thumbnail_async (GFile               *file,
+                                     int                  io_priority,
                                      GCancellable        *cancellable,
                                      GAsyncReadyCallback  callback,
                                      gpointer             user_data)
 {
   g_autoptr(GTask) task = NULL;
+  g_autofree char *uri = NULL;
+  ThumbnailJob *job;
 
   g_return_if_fail (G_IS_FILE (file));
   g_return_if_fail (callback);
 
   task = g_task_new (NULL, cancellable, callback, user_data);
-  g_task_set_task_data (task, g_object_ref (file), g_object_unref);
+  g_task_set_source_tag (task, chatty_utils_create_thumbnail_async);
+  g_task_set_priority (task, io_priority);
+
+  G_LOCK (thumbnail_jobs);
+
+  if (!thumbnail_pool) {
+    thumbnail_factory = gnome_desktop_thumbnail_factory_new (GNOME_DESKTOP_THUMBNAIL_SIZE_LARGE);
+    thumbnail_jobs = g_hash_table_new (g_str_hash, g_str_equal);
+    thumbnail_pool = g_thread_pool_new (thumbnail_pool_func, NULL,
+                                        MAX_THUMBNAIL_THREADS, FALSE, NULL);
+    g_thread_pool_set_sort_function (thumbnail_pool, thumbnail_job_compare, NULL);
+  }
 
-  g_task_run_in_thread (task, utils_create_thumbnail);
+  uri = g_file_get_uri (file);
+  job = g_hash_table_lookup (thumbnail_jobs, uri);
+
+  if (job) {
+    g_ptr_array_add (job->tasks, g_steal_pointer (&task));
+    G_UNLOCK (thumbnail_jobs);
+
+    return;
+  }
+
+  job = g_new0 (ThumbnailJob, 1);
+  job->file = g_object_ref (file);
+  job->uri = g_steal_pointer (&uri);
+  job->io_priority = io_priority;
+  job->tasks = g_ptr_array_new_with_free_func (g_object_unref);
+  g_ptr_array_add (job->tasks, g_steal_pointer (&task));
+  g_hash_table_insert (thumbnail_jobs, job->uri, job);
+
+  G_UNLOCK (thumbnail_jobs);
+
+  g_thread_pool_push (thumbnail_pool, job, NULL);
 }
 
 gboolean
@@ -889,3 +998,180 @@ chatty_utils_create_thumbnail_finish (GAsyncResult  *result,
 
   return g_task_propagate_boolean (G_TASK (result), error);
 }
+
+/* Decoding is CPU heavy, keep a core free for the UI */
+#define MAX_DECODE_THREADS 2
+
+static GThreadPool *decode_pool;
+
+static int
+decode_task_compare (gconstpointer a,
+                     gconstpointer b,
+                     gpointer      user_data)
+{
+  int priority_a = g_task_get_priority ((GTask *)a);
+  int priority_b = g_task_get_priority ((GTask *)b);
+
+  return (priority_a > priority_b) - (priority_a < priority_b);
+}
+
+static void
+decode_pool_func (gpointer data,
+                  gpointer user_data)
+{
+  g_autoptr(GTask) task = data;
+  GInputStream *stream;
+  GCancellable *cancellable;
+  GError *error = NULL;
+  gboolean animation;
+  gint64 begin_time;
+  int width;
+
+  /* Skip requests of widgets that are already gone */
+  if (g_task_return_error_if_cancelled (task))
+    return;
+
+  begin_time = g_get_monotonic_time ();
+
+  stream = g_task_get_task_data (task);
+  cancellable = g_task_get_cancellable (task);
+  width = GPOINTER_TO_INT (g_object_get_data (G_OBJECT (task), "width"));
+  animation = GPOINTER_TO_INT (g_object_get_data (G_OBJECT (task), "animation"));
+
+  if (animation) {
+    GdkPixbufAnimation *pixbuf_animation;
+
+    pixbuf_animation = gdk_pixbuf_animation_new_from_stream (stream, cancellable, &error);
+
+    if (pixbuf_animation)
+      g_task_return_pointer (task, pixbuf_animation, g_object_unref);
+    else
+      g_task_return_error (task, error);
+  } else {
+    GdkPixbuf *pixbuf;
+
+    if (width > 0)
+      pixbuf = gdk_pixbuf_new_from_stream_at_scale (stream, width, -1, TRUE, cancellable, &error);
+    else
+      pixbuf = gdk_pixbuf_new_from_stream (stream, cancellable, &error);
+
+    if (pixbuf)
+      g_task_return_pointer (task, pixbuf, g_object_unref);
+    else
+      g_task_return_error (task, error);
+  }
+
+  chatty_stats_record_since (CHATTY_STAT_IMAGE_DECODE, begin_time);
+}
+
+static void
+utils_push_decode_task (GTask *task)
+{
+  if (g_once_init_enter (&decode_pool)) {
+    GThreadPool *pool;
+
+    pool = g_thread_pool_new (decode_pool_func, NULL, MAX_DECODE_THREADS, FALSE, NULL);
+    g_thread_pool_set_sort_function (pool, decode_task_compare, NULL);
+    g_once_init_leave (&decode_pool, pool);
+  }
+
+  g_thread_pool_push (decode_pool, task, NULL);
+}
+
+/**
+ * chatty_utils_decode_image_async:
+ * @stream: A #GInputStream with the image data
+ * @width: The width to scale the image to, or -1
+ * @io_priority: The I/O priority of the request
+ * @cancellable: (nullable): A #GCancellable
+ * @callback: A #GAsyncReadyCallback
+ * @user_data: The user data for @callback
+ *
+ * Decode the image in @stream in a shared thread pool,
+ * scaled down to @width keeping the aspect ratio.
+ * More urgent @io_priority requests are run first,
+ * eg: those for widgets on screen.  Finish with
+ * chatty_utils_decode_image_finish().
+ */
+void
+chatty_utils_decode_image_async (GInputStream        *stream,
+                                 int                  width,
+                                 int                  io_priority,
+                                 GCancellable        *cancellable,
+                                 GAsyncReadyCallback  callback,
+                                 gpointer             user_data)
+{
+  GTask *task;
+
+  g_return_if_fail (G_IS_INPUT_STREAM (stream));
+
+  task = g_task_new (NULL, cancellable, callback, user_data);
+  g_task_set_source_tag (task, chatty_utils_decode_image_async);
+  g_task_set_priority (task, io_priority);
+  g_task_set_task_data (task, g_object_ref (stream), g_object_unref);
+  g_object_set_data (G_OBJECT (task), "width", GINT_TO_POINTER (width));
+
+  utils_push_decode_task (task);
+}
+
+/**
+ * chatty_utils_decode_image_finish:
+ * @result: A #GAsyncResult
+ * @error: A #GError
+ *
+ * Finish operation started by chatty_utils_decode_image_async()
+ *
+ * Returns: (transfer full): The decoded #GdkPixbuf or
+ * %NULL with @error set.
+ */
+GdkPixbuf *
+chatty_utils_decode_image_finish (GAsyncResult  *result,
+                                  GError       **error)
+{
+  g_return_val_if_fail (G_IS_TASK (result), NULL);
+  g_return_val_if_fail (!error || !*error, NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+/**
+ * chatty_utils_decode_animation_async:
+ * @stream: A #GInputStream with the image data
+ * @io_priority: The I/O priority of the request
+ * @cancellable: (nullable): A #GCancellable
+ * @callback: A #GAsyncReadyCallback
+ * @user_data: The user data for @callback
+ *
+ * Same as chatty_utils_decode_image_async(), but decodes
+ * all frames of animated images like GIFs.  Finish with
+ * chatty_utils_decode_animation_finish().
+ */
+void
+chatty_utils_decode_animation_async (GInputStream        *stream,
+                                     int                  io_priority,
+                                     GCancellable        *cancellable,
+                                     GAsyncReadyCallback  callback,
+                                     gpointer             user_data)
+{
+  GTask *task;
+
+  g_return_if_fail (G_IS_INPUT_STREAM (stream));
+
+  task = g_task_new (NULL, cancellable, callback, user_data);
+  g_task_set_source_tag (task, chatty_utils_decode_animation_async);
+  g_task_set_priority (task, io_priority);
+  g_task_set_task_data (task, g_object_ref (stream), g_object_unref);
+  g_object_set_data (G_OBJECT (task), "animation", GINT_TO_POINTER (TRUE));
+
+  utils_push_decode_task (task);
+}
+
+GdkPixbufAnimation *
+chatty_utils_decode_animation_finish (GAsyncResult  *result,
+                                      GError       **error)
+{
+  g_return_val_if_fail (G_IS_TASK (result), NULL);
+  g_return_val_if_fail (!error || !*error, NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
@@ -39,8 +39,24 @@ gboolean chatty_utils_remove_list_item  (GListStore *store,
 GdkPixbuf           *chatty_utils_get_pixbuf_from_data  (const guchar *buf,
                                                          gsize         count);
 void      chatty_utils_create_thumbnail_async  (GFile               *file,
+                                                int                  io_priority,
                                                 GCancellable        *cancellable,
                                                 GAsyncReadyCallback callback,
                                                 gpointer       user_data);
 gboolean  chatty_utils_create_thumbnail_finish (GAsyncResult  *result,
                                                 GError       **error);
+void      chatty_utils_decode_image_async      (GInputStream        *stream,
+                                                int                  width,
+                                                int                  io_priority,
+                                                GCancellable        *cancellable,
+                                                GAsyncReadyCallback  callback,
+                                                gpointer             user_data);
+GdkPixbuf *chatty_utils_decode_image_finish    (GAsyncResult        *result,
+                                                GError             **error);
+void      chatty_utils_decode_animation_async  (GInputStream        *stream,
+                                                int                  io_priority,
+                                                GCancellable        *cancellable,
+                                                GAsyncReadyCallback  callback,
+                                                gpointer             user_data);
+GdkPixbufAnimation *chatty_utils_decode_animation_finish (GAsyncResult  *result,
+                                                          GError       **error);
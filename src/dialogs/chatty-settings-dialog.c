@@ -987,6 +987,9 @@ pgp_settings_row_activated_cb (ChattySettingsDialog *self)
   gtk_widget_set_visible (self->back_button, FALSE);
   adw_header_bar_set_show_end_title_buttons (ADW_HEADER_BAR (self->header_bar), FALSE);
 
+  /* Fingerprints are looked up on save, have the keys ready by then */
+  chatty_pgp_load_keyring_async (NULL, NULL);
+
   gtk_stack_set_visible_child_name (GTK_STACK (self->main_stack), "pgp-settings-view");
 }
 
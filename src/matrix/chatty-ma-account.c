@@ -14,6 +14,8 @@
 #include <glib/gi18n.h>
 
 #include "chatty-history.h"
+#include "chatty-manager.h"
+#include "chatty-media-cache.h"
 #include "chatty-utils.h"
 #include "chatty-ma-chat.h"
 #include "chatty-ma-key-chat.h"
@@ -357,6 +359,23 @@ chatty_ma_account_get_username (ChattyItem *item)
   return "";
 }
 
+static void
+ma_account_decode_avatar_cb (GObject      *object,
+                             GAsyncResult *result,
+                             gpointer      user_data)
+{
+  g_autoptr(ChattyMaAccount) self = user_data;
+  g_autoptr(GdkPixbuf) avatar = NULL;
+
+  avatar = chatty_utils_decode_image_finish (result, NULL);
+
+  if (self->avatar)
+    return;
+
+  self->avatar = g_steal_pointer (&avatar);
+  g_signal_emit_by_name (self, "avatar-changed", 0);
+}
+
 static void
 ma_account_get_avatar_cb (GObject      *object,
                           GAsyncResult *result,
@@ -374,8 +393,40 @@ ma_account_get_avatar_cb (GObject      *object,
   if (error || !stream)
     return;
 
-  self->avatar = gdk_pixbuf_new_from_stream (stream, NULL, NULL);
-  g_signal_emit_by_name (self, "avatar-changed", 0);
+  if (cm_user_get_avatar_file (CM_USER (object)) && cm_user_get_avatar_url (CM_USER (object)))
+    chatty_media_cache_add_async (chatty_manager_get_media_cache (chatty_manager_get_default ()),
+                                  cm_user_get_avatar_file (CM_USER (object)),
+                                  cm_user_get_avatar_url (CM_USER (object)),
+                                  TRUE, NULL, NULL, NULL);
+
+  chatty_utils_decode_image_async (stream, -1, G_PRIORITY_DEFAULT, NULL,
+                                   ma_account_decode_avatar_cb,
+                                   g_steal_pointer (&self));
+}
+
+static void
+ma_account_load_avatar_cb (GObject      *object,
+                           GAsyncResult *result,
+                           gpointer      user_data)
+{
+  g_autoptr(ChattyMaAccount) self = user_data;
+  g_autoptr(GdkPixbuf) avatar = NULL;
+
+  avatar = chatty_media_cache_load_image_finish (CHATTY_MEDIA_CACHE (object), result, NULL);
+
+  if (self->avatar)
+    return;
+
+  if (avatar) {
+    self->avatar = g_steal_pointer (&avatar);
+    g_signal_emit_by_name (self, "avatar-changed", 0);
+    return;
+  }
+
+  /* Not cached, or evicted since */
+  cm_user_get_avatar_async (CM_USER (cm_client_get_account (self->cm_client)), NULL,
+                            ma_account_get_avatar_cb,
+                            g_steal_pointer (&self));
 }
 
 static GdkPixbuf *
@@ -391,9 +442,15 @@ chatty_ma_account_get_avatar (ChattyItem *item)
 
   account = cm_client_get_account (self->cm_client);
 
-  cm_user_get_avatar_async (CM_USER (account), NULL,
-                            ma_account_get_avatar_cb,
-                            g_object_ref (self));
+  if (cm_user_get_avatar_url (CM_USER (account)))
+    chatty_media_cache_load_image_async (chatty_manager_get_media_cache (chatty_manager_get_default ()),
+                                         cm_user_get_avatar_url (CM_USER (account)), -1, NULL,
+                                         ma_account_load_avatar_cb,
+                                         g_object_ref (self));
+  else
+    cm_user_get_avatar_async (CM_USER (account), NULL,
+                              ma_account_get_avatar_cb,
+                              g_object_ref (self));
   return NULL;
 }
 
@@ -501,6 +558,21 @@ chatty_ma_account_init (ChattyMaAccount *self)
   self->chat_list = g_list_store_new (CHATTY_TYPE_CHAT);
 }
 
+static void
+ma_account_chat_time_changed_cb (ChattyMaAccount *self,
+                                 GParamSpec      *pspec,
+                                 ChattyChat      *chat)
+{
+  guint position;
+
+  g_assert (CHATTY_IS_MA_ACCOUNT (self));
+  g_assert (CHATTY_IS_CHAT (chat));
+
+  /* Let the sorted chat list move only this chat */
+  if (chatty_utils_get_item_position (G_LIST_MODEL (self->chat_list), chat, &position))
+    g_list_model_items_changed (G_LIST_MODEL (self->chat_list), position, 1, 1);
+}
+
 static void
 joined_rooms_changed (ChattyMaAccount *self,
                       int              position,
@@ -524,6 +596,9 @@ joined_rooms_changed (ChattyMaAccount *self,
       room = g_list_model_get_item (model, i);
       chat = chatty_ma_chat_new_with_room (room);
       chatty_ma_chat_set_data (chat, CHATTY_ACCOUNT (self), self->cm_client);
+      g_signal_connect_object (chat, "notify::last-message-time",
+                               G_CALLBACK (ma_account_chat_time_changed_cb),
+                               self, G_CONNECT_SWAPPED);
       g_ptr_array_add (items, chat);
     }
 
@@ -14,6 +14,9 @@
 #include <string.h>
 #include <glib/gi18n.h>
 
+#include "chatty-utils.h"
+#include "chatty-manager.h"
+#include "chatty-media-cache.h"
 #include "chatty-ma-buddy.h"
 #include "chatty-log.h"
 
@@ -101,6 +104,30 @@ chatty_ma_buddy_get_username (ChattyItem *item)
   return "";
 }
 
+static void
+ma_buddy_decode_avatar_cb (GObject      *object,
+                           GAsyncResult *result,
+                           gpointer      user_data)
+{
+  g_autoptr(ChattyMaBuddy) self = user_data;
+  g_autoptr(GdkPixbuf) avatar = NULL;
+  g_autoptr(GError) error = NULL;
+
+  avatar = chatty_utils_decode_image_finish (result, &error);
+
+  if (self->avatar)
+    return;
+
+  if (avatar) {
+    self->avatar = g_steal_pointer (&avatar);
+    g_signal_emit_by_name (self, "avatar-changed", 0);
+  } else {
+    CHATTY_WARNING (chatty_ma_buddy_get_name (CHATTY_ITEM (self)),
+                    "Could not get avatar '%s' for matrix chat:",
+                    error->message);
+  }
+}
+
 static void
 ma_buddy_get_avatar_cb (GObject      *object,
                         GAsyncResult *result,
@@ -118,13 +145,41 @@ ma_buddy_get_avatar_cb (GObject      *object,
   if (error || !stream)
     return;
 
-  self->avatar = gdk_pixbuf_new_from_stream_at_scale (stream, 192, -1, TRUE, NULL, &error);
-  if (self->avatar)
+  /* The avatar can be downloaded again, so it can be evicted */
+  if (cm_user_get_avatar_file (self->cm_user) && cm_user_get_avatar_url (self->cm_user))
+    chatty_media_cache_add_async (chatty_manager_get_media_cache (chatty_manager_get_default ()),
+                                  cm_user_get_avatar_file (self->cm_user),
+                                  cm_user_get_avatar_url (self->cm_user),
+                                  TRUE, NULL, NULL, NULL);
+
+  chatty_utils_decode_image_async (stream, 192, G_PRIORITY_DEFAULT, NULL,
+                                   ma_buddy_decode_avatar_cb,
+                                   g_steal_pointer (&self));
+}
+
+static void
+ma_buddy_load_avatar_cb (GObject      *object,
+                         GAsyncResult *result,
+                         gpointer      user_data)
+{
+  g_autoptr(ChattyMaBuddy) self = user_data;
+  g_autoptr(GdkPixbuf) avatar = NULL;
+
+  avatar = chatty_media_cache_load_image_finish (CHATTY_MEDIA_CACHE (object), result, NULL);
+
+  if (self->avatar || !self->cm_user)
+    return;
+
+  if (avatar) {
+    self->avatar = g_steal_pointer (&avatar);
     g_signal_emit_by_name (self, "avatar-changed", 0);
-  else
-    CHATTY_WARNING (chatty_ma_buddy_get_name (CHATTY_ITEM (self)),
-                    "Could not get avatar '%s' for matrix chat:",
-                    error->message);
+    return;
+  }
+
+  /* Not cached, or evicted since */
+  cm_user_get_avatar_async (self->cm_user, NULL,
+                            ma_buddy_get_avatar_cb,
+                            g_steal_pointer (&self));
 }
 
 static GdkPixbuf *
@@ -140,9 +195,16 @@ chatty_ma_buddy_get_avatar (ChattyItem *item)
   if (!self->cm_user)
     return NULL;
 
-  cm_user_get_avatar_async (self->cm_user, NULL,
-                            ma_buddy_get_avatar_cb,
-                            g_object_ref (self));
+  /* Avoid downloading avatars that are already cached */
+  if (cm_user_get_avatar_url (self->cm_user))
+    chatty_media_cache_load_image_async (chatty_manager_get_media_cache (chatty_manager_get_default ()),
+                                         cm_user_get_avatar_url (self->cm_user), 192, NULL,
+                                         ma_buddy_load_avatar_cb,
+                                         g_object_ref (self));
+  else
+    cm_user_get_avatar_async (self->cm_user, NULL,
+                              ma_buddy_get_avatar_cb,
+                              g_object_ref (self));
 
   return NULL;
 }
@@ -226,3 +288,11 @@ chatty_ma_buddy_matches_cm_user (ChattyMaBuddy *self,
 
   return user == self->cm_user;
 }
+
+CmUser *
+chatty_ma_buddy_get_cm_user (ChattyMaBuddy *self)
+{
+  g_return_val_if_fail (CHATTY_IS_MA_BUDDY (self), NULL);
+
+  return self->cm_user;
+}
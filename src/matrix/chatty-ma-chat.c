@@ -21,6 +21,10 @@
 #include "chatty-file.h"
 #include "chatty-ma-buddy.h"
 #include "chatty-ma-chat.h"
+#include "chatty-ma-event-list.h"
+#include "chatty-manager.h"
+#include "chatty-media-cache.h"
+#include "chatty-utils.h"
 #include "chatty-log.h"
 
 /**
@@ -42,8 +46,9 @@ struct _ChattyMaChat
   GdkPixbuf           *avatar;
   GCancellable        *avatar_cancellable;
   GListStore          *buddy_list;
-  GListStore          *message_list;
-  GtkFilterListModel  *filtered_event_list;
+  /* CmUser to ChattyMaBuddy in buddy_list */
+  GHashTable          *buddy_table;
+  ChattyMaEventList   *message_list;
 
   ChattyAccount    *account;
   CmClient         *cm_client;
@@ -61,48 +66,25 @@ G_DEFINE_TYPE (ChattyMaChat, chatty_ma_chat, CHATTY_TYPE_CHAT)
 /* Private */
 CmStatus cm_room_get_status (CmRoom *self);
 
-static gboolean
-ma_chat_filter_event_list (ChattyMessage *message,
-                           ChattyMaChat  *self)
-{
-  g_assert (CHATTY_IS_MESSAGE (message));
-  g_assert (CHATTY_IS_MA_CHAT (self));
-
-  return !!chatty_message_get_cm_event (message);
-}
-
 static ChattyMaBuddy *
 ma_chat_find_cm_user (ChattyMaChat *self,
-                      GListModel   *model,
                       CmUser       *user,
-                      guint        *index,
                       gboolean      add_if_missing)
 {
-  guint n_items;
+  ChattyMaBuddy *buddy;
 
   g_assert (CHATTY_IS_MA_CHAT (self));
-  g_assert (G_IS_LIST_MODEL (model));
-
-  n_items = g_list_model_get_n_items (model);
 
-  for (guint i = 0; i < n_items; i++) {
-    g_autoptr(ChattyMaBuddy) buddy = NULL;
+  buddy = g_hash_table_lookup (self->buddy_table, user);
 
-    buddy = g_list_model_get_item (model, i);
-    if (chatty_ma_buddy_matches_cm_user (buddy, user)) {
-      if (index)
-        *index = i;
-
-      return g_steal_pointer (&buddy);
-    }
-  }
+  if (buddy)
+    return g_object_ref (buddy);
 
   if (add_if_missing)
     {
-      ChattyMaBuddy *buddy;
-
       buddy = chatty_ma_buddy_new_with_user (user);
       g_list_store_append (self->buddy_list, buddy);
+      g_hash_table_insert (self->buddy_table, user, buddy);
 
       return buddy;
     }
@@ -110,6 +92,13 @@ ma_chat_find_cm_user (ChattyMaChat *self,
   return NULL;
 }
 
+static ChattyItem *
+ma_chat_get_sender (CmUser  *user,
+                    GObject *owner)
+{
+  return CHATTY_ITEM (ma_chat_find_cm_user (CHATTY_MA_CHAT (owner), user, TRUE));
+}
+
 static void
 ma_chat_get_past_events_cb (GObject      *object,
                             GAsyncResult *result,
@@ -210,7 +199,7 @@ chatty_ma_chat_get_messages (ChattyChat *chat)
 
   g_assert (CHATTY_IS_MA_CHAT (self));
 
-  return G_LIST_MODEL (self->filtered_event_list);
+  return G_LIST_MODEL (self->message_list);
 }
 
 static ChattyAccount *
@@ -372,7 +361,7 @@ chatty_ma_chat_get_last_message (ChattyChat *chat)
 
   g_assert (CHATTY_IS_MA_CHAT (self));
 
-  model = G_LIST_MODEL (self->filtered_event_list);
+  model = G_LIST_MODEL (self->message_list);
   n_items = g_list_model_get_n_items (model);
 
   if (n_items == 0)
@@ -474,6 +463,14 @@ ma_chat_send_message_cb (GObject      *object,
   g_task_return_pointer (task, NULL, NULL);
 }
 
+static void
+ma_chat_file_progress_cb (goffset  current_num_bytes,
+                          goffset  total_num_bytes,
+                          gpointer user_data)
+{
+  chatty_file_set_progress (user_data, current_num_bytes, total_num_bytes);
+}
+
 static void
 chatty_ma_chat_send_message_async (ChattyChat          *chat,
                                    ChattyMessage       *message,
@@ -493,7 +490,6 @@ chatty_ma_chat_send_message_async (ChattyChat          *chat,
 
   task = g_task_new (self, NULL, callback, user_data);
   g_task_set_task_data (task, g_object_ref (message), g_object_unref);
-  g_list_store_append (self->message_list, message);
 
   files = chatty_message_get_files (message);
 
@@ -502,8 +498,10 @@ chatty_ma_chat_send_message_async (ChattyChat          *chat,
 
   if (file) {
     g_object_set_data (G_OBJECT (task), "is-file", GINT_TO_POINTER (TRUE));
+    /* The file is kept alive by the message in task */
     event_id = cm_room_send_file_async (self->cm_room, file, NULL,
-                                        NULL, NULL, NULL,
+                                        ma_chat_file_progress_cb, files->data,
+                                        NULL,
                                         ma_chat_send_message_cb, g_steal_pointer (&task));
   } else {
     event_id = cm_room_send_text_async (self->cm_room,
@@ -654,6 +652,30 @@ chatty_ma_chat_get_protocols (ChattyItem *item)
   return CHATTY_PROTOCOL_MATRIX;
 }
 
+static void
+ma_chat_decode_avatar_cb (GObject      *object,
+                          GAsyncResult *result,
+                          gpointer      user_data)
+{
+  g_autoptr(ChattyMaChat) self = user_data;
+  g_autoptr(GdkPixbuf) avatar = NULL;
+  g_autoptr(GError) error = NULL;
+
+  avatar = chatty_utils_decode_image_finish (result, &error);
+
+  if (self->avatar)
+    return;
+
+  if (avatar) {
+    self->avatar = g_steal_pointer (&avatar);
+    g_signal_emit_by_name (self, "avatar-changed", 0);
+  } else {
+    CHATTY_WARNING (chatty_ma_chat_get_chat_name (CHATTY_CHAT (self)),
+                    "Could not get avatar '%s' for matrix chat:",
+                    error->message);
+  }
+}
+
 static void
 ma_chat_get_avatar_cb (GObject      *object,
                        GAsyncResult *result,
@@ -671,13 +693,41 @@ ma_chat_get_avatar_cb (GObject      *object,
   if (error || !stream)
     return;
 
-  self->avatar = gdk_pixbuf_new_from_stream_at_scale (stream, 192, -1, TRUE, NULL, &error);
+  /* Room avatars can be fetched again, so they are evictable */
+  if (cm_room_get_avatar_file (self->cm_room) && cm_room_get_avatar_url (self->cm_room))
+    chatty_media_cache_add_async (chatty_manager_get_media_cache (chatty_manager_get_default ()),
+                                  cm_room_get_avatar_file (self->cm_room),
+                                  cm_room_get_avatar_url (self->cm_room),
+                                  TRUE, NULL, NULL, NULL);
+
+  chatty_utils_decode_image_async (stream, 192, G_PRIORITY_DEFAULT, NULL,
+                                   ma_chat_decode_avatar_cb,
+                                   g_steal_pointer (&self));
+}
+
+static void
+ma_chat_load_avatar_cb (GObject      *object,
+                        GAsyncResult *result,
+                        gpointer      user_data)
+{
+  g_autoptr(ChattyMaChat) self = user_data;
+  g_autoptr(GdkPixbuf) avatar = NULL;
+
+  avatar = chatty_media_cache_load_image_finish (CHATTY_MEDIA_CACHE (object), result, NULL);
+
   if (self->avatar)
+    return;
+
+  if (avatar) {
+    self->avatar = g_steal_pointer (&avatar);
     g_signal_emit_by_name (self, "avatar-changed", 0);
-  else
-    CHATTY_WARNING (chatty_ma_chat_get_chat_name (CHATTY_CHAT (self)),
-                    "Could not get avatar '%s' for matrix chat:",
-                    error->message);
+    return;
+  }
+
+  /* Not cached, or evicted since */
+  cm_room_get_avatar_async (self->cm_room, NULL,
+                            ma_chat_get_avatar_cb,
+                            g_steal_pointer (&self));
 }
 
 static GdkPixbuf *
@@ -690,9 +740,16 @@ chatty_ma_chat_get_avatar (ChattyItem *item)
   if (self->avatar)
     return self->avatar;
 
-  cm_room_get_avatar_async (self->cm_room, NULL,
-                            ma_chat_get_avatar_cb,
-                            g_object_ref (self));
+  /* The avatar may be cached from an earlier session */
+  if (cm_room_get_avatar_url (self->cm_room))
+    chatty_media_cache_load_image_async (chatty_manager_get_media_cache (chatty_manager_get_default ()),
+                                         cm_room_get_avatar_url (self->cm_room), 192, NULL,
+                                         ma_chat_load_avatar_cb,
+                                         g_object_ref (self));
+  else
+    cm_room_get_avatar_async (self->cm_room, NULL,
+                              ma_chat_get_avatar_cb,
+                              g_object_ref (self));
 
   return NULL;
 }
@@ -702,7 +759,7 @@ chatty_ma_chat_finalize (GObject *object)
 {
   ChattyMaChat *self = (ChattyMaChat *)object;
 
-  g_list_store_remove_all (self->message_list);
+  g_clear_pointer (&self->buddy_table, g_hash_table_unref);
   g_list_store_remove_all (self->buddy_list);
   g_clear_object (&self->message_list);
   g_clear_object (&self->buddy_list);
@@ -754,16 +811,8 @@ chatty_ma_chat_class_init (ChattyMaChatClass *klass)
 static void
 chatty_ma_chat_init (ChattyMaChat *self)
 {
-  GtkCustomFilter *filter;
-
-  self->message_list = g_list_store_new (CHATTY_TYPE_MESSAGE);
-
-  filter = gtk_custom_filter_new ((GtkCustomFilterFunc)ma_chat_filter_event_list,
-                                  g_object_ref (self),
-                                  g_object_unref);
-  self->filtered_event_list = gtk_filter_list_model_new (g_object_ref (G_LIST_MODEL (self->message_list)),
-                                                         GTK_FILTER (filter));
   self->buddy_list = g_list_store_new (CHATTY_TYPE_MA_BUDDY);
+  self->buddy_table = g_hash_table_new (g_direct_hash, g_direct_equal);
 }
 
 static void
@@ -806,6 +855,19 @@ joined_members_changed_cb (ChattyMaChat *self,
   g_assert (CHATTY_IS_CHAT (self));
   g_assert (G_IS_LIST_MODEL (model));
 
+  for (guint i = position; i < position + removed; i++)
+    {
+      g_autoptr(ChattyMaBuddy) buddy = NULL;
+      CmUser *user;
+
+      buddy = g_list_model_get_item (G_LIST_MODEL (self->buddy_list), i);
+      user = chatty_ma_buddy_get_cm_user (buddy);
+
+      /* The user may have been added again as a different buddy */
+      if (g_hash_table_lookup (self->buddy_table, user) == buddy)
+        g_hash_table_remove (self->buddy_table, user);
+    }
+
   for (guint i = position; i < position + added; i++)
     {
       g_autoptr(CmUser) user = NULL;
@@ -816,6 +878,7 @@ joined_members_changed_cb (ChattyMaChat *self,
 
       user = g_list_model_get_item (model, i);
       buddy = chatty_ma_buddy_new_with_user (user);
+      g_hash_table_insert (self->buddy_table, user, buddy);
       g_ptr_array_add (items, buddy);
     }
 
@@ -830,39 +893,9 @@ events_list_changed_cb (ChattyMaChat *self,
                         guint         added,
                         GListModel   *model)
 {
-  g_autoptr(GPtrArray) items = NULL;
-
   g_assert (CHATTY_IS_CHAT (self));
   g_assert (G_IS_LIST_MODEL (model));
 
-  for (guint i = position; i < position + added; i++)
-    {
-      g_autoptr(CmEvent) event = NULL;
-      ChattyMessage *message;
-
-      if (!items)
-        items = g_ptr_array_new_with_free_func (g_object_unref);
-
-      event = g_list_model_get_item (model, i);
-
-      if (CM_IS_ROOM_MESSAGE_EVENT (event) ||
-          cm_event_is_encrypted (event)) {
-        g_autoptr(ChattyMaBuddy) user = NULL;
-
-        user = ma_chat_find_cm_user (self, G_LIST_MODEL (self->buddy_list),
-                                     cm_event_get_sender (event), NULL, TRUE);
-        message = chatty_message_new_from_event (CHATTY_ITEM (user), event);
-      } else {
-        message = g_object_new (CHATTY_TYPE_MESSAGE, NULL);
-      }
-
-      g_object_set_data_full (G_OBJECT (message), "cm-event", g_object_ref (event), g_object_unref);
-      g_ptr_array_add (items, message);
-    }
-
-  g_list_store_splice (self->message_list, position, removed,
-                       items ? items->pdata : NULL, added);
-
   /* todo: Keep track of unread messages instead of
    * blindly notifying about the last message
    */
@@ -902,6 +935,9 @@ chatty_ma_chat_new_with_room (CmRoom *room)
                              members);
 
   events = cm_room_get_events_list (room);
+  /* Connected first, so that the messages are up to date in events_list_changed_cb() */
+  self->message_list = chatty_ma_event_list_new (events, ma_chat_get_sender,
+                                                 G_OBJECT (self));
   g_signal_connect_object (events, "items-changed",
                            G_CALLBACK (events_list_changed_cb),
                            self, G_CONNECT_SWAPPED);
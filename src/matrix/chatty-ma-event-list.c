@@ -0,0 +1,345 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* chatty-ma-event-list.c
+ *
+ * Copyright 2024 Purism SPC
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define G_LOG_DOMAIN "chatty-ma-event-list"
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "chatty-message.h"
+#include "chatty-ma-buddy.h"
+#include "chatty-ma-event-list.h"
+#include "chatty-log.h"
+
+/**
+ * SECTION: chatty-ma-event-list
+ * @title: ChattyMaEventList
+ * @short_description: A #ChattyMessage view of the events of a room
+ * @include: "chatty-ma-event-list.h"
+ *
+ * #ChattyMaEventList exposes only the message events of a
+ * #CmRoom events list, as #ChattyMessage items.  Messages are
+ * created when asked for, and are kept only as long as someone
+ * holds a reference, so the events list stays the only full
+ * copy of the room history.  Messages can also be looked up
+ * by event id with chatty_ma_event_list_find_message().
+ */
+
+struct _ChattyMaEventList
+{
+  GObject      parent_instance;
+
+  GListModel  *events;
+  /* Positions in events of message events, sorted */
+  GArray      *index;
+  /* The events at the positions in index */
+  GPtrArray   *index_events;
+  /* Event ids of index_events, to CmEvent */
+  GHashTable  *event_ids;
+
+  ChattyMaEventListSenderFunc sender_func;
+  GWeakRef     owner;
+};
+
+static void chatty_ma_event_list_model_init (GListModelInterface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (ChattyMaEventList, chatty_ma_event_list, G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (G_TYPE_LIST_MODEL,
+                                                chatty_ma_event_list_model_init))
+
+/* The message created for an event, stored on the event as a weak reference */
+static GQuark message_quark;
+
+static void
+weak_ref_free (gpointer data)
+{
+  GWeakRef *ref = data;
+
+  g_weak_ref_clear (ref);
+  g_free (ref);
+}
+
+static gboolean
+event_is_message (CmEvent *event)
+{
+  return CM_IS_ROOM_MESSAGE_EVENT (event) || cm_event_is_encrypted (event);
+}
+
+/* Index of the first entry in index that is >= position */
+static guint
+ma_event_list_lower_bound (ChattyMaEventList *self,
+                           guint              position)
+{
+  guint low = 0, high = self->index->len;
+
+  while (low < high) {
+    guint mid = low + (high - low) / 2;
+
+    if (g_array_index (self->index, guint, mid) < position)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+
+  return low;
+}
+
+static void
+ma_event_list_add_id (ChattyMaEventList *self,
+                      CmEvent           *event)
+{
+  const char *event_id;
+
+  event_id = cm_event_get_id (event);
+
+  if (event_id)
+    g_hash_table_insert (self->event_ids, g_strdup (event_id), event);
+}
+
+static void
+ma_event_list_remove_id (ChattyMaEventList *self,
+                         CmEvent           *event)
+{
+  const char *event_id;
+
+  event_id = cm_event_get_id (event);
+
+  if (event_id && g_hash_table_lookup (self->event_ids, event_id) == event)
+    g_hash_table_remove (self->event_ids, event_id);
+}
+
+static void
+events_items_changed_cb (ChattyMaEventList *self,
+                         guint              position,
+                         guint              removed,
+                         guint              added,
+                         GListModel        *events)
+{
+  g_autoptr(GArray) new_items = NULL;
+  g_autoptr(GPtrArray) new_events = NULL;
+  guint start, end;
+
+  g_assert (CHATTY_IS_MA_EVENT_LIST (self));
+
+  start = ma_event_list_lower_bound (self, position);
+  end = ma_event_list_lower_bound (self, position + removed);
+
+  new_items = g_array_new (FALSE, FALSE, sizeof (guint));
+  new_events = g_ptr_array_new ();
+
+  for (guint i = position; i < position + added; i++) {
+    g_autoptr(CmEvent) event = NULL;
+
+    event = g_list_model_get_item (events, i);
+
+    if (event_is_message (event)) {
+      g_array_append_val (new_items, i);
+      g_ptr_array_add (new_events, g_steal_pointer (&event));
+    }
+  }
+
+  /* Shift the positions of the events after the changed range */
+  if (added != removed) {
+    for (guint i = end; i < self->index->len; i++)
+      g_array_index (self->index, guint, i) += added - removed;
+  }
+
+  for (guint i = start; i < end; i++)
+    ma_event_list_remove_id (self, self->index_events->pdata[i]);
+
+  for (guint i = 0; i < new_events->len; i++)
+    ma_event_list_add_id (self, new_events->pdata[i]);
+
+  g_array_remove_range (self->index, start, end - start);
+  g_array_insert_vals (self->index, start, new_items->data, new_items->len);
+  g_ptr_array_remove_range (self->index_events, start, end - start);
+
+  /* The references of new_events are moved to index_events */
+  for (guint i = 0; i < new_events->len; i++)
+    g_ptr_array_insert (self->index_events, start + i, new_events->pdata[i]);
+
+  if (end - start || new_items->len)
+    g_list_model_items_changed (G_LIST_MODEL (self), start, end - start, new_items->len);
+}
+
+static ChattyMessage *
+ma_event_list_get_message (ChattyMaEventList *self,
+                           CmEvent           *event)
+{
+  g_autoptr(ChattyItem) sender = NULL;
+  g_autoptr(GObject) owner = NULL;
+  ChattyMessage *message;
+  GWeakRef *ref;
+
+  ref = g_object_get_qdata (G_OBJECT (event), message_quark);
+
+  if (ref && (message = g_weak_ref_get (ref)))
+    return message;
+
+  owner = g_weak_ref_get (&self->owner);
+
+  if (owner)
+    sender = self->sender_func (cm_event_get_sender (event), owner);
+  else
+    sender = CHATTY_ITEM (chatty_ma_buddy_new_with_user (cm_event_get_sender (event)));
+
+  message = chatty_message_new_from_event (sender, event);
+
+  ref = g_new0 (GWeakRef, 1);
+  g_weak_ref_init (ref, message);
+  g_object_set_qdata_full (G_OBJECT (event), message_quark, ref, weak_ref_free);
+
+  return message;
+}
+
+static GType
+chatty_ma_event_list_get_item_type (GListModel *model)
+{
+  return CHATTY_TYPE_MESSAGE;
+}
+
+static guint
+chatty_ma_event_list_get_n_items (GListModel *model)
+{
+  ChattyMaEventList *self = CHATTY_MA_EVENT_LIST (model);
+
+  return self->index->len;
+}
+
+static gpointer
+chatty_ma_event_list_get_item (GListModel *model,
+                               guint       position)
+{
+  ChattyMaEventList *self = CHATTY_MA_EVENT_LIST (model);
+
+  if (position >= self->index->len)
+    return NULL;
+
+  return ma_event_list_get_message (self, self->index_events->pdata[position]);
+}
+
+static void
+chatty_ma_event_list_model_init (GListModelInterface *iface)
+{
+  iface->get_item_type = chatty_ma_event_list_get_item_type;
+  iface->get_n_items = chatty_ma_event_list_get_n_items;
+  iface->get_item = chatty_ma_event_list_get_item;
+}
+
+static void
+chatty_ma_event_list_finalize (GObject *object)
+{
+  ChattyMaEventList *self = (ChattyMaEventList *)object;
+
+  g_clear_object (&self->events);
+  g_clear_pointer (&self->index, g_array_unref);
+  g_clear_pointer (&self->index_events, g_ptr_array_unref);
+  g_clear_pointer (&self->event_ids, g_hash_table_unref);
+  g_weak_ref_clear (&self->owner);
+
+  G_OBJECT_CLASS (chatty_ma_event_list_parent_class)->finalize (object);
+}
+
+static void
+chatty_ma_event_list_class_init (ChattyMaEventListClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = chatty_ma_event_list_finalize;
+
+  message_quark = g_quark_from_static_string ("chatty-ma-event-list-message");
+}
+
+static void
+chatty_ma_event_list_init (ChattyMaEventList *self)
+{
+  self->index = g_array_new (FALSE, FALSE, sizeof (guint));
+  self->index_events = g_ptr_array_new_with_free_func (g_object_unref);
+  self->event_ids = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  g_weak_ref_init (&self->owner, NULL);
+}
+
+/**
+ * chatty_ma_event_list_new:
+ * @events: The events list of a #CmRoom
+ * @sender_func: A function to get the #ChattyItem of senders
+ * @owner: The object @sender_func is called with
+ *
+ * Create a new list of the message events in @events.
+ * Only a weak reference to @owner is kept.
+ *
+ * Returns: (transfer full): A #ChattyMaEventList
+ */
+ChattyMaEventList *
+chatty_ma_event_list_new (GListModel                  *events,
+                         ChattyMaEventListSenderFunc  sender_func,
+                         GObject                     *owner)
+{
+  ChattyMaEventList *self;
+
+  g_return_val_if_fail (G_IS_LIST_MODEL (events), NULL);
+  g_return_val_if_fail (sender_func, NULL);
+  g_return_val_if_fail (G_IS_OBJECT (owner), NULL);
+
+  self = g_object_new (CHATTY_TYPE_MA_EVENT_LIST, NULL);
+  self->events = g_object_ref (events);
+  self->sender_func = sender_func;
+  g_weak_ref_set (&self->owner, owner);
+
+  g_signal_connect_object (events, "items-changed",
+                           G_CALLBACK (events_items_changed_cb),
+                           self, G_CONNECT_SWAPPED);
+  events_items_changed_cb (self, 0, 0,
+                           g_list_model_get_n_items (events),
+                           events);
+
+  return self;
+}
+
+/**
+ * chatty_ma_event_list_find_message:
+ * @self: A #ChattyMaEventList
+ * @event_id: The event id of a message
+ *
+ * Find the message with @event_id in @self without
+ * creating messages for the other events.
+ *
+ * Returns: (transfer full) (nullable): A #ChattyMessage
+ */
+ChattyMessage *
+chatty_ma_event_list_find_message (ChattyMaEventList *self,
+                                   const char        *event_id)
+{
+  CmEvent *event;
+
+  g_return_val_if_fail (CHATTY_IS_MA_EVENT_LIST (self), NULL);
+
+  if (!event_id || !*event_id)
+    return NULL;
+
+  event = g_hash_table_lookup (self->event_ids, event_id);
+
+  /* Events we send get their id only after they are added */
+  if (!event) {
+    for (guint i = self->index_events->len; i > 0; i--) {
+      CmEvent *item = self->index_events->pdata[i - 1];
+
+      if (g_strcmp0 (cm_event_get_id (item), event_id) == 0) {
+        event = item;
+        ma_event_list_add_id (self, event);
+        break;
+      }
+    }
+  }
+
+  if (!event)
+    return NULL;
+
+  return ma_event_list_get_message (self, event);
+}
@@ -0,0 +1,39 @@
+/* chatty-ma-event-list.h
+ *
+ * Copyright 2024 Purism SPC
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+#define CMATRIX_USE_EXPERIMENTAL_API
+#include "cmatrix.h"
+
+#include "chatty-item.h"
+#include "chatty-message.h"
+
+G_BEGIN_DECLS
+
+/**
+ * ChattyMaEventListSenderFunc:
+ * @user: The sender of an event
+ * @owner: The owner passed to chatty_ma_event_list_new()
+ *
+ * Returns: (transfer full): The #ChattyItem representing @user
+ */
+typedef ChattyItem *(*ChattyMaEventListSenderFunc) (CmUser  *user,
+                                                    GObject *owner);
+
+#define CHATTY_TYPE_MA_EVENT_LIST (chatty_ma_event_list_get_type ())
+
+G_DECLARE_FINAL_TYPE (ChattyMaEventList, chatty_ma_event_list, CHATTY, MA_EVENT_LIST, GObject)
+
+ChattyMaEventList *chatty_ma_event_list_new (GListModel                  *events,
+                                             ChattyMaEventListSenderFunc  sender_func,
+                                             GObject                     *owner);
+ChattyMessage     *chatty_ma_event_list_find_message (ChattyMaEventList *self,
+                                                      const char        *event_id);
+
+G_END_DECLS
@@ -16,6 +16,7 @@
 
 #include <glib/gi18n.h>
 #include "chatty-settings.h"
+#include "chatty-stats.h"
 #include "chatty-history.h"
 #include "chatty-mm-chat.h"
 #include "chatty-utils.h"
@@ -28,6 +29,13 @@
 
 #define RECIEVE_TIMEOUT_SECONDS  7*24*60*60 /* 1 week in seconds */
 #define RECIEVE_TIMEOUT_SECONDS_UNKNOWN_RECEIVE_TIME  3*24*60*60 /* 3 days in seconds */
+/* Time to wait for more SMS before storing the received ones */
+#define SMS_BATCH_TIMEOUT_MS  200
+/* The number of SMS being created and sent at once on a modem */
+#define SMS_MAX_PARALLEL_SENDS  4
+#define SMS_MAX_SEND_ATTEMPTS   3
+/* Doubled on each failed attempt */
+#define SMS_RETRY_DELAY_SECONDS 30
 
 /**
  * SECTION: chatty-mm-account
@@ -43,6 +51,10 @@ struct _ChattyMmDevice
 
   MMObject  *mm_object;
   gulong     modem_state_id;
+
+  /* SMS #GTasks waiting to be sent */
+  GQueue    *send_queue;
+  guint      n_sending;
 };
 
 G_DEFINE_TYPE (ChattyMmDevice, chatty_mm_device, G_TYPE_OBJECT)
@@ -55,6 +67,7 @@ chatty_mm_device_finalize (GObject *object)
   g_clear_signal_handler (&self->modem_state_id,
                           mm_object_peek_modem (self->mm_object));
   g_clear_object (&self->mm_object);
+  g_queue_free_full (self->send_queue, g_object_unref);
 
   G_OBJECT_CLASS (chatty_mm_device_parent_class)->finalize (object);
 }
@@ -67,6 +80,7 @@ chatty_mm_device_class_init (ChattyMmDeviceClass *klass)
 static void
 chatty_mm_device_init (ChattyMmDevice *self)
 {
+  self->send_queue = g_queue_new ();
 }
 
 static ChattyMmDevice *
@@ -75,6 +89,15 @@ chatty_mm_device_new (void)
   return g_object_new (CHATTY_TYPE_MM_DEVICE, NULL);
 }
 
+/* The equipment identifier, which is kept across restarts */
+static const char *
+chatty_mm_device_get_id (ChattyMmDevice *device)
+{
+  g_assert (CHATTY_IS_MM_DEVICE (device));
+
+  return mm_modem_get_equipment_identifier (mm_object_peek_modem (device->mm_object));
+}
+
 char *
 chatty_mm_device_get_number (ChattyMmDevice *device)
 {
@@ -114,12 +137,23 @@ struct _ChattyMmAccount
   GListStore       *blocked_chat_list;
   GHashTable       *pending_sms;
   GHashTable       *stuck_sms;
+  GHashTable       *receiving_sms;
   GCancellable     *cancellable;
 
+  /* SMS #GTasks waiting to be retried, mapped to their timeout ids */
+  GHashTable       *sms_retries;
+  /* SMS #GTasks restored from history, waiting for their modem */
+  GPtrArray        *restored_sms;
+
+  /* Received SMS not yet stored in history */
+  struct _SmsBatch *sms_batch;
+  guint             sms_batch_id;
+
   ChattyStatus      status;
 
   guint             mm_watch_id;
   gboolean          mm_loaded;
+  gboolean          sms_queue_loaded;
   gboolean          has_mms;
 
   ChattyMmsd       *mmsd;
@@ -127,9 +161,28 @@ struct _ChattyMmAccount
 
 typedef struct _MessagingData {
   ChattyMmAccount *object;
-  char            *message_path;
+  ChattyMmDevice  *device;
+  /* When ModemManager announced the message */
+  gint64           received_time;
 } MessagingData;
 
+typedef struct _SmsBatch {
+  ChattyMmAccount *object;
+  GPtrArray       *chats;
+  GPtrArray       *messages;
+  /* Incoming SMS to delete from the modem once stored, and their
+   * devices.  %NULL for messages that aren't in the modem store */
+  GPtrArray       *sms;
+  GPtrArray       *devices;
+  /* Messages left to store one by one if the batch failed */
+  guint            pending;
+} SmsBatch;
+
+typedef struct {
+  SmsBatch *batch;
+  guint     index;
+} SmsBatchItem;
+
 typedef struct _StuckSmSPayload {
   ChattyMmAccount *object;
   ChattyMmDevice  *device;
@@ -154,6 +207,46 @@ stuck_sms_payload_free (gpointer data)
   g_free (payload);
 }
 
+static void
+sms_batch_unref_item (gpointer data)
+{
+  if (data)
+    g_object_unref (data);
+}
+
+static SmsBatch *
+sms_batch_new (void)
+{
+  SmsBatch *batch;
+
+  batch = g_new0 (SmsBatch, 1);
+  batch->chats = g_ptr_array_new_with_free_func (g_object_unref);
+  batch->messages = g_ptr_array_new_with_free_func (g_object_unref);
+  batch->sms = g_ptr_array_new_with_free_func (sms_batch_unref_item);
+  batch->devices = g_ptr_array_new_with_free_func (sms_batch_unref_item);
+
+  return batch;
+}
+
+static void
+sms_batch_free (SmsBatch *batch)
+{
+  g_clear_object (&batch->object);
+  g_ptr_array_unref (batch->chats);
+  g_ptr_array_unref (batch->messages);
+  g_ptr_array_unref (batch->sms);
+  g_ptr_array_unref (batch->devices);
+  g_free (batch);
+}
+
+static void
+messaging_data_free (MessagingData *data)
+{
+  g_object_unref (data->object);
+  g_clear_object (&data->device);
+  g_free (data);
+}
+
 static int
 sort_strv (gconstpointer a,
            gconstpointer b)
@@ -254,6 +347,220 @@ mm_account_lookup_device (ChattyMmAccount  *self,
   return NULL;
 }
 
+static void mm_account_send_next_sms        (ChattyMmAccount     *self,
+                                             ChattyMmDevice      *device);
+static void mm_account_delete_message_async (ChattyMmAccount     *self,
+                                             ChattyMmDevice      *device,
+                                             MMSms               *sms,
+                                             GAsyncReadyCallback  callback,
+                                             gpointer             user_data);
+
+static MMSmsProperties *
+mm_account_new_sms_properties (ChattyMessage *message,
+                               const char    *phone)
+{
+  MMSmsProperties *sms_properties;
+  ChattySettings *settings;
+  gboolean request_report;
+
+  settings = chatty_settings_get_default ();
+  request_report = chatty_settings_request_sms_delivery_reports (settings);
+  sms_properties = mm_sms_properties_new ();
+  mm_sms_properties_set_text (sms_properties, chatty_message_get_text (message));
+  mm_sms_properties_set_number (sms_properties, phone);
+  mm_sms_properties_set_delivery_report_request (sms_properties, request_report);
+  /*
+   * https://gitlab.freedesktop.org/mobile-broadband/ModemManager/-/blob/201c8533e0e51c2f3ec6c64240d8a5705c26c8d3/src/mm-sms-part-3gpp.c#L307
+   * Max Value for validity relative is 635040, value is in minutes
+   */
+  mm_sms_properties_set_validity_relative (sms_properties, 635040);
+
+  return sms_properties;
+}
+
+static void
+mm_account_push_sms (ChattyMmAccount *self,
+                     GTask           *task)
+{
+  ChattyMmDevice *device;
+
+  g_assert (CHATTY_IS_MM_ACCOUNT (self));
+  g_assert (G_IS_TASK (task));
+
+  device = g_object_get_data (G_OBJECT (task), "device");
+  g_queue_push_tail (device->send_queue, task);
+  mm_account_send_next_sms (self, device);
+}
+
+static gboolean
+mm_account_retry_sms (gpointer user_data)
+{
+  ChattyMmAccount *self;
+  GTask *task = user_data;
+
+  self = g_task_get_source_object (task);
+  g_hash_table_remove (self->sms_retries, task);
+  mm_account_push_sms (self, task);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+mm_account_retry_sms_later (ChattyMmAccount *self,
+                            GTask           *task,
+                            guint            delay)
+{
+  guint id;
+
+  g_assert (CHATTY_IS_MM_ACCOUNT (self));
+  g_assert (G_IS_TASK (task));
+
+  id = g_timeout_add_seconds (delay, mm_account_retry_sms, task);
+  g_hash_table_insert (self->sms_retries, task, GUINT_TO_POINTER (id));
+}
+
+/* Give up on @task without touching the queue, so that it's sent on next start */
+static void
+mm_account_cancel_sms (gpointer data)
+{
+  GTask *task = data;
+
+  g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                           "Account closed");
+  g_object_unref (task);
+}
+
+static gboolean
+mm_account_cancel_sms_retry (gpointer key,
+                             gpointer value,
+                             gpointer user_data)
+{
+  g_source_remove (GPOINTER_TO_UINT (value));
+  mm_account_cancel_sms (key);
+
+  return TRUE;
+}
+
+/* Finish sending the SMS in @task, which won't be retried */
+static void
+mm_account_complete_sms (ChattyMmAccount *self,
+                         GTask           *task,
+                         GError          *error)
+{
+  ChattyMessage *message;
+  ChattyChat *chat;
+  int id;
+
+  g_assert (CHATTY_IS_MM_ACCOUNT (self));
+  g_assert (G_IS_TASK (task));
+
+  chat = g_object_get_data (G_OBJECT (task), "chat");
+  message = g_task_get_task_data (task);
+  id = GPOINTER_TO_INT (g_object_get_data (G_OBJECT (task), "queue-id"));
+
+  if (error) {
+    g_autofree char *title = NULL;
+
+    chatty_message_set_status (message, CHATTY_STATUS_SENDING_FAILED, 0);
+    chatty_history_add_message (self->history_db, chat, message);
+    title = g_strdup_printf (_("Error Sending SMS to %s"),
+                              chatty_item_get_name (CHATTY_ITEM (chat)));
+    chatty_mm_notify_message (title, ERROR_MM_SMS_SEND_RECEIVE, "");
+  }
+
+  if (id)
+    chatty_history_remove_queued_sms (self->history_db, id);
+
+  if (error)
+    g_task_return_error (task, error);
+  else
+    g_task_return_boolean (task, TRUE);
+
+  g_object_unref (task);
+}
+
+/*
+ * Whether the failure to send @sms means that it never
+ * reached the network, so that sending it again can't
+ * deliver it twice.  @sms is %NULL if it failed to be
+ * created in the modem.
+ */
+static gboolean
+mm_account_sms_can_retry (MMSms        *sms,
+                          const GError *error)
+{
+  g_assert (error);
+
+  if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    return FALSE;
+
+  if (!sms)
+    return TRUE;
+
+  return g_error_matches (error, MM_CORE_ERROR, MM_CORE_ERROR_WRONG_STATE) ||
+    g_error_matches (error, MM_CORE_ERROR, MM_CORE_ERROR_RETRY) ||
+    g_error_matches (error, MM_MESSAGE_ERROR, MM_MESSAGE_ERROR_NO_NETWORK) ||
+    g_error_matches (error, MM_MESSAGE_ERROR, MM_MESSAGE_ERROR_SIM_BUSY) ||
+    g_error_matches (error, MM_MOBILE_EQUIPMENT_ERROR, MM_MOBILE_EQUIPMENT_ERROR_NO_NETWORK) ||
+    g_error_matches (error, MM_MOBILE_EQUIPMENT_ERROR, MM_MOBILE_EQUIPMENT_ERROR_SIM_BUSY);
+}
+
+/*
+ * Called when the SMS in @task is sent or failed to send.
+ * Messages that failed before reaching the network are
+ * retried later, and the retry state is stored so that it
+ * survives a restart.  Other failures are left to the user.
+ */
+static void
+mm_account_sms_done (GTask  *task,
+                     GError *error)
+{
+  g_autoptr(ChattyMmAccount) self = NULL;
+  g_autoptr(ChattyMmDevice) device = NULL;
+  g_autoptr(MMSms) sms = NULL;
+  gboolean failed;
+  int id, attempts;
+
+  g_assert (G_IS_TASK (task));
+
+  self = g_object_ref (g_task_get_source_object (task));
+  device = g_object_ref (g_object_get_data (G_OBJECT (task), "device"));
+  sms = g_object_steal_data (G_OBJECT (task), "sms");
+  id = GPOINTER_TO_INT (g_object_get_data (G_OBJECT (task), "queue-id"));
+  attempts = GPOINTER_TO_INT (g_object_get_data (G_OBJECT (task), "attempts"));
+  failed = error != NULL;
+
+  g_assert (device->n_sending > 0);
+  device->n_sending--;
+
+  if (error && ++attempts < SMS_MAX_SEND_ATTEMPTS &&
+      mm_account_sms_can_retry (sms, error)) {
+    guint delay;
+
+    delay = SMS_RETRY_DELAY_SECONDS << (attempts - 1);
+    g_debug ("Failed to send sms, attempt %d, retrying in %u seconds: %s",
+             attempts, delay, error->message);
+    g_object_set_data (G_OBJECT (task), "attempts", GINT_TO_POINTER (attempts));
+
+    if (id)
+      chatty_history_update_sms_queue (self->history_db, id, attempts, time (NULL) + delay);
+
+    mm_account_retry_sms_later (self, task, delay);
+    g_error_free (error);
+  } else {
+    if (error)
+      g_debug ("Failed to send sms: %s", error->message);
+
+    mm_account_complete_sms (self, task, error);
+  }
+
+  /* Don't let failed messages pile up in the modem */
+  if (failed && sms)
+    mm_account_delete_message_async (self, device, sms, NULL, NULL);
+
+  mm_account_send_next_sms (self, device);
+}
+
 static void
 sent_message_delete_cb (GObject      *object,
                         GAsyncResult *result,
@@ -261,7 +568,7 @@ sent_message_delete_cb (GObject      *object,
 {
   ChattyMmAccount *self;
   MMModemMessaging *messaging = (MMModemMessaging *)object;
-  g_autoptr(GTask) task = user_data;
+  GTask *task = user_data;
   g_autoptr(GError) error = NULL;
   ChattyMessage *message;
   ChattyChat *chat;
@@ -274,13 +581,15 @@ sent_message_delete_cb (GObject      *object,
   g_assert (CHATTY_IS_MM_ACCOUNT (self));
   g_assert (CHATTY_IS_CHAT (chat));
 
-  /* We add the item to db only if we are able to delete it from modem */
-  if (mm_modem_messaging_delete_finish (messaging, result, &error))
-    chatty_history_add_message (self->history_db, chat, message);
-  else if (error)
+  /*
+   * The message is sent, so update it in db even if we failed to delete
+   * it from the modem.  Such messages are removed later as stuck SMS.
+   */
+  if (!mm_modem_messaging_delete_finish (messaging, result, &error) && error)
     g_warning ("Error deleting message: %s", error->message);
 
-  g_task_return_boolean (task, TRUE);
+  chatty_history_add_message (self->history_db, chat, message);
+  mm_account_sms_done (task, NULL);
 }
 
 static gboolean
@@ -311,7 +620,7 @@ get_message_reference (gpointer user_data)
                              mm_sms_get_path (sms),
                              g_task_get_cancellable (task),
                              sent_message_delete_cb,
-                             task);
+                             g_object_ref (task));
 
   return G_SOURCE_REMOVE;
 }
@@ -321,39 +630,22 @@ sms_send_cb (GObject      *object,
              GAsyncResult *result,
              gpointer      user_data)
 {
-  ChattyMmAccount *self;
-  g_autoptr(GTask) task = user_data;
+  GTask *task = user_data;
   MMSms *sms = (MMSms *)object;
   ChattyMessage *message;
-  ChattyChat *chat;
   GError *error = NULL;
 
   g_assert (G_IS_TASK (task));
 
-  self = g_task_get_source_object (task);
-  chat = g_object_get_data (G_OBJECT (task), "chat");
-  g_assert (CHATTY_IS_MM_ACCOUNT (self));
-  g_assert (CHATTY_IS_CHAT (chat));
-
   message = g_task_get_task_data (task);
 
   if (!mm_sms_send_finish (sms, result, &error)) {
-    g_autofree char *title = NULL;
-
-    chatty_message_set_status (message, CHATTY_STATUS_SENDING_FAILED, 0);
-    chatty_history_add_message (self->history_db, chat, message);
-    title = g_strdup_printf (_("Error Sending SMS to %s"),
-                              chatty_item_get_name (CHATTY_ITEM (chat)));
-    chatty_mm_notify_message (title, ERROR_MM_SMS_SEND_RECEIVE, "");
-    g_debug ("Failed to send sms: %s", error->message);
-    g_task_return_error (task, error);
+    mm_account_sms_done (task, error);
     return;
   }
 
   chatty_message_set_status (message, CHATTY_STATUS_SENT, 0);
 
-  g_object_set_data_full (G_OBJECT (task), "sms", g_object_ref (sms), g_object_unref);
-
   /*
    * HACK: There seems some slight delay with updating message_reference with my AT modem.
    * So if mm_sms_get_message_reference (sms) returns 0, try again after some timeout.
@@ -361,7 +653,10 @@ sms_send_cb (GObject      *object,
   if (mm_sms_get_message_reference (sms))
     get_message_reference (task);
   else
-    g_timeout_add (100, get_message_reference, g_steal_pointer (&task));
+    g_timeout_add_full (G_PRIORITY_DEFAULT, 100, get_message_reference,
+                        g_object_ref (task), g_object_unref);
+
+  g_object_unref (task);
 }
 
 static void
@@ -369,44 +664,220 @@ sms_create_cb (GObject      *object,
                GAsyncResult *result,
                gpointer      user_data)
 {
-  ChattyMmAccount *self;
-  g_autoptr(GTask) task = user_data;
+  GTask *task = user_data;
   g_autoptr(MMSms) sms = NULL;
-  GCancellable *cancellable;
   GError *error = NULL;
 
   g_assert (G_IS_TASK (task));
 
+  sms = mm_modem_messaging_create_finish (MM_MODEM_MESSAGING (object), result, &error);
+
+  if (!sms) {
+    mm_account_sms_done (task, error);
+    return;
+  }
+
+  g_object_set_data_full (G_OBJECT (task), "sms", g_object_ref (sms), g_object_unref);
+
+  CHATTY_TRACE_MSG ("Sending message");
+  mm_sms_send (sms, g_task_get_cancellable (task), sms_send_cb, task);
+}
+
+/* Create and send queued SMS, several at a time */
+static void
+mm_account_send_next_sms (ChattyMmAccount *self,
+                          ChattyMmDevice  *device)
+{
+  GTask *task;
+
+  g_assert (CHATTY_IS_MM_ACCOUNT (self));
+  g_assert (CHATTY_IS_MM_DEVICE (device));
+
+  while (device->n_sending < SMS_MAX_PARALLEL_SENDS &&
+         (task = g_queue_pop_head (device->send_queue))) {
+    MMSmsProperties *sms_properties;
+
+    sms_properties = g_object_get_data (G_OBJECT (task), "properties");
+    device->n_sending++;
+
+    CHATTY_TRACE_MSG ("Creating sms message, %u being sent", device->n_sending);
+    mm_modem_messaging_create (mm_object_peek_modem_messaging (device->mm_object),
+                               sms_properties, g_task_get_cancellable (task),
+                               sms_create_cb, task);
+  }
+}
+
+static gboolean
+mm_account_fail_sms_retry (gpointer key,
+                           gpointer value,
+                           gpointer user_data)
+{
+  GTask *task = key;
+
+  if (g_object_get_data (G_OBJECT (task), "device") != user_data)
+    return FALSE;
+
+  g_source_remove (GPOINTER_TO_UINT (value));
+  mm_account_complete_sms (g_task_get_source_object (task), task,
+                           g_error_new (G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                                        "Modem removed"));
+  return TRUE;
+}
+
+/* Fail the SMS waiting to be sent with @device, eg: when it's removed */
+static void
+mm_account_fail_queued_sms (ChattyMmAccount *self,
+                            ChattyMmDevice  *device)
+{
+  GTask *task;
+
+  g_assert (CHATTY_IS_MM_ACCOUNT (self));
+  g_assert (CHATTY_IS_MM_DEVICE (device));
+
+  while ((task = g_queue_pop_head (device->send_queue)))
+    mm_account_complete_sms (self, task,
+                             g_error_new (G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                                          "Modem removed"));
+
+  g_hash_table_foreach_remove (self->sms_retries, mm_account_fail_sms_retry, device);
+}
+
+static void
+sms_queued_cb (GObject      *object,
+               GAsyncResult *result,
+               gpointer      user_data)
+{
+  ChattyMmAccount *self;
+  GTask *task = user_data;
+  g_autoptr(GError) error = NULL;
+  int id;
+
+  g_assert (G_IS_TASK (task));
+
   self = g_task_get_source_object (task);
   g_assert (CHATTY_IS_MM_ACCOUNT (self));
 
-  sms = mm_modem_messaging_create_finish (MM_MODEM_MESSAGING (object), result, &error);
+  id = chatty_history_queue_sms_finish (self->history_db, result, &error);
 
-  if (!sms) {
-    ChattyMessage *message;
-    ChattyChat *chat;
-    g_autofree char *title = NULL;
+  /* Try sending anyway, it just won't survive a restart */
+  if (error)
+    g_warning ("Failed to queue sms: %s", error->message);
 
-    chat = g_object_get_data (G_OBJECT (task), "chat");
-    message = g_task_get_task_data (task);
-    g_assert (CHATTY_IS_CHAT (chat));
+  g_object_set_data (G_OBJECT (task), "queue-id", GINT_TO_POINTER (id));
+  mm_account_push_sms (self, task);
+}
 
-    chatty_message_set_status (message, CHATTY_STATUS_SENDING_FAILED, 0);
-    chatty_history_add_message (self->history_db, chat, message);
-    title = g_strdup_printf (_("Error Sending SMS to %s"),
-                              chatty_item_get_name (CHATTY_ITEM (chat)));
-    chatty_mm_notify_message (title, ERROR_MM_SMS_SEND_RECEIVE, "");
+/*
+ * Send the SMS restored from history that were queued with
+ * @device, or with an unknown modem.  The others wait for
+ * their modem to appear.
+ */
+static void
+mm_account_restore_sms (ChattyMmAccount *self,
+                        ChattyMmDevice  *device)
+{
+  const char *device_id;
+  gint64 now;
 
-    g_debug ("Failed creating sms: %s", error->message);
-    g_task_return_error (task, error);
+  g_assert (CHATTY_IS_MM_ACCOUNT (self));
+  g_assert (CHATTY_IS_MM_DEVICE (device));
+
+  if (!self->restored_sms)
     return;
+
+  device_id = chatty_mm_device_get_id (device);
+  now = time (NULL);
+
+  for (guint i = 0; i < self->restored_sms->len;) {
+    GTask *task = self->restored_sms->pdata[i];
+    const char *task_device_id;
+    gint64 *next_attempt;
+
+    task_device_id = g_object_get_data (G_OBJECT (task), "device-id");
+
+    if (task_device_id && g_strcmp0 (task_device_id, device_id) != 0) {
+      i++;
+      continue;
+    }
+
+    g_ptr_array_steal_index (self->restored_sms, i);
+    g_object_set_data_full (G_OBJECT (task), "device", g_object_ref (device), g_object_unref);
+    next_attempt = g_object_get_data (G_OBJECT (task), "next-attempt");
+
+    if (*next_attempt > now)
+      mm_account_retry_sms_later (self, task, *next_attempt - now);
+    else
+      mm_account_push_sms (self, task);
   }
+}
 
-  cancellable = g_task_get_cancellable (task);
+static void
+mm_account_sms_queue_loaded_cb (GObject      *object,
+                                GAsyncResult *result,
+                                gpointer      user_data)
+{
+  g_autoptr(ChattyMmAccount) self = user_data;
+  g_autoptr(GPtrArray) items = NULL;
+  g_autoptr(GError) error = NULL;
+  guint n_items;
 
-  CHATTY_TRACE_MSG ("Sending message");
-  mm_sms_send (sms, cancellable, sms_send_cb,
-               g_steal_pointer (&task));
+  g_assert (CHATTY_IS_MM_ACCOUNT (self));
+
+  items = chatty_history_get_sms_queue_finish (self->history_db, result, &error);
+
+  if (!items) {
+    g_warning ("Failed to load sms queue: %s", error->message);
+    return;
+  }
+
+  /* The account was closed meanwhile */
+  if (!self->restored_sms)
+    return;
+
+  CHATTY_TRACE_MSG ("Restoring %u queued sms", items->len);
+
+  for (guint i = 0; i < items->len; i++) {
+    ChattySmsQueueItem *item = items->pdata[i];
+    g_autofree char *phone = NULL;
+    g_autoptr(ChattyMessage) message = NULL;
+    ChattyChat *chat;
+    GTask *task;
+
+    chat = chatty_mm_account_find_chat (self, item->chat_name);
+    phone = strip_phone_number (item->number);
+
+    /* The chat was deleted, or the message can't be sent anyway */
+    if (!chat || !phone || !*phone) {
+      chatty_history_remove_queued_sms (self->history_db, item->id);
+      continue;
+    }
+
+    message = chatty_chat_find_message (chat, chatty_message_get_uid (item->message));
+    if (!message)
+      message = g_object_ref (item->message);
+
+    task = g_task_new (self, self->cancellable, NULL, NULL);
+    g_task_set_task_data (task, g_object_ref (message), g_object_unref);
+    g_object_set_data_full (G_OBJECT (task), "chat", g_object_ref (chat), g_object_unref);
+    g_object_set_data_full (G_OBJECT (task), "device-id", g_strdup (item->device_id), g_free);
+    g_object_set_data_full (G_OBJECT (task), "properties",
+                            mm_account_new_sms_properties (message, phone),
+                            g_object_unref);
+    g_object_set_data_full (G_OBJECT (task), "next-attempt",
+                            g_memdup2 (&item->next_attempt, sizeof (gint64)), g_free);
+    g_object_set_data (G_OBJECT (task), "queue-id", GINT_TO_POINTER (item->id));
+    g_object_set_data (G_OBJECT (task), "attempts", GINT_TO_POINTER (item->attempts));
+    g_ptr_array_add (self->restored_sms, task);
+  }
+
+  n_items = g_list_model_get_n_items (G_LIST_MODEL (self->device_list));
+
+  for (guint i = 0; i < n_items; i++) {
+    g_autoptr(ChattyMmDevice) device = NULL;
+
+    device = g_list_model_get_item (G_LIST_MODEL (self->device_list), i);
+    mm_account_restore_sms (self, device);
+  }
 }
 
 static gboolean
@@ -448,13 +919,13 @@ chatty_mm_account_check_eds (gpointer user_data)
   return G_SOURCE_CONTINUE;
 }
 
-static gboolean
-chatty_mm_account_append_message (ChattyMmAccount *self,
-                                  ChattyMessage   *message,
-                                  ChattyChat      *chat)
+/* Show @message in @chat without storing it to history */
+static void
+mm_account_show_message (ChattyMmAccount *self,
+                         ChattyMessage   *message,
+                         ChattyChat      *chat)
 {
   guint position;
-  gboolean success;
 
   g_assert (CHATTY_IS_MM_ACCOUNT (self));
   g_assert (CHATTY_IS_MESSAGE (message));
@@ -465,7 +936,6 @@ chatty_mm_account_append_message (ChattyMmAccount *self,
     chatty_item_set_state (CHATTY_ITEM (chat), CHATTY_ITEM_VISIBLE);
 
   chatty_mm_chat_append_message (CHATTY_MM_CHAT (chat), message);
-  success = chatty_history_add_message (self->history_db, chat, message);
   chatty_chat_set_unread_count (chat, chatty_chat_get_unread_count (chat) + 1);
   g_signal_emit_by_name (chat, "changed", 0);
   if (chatty_message_get_msg_direction (message) == CHATTY_DIRECTION_IN) {
@@ -479,8 +949,16 @@ chatty_mm_account_append_message (ChattyMmAccount *self,
 
   if (chatty_utils_get_item_position (G_LIST_MODEL (self->chat_list), chat, &position))
     g_list_model_items_changed (G_LIST_MODEL (self->chat_list), position, 1, 1);
+}
 
-  return success;
+static gboolean
+chatty_mm_account_append_message (ChattyMmAccount *self,
+                                  ChattyMessage   *message,
+                                  ChattyChat      *chat)
+{
+  mm_account_show_message (self, message, chat);
+
+  return chatty_history_add_message (self->history_db, chat, message);
 }
 
 gboolean
@@ -507,7 +985,7 @@ chatty_mm_account_recieve_mms_cb (ChattyMmAccount *self,
       (msg_status == CHATTY_STATUS_SENT ||
        msg_status == CHATTY_STATUS_DELIVERED ||
        msg_status == CHATTY_STATUS_SENDING_FAILED )) {
-    ChattyMessage  *messagecheck;
+    g_autoptr(ChattyMessage) messagecheck = NULL;
 
     chat = chatty_mm_account_find_chat (self, recipientlist);
 
@@ -517,8 +995,7 @@ chatty_mm_account_recieve_mms_cb (ChattyMmAccount *self,
       return FALSE;
     }
 
-    messagecheck = chatty_mm_chat_find_message_with_uid (CHATTY_MM_CHAT (chat),
-                                                         chatty_message_get_uid (message));
+    messagecheck = chatty_chat_find_message (chat, chatty_message_get_uid (message));
     if (messagecheck != NULL) {
       chatty_message_set_status (messagecheck, chatty_message_get_status (message), 0);
       chatty_history_add_message (self->history_db, chat, message);
@@ -539,9 +1016,9 @@ chatty_mm_account_recieve_mms_cb (ChattyMmAccount *self,
     chat = chatty_mm_account_find_chat (self, recipientlist);
 
     if (chat) {
-      ChattyMessage  *messagecheck;
-      messagecheck = chatty_mm_chat_find_message_with_uid (CHATTY_MM_CHAT (chat),
-                                                           chatty_message_get_uid (message));
+      g_autoptr(ChattyMessage) messagecheck = NULL;
+
+      messagecheck = chatty_chat_find_message (chat, chatty_message_get_uid (message));
       if (messagecheck != NULL)
         return TRUE;
     }
@@ -608,11 +1085,124 @@ mm_account_delete_message_async (ChattyMmAccount     *self,
   g_hash_table_remove (self->stuck_sms, sms_path);
 }
 
+/* Show the stored message at @index and delete it from the modem */
+static void
+mm_account_sms_batch_item_stored (SmsBatch *batch,
+                                  guint     index)
+{
+  ChattyMmAccount *self = batch->object;
+
+  g_assert (CHATTY_IS_MM_ACCOUNT (self));
+
+  mm_account_show_message (self, batch->messages->pdata[index], batch->chats->pdata[index]);
+
+  /* ModemManager can delete only one message per call, but we don't wait for each */
+  if (batch->sms->pdata[index])
+    mm_account_delete_message_async (self, batch->devices->pdata[index],
+                                     batch->sms->pdata[index], NULL, NULL);
+}
+
+static void
+mm_account_sms_item_stored_cb (GObject      *object,
+                               GAsyncResult *result,
+                               gpointer      user_data)
+{
+  SmsBatchItem *item = user_data;
+  SmsBatch *batch = item->batch;
+  ChattyMmAccount *self = batch->object;
+  g_autoptr(GError) error = NULL;
+
+  g_assert (CHATTY_IS_MM_ACCOUNT (self));
+
+  if (chatty_history_add_message_finish (self->history_db, result, &error))
+    mm_account_sms_batch_item_stored (batch, item->index);
+  else
+    /* Keep it in the modem, so that it is imported again later */
+    g_warning ("Failed to store SMS: %s", error->message);
+
+  batch->pending--;
+  if (!batch->pending)
+    sms_batch_free (batch);
+
+  g_free (item);
+}
+
+static void
+mm_account_sms_batch_stored_cb (GObject      *object,
+                                GAsyncResult *result,
+                                gpointer      user_data)
+{
+  SmsBatch *batch = user_data;
+  ChattyMmAccount *self = batch->object;
+  g_autoptr(GError) error = NULL;
+
+  g_assert (CHATTY_IS_MM_ACCOUNT (self));
+
+  if (!chatty_history_add_messages_finish (self->history_db, result, &error)) {
+    /*
+     * The batch is rolled back as a whole, so a single bad message
+     * would keep every other one in the modem.  Store them one by one
+     * instead, so that only the bad ones are left to be imported again.
+     */
+    g_warning ("Failed to store %u SMS at once, storing one by one: %s",
+               batch->messages->len, error->message);
+
+    batch->pending = batch->messages->len;
+
+    for (guint i = 0; i < batch->messages->len; i++) {
+      SmsBatchItem *item;
+
+      item = g_new0 (SmsBatchItem, 1);
+      item->batch = batch;
+      item->index = i;
+      chatty_history_add_message_async (self->history_db, batch->chats->pdata[i],
+                                        batch->messages->pdata[i],
+                                        mm_account_sms_item_stored_cb, item);
+    }
+
+    return;
+  }
+
+  CHATTY_TRACE_MSG ("stored %u SMS", batch->messages->len);
+
+  for (guint i = 0; i < batch->messages->len; i++)
+    mm_account_sms_batch_item_stored (batch, i);
+
+  sms_batch_free (batch);
+}
+
+static void
+mm_account_flush_sms_batch (gpointer user_data)
+{
+  ChattyMmAccount *self = user_data;
+  SmsBatch *batch;
+
+  g_assert (CHATTY_IS_MM_ACCOUNT (self));
+
+  self->sms_batch_id = 0;
+  batch = g_steal_pointer (&self->sms_batch);
+
+  if (!batch)
+    return;
+
+  batch->object = g_object_ref (self);
+  chatty_history_add_messages_async (self->history_db, batch->chats, batch->messages,
+                                     mm_account_sms_batch_stored_cb, batch);
+}
+
+/*
+ * Queue the message in @sms to be stored in history.  SMS received
+ * in bursts (eg: after getting back network or on start up) are
+ * stored in a single transaction.  Messages are shown, and incoming
+ * ones deleted from the modem, only once they are stored, so that a
+ * message that fails to store is neither lost nor shown twice when
+ * it is imported again.
+ */
 static gboolean
-mm_account_add_sms (ChattyMmAccount *self,
-                    ChattyMmDevice  *device,
-                    MMSms           *sms,
-                    MMSmsState       state)
+mm_account_queue_sms (ChattyMmAccount *self,
+                      ChattyMmDevice  *device,
+                      MMSms           *sms,
+                      MMSmsState       state)
 {
   g_autoptr(ChattyMessage) message = NULL;
   g_autoptr(GDateTime) date_time = NULL;
@@ -623,7 +1213,6 @@ mm_account_add_sms (ChattyMmAccount *self,
   const char *msg;
   ChattyMsgDirection direction = CHATTY_DIRECTION_UNKNOWN;
   gint64 unix_time = 0;
-  gboolean message_added;
 
   g_assert (CHATTY_IS_MM_ACCOUNT (self));
   g_assert (MM_IS_SMS (sms));
@@ -661,12 +1250,26 @@ mm_account_add_sms (ChattyMmAccount *self,
   message = chatty_message_new (CHATTY_ITEM (senderbuddy),
                                 msg, uuid, unix_time, CHATTY_MESSAGE_TEXT, direction, 0);
 
-  message_added = chatty_mm_account_append_message (self, message, chat);
+  if (!self->sms_batch)
+    self->sms_batch = sms_batch_new ();
 
-  if (message_added && direction == CHATTY_DIRECTION_IN)
-    mm_account_delete_message_async (self, device, sms, NULL, NULL);
+  g_ptr_array_add (self->sms_batch->chats, g_object_ref (chat));
+  g_ptr_array_add (self->sms_batch->messages, g_object_ref (message));
+
+  if (direction == CHATTY_DIRECTION_IN) {
+    g_ptr_array_add (self->sms_batch->sms, g_object_ref (sms));
+    g_ptr_array_add (self->sms_batch->devices, g_object_ref (device));
+  } else {
+    g_ptr_array_add (self->sms_batch->sms, NULL);
+    g_ptr_array_add (self->sms_batch->devices, NULL);
+  }
+
+  if (!self->sms_batch_id)
+    self->sms_batch_id = g_timeout_add_once (SMS_BATCH_TIMEOUT_MS,
+                                             mm_account_flush_sms_batch,
+                                             self);
 
-  return message_added;
+  return TRUE;
 }
 
 static void
@@ -685,13 +1288,9 @@ sms_state_changed_cb (ChattyMmAccount *self,
     ChattyMmDevice *device;
 
     device = g_object_get_data (G_OBJECT (sms), "device");
-    if (mm_account_add_sms (self, device, sms, state)) {
-      CHATTY_TRACE_MSG ("deleting message %s", mm_sms_get_path (sms));
-      mm_modem_messaging_delete (mm_object_peek_modem_messaging (device->mm_object),
-                                 mm_sms_get_path (sms),
-                                 NULL, NULL, NULL);
-      g_hash_table_remove (self->stuck_sms, mm_sms_get_path (sms));
-    }
+    mm_account_queue_sms (self, device, sms, state);
+    g_signal_handlers_disconnect_by_func (sms, sms_state_changed_cb, self);
+    g_hash_table_remove (self->receiving_sms, mm_sms_get_path (sms));
   }
 }
 
@@ -730,6 +1329,7 @@ mm_account_state_timeout (gpointer user_data)
                              mm_sms_get_path (data->sms),
                              NULL, mm_account_state_timeout_delete_cb, self);
 
+  g_hash_table_remove (self->receiving_sms, mm_sms_get_path (data->sms));
   g_hash_table_remove (self->stuck_sms, mm_sms_get_path (data->sms));
 }
 
@@ -824,8 +1424,12 @@ parse_sms (ChattyMmAccount *self,
   type = mm_sms_get_pdu_type (sms);
 
   if (state == MM_SMS_STATE_SENDING ||
-      state == MM_SMS_STATE_SENT)
+      state == MM_SMS_STATE_SENT) {
+    /* Left over from an earlier run, the sms queue sends them again if required */
+    if (type == MM_SMS_PDU_TYPE_SUBMIT && chatty_settings_get_clear_out_stuck_sms (settings))
+      mm_account_check_state (self, device, sms);
     return;
+  }
 
   /* Unknown messages are generally messages that haven't been sent yet. Don't worry about them */
   if (chatty_settings_get_clear_out_stuck_sms (settings) && state == MM_SMS_STATE_RECEIVING)
@@ -857,12 +1461,8 @@ parse_sms (ChattyMmAccount *self,
     }
   } else if (type == MM_SMS_PDU_TYPE_CDMA_DELIVER ||
              type == MM_SMS_PDU_TYPE_DELIVER) {
-    if (state == MM_SMS_STATE_RECEIVED && mm_account_add_sms (self, device, sms, state)) {
-        CHATTY_TRACE_MSG ("deleting message %s", mm_sms_get_path (sms));
-        mm_modem_messaging_delete (mm_object_peek_modem_messaging (device->mm_object),
-                                   mm_sms_get_path (sms),
-                                   NULL, NULL, NULL);
-        g_hash_table_remove (self->stuck_sms, mm_sms_get_path (sms));
+    if (state == MM_SMS_STATE_RECEIVED) {
+      mm_account_queue_sms (self, device, sms, state);
     } else if (state == MM_SMS_STATE_RECEIVING) {
       g_object_set_data_full (G_OBJECT (sms), "device",
                               g_object_ref (device),
@@ -871,6 +1471,8 @@ parse_sms (ChattyMmAccount *self,
                                G_CALLBACK (sms_state_changed_cb),
                                self,
                                G_CONNECT_SWAPPED | G_CONNECT_AFTER);
+      /* Keep the message alive until we get the rest of it */
+      g_hash_table_insert (self->receiving_sms, mm_sms_dup_path (sms), g_object_ref (sms));
     }
   }
 }
@@ -884,9 +1486,7 @@ mm_account_messaging_list_cb (GObject      *object,
   MMModemMessaging *mm_messaging = (MMModemMessaging *)object;
   MessagingData *data = user_data;
   g_autoptr(GError) error = NULL;
-  g_autoptr(ChattyMmDevice) device = NULL;
   GList *list;
-  char *path;
 
   g_assert (data);
   g_assert (CHATTY_IS_MM_ACCOUNT (data->object));
@@ -898,23 +1498,43 @@ mm_account_messaging_list_cb (GObject      *object,
 
   if (error) {
     g_debug ("Error listing messages: %s", error->message);
+    messaging_data_free (data);
     return;
   }
 
-  path = data->message_path;
-  device = mm_account_lookup_device (self, NULL, mm_messaging);
-
+  /* Received messages are queued and stored in a single batch */
   for (GList *node = list; node; node = node->next)
-    if (!path || g_str_equal (mm_sms_get_path (node->data), path)) {
-      parse_sms (self, device, node->data);
+    parse_sms (self, data->device, node->data);
 
-      if (path)
-        break;
-    }
+  g_list_free_full (list, g_object_unref);
+  messaging_data_free (data);
+}
 
-  g_object_unref (data->object);
-  g_free (data->message_path);
-  g_free (data);
+static void
+mm_account_sms_new_cb (GObject      *object,
+                       GAsyncResult *result,
+                       gpointer      user_data)
+{
+  MessagingData *data = user_data;
+  g_autoptr(GObject) sms = NULL;
+  g_autoptr(GError) error = NULL;
+
+  g_assert (data);
+  g_assert (CHATTY_IS_MM_ACCOUNT (data->object));
+
+  sms = g_async_initable_new_finish (G_ASYNC_INITABLE (object), result, &error);
+
+  if (error) {
+    g_debug ("Error getting message: %s", error->message);
+  } else {
+    parse_sms (data->object, data->device, MM_SMS (sms));
+
+    /* Complete messages are queued to be stored when parsed */
+    if (mm_sms_get_state (MM_SMS (sms)) == MM_SMS_STATE_RECEIVED)
+      chatty_stats_record_since (CHATTY_STAT_SMS_RECEIVE, data->received_time);
+  }
+
+  messaging_data_free (data);
 }
 
 static void
@@ -928,18 +1548,34 @@ mm_account_sms_received_cb (ChattyMmAccount  *self,
   g_assert (CHATTY_IS_MM_ACCOUNT (self));
   g_assert (MM_IS_MODEM_MESSAGING (mm_messaging));
 
-  if (!arg_path)
+  /* Messages we create to send are handled when sending */
+  if (!arg_path || !arg_received)
     return;
 
   data = g_new0 (MessagingData, 1);
   data->object = g_object_ref (self);
-  data->message_path = g_strdup (arg_path);
+  data->device = mm_account_lookup_device (self, NULL, mm_messaging);
+  data->received_time = g_get_monotonic_time ();
 
-  CHATTY_TRACE_MSG ("List modem messages");
+  if (!data->device) {
+    messaging_data_free (data);
+    return;
+  }
 
-  mm_modem_messaging_list (mm_messaging, self->cancellable,
-                           mm_account_messaging_list_cb,
-                           data);
+  CHATTY_TRACE_MSG ("Get modem message %s", arg_path);
+
+  /* Fetch only the new message instead of listing every message in the modem */
+  g_async_initable_new_async (MM_TYPE_SMS,
+                              G_PRIORITY_DEFAULT,
+                              self->cancellable,
+                              mm_account_sms_new_cb,
+                              data,
+                              "g-flags", G_DBUS_PROXY_FLAGS_DO_NOT_AUTO_START,
+                              "g-name", MM_DBUS_SERVICE,
+                              "g-connection", g_dbus_proxy_get_connection (G_DBUS_PROXY (mm_messaging)),
+                              "g-object-path", arg_path,
+                              "g-interface-name", MM_DBUS_INTERFACE_SMS,
+                              NULL);
 }
 
 static void
@@ -1026,11 +1662,22 @@ mm_object_added_cb (ChattyMmAccount *self,
 
   data = g_new0 (MessagingData, 1);
   data->object = g_object_ref (self);
+  data->device = g_object_ref (device);
 
   mm_modem_messaging_list (mm_object_peek_modem_messaging (MM_OBJECT (object)),
                            NULL,
                            mm_account_messaging_list_cb,
                            data);
+
+  /* Send the SMS queued before chatty was last closed */
+  if (!self->sms_queue_loaded) {
+    self->sms_queue_loaded = TRUE;
+    chatty_history_get_sms_queue_async (self->history_db,
+                                        mm_account_sms_queue_loaded_cb,
+                                        g_object_ref (self));
+  } else {
+    mm_account_restore_sms (self, device);
+  }
 }
 
 /*
@@ -1074,6 +1721,7 @@ mm_object_removed_cb (ChattyMmAccount *self,
                    mm_object_get_path (device->mm_object)) == 0) {
       self->status = CHATTY_UNKNOWN;
       g_hash_table_foreach_remove (self->stuck_sms, delete_stuck_sms, mm_object_dup_path (MM_OBJECT (object)));
+      mm_account_fail_queued_sms (self, device);
       g_list_store_remove (self->device_list, i);
       break;
     }
@@ -1258,6 +1906,31 @@ chatty_mm_account_get_username (ChattyItem *item)
   return "invalid-0000000000000000";
 }
 
+static void
+chatty_mm_account_dispose (GObject *object)
+{
+  ChattyMmAccount *self = (ChattyMmAccount *)object;
+  guint n_items;
+
+  /* The pending SMS are kept in history, to be sent on next start */
+  g_hash_table_foreach_remove (self->sms_retries, mm_account_cancel_sms_retry, NULL);
+  g_clear_pointer (&self->restored_sms, g_ptr_array_unref);
+
+  n_items = self->device_list ? g_list_model_get_n_items (G_LIST_MODEL (self->device_list)) : 0;
+
+  for (guint i = 0; i < n_items; i++) {
+    g_autoptr(ChattyMmDevice) device = NULL;
+    GTask *task;
+
+    device = g_list_model_get_item (G_LIST_MODEL (self->device_list), i);
+
+    while ((task = g_queue_pop_head (device->send_queue)))
+      mm_account_cancel_sms (task);
+  }
+
+  G_OBJECT_CLASS (chatty_mm_account_parent_class)->dispose (object);
+}
+
 static void
 chatty_mm_account_finalize (GObject *object)
 {
@@ -1267,6 +1940,8 @@ chatty_mm_account_finalize (GObject *object)
     g_cancellable_cancel (self->cancellable);
   g_clear_object (&self->cancellable);
   g_list_store_remove_all (self->device_list);
+  g_clear_handle_id (&self->sms_batch_id, g_source_remove);
+  g_clear_pointer (&self->sms_batch, sms_batch_free);
 
   g_clear_handle_id (&self->mm_watch_id, g_bus_unwatch_name);
   g_clear_object (&self->history_db);
@@ -1278,6 +1953,8 @@ chatty_mm_account_finalize (GObject *object)
   g_hash_table_unref (self->pending_sms);
   g_hash_table_remove_all (self->stuck_sms);
   g_hash_table_destroy (self->stuck_sms);
+  g_hash_table_unref (self->receiving_sms);
+  g_hash_table_unref (self->sms_retries);
 
   G_OBJECT_CLASS (chatty_mm_account_parent_class)->finalize (object);
 }
@@ -1289,6 +1966,7 @@ chatty_mm_account_class_init (ChattyMmAccountClass *klass)
   ChattyItemClass *item_class = CHATTY_ITEM_CLASS (klass);
   ChattyAccountClass *account_class = CHATTY_ACCOUNT_CLASS (klass);
 
+  object_class->dispose = chatty_mm_account_dispose;
   object_class->finalize = chatty_mm_account_finalize;
 
   item_class->get_protocols = chatty_mm_account_get_protocols;
@@ -1309,6 +1987,10 @@ chatty_mm_account_init (ChattyMmAccount *self)
                                              NULL, g_object_unref);
   self->stuck_sms = g_hash_table_new_full (g_str_hash, g_str_equal,
                                            g_free, stuck_sms_payload_free);
+  self->receiving_sms = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                               g_free, g_object_unref);
+  self->sms_retries = g_hash_table_new (g_direct_hash, g_direct_equal);
+  self->restored_sms = g_ptr_array_new_with_free_func (mm_account_cancel_sms);
   self->has_mms = FALSE;
 }
 
@@ -1624,13 +2306,10 @@ chatty_mm_account_send_message_async (ChattyMmAccount     *self,
                                       GAsyncReadyCallback  callback,
                                       gpointer             user_data)
 {
-  g_autoptr(MMSmsProperties) sms_properties = NULL;
   g_autoptr(GTask) task = NULL;
   g_autofree char *phone = NULL;
-  ChattySettings *settings;
   ChattyMmDevice *device;
   guint position;
-  gboolean request_report;
 
   g_return_if_fail (CHATTY_IS_MM_ACCOUNT (self));
   g_return_if_fail (CHATTY_IS_MM_CHAT (chat));
@@ -1670,26 +2349,18 @@ chatty_mm_account_send_message_async (ChattyMmAccount     *self,
     return;
   }
 
-  settings = chatty_settings_get_default ();
-  request_report = chatty_settings_request_sms_delivery_reports (settings);
-  sms_properties = mm_sms_properties_new ();
-  mm_sms_properties_set_text (sms_properties, chatty_message_get_text (message));
-  mm_sms_properties_set_number (sms_properties, phone);
-  mm_sms_properties_set_delivery_report_request (sms_properties, request_report);
-  /*
-   * https://gitlab.freedesktop.org/mobile-broadband/ModemManager/-/blob/201c8533e0e51c2f3ec6c64240d8a5705c26c8d3/src/mm-sms-part-3gpp.c#L307
-   * Max Value for validity relative is 635040, value is in minutes
-   */
-  mm_sms_properties_set_validity_relative (sms_properties, 635040);
+  g_object_set_data_full (G_OBJECT (task), "properties",
+                          mm_account_new_sms_properties (message, phone),
+                          g_object_unref);
 
   if (chatty_utils_get_item_position (G_LIST_MODEL (self->chat_list), chat, &position))
     g_list_model_items_changed (G_LIST_MODEL (self->chat_list), position, 1, 1);
 
-  CHATTY_TRACE (phone, "Creating sms message to number: ");
-  mm_modem_messaging_create (mm_object_peek_modem_messaging (device->mm_object),
-                             sms_properties, cancellable,
-                             sms_create_cb,
-                             g_steal_pointer (&task));
+  /* Store the message first, so that it's sent even if we are killed before that */
+  CHATTY_TRACE (phone, "Queueing sms message to number: ");
+  chatty_history_queue_sms_async (self->history_db, chat, message, phone,
+                                  chatty_mm_device_get_id (device),
+                                  sms_queued_cb, g_steal_pointer (&task));
 }
 
 gboolean
@@ -198,6 +198,12 @@ chatty_mm_buddy_get_contact (ChattyMmBuddy *self)
   return self->contact;
 }
 
+static void
+mm_buddy_contact_avatar_changed_cb (ChattyMmBuddy *self)
+{
+  g_signal_emit_by_name (self, "avatar-changed");
+}
+
 void
 chatty_mm_buddy_set_contact (ChattyMmBuddy *self,
                              ChattyContact *contact)
@@ -205,8 +211,22 @@ chatty_mm_buddy_set_contact (ChattyMmBuddy *self,
   g_return_if_fail (CHATTY_IS_MM_BUDDY (self));
   g_return_if_fail (!contact || CHATTY_IS_CONTACT (contact));
 
-  if (g_set_object (&self->contact, contact)) {
-    g_object_notify (G_OBJECT (self), "name");
-    g_signal_emit_by_name (self, "avatar-changed");
-  }
+  if (self->contact == contact)
+    return;
+
+  if (self->contact)
+    g_signal_handlers_disconnect_by_func (self->contact,
+                                          mm_buddy_contact_avatar_changed_cb,
+                                          self);
+
+  g_set_object (&self->contact, contact);
+
+  /* Contact avatars are loaded asynchronously */
+  if (contact)
+    g_signal_connect_object (contact, "avatar-changed",
+                             G_CALLBACK (mm_buddy_contact_avatar_changed_cb),
+                             self, G_CONNECT_SWAPPED);
+
+  g_object_notify (G_OBJECT (self), "name");
+  g_signal_emit_by_name (self, "avatar-changed");
 }
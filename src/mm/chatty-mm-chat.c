@@ -18,6 +18,7 @@
 #include "chatty-utils.h"
 #include "chatty-mm-account.h"
 #include "chatty-history.h"
+#include "chatty-message-list.h"
 #include "chatty-mm-chat.h"
 #include "chatty-log.h"
 
@@ -37,12 +38,9 @@ struct _ChattyMmChat
   ChattyHistory   *history_db;
   ChattySmsUri    *sms_uri;
   GListStore      *chat_users;
-  GListStore      *message_store;
+  ChattyMessageList *message_store;
   /* A Queue of #GTask */
   GQueue          *message_queue;
-  /* Index of @chat_users for the message
-     that's currently being sent */
-  guint            sender_index;
 
   char            *last_message;
   char            *chat_id;
@@ -74,6 +72,31 @@ chatty_mm_chat_set_data (ChattyChat *chat,
   g_set_object (&self->history_db, history_db);
 }
 
+static void
+mm_chat_buddy_avatar_changed_cb (ChattyMmChat *self)
+{
+  /* Only chats with a single user show the avatar of the user */
+  if (g_list_model_get_n_items (G_LIST_MODEL (self->chat_users)) == 1)
+    g_signal_emit_by_name (self, "avatar-changed");
+}
+
+static void
+mm_chat_users_changed_cb (ChattyMmChat *self,
+                          guint         position,
+                          guint         removed,
+                          guint         added,
+                          GListModel   *users)
+{
+  for (guint i = position; i < position + added; i++) {
+    g_autoptr(ChattyMmBuddy) buddy = NULL;
+
+    buddy = g_list_model_get_item (users, i);
+    g_signal_connect_object (buddy, "avatar-changed",
+                             G_CALLBACK (mm_chat_buddy_avatar_changed_cb),
+                             self, G_CONNECT_SWAPPED);
+  }
+}
+
 static void
 chatty_mm_chat_update_contact (ChattyMmChat *self)
 {
@@ -167,7 +190,7 @@ mm_chat_load_db_messages_cb (GObject      *object,
   g_object_notify (G_OBJECT (self), "loading-history");
 
   if (messages && messages->len) {
-    g_list_store_splice (self->message_store, 0, 0, messages->pdata, messages->len);
+    chatty_message_list_add_many (self->message_store, messages);
     g_signal_emit_by_name (self, "changed", 0);
     g_object_notify (G_OBJECT (self), "last-message-time");
   } else if (error &&
@@ -297,6 +320,14 @@ chatty_mm_chat_set_unread_count (ChattyChat *chat,
 
 static void mm_chat_send_message_from_queue (ChattyMmChat *self);
 
+static gboolean
+mm_chat_message_is_mms (ChattyMmChat  *self,
+                        ChattyMessage *message)
+{
+  return self->protocol == CHATTY_PROTOCOL_MMS ||
+         chatty_message_get_files (message) != NULL;
+}
+
 static void
 mm_chat_send_message_cb (GObject      *object,
                          GAsyncResult *result,
@@ -304,12 +335,9 @@ mm_chat_send_message_cb (GObject      *object,
 {
   ChattyMmChat *self;
   g_autoptr(GTask) task = user_data;
-  g_autoptr(ChattyMmBuddy) buddy = NULL;
   g_autoptr(GError) error = NULL;
   ChattyMessage *message;
-  GList *files;
-  gboolean is_mms = FALSE;
-
+  guint n_pending;
 
   g_assert (G_IS_TASK (task));
 
@@ -329,48 +357,35 @@ mm_chat_send_message_cb (GObject      *object,
     chatty_message_set_status (message, CHATTY_STATUS_SENDING_FAILED, 0);
   }
 
-  files = chatty_message_get_files (message);
-  if (self->protocol == CHATTY_PROTOCOL_MMS || files != NULL) {
-    is_mms = TRUE;
-  }
-
-  if (!is_mms) {
-    GListModel *users;
+  if (mm_chat_message_is_mms (self, message)) {
+    self->is_sending_message = FALSE;
+    g_task_return_boolean (task, TRUE);
+    g_object_unref (g_queue_pop_head (self->message_queue));
+    mm_chat_send_message_from_queue (self);
 
-    users = G_LIST_MODEL (self->chat_users);
-    buddy = g_list_model_get_item (users, self->sender_index);
+    return;
   }
 
-  self->is_sending_message = FALSE;
+  /* The task is done when the SMS is sent to every buddy */
+  n_pending = GPOINTER_TO_UINT (g_object_get_data (G_OBJECT (task), "n-pending"));
+  g_object_set_data (G_OBJECT (task), "n-pending", GUINT_TO_POINTER (--n_pending));
 
-  /* If we don't have any more buddies, we have sent the message
-     to all buddies in the list.  Reset sender index and mark task
-     as done */
-  if (!buddy || is_mms) {
-    self->sender_index = 0;
+  if (!n_pending)
     g_task_return_boolean (task, TRUE);
-    g_object_unref (g_queue_pop_head (self->message_queue));
-  }
-
-  mm_chat_send_message_from_queue (self);
 }
 
 /*
  * Try sending message from queue if not empty.
- * For SMS messages, the message is sent to individual
- * buddies sequentially and the message is removed
- * from queue only after the message is sent to every
- * buddy in the chat list
+ * MMS messages are sent one at a time.  SMS messages are
+ * handed over to the account for every buddy in the chat
+ * at once, as the account keeps its own persistent queue
+ * and sends several of them in parallel.
  */
 static void
 mm_chat_send_message_from_queue (ChattyMmChat *self)
 {
-  g_autoptr(ChattyMmBuddy) buddy = NULL;
-  ChattyMessage *message;
   GListModel *users;
   GTask *task;
-  GList *files;
-  gboolean is_mms = FALSE;
 
   g_assert (CHATTY_IS_MM_CHAT (self));
 
@@ -382,32 +397,40 @@ mm_chat_send_message_from_queue (ChattyMmChat *self)
   users = G_LIST_MODEL (self->chat_users);
   g_return_if_fail (g_list_model_get_n_items (users) > 0);
 
-  self->is_sending_message = TRUE;
-  task = g_queue_peek_head (self->message_queue);
-  message = g_task_get_task_data (task);
-
-  files = chatty_message_get_files (message);
-  if (self->protocol == CHATTY_PROTOCOL_MMS || files != NULL) {
-    is_mms = TRUE;
-  }
+  while ((task = g_queue_peek_head (self->message_queue))) {
+    ChattyMessage *message;
+    guint n_items;
 
-  /*
-   * For SMS, we iterate over the buddy list and send individual message
-   * to each buddy sequentially
-   */
-  if (!is_mms) {
-    /* Get the current buddy in the index */
-    buddy = g_list_model_get_item (users, self->sender_index);
-    /* Increment the index which shall be used in the next iteration */
-    self->sender_index++;
-    g_assert (buddy);
+    message = g_task_get_task_data (task);
+
+    if (mm_chat_message_is_mms (self, message)) {
+      self->is_sending_message = TRUE;
+      chatty_mm_account_send_message_async (self->account, CHATTY_CHAT (self),
+                                            NULL, message, TRUE,
+                                            g_task_get_cancellable (task),
+                                            mm_chat_send_message_cb,
+                                            g_object_ref (task));
+      return;
+    }
+
+    g_queue_pop_head (self->message_queue);
+    n_items = g_list_model_get_n_items (users);
+    g_object_set_data (G_OBJECT (task), "n-pending", GUINT_TO_POINTER (n_items));
+
+    for (guint i = 0; i < n_items; i++) {
+      g_autoptr(ChattyMmBuddy) buddy = NULL;
+
+      buddy = g_list_model_get_item (users, i);
+      chatty_mm_account_send_message_async (self->account, CHATTY_CHAT (self),
+                                            buddy, message, FALSE,
+                                            g_task_get_cancellable (task),
+                                            mm_chat_send_message_cb,
+                                            g_object_ref (task));
+    }
+
+    /* The callbacks hold the references now */
+    g_object_unref (task);
   }
-
-  chatty_mm_account_send_message_async (self->account, CHATTY_CHAT (self),
-                                        buddy, message, is_mms,
-                                        g_task_get_cancellable (task),
-                                        mm_chat_send_message_cb,
-                                        g_object_ref (task));
 }
 
 static void
@@ -569,7 +592,7 @@ chatty_mm_chat_finalize (GObject *object)
 
   g_queue_free_full (self->message_queue, g_object_unref);
   g_list_store_remove_all (self->chat_users);
-  g_list_store_remove_all (self->message_store);
+  chatty_message_list_remove_all (self->message_store);
   g_clear_object (&self->history_db);
   g_clear_object (&self->chatty_eds);
   g_clear_object (&self->account);
@@ -618,7 +641,10 @@ static void
 chatty_mm_chat_init (ChattyMmChat *self)
 {
   self->chat_users = g_list_store_new (CHATTY_TYPE_MM_BUDDY);
-  self->message_store = g_list_store_new (CHATTY_TYPE_MESSAGE);
+  g_signal_connect_object (self->chat_users, "items-changed",
+                           G_CALLBACK (mm_chat_users_changed_cb),
+                           self, G_CONNECT_SWAPPED);
+  self->message_store = chatty_message_list_new ();
   self->message_queue = g_queue_new ();
   /* We do not know if there is a custom name or not.
    * If there is not a custom name, self->name will be NULL or "",
@@ -709,32 +735,6 @@ chatty_mm_chat_set_eds (ChattyMmChat *self,
                            G_CONNECT_SWAPPED);
 }
 
-ChattyMessage *
-chatty_mm_chat_find_message_with_uid (ChattyMmChat *self,
-                                      const char   *uid)
-{
-  guint n_items;
-
-  g_return_val_if_fail (CHATTY_IS_MM_CHAT (self), NULL);
-  g_return_val_if_fail (uid && *uid, NULL);
-
-  n_items = g_list_model_get_n_items (G_LIST_MODEL (self->message_store));
-
-  /* Search from end, the item is more likely to be at the end */
-  for (guint i = n_items; i > 0; i--) {
-    g_autoptr(ChattyMessage) message = NULL;
-    const char *message_uid;
-
-    message = g_list_model_get_item (G_LIST_MODEL (self->message_store), i - 1);
-    message_uid = chatty_message_get_uid (message);
-
-    if (g_str_equal (uid, message_uid))
-      return message;
-  }
-
-  return NULL;
-}
-
 ChattyMmBuddy *
 chatty_mm_chat_find_user (ChattyMmChat *self,
                           const char   *phone)
@@ -774,7 +774,7 @@ chatty_mm_chat_append_message (ChattyMmChat  *self,
   g_return_if_fail (CHATTY_IS_MM_CHAT (self));
   g_return_if_fail (CHATTY_IS_MESSAGE (message));
 
-  g_list_store_append (self->message_store, message);
+  chatty_message_list_add (self->message_store, message);
   g_signal_emit_by_name (self, "changed", 0);
   g_object_notify (G_OBJECT (self), "last-message-time");
 }
@@ -790,7 +790,7 @@ chatty_mm_chat_prepend_messages (ChattyMmChat *self,
 
   g_return_if_fail (CHATTY_IS_MESSAGE (messages->pdata[0]));
 
-  g_list_store_splice (self->message_store, 0, 0, messages->pdata, messages->len);
+  chatty_message_list_add_many (self->message_store, messages);
   g_signal_emit_by_name (self, "changed", 0);
   g_object_notify (G_OBJECT (self), "last-message-time");
 }
@@ -41,8 +41,6 @@ void              chatty_mm_chat_append_message         (ChattyMmChat   *self,
                                                          ChattyMessage  *message);
 void              chatty_mm_chat_prepend_messages       (ChattyMmChat   *self,
                                                          GPtrArray      *messages);
-ChattyMessage    *chatty_mm_chat_find_message_with_uid  (ChattyMmChat   *self,
-                                                         const char     *uid);
 ChattyMmBuddy    *chatty_mm_chat_find_user              (ChattyMmChat   *self,
                                                          const char     *phone);
 void              chatty_mm_chat_add_user               (ChattyMmChat   *self,
@@ -31,7 +31,9 @@
 #include "chatty-media.h"
 #include "chatty-mmsd.h"
 #include "chatty-log.h"
-#include "chatty-mmsd.h"
+#include "chatty-mark.h"
+#include "chatty-manager.h"
+#include "chatty-media-cache.h"
 #include "chatty-mm-notify.h"
 
 #define MMSD_DELIVERY_TIMEOUT           604800
@@ -84,6 +86,8 @@ struct _ChattyMmsd {
   char             *modified_modem_number;
   GPtrArray        *mms_arr;
   GHashTable       *mms_hash_table;
+  /* Object paths of MMS being processed */
+  GHashTable       *receiving_mms;
   gsize             max_attach_size;
   int               max_num_attach;
   char             *carrier_mmsc;
@@ -490,8 +494,9 @@ chatty_mmsd_send_mms_create_options (void)
 }
 
 static GVariant *
-chatty_mmsd_send_mms_create_attachments (ChattyMmsd    *self,
-                                         ChattyMessage *message)
+chatty_mmsd_send_mms_create_attachments (ChattyMmsd     *self,
+                                         ChattyMessage  *message,
+                                         GFile         **text_filep)
 {
   const char *text = chatty_message_get_text (message);
   GVariantBuilder attachment_builder;
@@ -504,10 +509,16 @@ chatty_mmsd_send_mms_create_attachments (ChattyMmsd    *self,
   if (text)
     size = strlen (text);
 
-  /* If there is text in the ChattyMessage, convert it into a file for MMSD */
+  /*
+   * If there is text in the ChattyMessage, convert it into a file for MMSD.
+   * mmsd only accepts attachments as paths, so write the text once to the
+   * temp file it's created as.  The file is removed once mmsd has encoded
+   * the message.
+   */
   if (size > 0) {
+    g_autoptr(GFileIOStream) iostream = NULL;
     g_autoptr(GFile) text_file = NULL;
-    GFileIOStream *iostream;
+    GOutputStream *out;
 
     text_file = g_file_new_tmp ("chatty-mms-text.XXXXXX.txt", &iostream, &error);
     if (error) {
@@ -515,15 +526,18 @@ chatty_mmsd_send_mms_create_attachments (ChattyMmsd    *self,
       return NULL;
     }
 
-    if (!g_file_replace_contents (text_file, text, size, NULL, FALSE,
-                                  G_FILE_CREATE_NONE, NULL, NULL, &error)) {
+    out = g_io_stream_get_output_stream (G_IO_STREAM (iostream));
+    if (!g_output_stream_write_all (out, text, size, NULL, NULL, &error) ||
+        !g_io_stream_close (G_IO_STREAM (iostream), NULL, &error)) {
       g_warning ("Failed to write to file %s: %s",
                  g_file_peek_path (text_file), error->message);
+      g_file_delete (text_file, NULL, NULL);
       return NULL;
     }
 
     g_variant_builder_add_parsed (&attachment_builder, "('message-contents.txt','text/plain',%s)",
                                   g_file_peek_path (text_file));
+    *text_filep = g_steal_pointer (&text_file);
   }
 
   /* Get attachments to process for MMSD */
@@ -714,17 +728,21 @@ chatty_mmsd_send_mms_async_cb (GObject      *service,
                                GAsyncResult *res,
                                gpointer      user_data)
 {
-  ChattyMmsd *self = user_data;
+  g_autoptr(GFile) text_file = user_data;
   g_autoptr(GVariant) ret = NULL;
   g_autoptr(GError) error = NULL;
 
   g_debug ("%s", __func__);
 
-  ret = g_dbus_proxy_call_finish (self->service_proxy, res, &error);
+  ret = g_dbus_proxy_call_finish (G_DBUS_PROXY (service), res, &error);
 
   if (error != NULL) {
     g_warning ("Error in Proxy call: %s\n", error->message);
   }
+
+  /* mmsd has the text in its own storage now */
+  if (text_file)
+    g_file_delete_async (text_file, G_PRIORITY_DEFAULT, NULL, NULL, NULL);
 }
 
 gboolean
@@ -735,10 +753,16 @@ chatty_mmsd_send_mms_async (ChattyMmsd    *self,
 {
   GVariant *parameters, *attachments, *options;
   g_autoptr(GTask) task = user_data;
+  GFile *text_file = NULL;
   char **send;
+  gint64 mark_time;
 
-  attachments = chatty_mmsd_send_mms_create_attachments (self, message);
+  mark_time = CHATTY_MARK_NOW ();
+  attachments = chatty_mmsd_send_mms_create_attachments (self, message, &text_file);
   if (attachments == NULL) {
+    if (text_file)
+      g_file_delete (text_file, NULL, NULL);
+    g_clear_object (&text_file);
     g_warning ("Error making attachments!\n");
     g_task_return_boolean (task, FALSE);
     return FALSE;
@@ -763,214 +787,499 @@ chatty_mmsd_send_mms_async (ChattyMmsd    *self,
                      -1,
                      NULL,
                      (GAsyncReadyCallback)chatty_mmsd_send_mms_async_cb,
-                     self);
+                     text_file);
 
   g_strfreev (send);
+  CHATTY_MARK (mark_time, "mmsd-send", "message %s", chatty_message_get_uid (message));
 
   g_task_return_boolean (task, TRUE);
   return TRUE;
 }
 
+typedef struct {
+  char  *name;
+  char  *mime_type;
+  /* Absolute path of the part written to disk */
+  char  *path;
+  /* Path relative to $XDG_DATA_HOME/chatty once stored */
+  char  *relative_path;
+  gsize  size;
+  /* The receive task, held while the part is being cached */
+  GTask *task;
+} MmsPart;
+
+typedef struct {
+  mms_payload *payload;
+  char        *objectpath;
+  char        *date;
+  char        *subject;
+  char        *status;
+  char        *expire_time_string;
+  ChattyMsgDirection direction;
+  ChattyMsgStatus    mms_status;
+
+  /* Filled in the worker thread */
+  char        *containerpath;
+  char        *savedir;
+  GVariant    *attachments;
+  GPtrArray   *parts;
+  char        *mms_message;
+
+  guint        n_pending;
+} ReceiveData;
+
+static void
+mms_part_free (gpointer data)
+{
+  MmsPart *part = data;
+
+  g_free (part->name);
+  g_free (part->mime_type);
+  g_free (part->path);
+  g_free (part->relative_path);
+  g_clear_object (&part->task);
+  g_free (part);
+}
+
+static void
+receive_data_free (gpointer user_data)
+{
+  ReceiveData *data = user_data;
+
+  g_clear_pointer (&data->payload, mms_payload_free);
+  g_free (data->objectpath);
+  g_free (data->date);
+  g_free (data->subject);
+  g_free (data->status);
+  g_free (data->expire_time_string);
+  g_free (data->containerpath);
+  g_free (data->savedir);
+  g_clear_pointer (&data->attachments, g_variant_unref);
+  g_clear_pointer (&data->parts, g_ptr_array_unref);
+  g_free (data->mms_message);
+  g_free (data);
+}
+
+/*
+ * Returns %TRUE if @text was used as the message body, so that
+ * it doesn't have to be saved as a file.
+ */
+static gboolean
+mmsd_receive_append_text (GString    *message_contents,
+                          const char *text,
+                          gboolean   *content_set)
+{
+  g_autofree char *stripped_contents = NULL;
+
+  /*
+   * iMessage decided to add a text file to MMS that says
+   * "Replied to a message:" plus the text file. It's annoying.
+   * If we encounter that text file, we should prepend it to
+   * the message.
+   */
+  stripped_contents = g_strstrip (g_strdup (text));
+  if (g_str_has_prefix (stripped_contents, "Replied to a message:")) {
+    if (message_contents->len) {
+      g_string_prepend (message_contents, "\n");
+      g_string_prepend (message_contents, text);
+    } else {
+      g_string_append (message_contents, text);
+      g_string_append (message_contents, "\n");
+    }
+
+    return TRUE;
+  }
+
+  /*
+   * With the exception of the goofy iMessage stuff, if an MMS
+   * has a message, it tends to be the first text/plain attachment
+   */
+  if (*text && !*content_set) {
+    g_string_append (message_contents, text);
+    *content_set = TRUE;
+
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
 /*
- * Until chatty has support for inline attachments, this present URI links for
- * all attachments along with the Message and Subject.
+ * mmsd stores all parts of an MMS in a single container file.
+ * Map the container instead of loading it, extract text parts
+ * in memory, and write each of the other parts to disk once.
+ * SMIL parts are only needed for layout, and are not saved.
  */
-static char *
-chatty_mmsd_process_mms_message_attachments (GList **filesp)
+static void
+mmsd_receive_parts_thread (GTask        *task,
+                           gpointer      source_object,
+                           gpointer      task_data,
+                           GCancellable *cancellable)
 {
-  GString *message_contents;
+  ReceiveData *data = task_data;
+  g_autoptr(GMappedFile) mapped_file = NULL;
+  g_autoptr(GFile) parent = NULL;
+  g_autoptr(GFile) savepath = NULL;
+  g_autoptr(GString) message_contents = NULL;
+  GVariant *attach;
+  GVariantIter iter;
+  GError *error = NULL;
+  const char *contents;
+  gsize length;
   gboolean content_set = FALSE;
 
-  message_contents = g_string_new (NULL);
+  mapped_file = g_mapped_file_new (data->containerpath, FALSE, &error);
 
-  for (GList *l = *filesp; l != NULL;) {
-    ChattyFile *attachment = l->data;
+  if (!mapped_file) {
+    g_task_return_error (task, error);
+    return;
+  }
 
-    l = l->next;
-    if (g_strcmp0 (chatty_file_get_mime_type (attachment), "application/smil") == 0) {
-      *filesp = g_list_remove (*filesp, attachment);
-      if (chatty_file_get_url (attachment)) {
-        g_autoptr(GFile) file = NULL;
-        g_autoptr(GError) error = NULL;
+  contents = g_mapped_file_get_contents (mapped_file);
+  length = g_mapped_file_get_length (mapped_file);
 
-        file = g_file_new_for_uri (chatty_file_get_url (attachment));
-        g_file_delete (file, NULL, &error);
+  parent = g_file_new_build_filename (g_get_user_data_dir (), "chatty", NULL);
+  savepath = g_file_new_for_path (data->savedir);
+  message_contents = g_string_new (NULL);
+  data->parts = g_ptr_array_new_with_free_func (mms_part_free);
 
-        if (error && !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
-          g_warning ("Deleting file failed: %s", error->message);
-      }
+  g_variant_iter_init (&iter, data->attachments);
 
+  while ((attach = g_variant_iter_next_value (&iter))) {
+    g_autoptr(GFile) new = NULL;
+    g_autofree char *filenode = NULL;
+    g_autofree char *sanitized = NULL;
+    g_autofree char *filename = NULL;
+    g_autofree char *mimetype = NULL;
+    g_autofree char *file_mime_type = NULL;
+    g_autofree char *content_type = NULL;
+    const char *part_data;
+    MmsPart *part;
+    guint64 size, offset;
+
+    g_variant_get (attach, "(ssstt)", &filenode,
+                   &mimetype,
+                   NULL,
+                   &offset,
+                   &size);
+    g_variant_unref (attach);
+
+    if (offset > length || size > length - offset) {
+      g_warning ("MMS attachment %s is out of bounds of the payload", filenode);
       continue;
     }
 
-    if (g_str_has_prefix (chatty_file_get_mime_type (attachment), "text/plain")) {
-      g_autoptr(GFile) text_file = NULL;
-      g_autofree char *contents = NULL;
-      g_autofree char *stripped_contents = NULL;
-      g_autoptr(GError) error = NULL;
-      gsize length;
-
-      text_file = g_file_new_build_filename (g_get_user_data_dir (),
-                                             "chatty", chatty_file_get_path (attachment), NULL);
-      g_file_load_contents (text_file,
-                            NULL,
-                            &contents,
-                            &length,
-                            NULL,
-                            &error);
-      if (error) {
-        g_warning ("error opening file: %s", error->message);
-        break;
-      }
+    part_data = contents + offset;
 
-      /*
-       * iMessage decided to add a text file to MMS that says
-       * "Replied to a message:" plus the text file. It's annoying.
-       * If we encounter that text file, we should prepend it to
-       * the message.
-       */
-      stripped_contents = g_strdup (contents);
-      g_strstrip (stripped_contents);
-      if (g_str_has_prefix (stripped_contents, "Replied to a message:")) {
-        if (message_contents->str && *message_contents->str) {
-          g_string_prepend (message_contents, "\n");
-          g_string_prepend (message_contents, contents);
-        } else {
-          g_string_append (message_contents, contents);
-          g_string_append (message_contents, "\n");
-        }
+    sanitized = g_strdup (filenode);
+    g_strdelimit (sanitized, "<>", ' ');
+    g_strstrip (sanitized);
+    chatty_utils_sanitize_filename (sanitized);
+    filename = g_path_get_basename (sanitized);
 
-        /* We don't want the message content to be saved as a file */
-        *filesp = g_list_remove (*filesp, attachment);
-        if (chatty_file_get_url (attachment)) {
-          g_autoptr(GFile) file = NULL;
+    if (mimetype && g_str_has_prefix (mimetype, "text/plain")) {
+      g_autofree char *text = NULL;
 
-          file = g_file_new_for_uri (chatty_file_get_url (attachment));
-          g_file_delete (file, NULL, &error);
+      /* If the MMS reports the attachment is text/plain, trust it */
+      text = g_strndup (part_data, size);
+      if (mmsd_receive_append_text (message_contents, text, &content_set))
+        continue;
 
-          if (error && !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
-            g_warning ("Deleting file failed: %s", error->message);
-        }
-      /*
-       * With the exception of the goofy iMessage stuff, if an MMS
-       * has a message, it tends to be the first text/plain attachment
-       */
-      } else if (contents && *contents && !content_set) {
-        g_string_append (message_contents, contents);
-        content_set = TRUE;
-
-        /* We don't want the message content to be saved as a file */
-        *filesp = g_list_remove (*filesp, attachment);
-        if (chatty_file_get_url (attachment)) {
-          g_autoptr(GFile) file = NULL;
-
-          file = g_file_new_for_uri (chatty_file_get_url (attachment));
-          g_file_delete (file, NULL, &error);
-
-          if (error && !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
-            g_warning ("Deleting file failed: %s", error->message);
-        }
+      file_mime_type = g_strdup (mimetype);
+    } else {
+      /* If we can't figure out content type, do not trust what the MMS tells it is */
+      content_type = g_content_type_guess (filename, (const guchar *)part_data, size, NULL);
+      if (content_type)
+        file_mime_type = g_content_type_get_mime_type (content_type);
+      if (!file_mime_type)
+        file_mime_type = g_strdup (content_type ? content_type : "application/octet-stream");
+    }
+
+    if (g_strcmp0 (file_mime_type, "application/smil") == 0)
+      continue;
+
+    if (data->parts->len == 0 &&
+        !g_file_make_directory_with_parents (savepath, cancellable, &error)) {
+      if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_EXISTS)) {
+        g_clear_error (&error);
+      } else {
+        g_task_return_error (task, error);
+        return;
       }
     }
+
+    new = g_file_get_child (savepath, filename);
+    if (!g_file_replace_contents (new, part_data, size, NULL, FALSE,
+                                  G_FILE_CREATE_PRIVATE, NULL, cancellable, &error)) {
+      g_warning ("Failed to write to file %s: %s",
+                 g_file_peek_path (new), error->message);
+      g_clear_error (&error);
+      continue;
+    }
+
+    part = g_new0 (MmsPart, 1);
+    part->name = g_steal_pointer (&filename);
+    part->mime_type = g_steal_pointer (&file_mime_type);
+    part->path = g_file_get_path (new);
+    part->relative_path = g_file_get_relative_path (parent, new);
+    part->size = size;
+    g_ptr_array_add (data->parts, part);
   }
 
   if (message_contents->len)
-    return g_string_free (message_contents, FALSE);
+    data->mms_message = g_string_free (g_steal_pointer (&message_contents), FALSE);
 
-  return NULL;
+  g_task_return_boolean (task, TRUE);
 }
 
-static mms_payload *
-chatty_mmsd_receive_message (ChattyMmsd *self,
-                             GVariant   *message_t)
+static void
+mmsd_receive_complete (GTask *task)
 {
   g_autoptr(GFile) parent = NULL;
-  g_autoptr(GFile) savepath = NULL;
-  g_autoptr(GVariant) recipients = NULL;
-  g_autoptr(GVariant) attachments = NULL;
   g_autoptr(GDateTime) date_time = NULL;
-  ChattyMsgDirection direction = CHATTY_DIRECTION_UNKNOWN;
-  ChattyMsgStatus mms_status = CHATTY_STATUS_UNKNOWN;
+  g_autofree char *basename = NULL;
   ChattyMsgType chatty_msg_type = CHATTY_MESSAGE_MMS;
+  ReceiveData *data;
+  mms_payload *payload;
+  GList *files = NULL;
+  gint64 unix_time = 0;
+
+  data = g_task_get_task_data (task);
+  parent = g_file_new_build_filename (g_get_user_data_dir (), "chatty", NULL);
+
+  for (guint i = 0; data->parts && i < data->parts->len; i++) {
+    g_autoptr(GFile) file = NULL;
+    g_autofree char *uri = NULL;
+    ChattyFile *attachment;
+    MmsPart *part;
+
+    part = data->parts->pdata[i];
+    file = g_file_resolve_relative_path (parent, part->relative_path);
+    uri = g_file_get_uri (file);
+    attachment = chatty_file_new_full (part->name, uri, part->relative_path,
+                                       part->mime_type, part->size, 0, 0, 0);
+    chatty_file_set_status (attachment, CHATTY_FILE_DOWNLOADED);
+    files = g_list_append (files, attachment);
+  }
+
+  /* Stored parts have been moved to the media cache, so the directory is empty */
+  if (data->savedir) {
+    g_autoptr(GFile) savepath = NULL;
+    g_autoptr(GError) error = NULL;
+
+    savepath = g_file_new_for_path (data->savedir);
+    if (!g_file_delete (savepath, NULL, &error) &&
+        !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND) &&
+        !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_EMPTY))
+      g_warning ("Error deleting MMS directory: %s", error->message);
+  }
+
+  /* If there are no files, then there is a text message */
+  if (!files && data->attachments)
+    chatty_msg_type = CHATTY_MESSAGE_TEXT;
+
+  if (!data->subject && !data->mms_message && files && !files->next) {
+    ChattyFile *attachment = files->data;
+
+    if (attachment && chatty_file_get_mime_type (attachment)) {
+      if (g_str_has_prefix (chatty_file_get_mime_type (attachment), "image"))
+        chatty_msg_type = CHATTY_MESSAGE_IMAGE;
+      else if (g_str_has_prefix (chatty_file_get_mime_type (attachment), "audio"))
+        chatty_msg_type = CHATTY_MESSAGE_AUDIO;
+      else if (g_str_has_prefix (chatty_file_get_mime_type (attachment), "video"))
+        chatty_msg_type = CHATTY_MESSAGE_VIDEO;
+      else
+        chatty_msg_type = CHATTY_MESSAGE_FILE;
+    }
+  }
+
+  if (!data->mms_message && !files) {
+    if (g_strcmp0 (data->status, "expired") == 0)
+      data->mms_message = g_strdup_printf (_("You received an MMS, but it expired on: %s"),
+                                           data->expire_time_string);
+    else
+      data->mms_message = g_strdup (_("You received an empty MMS."));
+  }
+
+  date_time = g_date_time_new_from_iso8601 (data->date, NULL);
+  if (date_time)
+    unix_time = g_date_time_to_unix (date_time);
+  if (!unix_time)
+    unix_time = time (NULL);
+  /*
+   * Sometimes MMS have a timestamp of the future
+   * Also make sure the time of day isn't Jan 1, 1970
+   */
+  if (unix_time > time (NULL) && time (NULL) > JAN_ONE_2023)
+    unix_time = time (NULL);
+
+  payload = g_steal_pointer (&data->payload);
+  basename = g_path_get_basename (data->objectpath);
+  payload->message = chatty_message_new (NULL, data->mms_message, basename, unix_time,
+                                         chatty_msg_type, data->direction, data->mms_status);
+  chatty_message_set_subject (payload->message, data->subject);
+  chatty_message_set_files (payload->message, files);
+
+  /* Since we successfully got an mms, we know the temp send/receive errors are gone */
+  chatty_mm_notify_withdraw_notification (ERROR_MM_MMS_TEMP_SEND_RECEIVE);
+
+  /* Since we successfully got an mms, we know the temp configuration errors are gone */
+  chatty_mm_notify_withdraw_notification (ERROR_MM_MMS_CONFIGURATION);
+
+  g_task_return_pointer (task, payload, mms_payload_free);
+}
+
+static void
+mmsd_receive_part_cached_cb (GObject      *object,
+                             GAsyncResult *result,
+                             gpointer      user_data)
+{
+  MmsPart *part = user_data;
+  g_autoptr(GTask) task = NULL;
+  g_autoptr(GError) error = NULL;
+  ReceiveData *data;
+  char *cache_path;
+
+  task = g_steal_pointer (&part->task);
+  data = g_task_get_task_data (task);
+  cache_path = chatty_media_cache_add_finish (CHATTY_MEDIA_CACHE (object), result, &error);
+
+  /* On failure, the part is kept where it was written */
+  if (cache_path) {
+    g_free (part->relative_path);
+    part->relative_path = cache_path;
+  } else
+    g_warning ("Failed to cache MMS attachment %s: %s", part->name, error->message);
+
+  data->n_pending--;
+
+  if (data->n_pending == 0)
+    mmsd_receive_complete (task);
+}
+
+static void
+mmsd_receive_parts_cb (GObject      *object,
+                       GAsyncResult *result,
+                       gpointer      user_data)
+{
+  ChattyMmsd *self = CHATTY_MMSD (object);
+  g_autoptr(GTask) task = user_data;
+  ChattyMediaCache *cache;
+  ReceiveData *data;
+  GError *error = NULL;
+
+  data = g_task_get_task_data (task);
+
+  if (!g_task_propagate_boolean (G_TASK (result), &error)) {
+    if (g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+      g_debug ("MMS Payload does not exist, deleting...");
+      chatty_mmsd_delete_mms (self, data->objectpath);
+    }
+
+    g_task_return_error (task, error);
+    return;
+  }
+
+  if (!data->parts->len) {
+    mmsd_receive_complete (task);
+    return;
+  }
+
+  /* MMS attachments can't be downloaded again, so they are never evicted */
+  cache = chatty_manager_get_media_cache (chatty_manager_get_default ());
+  data->n_pending = data->parts->len;
+
+  for (guint i = 0; i < data->parts->len; i++) {
+    g_autoptr(GFile) file = NULL;
+    MmsPart *part = data->parts->pdata[i];
+
+    file = g_file_new_for_path (part->path);
+    part->task = g_object_ref (task);
+    chatty_media_cache_add_async (cache, file, NULL, FALSE, NULL,
+                                  mmsd_receive_part_cached_cb, part);
+  }
+}
+
+static void
+chatty_mmsd_receive_message_async (ChattyMmsd          *self,
+                                   GVariant            *message_t,
+                                   GAsyncReadyCallback  callback,
+                                   gpointer             user_data)
+{
+  g_autoptr(GTask) task = NULL;
+  g_autoptr(GVariant) recipients = NULL;
+  g_autoptr(GVariant) attachments = NULL;
   g_autoptr(GVariant) properties = NULL;
-  g_autoptr(GFileInfo) attachment_info = NULL;
-  GVariant *reciever, *attach;
+  GVariant *reciever;
   GVariantDict dict;
-  GVariantIter iter;
-  GFile *container = NULL;
-  GList *files = NULL;
-  g_autofree char *objectpath = NULL;
-  g_autofree char *date = NULL;
   g_autofree char *sender = NULL;
-  g_autofree char *smil = NULL;
-  g_autofree char *subject = NULL;
-  g_autofree char *status = NULL;
   g_autofree char *rx_modem_number = NULL;
-  g_autofree char *mms_message = NULL;
-  g_autofree char *contents = NULL;
-  g_autofree char *expire_time_string = NULL;
   const char *known_modem_number = NULL;
   GString *who;
   GVariantIter recipientiter;
+  ReceiveData *data;
   mms_payload *payload;
-  gint64 unix_time = 0;
   int delivery_report = FALSE;
 
-  parent = g_file_new_build_filename (g_get_user_data_dir (),
-                                      "chatty", NULL);
-
+  data = g_new0 (ReceiveData, 1);
+  task = g_task_new (self, NULL, callback, user_data);
+  g_task_set_source_tag (task, chatty_mmsd_receive_message_async);
+  g_task_set_task_data (task, data, receive_data_free);
 
   /* Parse through the MMS Payload. mmsd-tng has a parser, so we are using that */
-  g_variant_get (message_t, "(o@a{?*})", &objectpath, &properties);
+  g_variant_get (message_t, "(o@a{?*})", &data->objectpath, &properties);
+  g_object_set_data_full (G_OBJECT (task), "objectpath",
+                          g_strdup (data->objectpath), g_free);
 
   g_variant_dict_init (&dict, properties);
-  g_variant_dict_lookup (&dict, "Date", "s", &date);
+  g_variant_dict_lookup (&dict, "Date", "s", &data->date);
   g_variant_dict_lookup (&dict, "Sender", "s", &sender);
-  g_variant_dict_lookup (&dict, "Smil", "s", &smil);
-  g_variant_dict_lookup (&dict, "Subject", "s", &subject);
+  g_variant_dict_lookup (&dict, "Subject", "s", &data->subject);
   g_variant_dict_lookup (&dict, "Delivery Report", "b", &delivery_report);
   /* refer to mms_message_status_get_string () in MMSD mmsutil.c for a listing of statuses */
-  g_variant_dict_lookup (&dict, "Status", "s", &status);
+  g_variant_dict_lookup (&dict, "Status", "s", &data->status);
   g_variant_dict_lookup (&dict, "Modem Number", "s", &rx_modem_number);
 
   /* Android seems to put this on the subject */
-  if (g_strcmp0 ("NoSubject", subject) == 0)
-    g_clear_pointer (&subject, g_free);
-  else if (subject && !*subject)
-    g_clear_pointer (&subject, g_free);
+  if (g_strcmp0 ("NoSubject", data->subject) == 0)
+    g_clear_pointer (&data->subject, g_free);
+  else if (data->subject && !*data->subject)
+    g_clear_pointer (&data->subject, g_free);
 
   /* Determine what type of MMS we have */
-  if (g_strcmp0 (status, "draft") == 0) {
-    direction = CHATTY_DIRECTION_OUT;
-    mms_status = CHATTY_STATUS_SENDING;
-  } else if (g_strcmp0 (status, "sent") == 0) {
-    direction = CHATTY_DIRECTION_OUT;
-    mms_status = CHATTY_STATUS_SENT;
-  } else if (g_strcmp0 (status, "sending_failed") == 0) {
-    direction = CHATTY_DIRECTION_OUT;
-    mms_status = CHATTY_STATUS_SENDING_FAILED;
-  } else if (g_strcmp0 (status, "delivered") == 0) {
-    direction = CHATTY_DIRECTION_OUT;
-    mms_status = CHATTY_STATUS_DELIVERED;
-  } else if (g_strcmp0 (status, "received") == 0) {
-    direction = CHATTY_DIRECTION_IN;
-    mms_status = CHATTY_STATUS_RECEIVED;
-  } else if (g_strcmp0 (status, "downloaded") == 0) {
+  if (g_strcmp0 (data->status, "draft") == 0) {
+    data->direction = CHATTY_DIRECTION_OUT;
+    data->mms_status = CHATTY_STATUS_SENDING;
+  } else if (g_strcmp0 (data->status, "sent") == 0) {
+    data->direction = CHATTY_DIRECTION_OUT;
+    data->mms_status = CHATTY_STATUS_SENT;
+  } else if (g_strcmp0 (data->status, "sending_failed") == 0) {
+    data->direction = CHATTY_DIRECTION_OUT;
+    data->mms_status = CHATTY_STATUS_SENDING_FAILED;
+  } else if (g_strcmp0 (data->status, "delivered") == 0) {
+    data->direction = CHATTY_DIRECTION_OUT;
+    data->mms_status = CHATTY_STATUS_DELIVERED;
+  } else if (g_strcmp0 (data->status, "received") == 0) {
+    data->direction = CHATTY_DIRECTION_IN;
+    data->mms_status = CHATTY_STATUS_RECEIVED;
+  } else if (g_strcmp0 (data->status, "downloaded") == 0) {
     /* This is an internal mmsd-tng state, and shouldn't be shown */
-    return NULL;
-  } else if (g_strcmp0 (status, "read") == 0) {
+    g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                             "MMS is not yet fully downloaded");
+    return;
+  } else if (g_strcmp0 (data->status, "read") == 0) {
     /*
      * This doesn't really mean anything except that some
      * program marked the MMS as "read". I will just process
      * it like a "received" message.
      */
-    direction = CHATTY_DIRECTION_IN;
-    mms_status = CHATTY_STATUS_RECEIVED;
-  } else if (g_strcmp0 (status, "expired") == 0) {
+    data->direction = CHATTY_DIRECTION_IN;
+    data->mms_status = CHATTY_STATUS_RECEIVED;
+  } else if (g_strcmp0 (data->status, "expired") == 0) {
     g_autoptr(GDateTime) expire_time = NULL;
     g_autofree char *expire_date = NULL;
-    direction = CHATTY_DIRECTION_IN;
-    mms_status = CHATTY_STATUS_RECEIVED;
+    data->direction = CHATTY_DIRECTION_IN;
+    data->mms_status = CHATTY_STATUS_RECEIVED;
 
     g_variant_dict_lookup (&dict, "Expire", "s", &expire_date);
 
@@ -981,15 +1290,18 @@ chatty_mmsd_receive_message (ChattyMmsd *self,
   /* TRANSLATORS: Timestamp for minute accuracy, e.g. “2020-08-11 15:27”.
      See https://developer.gnome.org/glib/stable/glib-GDateTime.html#g-date-time-format
    */
-    expire_time_string = g_date_time_format (expire_time, _("%Y-%m-%d %H∶%M"));
+    data->expire_time_string = g_date_time_format (expire_time, _("%Y-%m-%d %H∶%M"));
   } else {
     /* This is a state Chatty cannot support yet */
-    return NULL;
+    g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                             "Unsupported MMS status '%s'", data->status);
+    return;
   }
 
-  payload = g_try_new0 (mms_payload, 1);
+  payload = data->payload = g_new0 (mms_payload, 1);
+  payload->self = self;
   payload->delivery_report = delivery_report;
-  payload->objectpath = g_strdup (objectpath);
+  payload->objectpath = g_strdup (data->objectpath);
   payload->mmsd_message_proxy_watch_id = 0;
 
   if (delivery_report) {
@@ -1015,7 +1327,7 @@ chatty_mmsd_receive_message (ChattyMmsd *self,
     known_modem_number = "";
 
   /* Fill out Sender and All Numbers */
-  if (direction == CHATTY_DIRECTION_IN) {
+  if (data->direction == CHATTY_DIRECTION_IN) {
     const char *country_code = chatty_settings_get_country_iso_code (chatty_settings_get_default ());
 
     payload->sender = chatty_utils_check_phonenumber (sender, country_code);
@@ -1027,7 +1339,7 @@ chatty_mmsd_receive_message (ChattyMmsd *self,
 
   recipients = g_variant_dict_lookup_value (&dict, "Recipients", G_VARIANT_TYPE_STRING_ARRAY);
 
-  if (direction == CHATTY_DIRECTION_IN) {
+  if (data->direction == CHATTY_DIRECTION_IN) {
     who = g_string_new (payload->sender);
   } else {
     who = g_string_new (NULL);
@@ -1059,291 +1371,95 @@ chatty_mmsd_receive_message (ChattyMmsd *self,
 
   /* Go through the attachments */
   attachments = g_variant_dict_lookup_value (&dict, "Attachments", G_VARIANT_TYPE_ARRAY);
-  if (attachments)
-    g_variant_iter_init (&iter, attachments);
-
-  while (attachments && (attach = g_variant_iter_next_value (&iter))) {
-    ChattyFile *attachment = NULL;
-    GFile *new;
-    GFileOutputStream *out;
-    g_autofree char *containerpath = NULL;
-    g_autofree char *filenode = NULL;
-    g_autofree char *filename = NULL;
-    g_autofree char *mimetype = NULL;
-    g_autofree char *file_mime_type = NULL;
-    g_autofree char *attachment_file_uri = NULL;
-    g_autofree char *attachment_file_relative_path = NULL;
-    gulong size, data;
-    gsize length, written = 0;
-    g_autoptr(GError) error = NULL;
-
-    g_variant_get (attach, "(ssstt)", &filenode,
-                   &mimetype,
-                   &containerpath,
-                   &data,
-                   &size);
-    g_variant_unref (attach);
-
-    if (!container) {
-      g_autofree char *tag = NULL;
-      g_autofree char *uid = NULL;
-
-      uid = g_path_get_basename (objectpath);
-      container = g_file_new_for_path (containerpath);
-      g_file_load_contents (container,
-                            NULL,
-                            &contents,
-                            &length,
-                            NULL,
-                            &error);
-
-      if (error && g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND)) {
-        g_debug ("MMS Payload does not exist, deleting...");
-        chatty_mmsd_delete_mms (self, payload->objectpath);
-        return NULL;
-      } else if (error) {
-        g_warning ("Error loading MMSD Payload: %s", error->message);
-        return NULL;
-      }
-
-      tag = g_strconcat (date, payload->sender, uid, NULL);
-      /* Save MMS in $XDG_DATA_HOME/chatty/mms/ */
-      savepath = g_file_new_build_filename (g_get_user_data_dir (),
-                                            "chatty", "mms", tag, NULL);
-      if (!g_file_make_directory_with_parents (savepath, NULL, &error)) {
-        if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_EXISTS)) {
-          g_debug ("Directory exists, skipping error...");
-          g_clear_error (&error);
-        } else if (error) {
-          g_warning ("Error creating Directory: %s", error->message);
-          return NULL;
-        }
-      }
-      /* create a file containing the smil */
-      if (smil != NULL) {
-        size_t smil_size = strlen (smil);
-        g_autofree char *smil_file_uri = NULL;
-        g_autofree char *smil_file_relative_path = NULL;
-
-        new = g_file_get_child (savepath, "mms.smil");
-        out = g_file_create (new, G_FILE_CREATE_PRIVATE, NULL, &error);
-        if (error) {
-          if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_EXISTS)) {
-            g_autoptr(GFileInfo) file_info = NULL;
-            g_debug ("%s Exists, Skipping Error....", g_file_peek_path (new));
-            g_clear_error (&error);
-            file_info = g_file_query_info (new,
-                                           G_FILE_ATTRIBUTE_STANDARD_SIZE,
-                                           G_FILE_QUERY_INFO_NONE,
-                                           NULL,
-                                           &error);
-            if (error)
-              g_warning ("Error getting file info: %s", error->message);
-            else
-              written = g_file_info_get_size (file_info);
-
-          } else {
-            g_warning ("Failed to create %s: %s",
-                       g_file_peek_path (new), error->message);
-          }
-          g_clear_error (&error);
-        } else {
-          if (!g_output_stream_write_all ((GOutputStream *) out,
-                                          smil,
-                                          smil_size,
-                                          &written,
-                                          NULL,
-                                          &error)) {
-            g_warning ("Failed to write to file %s: %s",
-                       g_file_peek_path (new), error->message);
-            g_clear_error (&error);
-          }
-        }
-        if (out)
-          g_output_stream_close (G_OUTPUT_STREAM (out), NULL, NULL);
-
-        smil_file_uri = g_file_get_uri (new);
-        smil_file_relative_path = g_file_get_relative_path (parent, new);
-
-        attachment = chatty_file_new_full ("mms.smil",
-                                           smil_file_uri,
-                                           smil_file_relative_path,
-                                           "application/smil",
-                                           written, 0, 0, 0);
-        chatty_file_set_status (attachment, CHATTY_FILE_DOWNLOADED);
-
-        files = g_list_append (files, attachment);
-        attachment = NULL;
-        g_clear_object (&new);
-      }
-    }
-    filename = g_strdup (filenode);
-    g_strdelimit (filename, "<>", ' ');
-    g_strstrip (filename);
-    chatty_utils_sanitize_filename (filename);
-    filename = g_path_get_basename (filename);
-    new = g_file_get_child (savepath, filename);
-    out = g_file_create (new, G_FILE_CREATE_PRIVATE, NULL, &error);
-    if (error) {
-      if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_EXISTS)) {
-        g_autoptr(GFileInfo) file_info = NULL;
-        g_debug ("%s Exists, Skipping Error....", g_file_peek_path (new));
-        g_clear_error (&error);
-        file_info = g_file_query_info (new,
-                                       G_FILE_ATTRIBUTE_STANDARD_SIZE,
-                                       G_FILE_QUERY_INFO_NONE,
-                                       NULL,
-                                       &error);
-        if (error)
-          g_warning ("Error getting file info: %s", error->message);
-        else
-          written = g_file_info_get_size (file_info);
-      } else {
-        g_warning ("Failed to create %s: %s",
-                   g_file_peek_path (new), error->message);
-      }
-      g_clear_error (&error);
-    } else {
-      if (!g_output_stream_write_all (G_OUTPUT_STREAM (out),
-                                      contents + data,
-                                      size,
-                                      &written,
-                                      NULL,
-                                      &error)) {
-        g_warning ("Failed to write to file %s: %s",
-                   g_file_peek_path (new), error->message);
-        g_clear_error (&error);
-      }
-    }
-    if (out)
-      g_output_stream_close (G_OUTPUT_STREAM (out), NULL, NULL);
-
-    attachment_info = g_file_query_info (new,
-                                         G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE,
-                                         G_FILE_QUERY_INFO_NONE,
-                                         NULL,
-                                         &error);
-
-
-    if (mimetype && g_str_has_prefix (mimetype, "text/plain")) {
-      /* If the MMS reports the attachment is text/plain, trust it */
-      file_mime_type = g_strdup (mimetype);
-    } else if (error != NULL || g_file_info_get_content_type (attachment_info) == NULL) {
-      g_clear_error (&error);
-      /* If we can't figure out content type, do not trust what the MMS tells it is */
-      file_mime_type = g_strdup ("application/octet-stream");
-    } else {
-      file_mime_type = g_content_type_get_mime_type (g_file_info_get_content_type (attachment_info));
-      if (file_mime_type == NULL) {
-        if (g_file_info_get_content_type (attachment_info) != NULL)
-          file_mime_type = g_strdup (g_file_info_get_content_type (attachment_info));
-        else
-          file_mime_type = g_strdup ("application/octet-stream");
-      }
-    }
 
-    attachment_file_uri = g_file_get_uri (new);
-    attachment_file_relative_path = g_file_get_relative_path (parent, new);
-
-    attachment = chatty_file_new_full (filename,
-                                       attachment_file_uri,
-                                       attachment_file_relative_path,
-                                       file_mime_type,
-                                       written, 0, 0, 0);
-    chatty_file_set_status (attachment, CHATTY_FILE_DOWNLOADED);
-    files = g_list_prepend (files, attachment);
-    g_clear_object (&new);
+  if (attachments && g_variant_n_children (attachments)) {
+    g_autoptr(GTask) parts_task = NULL;
+    g_autofree char *tag = NULL;
+    g_autofree char *uid = NULL;
+
+    /* All attachments share the same container */
+    g_variant_get_child (attachments, 0, "(ssstt)", NULL, NULL,
+                         &data->containerpath, NULL, NULL);
+    data->attachments = g_steal_pointer (&attachments);
+
+    uid = g_path_get_basename (data->objectpath);
+    tag = g_strconcat (data->date, payload->sender, uid, NULL);
+    /* Parts are written to $XDG_DATA_HOME/chatty/mms/ before being cached */
+    data->savedir = g_build_filename (g_get_user_data_dir (),
+                                      "chatty", "mms", tag, NULL);
+
+    parts_task = g_task_new (self, NULL, mmsd_receive_parts_cb, g_steal_pointer (&task));
+    /* The data is owned by the outer task, which outlives this one */
+    g_task_set_task_data (parts_task, data, NULL);
+    g_task_run_in_thread (parts_task, mmsd_receive_parts_thread);
+    return;
   }
-  if (attachments)
-    g_object_unref (container);
 
-  mms_message = chatty_mmsd_process_mms_message_attachments (&files);
+  mmsd_receive_complete (task);
+}
 
-  if ((!files || !files->data) && savepath) {
-    g_autoptr(GError) error = NULL;
+static mms_payload *
+chatty_mmsd_receive_message_finish (ChattyMmsd    *self,
+                                    GAsyncResult  *result,
+                                    GError       **error)
+{
+  g_assert (CHATTY_IS_MMSD (self));
+  g_assert (G_IS_TASK (result));
 
-    /* If there are no files, then there is a text message */
-    chatty_msg_type = CHATTY_MESSAGE_TEXT;
-    g_file_delete (savepath, NULL, &error);
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
 
-    if (error)
-      g_warning ("Error deleting empty MMS directory: %s", error->message);
-  }
+static void
+chatty_mmsd_mms_received_cb (GObject      *object,
+                             GAsyncResult *result,
+                             gpointer      user_data)
+{
+  ChattyMmsd *self = CHATTY_MMSD (object);
+  g_autoptr(GError) error = NULL;
+  mms_payload *payload;
+  const char *objectpath;
+  gint64 mark_time;
 
-  if (!subject && !mms_message && files && g_list_length (files) == 1) {
-    ChattyFile *attachment = files->data;
+  mark_time = CHATTY_MARK_NOW ();
+  objectpath = g_object_get_data (G_OBJECT (result), "objectpath");
+  payload = chatty_mmsd_receive_message_finish (self, result, &error);
 
-    if (attachment && chatty_file_get_mime_type (attachment)) {
-      if (g_str_has_prefix (chatty_file_get_mime_type (attachment), "image"))
-        chatty_msg_type = CHATTY_MESSAGE_IMAGE;
-      else if (g_str_has_prefix (chatty_file_get_mime_type (attachment), "audio"))
-        chatty_msg_type = CHATTY_MESSAGE_AUDIO;
-      else if (g_str_has_prefix (chatty_file_get_mime_type (attachment), "video"))
-        chatty_msg_type = CHATTY_MESSAGE_VIDEO;
-      else
-        chatty_msg_type = CHATTY_MESSAGE_FILE;
-    }
+  /* mmsd was reloaded while the MMS was being processed */
+  if (!g_hash_table_remove (self->receiving_mms, objectpath)) {
+    g_clear_pointer (&payload, mms_payload_free);
+    return;
   }
 
-  if (!mms_message && !files) {
-    if (g_strcmp0 (status, "expired") == 0)
-      mms_message = g_strdup_printf (_("You received an MMS, but it expired on: %s"),
-                                     expire_time_string);
-    else
-      mms_message = g_strdup (_("You received an empty MMS."));
+  if (payload == NULL) {
+    g_warning ("There was an error with decoding the MMS %s: %s",
+               objectpath, error->message);
+    return;
   }
 
-  date_time = g_date_time_new_from_iso8601 (date, NULL);
-  if (date_time)
-    unix_time = g_date_time_to_unix (date_time);
-  if (!unix_time)
-    unix_time = time (NULL);
-  /*
-   * Sometimes MMS have a timestamp of the future
-   * Also make sure the time of day isn't Jan 1, 1970
-   */
-  if (unix_time > time (NULL) && time (NULL) > JAN_ONE_2023)
-    unix_time = time (NULL);
-
-  {
-    g_autofree char *basename = NULL;
-
-    basename = g_path_get_basename (objectpath);
-    payload->message = chatty_message_new (NULL, mms_message, basename, unix_time,
-                                           chatty_msg_type, direction, mms_status);
-    chatty_message_set_subject (payload->message, subject);
-    chatty_message_set_files (payload->message, files);
+  if (!g_hash_table_insert (self->mms_hash_table, g_strdup (payload->objectpath), payload)) {
+    g_warning ("g_hash_table:MMS Already exists! This should not happen");
   }
-
-  /* Since we successfully got an mms, we know the temp send/receive errors are gone */
-  chatty_mm_notify_withdraw_notification (ERROR_MM_MMS_TEMP_SEND_RECEIVE);
-
-  /* Since we successfully got an mms, we know the temp configuration errors are gone */
-  chatty_mm_notify_withdraw_notification (ERROR_MM_MMS_CONFIGURATION);
-  return payload;
+  chatty_mmsd_process_mms (self, payload);
+  CHATTY_MARK (mark_time, "mmsd-receive", "%s", objectpath);
 }
 
 static void
 chatty_mmsd_get_new_mms_cb (ChattyMmsd *self,
                             GVariant   *parameters)
 {
-  mms_payload *payload;
+  g_autofree char *objectpath = NULL;
 
   g_debug ("%s", __func__);
-  payload = chatty_mmsd_receive_message (self, parameters);
-  if (payload == NULL) {
-    g_autoptr(GVariant) properties = NULL;
-    g_autofree char *objectpath = NULL;
 
-    g_variant_get (parameters, "(o@a{?*})", &objectpath, &properties);
-    g_warning ("There was an error with decoding the MMS %s",
-               objectpath);
-  } else {
-    if (!g_hash_table_insert (self->mms_hash_table, g_strdup (payload->objectpath), payload)) {
-      g_warning ("g_hash_table:MMS Already exists! This should not happen");
-    }
-    chatty_mmsd_process_mms (self, payload);
+  g_variant_get (parameters, "(o@a{?*})", &objectpath, NULL);
+  CHATTY_MARK_INSTANT ("mmsd-message-added", "%s", objectpath);
+  if (!g_hash_table_add (self->receiving_mms, g_steal_pointer (&objectpath))) {
+    g_debug ("MMS is already being received, skipping...");
+    return;
   }
+
+  chatty_mmsd_receive_message_async (self, parameters,
+                                     chatty_mmsd_mms_received_cb, NULL);
 }
 
 static void
@@ -1374,24 +1490,19 @@ chatty_mmsd_get_all_mms_cb (GObject      *service,
 
       while ((message_t = g_variant_iter_next_value (&iter))) {
         g_autofree char *objectpath = NULL;
-        mms_payload *payload;
 
         g_variant_get (message_t, "(o@a{?*})", &objectpath, NULL);
-        if (g_hash_table_lookup (self->mms_hash_table, objectpath) != NULL) {
+        if (g_hash_table_lookup (self->mms_hash_table, objectpath) != NULL ||
+            g_hash_table_contains (self->receiving_mms, objectpath)) {
           g_debug ("MMS Already exists! skipping...");
           g_variant_unref (message_t);
           continue;
         }
-        payload = chatty_mmsd_receive_message (self, message_t);
+
+        g_hash_table_add (self->receiving_mms, g_steal_pointer (&objectpath));
+        chatty_mmsd_receive_message_async (self, message_t,
+                                           chatty_mmsd_mms_received_cb, NULL);
         g_variant_unref (message_t);
-        if (payload == NULL) {
-          g_warning ("There was an error with decoding the MMS Payload!");
-        } else {
-          if (!g_hash_table_insert (self->mms_hash_table, g_strdup (objectpath), payload)) {
-            g_warning ("g_hash_table:MMS Already exists! This should not happe");
-          }
-          chatty_mmsd_process_mms (self, payload);
-        }
       }
     } else {
       g_debug ("Have 0 MMS messages to process");
@@ -2242,6 +2353,7 @@ chatty_mmsd_reload (ChattyMmsd *self)
   g_assert (!self->mmsd_watch_id);
 
   g_hash_table_remove_all (self->mms_hash_table);
+  g_hash_table_remove_all (self->receiving_mms);
   g_clear_pointer (&self->modem_number, g_free);
 
   devices = chatty_mm_account_get_devices (self->mm_account);
@@ -2301,6 +2413,7 @@ chatty_mmsd_finalize (GObject *object)
 
   clear_chatty_mmsd (self);
   g_hash_table_destroy (self->mms_hash_table);
+  g_hash_table_destroy (self->receiving_mms);
   G_OBJECT_CLASS (chatty_mmsd_parent_class)->finalize (object);
 }
 
@@ -2317,6 +2430,7 @@ chatty_mmsd_init (ChattyMmsd *self)
 {
   self->mms_hash_table = g_hash_table_new_full (g_str_hash, g_str_equal,
                                                 g_free, mms_payload_free);
+  self->receiving_mms = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 }
 
 ChattyMmsd *
@@ -17,6 +17,7 @@
 #endif
 
 #include "chatty-history.h"
+#include "chatty-message-list.h"
 #include "chatty-settings.h"
 #include "chatty-utils.h"
 #include "chatty-pp-utils.h"
@@ -62,7 +63,7 @@ struct _ChattyPpChat
   PurpleConversation *conv;
   GListStore         *chat_users;
   GtkSortListModel   *sorted_chat_users;
-  GListStore         *message_store;
+  ChattyMessageList  *message_store;
   GListStore         *fp_list;
 
   char               *last_message;
@@ -421,7 +422,7 @@ pp_chat_load_db_messages_cb (GObject      *object,
 
   if (messages && messages->len &&
       chatty_pp_chat_get_auto_join (self)) {
-    g_list_store_splice (self->message_store, 0, 0, messages->pdata, messages->len);
+    chatty_message_list_add_many (self->message_store, messages);
     g_signal_emit_by_name (self, "changed", 0);
     g_object_notify (G_OBJECT (self), "last-message-time");
   } else if (error && !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
@@ -975,7 +976,7 @@ chatty_pp_chat_finalize (GObject *object)
   }
 
   g_list_store_remove_all (self->chat_users);
-  g_list_store_remove_all (self->message_store);
+  chatty_message_list_remove_all (self->message_store);
   g_list_store_remove_all (self->fp_list);
   g_object_unref (self->fp_list);
   g_object_unref (self->message_store);
@@ -1036,7 +1037,7 @@ chatty_pp_chat_init (ChattyPpChat *self)
   self->sorted_chat_users = gtk_sort_list_model_new (g_object_ref (G_LIST_MODEL (self->chat_users)),
                                                      GTK_SORTER (sorter));
 
-  self->message_store = g_list_store_new (CHATTY_TYPE_MESSAGE);
+  self->message_store = chatty_message_list_new ();
   self->fp_list = g_list_store_new (GTK_TYPE_STRING_OBJECT);
   self->encrypt = CHATTY_ENCRYPTION_UNSUPPORTED;
 }
@@ -1366,7 +1367,7 @@ chatty_pp_chat_append_message (ChattyPpChat  *self,
   g_return_if_fail (CHATTY_IS_PP_CHAT (self));
   g_return_if_fail (CHATTY_IS_MESSAGE (message));
 
-  g_list_store_append (self->message_store, message);
+  chatty_message_list_add (self->message_store, message);
   g_signal_emit_by_name (self, "changed", 0);
   g_object_notify (G_OBJECT (self), "last-message-time");
 }
@@ -1382,7 +1383,7 @@ chatty_pp_chat_prepend_messages (ChattyPpChat *self,
 
   g_return_if_fail (CHATTY_IS_MESSAGE (messages->pdata[0]));
 
-  g_list_store_splice (self->message_store, 0, 0, messages->pdata, messages->len);
+  chatty_message_list_add_many (self->message_store, messages);
   g_signal_emit_by_name (self, "changed", 0);
   g_object_notify (G_OBJECT (self), "last-message-time");
 }
@@ -30,6 +30,7 @@
 #include "chatty-manager.h"
 #include "chatty-purple.h"
 #include "chatty-log.h"
+#include "chatty-mark.h"
 
 struct _ChattyPurple
 {
@@ -123,6 +124,7 @@ purple_glib_io_invoke (GIOChannel   *source,
 {
   PurpleGLibIOClosure *closure = data;
   PurpleInputCondition purple_cond = 0;
+  gint64 mark_time;
 
   if (condition & PURPLE_GLIB_READ_COND)
     purple_cond |= PURPLE_INPUT_READ;
@@ -130,8 +132,11 @@ purple_glib_io_invoke (GIOChannel   *source,
   if (condition & PURPLE_GLIB_WRITE_COND)
     purple_cond |= PURPLE_INPUT_WRITE;
 
+  mark_time = CHATTY_MARK_NOW ();
   closure->function (closure->data, g_io_channel_unix_get_fd (source),
                      purple_cond);
+  CHATTY_MARK (mark_time, "purple-io", "watch %u: fd %d, condition %d",
+               closure->result, g_io_channel_unix_get_fd (source), purple_cond);
 
   return TRUE;
 }
@@ -1141,10 +1146,7 @@ chatty_conv_write_conversation (PurpleConversation *conv,
 
       chatty_chat_set_unread_count (CHATTY_CHAT (chat), 0);
     } else if (pcm.flags & PURPLE_MESSAGE_SEND) {
-      // offline send (from MAM)
-      // FIXME: current list_box does not allow ordering rows by timestamp
-      // TODO: Needs proper sort function and timestamp as user_data for rows
-      // FIXME: Alternatively may need to reload history to re-populate rows
+      // offline send (from MAM), the message store places it by timestamp
       chat_message = chatty_message_new (NULL, message, uuid, mtime, CHATTY_MESSAGE_HTML_ESCAPED,
                                          CHATTY_DIRECTION_OUT, 0);
       chatty_message_set_status (chat_message, CHATTY_STATUS_SENT, 0);
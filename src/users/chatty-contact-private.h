@@ -12,4 +12,6 @@
 
 #include "chatty-contact.h"
 
-void chatty_contact_clear_cache (ChattyContact *self);
+void chatty_contact_clear_cache       (ChattyContact *self);
+void chatty_contact_build_search_keys (ChattyContact *self,
+                                       const char    *country);
@@ -43,8 +43,25 @@ struct _ChattyContact
   char       *name;
   char       *value;
   GdkPixbuf *avatar;
+  /* The avatar is being loaded, or failed to load */
+  gboolean    avatar_requested;
+
+  /* Search keys, so that phone numbers are parsed only once */
+  char       *keys_country;
+  char       *digits_key;
+  char       *e164_key;
+  char       *national_key;
+  gboolean    keys_ready;
 };
 
+/* The last search string parsed, typically the same for all contacts */
+static struct {
+  char *needle;
+  char *country;
+  char *e164;
+  char *national;
+} needle_cache;
+
 G_DEFINE_TYPE (ChattyContact, chatty_contact, CHATTY_TYPE_ITEM)
 
 
@@ -62,6 +79,79 @@ chatty_contact_get_protocols (ChattyItem *item)
 }
 
 
+static void
+contact_parse_number (const char  *value,
+                      const char  *country,
+                      char       **e164,
+                      char       **national)
+{
+  EPhoneNumber *number;
+
+  *e164 = *national = NULL;
+
+  if (!value || !*value || !e_phone_number_is_supported ())
+    return;
+
+  number = e_phone_number_from_string (value, country, NULL);
+
+  if (!number)
+    return;
+
+  *e164 = e_phone_number_to_string (number, E_PHONE_NUMBER_FORMAT_E164);
+  *national = e_phone_number_get_national_number (number);
+  e_phone_number_free (number);
+}
+
+static const char *
+contact_get_country (void)
+{
+  ChattySettings *settings;
+
+  settings = chatty_settings_get_default ();
+
+  return chatty_settings_get_country_iso_code (settings);
+}
+
+static void
+contact_ensure_search_keys (ChattyContact *self,
+                            const char    *country)
+{
+  if (self->keys_ready && g_strcmp0 (self->keys_country, country) == 0)
+    return;
+
+  chatty_contact_build_search_keys (self, country);
+}
+
+/* Matches the same numbers e_phone_number_compare_strings_with_region() finds
+ * as exact or national match, without parsing @value again for every contact */
+static gboolean
+contact_number_matches (ChattyContact *self,
+                        const char    *value,
+                        const char    *country)
+{
+  contact_ensure_search_keys (self, country);
+
+  if (g_strcmp0 (value, needle_cache.needle) != 0 ||
+      g_strcmp0 (country, needle_cache.country) != 0) {
+    g_free (needle_cache.needle);
+    g_free (needle_cache.country);
+    g_free (needle_cache.e164);
+    g_free (needle_cache.national);
+    needle_cache.needle = g_strdup (value);
+    needle_cache.country = g_strdup (country);
+    contact_parse_number (value, country, &needle_cache.e164, &needle_cache.national);
+  }
+
+  if (needle_cache.e164 && g_strcmp0 (needle_cache.e164, self->e164_key) == 0)
+    return TRUE;
+
+  /* National match, if either number has no explicit country code */
+  if (needle_cache.national && g_strcmp0 (needle_cache.national, self->national_key) == 0)
+    return *value != '+' || *chatty_item_get_username (CHATTY_ITEM (self)) != '+';
+
+  return FALSE;
+}
+
 static gboolean
 chatty_contact_matches (ChattyItem     *item,
                         const char     *needle,
@@ -79,19 +169,20 @@ chatty_contact_matches (ChattyItem     *item,
 
   if (protocol == CHATTY_PROTOCOL_MMS_SMS &&
       protocols & CHATTY_PROTOCOL_MMS_SMS) {
-    ChattySettings *settings;
     const char *country;
-    EPhoneNumberMatch match;
 
     if (strstr (value, needle))
       return TRUE;
 
-    settings = chatty_settings_get_default ();
-    country = chatty_settings_get_country_iso_code (settings);
-    match = e_phone_number_compare_strings_with_region (value, needle, country, NULL);
+    country = contact_get_country ();
+    contact_ensure_search_keys (self, country);
+
+    /* Let "5551234" match "(555) 123-4" */
+    if (needle[strspn (needle, "0123456789")] == '\0' &&
+        self->digits_key && strstr (self->digits_key, needle))
+      return TRUE;
 
-    if (match == E_PHONE_NUMBER_MATCH_EXACT ||
-        match == E_PHONE_NUMBER_MATCH_NATIONAL)
+    if (contact_number_matches (self, needle, country))
       return TRUE;
 
     if (g_str_equal (value, needle))
@@ -140,47 +231,79 @@ chatty_contact_get_username (ChattyItem *item)
   return "";
 }
 
+static void chatty_contact_get_avatar_async (ChattyItem          *item,
+                                             GCancellable        *cancellable,
+                                             GAsyncReadyCallback  callback,
+                                             gpointer             user_data);
+
+static void
+contact_get_avatar_cb (GObject      *object,
+                       GAsyncResult *result,
+                       gpointer      user_data)
+{
+  g_task_propagate_pointer (G_TASK (result), NULL);
+}
+
 static GdkPixbuf *
 chatty_contact_get_avatar (ChattyItem *item)
 {
   ChattyContact *self = (ChattyContact *)item;
-  EContactPhoto *photo;
 
   g_assert (CHATTY_IS_CONTACT (self));
 
-  if (self->avatar)
+  if (self->avatar || self->avatar_requested || !self->e_contact)
     return self->avatar;
 
-  if (!self->e_contact)
-    return NULL;
+  /* Don't read and decode on the main thread, "avatar-changed"
+   * is emitted when the avatar is loaded */
+  self->avatar_requested = TRUE;
+  chatty_contact_get_avatar_async (item, NULL, contact_get_avatar_cb, NULL);
 
-  photo = e_contact_get (self->e_contact, E_CONTACT_PHOTO);
+  return NULL;
+}
 
-  if (!photo)
-    return NULL;
+static void
+contact_decode_avatar_cb (GObject      *object,
+                          GAsyncResult *result,
+                          gpointer      user_data)
+{
+  g_autoptr(GTask) task = user_data;
+  g_autoptr(GdkPixbuf) avatar = NULL;
+  ChattyContact *self;
 
-  if (photo->type == E_CONTACT_PHOTO_TYPE_URI) {
-    g_autoptr(GFileInputStream) stream = NULL;
-    g_autoptr(GFile) file = NULL;
+  self = g_task_get_source_object (task);
+  avatar = chatty_utils_decode_image_finish (result, NULL);
 
-    file = g_file_new_for_uri (e_contact_photo_get_uri (photo));
-    stream = g_file_read (file, NULL, NULL);
+  if (!self->avatar && avatar) {
+    self->avatar = g_steal_pointer (&avatar);
+    g_signal_emit_by_name (self, "avatar-changed");
+  }
+
+  g_task_return_pointer (task, self->avatar, NULL);
+}
 
-    if (stream)
-      self->avatar = gdk_pixbuf_new_from_stream (G_INPUT_STREAM (stream), NULL, NULL);
-  } else {
-    const guchar *data;
-    gsize len;
+static void
+contact_read_avatar_cb (GObject      *object,
+                        GAsyncResult *result,
+                        gpointer      user_data)
+{
+  g_autoptr(GTask) task = user_data;
+  g_autoptr(GFileInputStream) stream = NULL;
+  g_autoptr(GError) error = NULL;
 
-    data = e_contact_photo_get_inlined (photo, &len);
+  stream = g_file_read_finish (G_FILE (object), result, &error);
 
-    if (data)
-      self->avatar = chatty_utils_get_pixbuf_from_data (data, len);
+  if (!stream) {
+    g_debug ("Error reading avatar: %s", error->message);
+    g_task_return_pointer (task, NULL, NULL);
+    return;
   }
 
-  e_contact_photo_free (photo);
-
-  return self->avatar;
+  chatty_utils_decode_image_async (G_INPUT_STREAM (stream), ICON_SIZE * 4,
+                                   G_PRIORITY_DEFAULT,
+                                   g_task_get_cancellable (task),
+                                   contact_decode_avatar_cb,
+                                   g_steal_pointer (&task));
 }
 
 static void
@@ -190,15 +313,59 @@ chatty_contact_get_avatar_async (ChattyItem          *item,
                                  gpointer             user_data)
 {
   ChattyContact *self = (ChattyContact *)item;
+  g_autoptr(GInputStream) stream = NULL;
   g_autoptr(GTask) task = NULL;
+  EContactPhoto *photo = NULL;
+  const guchar *data;
+  gsize len;
 
   g_assert (CHATTY_IS_CONTACT (self));
   g_assert (!cancellable || G_IS_CANCELLABLE (cancellable));
 
   task = g_task_new (self, cancellable, callback, user_data);
 
-  self->avatar = chatty_contact_get_avatar (item);
-  g_task_return_pointer (task, self->avatar, NULL);
+  if (!self->avatar && self->e_contact)
+    photo = e_contact_get (self->e_contact, E_CONTACT_PHOTO);
+
+  if (!photo) {
+    g_task_return_pointer (task, self->avatar, NULL);
+    return;
+  }
+
+  if (photo->type == E_CONTACT_PHOTO_TYPE_URI) {
+    g_autoptr(GFile) file = NULL;
+
+    file = g_file_new_for_uri (e_contact_photo_get_uri (photo));
+    e_contact_photo_free (photo);
+
+    /* Don't block the main thread on the file system */
+    g_file_read_async (file, G_PRIORITY_DEFAULT, cancellable,
+                       contact_read_avatar_cb,
+                       g_steal_pointer (&task));
+    return;
+  }
+
+  data = e_contact_photo_get_inlined (photo, &len);
+
+  if (data) {
+    g_autoptr(GBytes) bytes = NULL;
+
+    bytes = g_bytes_new (data, len);
+    stream = g_memory_input_stream_new_from_bytes (bytes);
+  }
+
+  e_contact_photo_free (photo);
+
+  if (!stream) {
+    g_task_return_pointer (task, NULL, NULL);
+    return;
+  }
+
+  /* Decode in a worker, contact lists can have lots of avatars */
+  chatty_utils_decode_image_async (stream, ICON_SIZE * 4, G_PRIORITY_DEFAULT,
+                                   cancellable,
+                                   contact_decode_avatar_cb,
+                                   g_steal_pointer (&task));
 }
 
 static void
@@ -211,6 +378,10 @@ chatty_contact_dispose (GObject *object)
   g_clear_pointer (&self->attribute, e_vcard_attribute_free);
   g_clear_pointer (&self->name, g_free);
   g_clear_pointer (&self->value, g_free);
+  g_clear_pointer (&self->keys_country, g_free);
+  g_clear_pointer (&self->digits_key, g_free);
+  g_clear_pointer (&self->e164_key, g_free);
+  g_clear_pointer (&self->national_key, g_free);
 
   G_OBJECT_CLASS (chatty_contact_parent_class)->dispose (object);
 }
@@ -300,6 +471,7 @@ chatty_contact_set_value (ChattyContact *self,
 
   g_free (self->value);
   self->value = g_strdup (value);
+  self->keys_ready = FALSE;
 }
 
 /**
@@ -366,19 +538,10 @@ chatty_contact_is_exact_match (ChattyContact  *self,
 
   if (protocol & (CHATTY_PROTOCOL_MMS_SMS | CHATTY_PROTOCOL_MMS) &&
       protocols & (CHATTY_PROTOCOL_MMS_SMS | CHATTY_PROTOCOL_MMS)) {
-    ChattySettings *settings;
-    const char *country;
-    EPhoneNumberMatch match;
-
     if (g_str_equal (contact_value, value))
       return TRUE;
 
-    settings = chatty_settings_get_default ();
-    country = chatty_settings_get_country_iso_code (settings);
-    match = e_phone_number_compare_strings_with_region (contact_value, value, country, NULL);
-
-    if (match == E_PHONE_NUMBER_MATCH_EXACT ||
-        match == E_PHONE_NUMBER_MATCH_NATIONAL)
+    if (contact_number_matches (self, value, contact_get_country ()))
       return TRUE;
   }
 
@@ -398,6 +561,49 @@ chatty_contact_clear_cache (ChattyContact *self)
   g_return_if_fail (CHATTY_IS_CONTACT (self));
 
   g_clear_object (&self->avatar);
+  self->avatar_requested = FALSE;
+}
+
+/**
+ * chatty_contact_build_search_keys:
+ * @self: #ChattyContact
+ * @country: (nullable): The ISO country code to parse numbers for
+ *
+ * Parse the value of @self once, so that searching
+ * doesn't have to.  This can be run in a worker thread
+ * as long as @self isn't used elsewhere meanwhile.
+ * This API is only to be used by contact-provider.
+ */
+void
+chatty_contact_build_search_keys (ChattyContact *self,
+                                  const char    *country)
+{
+  g_autoptr(GString) digits = NULL;
+  const char *value;
+
+  g_return_if_fail (CHATTY_IS_CONTACT (self));
+
+  g_clear_pointer (&self->keys_country, g_free);
+  g_clear_pointer (&self->digits_key, g_free);
+  g_clear_pointer (&self->e164_key, g_free);
+  g_clear_pointer (&self->national_key, g_free);
+
+  self->keys_country = g_strdup (country);
+  self->keys_ready = TRUE;
+
+  if (!(chatty_item_get_protocols (CHATTY_ITEM (self)) &
+        (CHATTY_PROTOCOL_MMS_SMS | CHATTY_PROTOCOL_MMS | CHATTY_PROTOCOL_CALL)))
+    return;
+
+  value = chatty_item_get_username (CHATTY_ITEM (self));
+  digits = g_string_new (NULL);
+
+  for (const char *c = value; *c; c++)
+    if (g_ascii_isdigit (*c))
+      g_string_append_c (digits, *c);
+
+  self->digits_key = g_string_free (g_steal_pointer (&digits), FALSE);
+  contact_parse_number (value, country, &self->e164_key, &self->national_key);
 }
 
 gboolean
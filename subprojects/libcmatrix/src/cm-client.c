@@ -114,6 +114,8 @@ struct _CmClient
   gboolean        login_success;
   gboolean        is_sync;
   gboolean        sync_failed;
+  /* When the pending /sync request was sent */
+  gint64          sync_begin_time;
   gboolean        is_self_change;
   gboolean        save_client_pending;
   gboolean        save_secret_pending;
@@ -2553,6 +2555,7 @@ matrix_take_red_pill_cb (GObject      *obj,
       return;
     }
 
+  cm_utils_record_stat (CM_STAT_SYNC, self->sync_begin_time);
   client_set_login_state (self, FALSE, TRUE);
 
   g_free (self->next_batch);
@@ -2562,9 +2565,12 @@ matrix_take_red_pill_cb (GObject      *obj,
 
   {
     g_autofree char *json_str = NULL;
+    gint64 begin_time;
 
     json_str = cm_utils_json_object_to_string (root, FALSE);
+    begin_time = g_get_monotonic_time ();
     handle_red_pill (self, root);
+    cm_utils_record_stat (CM_STAT_SYNC_HANDLE, begin_time);
 
     /* update variables only after the result is locally parsed  */
     if (self->sync_failed || !self->is_sync)
@@ -2606,6 +2612,7 @@ matrix_take_red_pill (CmClient *self,
     g_hash_table_insert (query, g_strdup ("since"), g_strdup (self->next_batch));
 
   cancellable = g_task_get_cancellable (task);
+  self->sync_begin_time = g_get_monotonic_time ();
   cm_net_send_json_async (self->cm_net, 2, NULL,
                           "/_matrix/client/r0/sync", SOUP_METHOD_GET,
                           query, cancellable, matrix_take_red_pill_cb,
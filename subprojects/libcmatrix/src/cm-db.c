@@ -43,6 +43,8 @@ struct _CmDb
   GThread     *worker_thread;
   sqlite3     *db;
   char        *db_path;
+  /* The task being run by the worker thread */
+  GTask       *current_task;
 };
 
 #define VERIFICATION_UNSET       0
@@ -1365,6 +1367,26 @@ cm_db_update_user_device (CmDb     *self,
   sqlite3_finalize (stmt);
 }
 
+#ifdef HAVE_SYSPROF
+static int
+db_trace_cb (unsigned int  type,
+             void         *ctx,
+             void         *p,
+             void         *x)
+{
+  CmDb *self = ctx;
+  gint64 duration;
+
+  /* Time taken by the statement @p, in nanoseconds */
+  duration = *(sqlite3_int64 *)x;
+  sysprof_collector_mark_printf (SYSPROF_CAPTURE_CURRENT_TIME - duration, duration,
+                                 "libcmatrix", "db-sql", "task %p: %s",
+                                 self->current_task, sqlite3_sql (p));
+
+  return 0;
+}
+#endif
+
 static void
 matrix_open_db (CmDb  *self,
                 GTask *task)
@@ -1392,6 +1414,9 @@ matrix_open_db (CmDb  *self,
 
   if (status == SQLITE_OK) {
     self->db = db;
+#ifdef HAVE_SYSPROF
+    sqlite3_trace_v2 (self->db, SQLITE_TRACE_PROFILE, db_trace_cb, self);
+#endif
 
     sqlite3_exec (self->db, "PRAGMA foreign_keys = OFF;", NULL, NULL, NULL);
     sqlite3_exec (self->db, "BEGIN TRANSACTION;", NULL, NULL, NULL);
@@ -2662,10 +2687,15 @@ cm_db_worker (gpointer user_data)
   while ((task = g_async_queue_pop (self->queue)))
     {
       CmDbCallback callback;
+      gint64 mark_time;
 
       g_assert (task);
       callback = g_task_get_task_data (task);
+      mark_time = CM_MARK_NOW ();
+      self->current_task = task;
       callback (self, task);
+      self->current_task = NULL;
+      CM_MARK (mark_time, "db-task", "task %p: %s", task, g_task_get_name (task));
       g_object_unref (task);
 
       if (callback == matrix_close_db)
@@ -2675,6 +2705,24 @@ cm_db_worker (gpointer user_data)
   return NULL;
 }
 
+/*
+ * db_queue_task:
+ * @task: (transfer full)
+ * @urgent: Whether to run @task before the queued ones
+ */
+static void
+db_queue_task (CmDb     *self,
+               GTask    *task,
+               gboolean  urgent)
+{
+  CM_MARK_INSTANT ("db-enqueue", "task %p: %s", task, g_task_get_name (task));
+
+  if (urgent)
+    g_async_queue_push_front (self->queue, task);
+  else
+    g_async_queue_push (self->queue, task);
+}
+
 static void
 ma_finish_cb (GObject      *object,
               GAsyncResult *result,
@@ -2815,7 +2863,7 @@ cm_db_open_async (CmDb                *self,
   g_object_set_data_full (G_OBJECT (task), "dir", dir, g_free);
   g_object_set_data_full (G_OBJECT (task), "file-name", g_strdup (file_name), g_free);
 
-  g_async_queue_push (self->queue, task);
+  db_queue_task (self, task, FALSE);
 }
 
 /**
@@ -2882,7 +2930,7 @@ cm_db_close_async (CmDb                *self,
   g_task_set_source_tag (task, cm_db_close_async);
   g_task_set_task_data (task, matrix_close_db, NULL);
 
-  g_async_queue_push (self->queue, task);
+  db_queue_task (self, task, FALSE);
 }
 
 /**
@@ -2953,7 +3001,7 @@ cm_db_save_client_async (CmDb                *self,
   g_object_set_data_full (object, "filter-id",
                           g_strdup (cm_client_get_filter_id (client)), g_free);
 
-  g_async_queue_push (self->queue, task);
+  db_queue_task (self, task, FALSE);
 }
 
 gboolean
@@ -3000,7 +3048,7 @@ cm_db_load_client_async (CmDb                *self,
   g_object_set_data_full (G_OBJECT (task), "username", g_strdup (username), g_free);
   g_object_set_data_full (G_OBJECT (task), "client", g_object_ref (client), g_object_unref);
 
-  g_async_queue_push_front (self->queue, task);
+  db_queue_task (self, task, TRUE);
 }
 
 gboolean
@@ -3048,7 +3096,7 @@ cm_db_save_room_async (CmDb                *self,
   g_object_set_data_full (G_OBJECT (task), "replacement", g_strdup (replacement), g_free);
   g_object_set_data (G_OBJECT (task), "status", GINT_TO_POINTER (room_status));
 
-  g_async_queue_push (self->queue, task);
+  db_queue_task (self, task, FALSE);
 }
 
 gboolean
@@ -3085,7 +3133,7 @@ cm_db_delete_client_async (CmDb                *self,
   g_object_set_data_full (G_OBJECT (task), "device-id", g_strdup (device_id), g_free);
   g_object_set_data_full (G_OBJECT (task), "client", g_object_ref (client), g_object_unref);
 
-  g_async_queue_push (self->queue, task);
+  db_queue_task (self, task, FALSE);
 }
 
 gboolean
@@ -3125,7 +3173,7 @@ cm_db_add_session (CmDb     *self,
   if (cm_olm_get_session_type (session) == SESSION_MEGOLM_V1_OUT)
     g_object_set_data (object, "chain-index", GINT_TO_POINTER (cm_olm_get_message_index (session)));
 
-  g_async_queue_push_front (self->queue, task);
+  db_queue_task (self, task, TRUE);
 
   cm_db_wait_for_completion (task);
 
@@ -3154,7 +3202,7 @@ cm_db_save_file_enc_async (CmDb                *self,
   g_task_set_task_data (task, cm_db_save_file_enc, NULL);
   g_object_set_data (G_OBJECT (task), "file", file);
 
-  g_async_queue_push (self->queue, task);
+  db_queue_task (self, task, FALSE);
 }
 
 gboolean
@@ -3186,7 +3234,7 @@ cm_db_find_file_enc_async (CmDb                *self,
 
   g_object_set_data_full (G_OBJECT (task), "uri", g_strdup (uri), g_free);
 
-  g_async_queue_push (self->queue, task);
+  db_queue_task (self, task, FALSE);
 }
 
 CmEncFileInfo *
@@ -3236,7 +3284,7 @@ cm_db_lookup_session (CmDb          *self,
   g_object_set_data_full (object, "pickle-key", g_strdup (pickle_key),
                           (GDestroyNotify)cm_utils_free_buffer);
   g_object_set_data (object, "type", GINT_TO_POINTER (type));
-  g_async_queue_push (self->queue, task);
+  db_queue_task (self, task, FALSE);
   g_assert (task);
 
   cm_db_wait_for_completion (task);
@@ -3290,7 +3338,7 @@ cm_db_lookup_olm_session (CmDb           *self,
   g_object_set_data (object, "message-type", GUINT_TO_POINTER (message_type));
 
   /* Push to end as we may have to match items inserted immediately before */
-  g_async_queue_push (self->queue, task);
+  db_queue_task (self, task, FALSE);
   g_assert (task);
 
   cm_db_wait_for_completion (task);
@@ -3337,7 +3385,7 @@ cm_db_mark_user_device_change (CmDb      *self,
   g_object_set_data (object, "tracking", GINT_TO_POINTER (is_tracking));
   g_object_set_data (object, "outdated", GINT_TO_POINTER (outdated));
 
-  g_async_queue_push (self->queue, task);
+  db_queue_task (self, task, FALSE);
   g_assert (task);
 
   cm_db_wait_for_completion (task);
@@ -3396,7 +3444,7 @@ cm_db_update_user_devices (CmDb       *self,
   g_object_set_data_full (object, "account-device", g_strdup (device), g_free);
   g_object_set_data (object, "force-add", GINT_TO_POINTER (force_add));
 
-  g_async_queue_push (self->queue, task);
+  db_queue_task (self, task, FALSE);
   g_assert (task);
 
   cm_db_wait_for_completion (task);
@@ -3451,7 +3499,7 @@ cm_db_update_device (CmDb     *self,
   g_object_set_data_full (object, "username", g_strdup (cm_user_get_id (user)), g_free);
   g_object_set_data_full (object, "account-device", g_strdup (device_id), g_free);
 
-  g_async_queue_push (self->queue, task);
+  db_queue_task (self, task, FALSE);
   g_assert (task);
 
   cm_db_wait_for_completion (task);
@@ -3502,7 +3550,7 @@ cm_db_add_room_members (CmDb      *self,
   g_object_set_data_full (G_OBJECT (task), "username", g_strdup (username), g_free);
   g_object_set_data_full (G_OBJECT (task), "device", g_strdup (device), g_free);
 
-  g_async_queue_push (self->queue, task);
+  db_queue_task (self, task, FALSE);
 
   cm_db_wait_for_completion (task);
 
@@ -3559,7 +3607,7 @@ cm_db_add_room_events (CmDb      *self,
   g_object_set_data_full (G_OBJECT (task), "device", g_strdup (device), g_free);
   g_object_set_data (G_OBJECT (task), "prepend", GINT_TO_POINTER (!!prepend));
 
-  g_async_queue_push (self->queue, task);
+  db_queue_task (self, task, FALSE);
 
   cm_db_wait_for_completion (task);
 
@@ -3610,7 +3658,7 @@ cm_db_get_past_events_async (CmDb                *self,
   g_task_set_source_tag (task, cm_db_get_past_events_async);
   g_task_set_task_data (task, db_get_past_events, NULL);
 
-  g_async_queue_push (self->queue, task);
+  db_queue_task (self, task, FALSE);
 }
 
 GPtrArray *
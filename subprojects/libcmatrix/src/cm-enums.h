@@ -200,3 +200,21 @@ typedef enum
   CM_EVENT_STATE_SENT,
   CM_EVENT_STATE_RECEIVED,
 } CmEventState;
+
+/**
+ * CmStat:
+ * @CM_STAT_SYNC: The round trip of a `/sync` request
+ * @CM_STAT_JSON_PARSE: Parsing the JSON of a response
+ * @CM_STAT_SYNC_HANDLE: Handling a parsed `/sync` response
+ * @CM_STAT_DECRYPT: Decrypting an olm or megolm message
+ *
+ * The timings reported to the function set with
+ * cm_utils_set_stats_func().
+ */
+typedef enum
+{
+  CM_STAT_SYNC,
+  CM_STAT_JSON_PARSE,
+  CM_STAT_SYNC_HANDLE,
+  CM_STAT_DECRYPT,
+} CmStat;
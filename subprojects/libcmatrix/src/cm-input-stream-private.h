@@ -30,7 +30,10 @@ void            cm_input_stream_set_file_enc          (CmInputStream       *self
 void            cm_input_stream_set_encrypt           (CmInputStream       *self);
 char           *cm_input_stream_get_sha256            (CmInputStream       *self);
 const char     *cm_input_stream_get_content_type      (CmInputStream       *self);
+void            cm_input_stream_set_content_length    (CmInputStream       *self,
+                                                       goffset              content_length);
 goffset         cm_input_stream_get_size              (CmInputStream       *self);
+gboolean        cm_input_stream_verify_sha256         (CmInputStream       *self);
 JsonObject     *cm_input_stream_get_file_json         (CmInputStream       *self);
 
 G_END_DECLS
@@ -26,6 +26,10 @@ struct _CmInputStream
 
   char              *aes_key_base64;
   char              *aes_iv_base64;
+  /* Expected checksum of the encrypted data, for downloads */
+  char              *sha256_base64;
+  /* Size of the data to read, if not from a local file */
+  goffset            content_length;
 
   /* For files that will be used to upload */
   GFile             *file;
@@ -169,6 +173,7 @@ cm_input_stream_finalize (GObject *object)
   g_clear_pointer (&self->buffer, g_free);
   g_clear_pointer (&self->aes_iv_base64, g_free);
   g_clear_pointer (&self->aes_key_base64, g_free);
+  g_clear_pointer (&self->sha256_base64, g_free);
 
   g_clear_object (&self->file);
   g_clear_object (&self->file_info);
@@ -253,6 +258,8 @@ cm_input_stream_set_file_enc (CmInputStream *self,
   g_return_if_fail (file->aes_key_base64);
   g_return_if_fail (!self->cipher_hd);
 
+  self->sha256_base64 = g_strdup (file->sha256_base64);
+
   self->gcr_error = gcry_cipher_open (&cipher_hd, GCRY_CIPHER_AES256, GCRY_CIPHER_MODE_CTR, 0);
 
   if (!self->gcr_error)
@@ -363,17 +370,52 @@ cm_input_stream_get_content_type (CmInputStream *self)
   return "application/octet-stream";
 }
 
+void
+cm_input_stream_set_content_length (CmInputStream *self,
+                                    goffset        content_length)
+{
+  g_return_if_fail (CM_IS_INPUT_STREAM (self));
+
+  self->content_length = MAX (content_length, 0);
+}
+
 goffset
 cm_input_stream_get_size (CmInputStream *self)
 {
   g_return_val_if_fail (CM_IS_INPUT_STREAM (self), 0);
 
   if (!self->file_info)
-    return 0;
+    return self->content_length;
 
   return g_file_info_get_size (self->file_info);
 }
 
+/*
+ * cm_input_stream_verify_sha256:
+ * @self: A #CmInputStream
+ *
+ * Check if the sha256 checksum of the data read matches the
+ * one set with cm_input_stream_set_file_enc().  This should
+ * be run only after the stream is read completely.
+ *
+ * Returns: %TRUE if the checksum matches or if there is
+ * no checksum to verify, %FALSE otherwise.
+ */
+gboolean
+cm_input_stream_verify_sha256 (CmInputStream *self)
+{
+  g_autofree char *sha256 = NULL;
+
+  g_return_val_if_fail (CM_IS_INPUT_STREAM (self), FALSE);
+
+  if (self->encrypt || !self->sha256_base64)
+    return TRUE;
+
+  sha256 = cm_input_stream_get_sha256 (self);
+
+  return g_strcmp0 (sha256, self->sha256_base64) == 0;
+}
+
 JsonObject *
 cm_input_stream_get_file_json (CmInputStream *self)
 {
@@ -8,6 +8,9 @@
 
 #include "cm-config.h"
 
+#include <errno.h>
+#include <glib/gstdio.h>
+
 #define GCRYPT_NO_DEPRECATED
 #include <gcrypt.h>
 #include <libsoup/soup.h>
@@ -24,9 +27,30 @@
  * CmNet:
  *
  * Matrix Network related methods
+ *
+ * Requests with a priority greater than 0 (sync, message sends,
+ * typing notices, etc.) are sent immediately, while the rest
+ * (avatars, room state, key queries, etc.) are queued and sent
+ * in priority order, with at most %MAX_BACKGROUND_REQUESTS of
+ * them in flight.  This way bulk fetches never take all the
+ * connections to the homeserver and user visible requests don't
+ * have to wait behind them.  Queued requests that are cancelled
+ * return right away instead of waiting for their turn.
+ *
+ * HTTP/2 is negotiated by libsoup where the server supports it,
+ * in which case requests are multiplexed over a single connection.
+ *
+ * If the `CMATRIX_NET_RECORD_DIR` environment variable is set, the
+ * body of every JSON response received is also written to a file in
+ * that directory, named after the request path and prefixed with a
+ * sequence number, so that the traffic can later be replayed (See
+ * tests/sync-replay.c).  The files contain access tokens and keys
+ * as sent by the server, so this should be used only for testing.
  */
 
 #define MAX_CONNECTIONS     4
+/* Leave a connection for the /sync long-poll and one for sends */
+#define MAX_BACKGROUND_REQUESTS (MAX_CONNECTIONS - 2)
 #define DATA_BLOCK_SIZE     8192
 
 struct _CmNet
@@ -38,6 +62,10 @@ struct _CmNet
   GCancellable   *cancellable;
   char           *homeserver;
   char           *access_token;
+
+  /* Queued low priority requests, sorted by priority */
+  GQueue         *background_queue;
+  guint           background_running;
 };
 
 
@@ -52,6 +80,7 @@ net_get_file_stream_cb (GObject      *obj,
   CmNet *self;
   g_autoptr(GTask) task = user_data;
   GInputStream *stream;
+  SoupMessage *msg;
   GError *error = NULL;
 
   g_assert (G_IS_TASK (task));
@@ -60,6 +89,15 @@ net_get_file_stream_cb (GObject      *obj,
   g_assert (CM_IS_NET (self));
 
   stream = soup_session_send_finish (SOUP_SESSION (obj), result, &error);
+  msg = g_object_get_data (user_data, "msg");
+
+  if (!error && !SOUP_STATUS_IS_SUCCESSFUL (soup_message_get_status (msg)))
+    {
+      g_clear_object (&stream);
+      error = g_error_new (G_IO_ERROR, G_IO_ERROR_FAILED,
+                           "Failed to get file: %s",
+                           soup_message_get_reason_phrase (msg) ?: "");
+    }
 
   if (error)
     {
@@ -67,10 +105,16 @@ net_get_file_stream_cb (GObject      *obj,
     }
   else
     {
+      SoupMessageHeaders *headers;
       CmInputStream *cm_stream;
       CmEncFileInfo *enc_file;
 
       cm_stream = cm_input_stream_new (stream);
+      g_object_unref (stream);
+
+      headers = soup_message_get_response_headers (msg);
+      cm_input_stream_set_content_length (cm_stream,
+                                          soup_message_headers_get_content_length (headers));
 
       enc_file = g_object_get_data (user_data, "file");
       cm_input_stream_set_file_enc (cm_stream, enc_file);
@@ -79,6 +123,53 @@ net_get_file_stream_cb (GObject      *obj,
     }
 }
 
+static const char *
+net_get_record_dir (void)
+{
+  static const char *record_dir;
+  static gsize initialized;
+
+  if (g_once_init_enter (&initialized))
+    {
+      const char *dir;
+
+      dir = g_getenv ("CMATRIX_NET_RECORD_DIR");
+      if (dir && *dir)
+        record_dir = g_strdup (dir);
+
+      g_once_init_leave (&initialized, 1);
+    }
+
+  return record_dir;
+}
+
+static void
+net_record_response (GTask      *task,
+                     GByteArray *content,
+                     gsize       size)
+{
+  static guint sequence;
+  g_autofree char *name = NULL;
+  g_autofree char *file_name = NULL;
+  g_autoptr(GError) error = NULL;
+  const char *record_dir, *path;
+
+  record_dir = net_get_record_dir ();
+  path = g_object_get_data (G_OBJECT (task), "record-path");
+
+  if (!record_dir || !path)
+    return;
+
+  name = g_strdup_printf ("%06u%s.json", g_atomic_int_add (&sequence, 1), path);
+  g_strdelimit (name, "/", '_');
+  file_name = g_build_filename (record_dir, name, NULL);
+
+  if (g_mkdir_with_parents (record_dir, 0700) != 0 ||
+      !g_file_set_contents (file_name, (char *)content->data, size, &error))
+    g_warning ("Error recording response to %s: %s", file_name,
+               error ? error->message : g_strerror (errno));
+}
+
 static void
 parse_from_data (GTask        *task,
                  gpointer      source_object,
@@ -89,10 +180,15 @@ parse_from_data (GTask        *task,
   JsonNode *root = NULL;
   GError *error = NULL;
   GByteArray *content;
+  gint64 begin_time, mark_time;
 
   content = g_object_get_data (G_OBJECT (task), "content");
   parser = json_parser_new ();
+  begin_time = g_get_monotonic_time ();
+  mark_time = CM_MARK_NOW ();
   json_parser_load_from_data (parser, (char *)content->data, -1, &error);
+  cm_utils_record_stat (CM_STAT_JSON_PARSE, begin_time);
+  CM_MARK (mark_time, "net-parse", "task %p", task);
 
   if (!error)
     {
@@ -175,6 +271,8 @@ read_from_stream (GObject      *object,
   else
     {
       content->data[pos] = 0;
+      CM_MARK_INSTANT ("net-receive", "task %p: %" G_GSIZE_FORMAT " bytes", task, pos);
+      net_record_response (task, content, pos);
 
       if (*(content->data) != '{' &&
           content->len < 1024 &&
@@ -194,11 +292,14 @@ session_send_cb (GObject      *object,
   GInputStream *stream = NULL;
   GCancellable *cancellable;
   GByteArray *content;
+  SoupMessage *msg;
   GError *error = NULL;
 
   g_assert (G_IS_TASK (task));
 
   stream = soup_session_send_finish (SOUP_SESSION (object), result, &error);
+  msg = soup_session_get_async_result_message (SOUP_SESSION (object), result);
+  CM_MARK_INSTANT ("net-response", "task %p: %u", task, soup_message_get_status (msg));
 
   if (error) {
     if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
@@ -212,6 +313,11 @@ session_send_cb (GObject      *object,
   g_object_set_data_full (user_data, "stream", stream, g_object_unref);
   g_object_set_data_full (user_data, "content", content, (GDestroyNotify)g_byte_array_unref);
 
+  if (net_get_record_dir ())
+    g_object_set_data_full (user_data, "record-path",
+                            g_strdup (g_uri_get_path (soup_message_get_uri (msg))),
+                            g_free);
+
   cancellable = g_task_get_cancellable (task);
   g_input_stream_read_async (stream,
                              content->data,
@@ -222,6 +328,142 @@ session_send_cb (GObject      *object,
                              g_steal_pointer (&task));
 }
 
+static int
+net_get_task_priority (GTask *task)
+{
+  return GPOINTER_TO_INT (g_object_get_data (G_OBJECT (task), "priority"));
+}
+
+static int
+net_compare_task_priority (gconstpointer a,
+                           gconstpointer b,
+                           gpointer      user_data)
+{
+  /* Keep the insertion order for tasks of the same priority */
+  if (net_get_task_priority ((GTask *)a) >= net_get_task_priority ((GTask *)b))
+    return -1;
+
+  return 1;
+}
+
+/*
+ * net_send_message:
+ * @task: (transfer full)
+ */
+static void
+net_send_message (CmNet *self,
+                  GTask *task)
+{
+  SoupMessage *message;
+
+  g_assert (CM_IS_NET (self));
+  g_assert (G_IS_TASK (task));
+
+  message = g_task_get_task_data (task);
+  g_assert (SOUP_IS_MESSAGE (message));
+
+  CM_MARK_INSTANT ("net-send", "task %p: %s %s", task,
+                   soup_message_get_method (message),
+                   g_uri_get_path (soup_message_get_uri (message)));
+  soup_session_send_async (self->soup_session, message,
+                           soup_message_get_priority (message),
+                           g_task_get_cancellable (task),
+                           session_send_cb, task);
+}
+
+static void net_dispatch_background (CmNet *self);
+
+static void
+net_task_disconnect_cancellable (GTask *task)
+{
+  gulong handler_id;
+
+  handler_id = GPOINTER_TO_SIZE (g_object_steal_data (G_OBJECT (task), "cancelled-id"));
+
+  if (handler_id)
+    g_cancellable_disconnect (g_task_get_cancellable (task), handler_id);
+}
+
+static gboolean
+net_queued_task_cancelled_idle (gpointer user_data)
+{
+  GTask *task = user_data;
+  CmNet *self;
+  GList *link;
+
+  self = g_task_get_source_object (task);
+  link = g_queue_find (self->background_queue, task);
+
+  /* The request was sent meanwhile */
+  if (!link)
+    return G_SOURCE_REMOVE;
+
+  g_queue_delete_link (self->background_queue, link);
+  net_task_disconnect_cancellable (task);
+  g_task_return_error_if_cancelled (task);
+  g_object_unref (task);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+net_queued_task_cancelled_cb (GCancellable *cancellable,
+                              GTask        *task)
+{
+  g_autoptr(GSource) source = NULL;
+
+  /* This may be run from g_cancellable_connect() or from another
+   * thread, where the handler can't be disconnected, so handle it
+   * from an idle in the context of @task */
+  source = g_idle_source_new ();
+  g_source_set_callback (source, net_queued_task_cancelled_idle,
+                         g_object_ref (task), g_object_unref);
+  g_source_attach (source, g_task_get_context (task));
+}
+
+static void
+net_background_task_completed_cb (CmNet      *self,
+                                  GParamSpec *pspec,
+                                  GTask      *task)
+{
+  g_assert (CM_IS_NET (self));
+  g_assert (G_IS_TASK (task));
+  g_assert (self->background_running > 0);
+
+  g_signal_handlers_disconnect_by_func (task, net_background_task_completed_cb, self);
+  self->background_running--;
+  net_dispatch_background (self);
+}
+
+static void
+net_dispatch_background (CmNet *self)
+{
+  g_assert (CM_IS_NET (self));
+
+  while (self->background_running < MAX_BACKGROUND_REQUESTS &&
+         !g_queue_is_empty (self->background_queue))
+    {
+      GTask *task;
+
+      task = g_queue_pop_head (self->background_queue);
+      net_task_disconnect_cancellable (task);
+
+      /* The request was cancelled while waiting in the queue */
+      if (g_task_return_error_if_cancelled (task))
+        {
+          g_object_unref (task);
+          continue;
+        }
+
+      self->background_running++;
+      /* "completed" is notified only after the response is fully read */
+      g_signal_connect_object (task, "notify::completed",
+                               G_CALLBACK (net_background_task_completed_cb),
+                               self, G_CONNECT_SWAPPED);
+      net_send_message (self, task);
+    }
+}
+
 /*
  * queue_data:
  * @data: (transfer full)
@@ -240,7 +482,6 @@ queue_data (CmNet      *self,
   g_autoptr(SoupMessage) message = NULL;
   g_autoptr(GUri) uri = NULL;
   GUri *old_uri;
-  GCancellable *cancellable;
   SoupMessagePriority msg_priority;
   int priority = 0;
 
@@ -275,8 +516,8 @@ queue_data (CmNet      *self,
     g_hash_table_unref (query);
   }
 
+  /* Accept-Encoding is set by the session content decoder */
   message = soup_message_new_from_uri (method, uri);
-  soup_message_headers_append (soup_message_get_request_headers (message), "Accept-Encoding", "gzip");
 
   priority = GPOINTER_TO_INT (g_object_get_data (G_OBJECT (task), "priority"));
 
@@ -299,17 +540,36 @@ queue_data (CmNet      *self,
     soup_message_set_request_body_from_bytes (message, "application/json", content_data);
   }
 
-  cancellable = g_task_get_cancellable (task);
   g_task_set_task_data (task, g_object_ref (message), g_object_unref);
 
-  soup_session_send_async (self->soup_session, message, msg_priority, cancellable,
-                           session_send_cb, task);
+  if (priority > 0)
+    {
+      net_send_message (self, task);
+      return;
+    }
+
+  g_queue_insert_sorted (self->background_queue, task,
+                         net_compare_task_priority, NULL);
+
+  /* Don't let a cancelled request wait for its turn to return */
+  if (g_task_get_cancellable (task))
+    {
+      gulong handler_id;
+
+      handler_id = g_cancellable_connect (g_task_get_cancellable (task),
+                                          G_CALLBACK (net_queued_task_cancelled_cb),
+                                          task, NULL);
+      g_object_set_data (G_OBJECT (task), "cancelled-id", GSIZE_TO_POINTER (handler_id));
+    }
+
+  net_dispatch_background (self);
 }
 
 static void
 cm_net_finalize (GObject *object)
 {
   CmNet *self = (CmNet *)object;
+  GTask *task;
 
   if (self->cancellable)
     g_cancellable_cancel (self->cancellable);
@@ -321,6 +581,15 @@ cm_net_finalize (GObject *object)
   g_clear_object (&self->soup_session);
   g_clear_object (&self->file_session);
 
+  while ((task = g_queue_pop_head (self->background_queue)))
+    {
+      net_task_disconnect_cancellable (task);
+      g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                               "Request cancelled");
+      g_object_unref (task);
+    }
+  g_queue_free (self->background_queue);
+
   g_free (self->homeserver);
   g_clear_pointer (&self->access_token, gcry_free);
 
@@ -340,11 +609,17 @@ cm_net_init (CmNet *self)
 {
   self->soup_session = g_object_new (SOUP_TYPE_SESSION,
                                      "max-conns-per-host", MAX_CONNECTIONS,
+                                     "max-conns", MAX_CONNECTIONS * 2,
                                      NULL);
   self->file_session = g_object_new (SOUP_TYPE_SESSION,
                                      "max-conns-per-host", MAX_CONNECTIONS,
                                      NULL);
   self->cancellable = g_cancellable_new ();
+  self->background_queue = g_queue_new ();
+
+  /* Advertise and transparently decode gzip/deflate responses */
+  if (!soup_session_has_feature (self->soup_session, SOUP_TYPE_CONTENT_DECODER))
+    soup_session_add_feature_by_type (self->soup_session, SOUP_TYPE_CONTENT_DECODER);
 }
 
 CmNet *
@@ -404,7 +679,10 @@ cm_net_get_access_token (CmNet *self)
  * @method should be one of %SOUP_METHOD_GET, %SOUP_METHOD_PUT
  * or %SOUP_METHOD_POST.
  * If @cancellable is %NULL, the internal cancellable
- * shall be used
+ * shall be used.
+ *
+ * Requests with @priority less than or equal to 0 are
+ * queued as background requests and may be delayed.
  */
 void
 cm_net_send_data_async (CmNet               *self,
@@ -455,7 +733,10 @@ cm_net_send_data_async (CmNet               *self,
  * @method should be one of %SOUP_METHOD_GET, %SOUP_METHOD_PUT
  * or %SOUP_METHOD_POST.
  * If @cancellable is %NULL, the internal cancellable
- * shall be used
+ * shall be used.
+ *
+ * Requests with @priority less than or equal to 0 are
+ * queued as background requests and may be delayed.
  */
 void
 cm_net_send_json_async (CmNet               *self,
@@ -625,13 +906,21 @@ wrote_body_data_cb (GTask       *task,
                     guint       chunk_size)
 {
   GFileProgressCallback progress_cb;
+  CmInputStream *stream;
   gpointer progress_user_data;
+  gsize written;
 
   progress_cb = g_object_get_data (G_OBJECT (task), "progress-cb");
   progress_user_data = g_object_get_data (G_OBJECT (task), "progress-cb-data");
+  stream = g_object_get_data (G_OBJECT (task), "stream");
   g_assert (progress_cb);
+  g_assert (CM_IS_INPUT_STREAM (stream));
+
+  written = GPOINTER_TO_SIZE (g_object_get_data (G_OBJECT (task), "written"));
+  written += chunk_size;
+  g_object_set_data (G_OBJECT (task), "written", GSIZE_TO_POINTER (written));
 
-  progress_cb (0, 0, progress_user_data);
+  progress_cb (written, cm_input_stream_get_size (stream), progress_user_data);
 }
 
 void
@@ -683,6 +972,8 @@ cm_net_put_file_async (CmNet                 *self,
   g_task_set_task_data (task, g_object_ref (file), g_object_unref);
   g_object_set_data_full (G_OBJECT (task), "msg", msg, g_object_unref);
   g_object_set_data_full (G_OBJECT (task), "stream", cm_stream, g_object_unref);
+  g_object_set_data (G_OBJECT (task), "progress-cb", progress_callback);
+  g_object_set_data (G_OBJECT (task), "progress-cb-data", progress_user_data);
 
   local_task = g_task_new (self, cancellable, put_file_async_cb, self);
   g_task_set_task_data (local_task, task, g_object_unref);
@@ -678,16 +678,26 @@ cm_olm_decrypt (CmOlm      *self,
                 size_t      type,
                 const char *message)
 {
+  gint64 begin_time, mark_time;
+  char *plaintext = NULL;
+
   g_assert (CM_IS_OLM (self));
   g_return_val_if_fail (message, NULL);
 
+  begin_time = g_get_monotonic_time ();
+  mark_time = CM_MARK_NOW ();
+
   if (self->olm_session)
-    return session_decrypt (self, type, message);
+    plaintext = session_decrypt (self, type, message);
+  else if (self->in_gp_session)
+    plaintext = group_session_decrypt (self, message);
+  else
+    return NULL;
 
-  if (self->in_gp_session)
-    return group_session_decrypt (self, message);
+  cm_utils_record_stat (CM_STAT_DECRYPT, begin_time);
+  CM_MARK (mark_time, "decrypt", "session %s", cm_olm_get_session_id (self));
 
-  return NULL;
+  return plaintext;
 }
 
 size_t
@@ -916,6 +916,9 @@ cm_room_get_unread_notification_counts (CmRoom *self)
   return self->unread_count;
 }
 
+static void room_download_avatar (CmRoom *self,
+                                  GTask  *task);
+
 static void
 room_avatar_file_read_cb (GObject      *object,
                           GAsyncResult *result,
@@ -935,6 +938,17 @@ room_avatar_file_read_cb (GObject      *object,
   g_object_set_data_full (G_OBJECT (self->avatar_file), "stream",
                           istream, g_object_unref);
 
+  /* The file may have been moved or removed by the application */
+  if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND) &&
+      !self->avatar_loading)
+    {
+      g_clear_error (&error);
+      g_clear_object (&self->avatar_file);
+      self->avatar_loaded = FALSE;
+      room_download_avatar (self, g_steal_pointer (&task));
+      return;
+    }
+
   if (error)
     g_task_return_error (task, error);
   else
@@ -974,16 +988,93 @@ room_get_avatar_cb (GObject      *object,
     g_task_return_pointer (task, NULL, NULL);
 }
 
+/* @task is owned by the callee */
+static void
+room_download_avatar (CmRoom *self,
+                      GTask  *task)
+{
+  const char *avatar_url;
+
+  avatar_url = cm_room_get_avatar_url (self);
+  g_set_object (&self->avatar_task, task);
+
+  if (avatar_url)
+    {
+      g_autofree char *file_name = NULL;
+      const char *path;
+      char *file_path;
+
+      path = cm_matrix_get_data_dir ();
+      file_name = g_path_get_basename (avatar_url);
+      file_path = cm_utils_get_path_for_m_type (path, CM_M_ROOM_AVATAR, FALSE, file_name);
+
+      self->avatar_loading = TRUE;
+      cm_utils_save_url_to_path_async (self->client, avatar_url,
+                                       file_path, g_task_get_cancellable (task),
+                                       NULL, NULL,
+                                       room_get_avatar_cb,
+                                       task);
+    }
+  else
+    {
+      g_task_return_pointer (task, NULL, NULL);
+      g_object_unref (task);
+    }
+}
+
+/**
+ * cm_room_get_avatar_url:
+ * @self: The room
+ *
+ * Get the mxc url of the avatar of @self.
+ *
+ * Returns: (nullable): The avatar url
+ */
+const char *
+cm_room_get_avatar_url (CmRoom *self)
+{
+  g_autoptr(JsonObject) json = NULL;
+  JsonObject *child;
+  CmEvent *event;
+
+  g_return_val_if_fail (CM_IS_ROOM (self), NULL);
+
+  event = cm_room_event_list_get_event (self->room_event, CM_M_ROOM_AVATAR);
+
+  if (!event)
+    return NULL;
+
+  /* The json is owned by the event, so is the url */
+  json = cm_event_get_json (event);
+  child = cm_utils_json_object_get_object (json, "content");
+
+  return cm_utils_json_object_get_string (child, "url");
+}
+
+/**
+ * cm_room_get_avatar_file:
+ * @self: The room
+ *
+ * Get the local file the avatar of @self was
+ * last downloaded to, if any.
+ *
+ * Returns: (transfer none) (nullable): The avatar file
+ */
+GFile *
+cm_room_get_avatar_file (CmRoom *self)
+{
+  g_return_val_if_fail (CM_IS_ROOM (self), NULL);
+
+  return self->avatar_file;
+}
+
 void
 cm_room_get_avatar_async (CmRoom              *self,
                           GCancellable        *cancellable,
                           GAsyncReadyCallback  callback,
                           gpointer             user_data)
 {
-  g_autoptr(JsonObject) json = NULL;
   g_autoptr(GTask) task = NULL;
-  const char *avatar_url = NULL;
-  JsonObject *child;
   CmEvent *event;
 
   task = g_task_new (self, cancellable, callback, user_data);
@@ -1031,30 +1122,7 @@ cm_room_get_avatar_async (CmRoom              *self,
       return;
     }
 
-  json = cm_event_get_json (event);
-  child = cm_utils_json_object_get_object (json, "content");
-  avatar_url = cm_utils_json_object_get_string (child, "url");
-  g_set_object (&self->avatar_task, task);
-
-  if (avatar_url)
-    {
-      g_autofree char *file_name = NULL;
-      const char *path;
-      char *file_path;
-
-      path = cm_matrix_get_data_dir ();
-      file_name = g_path_get_basename (avatar_url);
-      file_path = cm_utils_get_path_for_m_type (path, CM_M_ROOM_AVATAR, FALSE, file_name);
-
-      self->avatar_loading = TRUE;
-      cm_utils_save_url_to_path_async (self->client, avatar_url,
-                                       file_path, cancellable,
-                                       NULL, NULL,
-                                       room_get_avatar_cb,
-                                       g_steal_pointer (&task));
-    }
-  else
-    g_task_return_pointer (task, NULL, NULL);
+  room_download_avatar (self, g_steal_pointer (&task));
 }
 
 /**
@@ -1489,7 +1557,7 @@ room_send_file_cb (GObject      *object,
 
   uri = cm_event_get_api_url (CM_EVENT (message), self);
 
-  cm_net_send_json_async (cm_client_get_net (self->client), 0,
+  cm_net_send_json_async (cm_client_get_net (self->client), 2,
                           cm_event_generate_json (CM_EVENT (message), self),
                           uri, SOUP_METHOD_PUT, NULL, g_task_get_cancellable (message_task),
                           send_cb, message_task);
@@ -1553,7 +1621,7 @@ room_send_message_from_queue (CmRoom *self)
   g_debug ("(%p) Send message, txn-id: '%s'",
            self, cm_event_get_txn_id (CM_EVENT (message)));
   cm_event_set_state (CM_EVENT (message), CM_EVENT_STATE_SENDING);
-  cm_net_send_json_async (cm_client_get_net (self->client), 0,
+  cm_net_send_json_async (cm_client_get_net (self->client), 2,
                           cm_event_generate_json (CM_EVENT (message), self),
                           uri, SOUP_METHOD_PUT, NULL, g_task_get_cancellable (message_task),
                           send_cb, message_task);
@@ -1972,7 +2040,7 @@ cm_room_set_typing_notice_async (CmRoom              *self,
   uri = g_strconcat ("/_matrix/client/r0/rooms/", self->room_id,
                      "/typing/", cm_client_get_user_id (self->client), NULL);
 
-  cm_net_send_json_async (cm_client_get_net (self->client), 0, object,
+  cm_net_send_json_async (cm_client_get_net (self->client), 1, object,
                           uri, SOUP_METHOD_PUT,
                           NULL, cancellable, send_typing_cb, task);
 }
@@ -39,6 +39,8 @@ void          cm_room_get_avatar_async                (CmRoom                *se
 GInputStream *cm_room_get_avatar_finish               (CmRoom                *self,
                                                        GAsyncResult          *result,
                                                        GError               **error);
+const char   *cm_room_get_avatar_url                  (CmRoom                *self);
+GFile        *cm_room_get_avatar_file                 (CmRoom                *self);
 void          cm_room_accept_invite_async         (CmRoom                *self,
                                                    GCancellable          *cancellable,
                                                    GAsyncReadyCallback    callback,
@@ -9,6 +9,9 @@
 #include <glib-object.h>
 #include <json-glib/json-glib.h>
 #include <libsoup/soup.h>
+#ifdef HAVE_SYSPROF
+# include <sysprof-capture.h>
+#endif
 
 #include "cm-enums.h"
 #include "cm-types.h"
@@ -26,9 +29,27 @@ static inline void check_format (const char *fmt, ...) {}
                     "CODE_FUNC", G_STRFUNC,                             \
                     "MESSAGE", fmt, ##__VA_ARGS__);                     \
 } while (0)
+
+/* Capture marks, tied together by the pointer of the task
+ * or object they belong to.  Arguments after @name are not
+ * evaluated unless built with sysprof support.
+ */
+#ifdef HAVE_SYSPROF
+# define CM_MARK_NOW() SYSPROF_CAPTURE_CURRENT_TIME
+# define CM_MARK(_begin, name, ...)                                     \
+  sysprof_collector_mark_printf (_begin, SYSPROF_CAPTURE_CURRENT_TIME - (_begin), \
+                                 "libcmatrix", name, __VA_ARGS__)
+#else
+# define CM_MARK_NOW() G_GINT64_CONSTANT (0)
+# define CM_MARK(_begin, name, ...) G_STMT_START { (void)(_begin); } G_STMT_END
+#endif
+#define CM_MARK_INSTANT(name, ...) CM_MARK (CM_MARK_NOW (), name, __VA_ARGS__)
+
 #define CM_LOG_SUCCESS(_value) cm_utils_log_bool_str (_value, TRUE)
 #define CM_LOG_BOOL(_value) cm_utils_log_bool_str (_value, FALSE)
 
+void          cm_utils_record_stat              (CmStat               stat,
+                                                 gint64               begin_time);
 const char   *cm_utils_log_bool_str             (gboolean             value,
                                                  gboolean             use_success);
 const char   *cm_utils_anonymize                (GString             *str,
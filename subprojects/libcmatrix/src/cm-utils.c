@@ -19,6 +19,7 @@
 #include "cm-common.h"
 #include "cm-enc-private.h"
 #include "cm-enums.h"
+#include "cm-input-stream-private.h"
 #include "cm-utils-private.h"
 #include "cm-utils.h"
 
@@ -63,6 +64,36 @@ typedef struct {
   GAsyncResult *res;
 } CmUtilsSyncData;
 
+static CmStatsFunc stats_func;
+static gpointer stats_data;
+
+/**
+ * cm_utils_set_stats_func:
+ * @func: (nullable): A #CmStatsFunc
+ * @user_data: The user data for @func
+ *
+ * Set the function to call with the time taken by
+ * the operations listed in #CmStat.  The function
+ * may be called from any thread, so this should be
+ * called once after cm_init() and before any
+ * #CmMatrix is created.
+ */
+void
+cm_utils_set_stats_func (CmStatsFunc func,
+                         gpointer    user_data)
+{
+  stats_func = func;
+  stats_data = user_data;
+}
+
+void
+cm_utils_record_stat (CmStat stat,
+                      gint64 begin_time)
+{
+  if (stats_func)
+    stats_func (stat, g_get_monotonic_time () - begin_time, stats_data);
+}
+
 const char *
 cm_utils_log_bool_str (gboolean value,
                        gboolean use_success)
@@ -1346,28 +1377,161 @@ cm_utils_verify_homeserver_finish (GAsyncResult  *result,
   return g_task_propagate_pointer (G_TASK (result), error);
 }
 
+/* Download files in chunks so that memory use doesn't grow with the file size */
+#define FILE_CHUNK_SIZE (64 * 1024)
+
+typedef struct
+{
+  GInputStream          *in_stream;
+  GOutputStream         *out_stream;
+  GFile                 *out_file;
+  /* The file being written to, moved to @out_file when complete */
+  GFile                 *part_file;
+  guchar                *buffer;
+  goffset                written;
+  GFileProgressCallback  progress_cb;
+  gpointer               progress_user_data;
+} FileCopyData;
+
+static void
+file_copy_data_free (gpointer user_data)
+{
+  FileCopyData *data = user_data;
+
+  g_clear_object (&data->in_stream);
+  g_clear_object (&data->out_stream);
+  g_clear_object (&data->out_file);
+  g_clear_object (&data->part_file);
+  g_free (data->buffer);
+  g_free (data);
+}
+
 static void
-utils_file_stream_cb (GObject      *obj,
-                      GAsyncResult *result,
-                      gpointer      user_data)
+utils_file_copy_failed (GTask  *task,
+                        GError *error)
+{
+  FileCopyData *data;
+
+  g_assert (G_IS_TASK (task));
+  g_assert (error);
+
+  data = g_task_get_task_data (task);
+
+  g_input_stream_close (data->in_stream, NULL, NULL);
+  g_output_stream_close (data->out_stream, NULL, NULL);
+  g_file_delete (data->part_file, NULL, NULL);
+
+  g_task_return_error (task, error);
+}
+
+static void utils_file_read_cb (GObject      *obj,
+                                GAsyncResult *result,
+                                gpointer      user_data);
+
+static void
+utils_file_close_cb (GObject      *obj,
+                     GAsyncResult *result,
+                     gpointer      user_data)
 {
   g_autoptr(GTask) task = user_data;
+  FileCopyData *data;
   GError *error = NULL;
 
   g_assert (G_IS_TASK (task));
 
-  g_output_stream_splice_finish (G_OUTPUT_STREAM (obj), result, &error);
+  data = g_task_get_task_data (task);
+  g_output_stream_close_finish (G_OUTPUT_STREAM (obj), result, &error);
 
-  if (error) {
-    g_task_return_error (task, error);
-  } else {
-    GFile *out_file;
+  if (!error && CM_IS_INPUT_STREAM (data->in_stream) &&
+      !cm_input_stream_verify_sha256 (CM_INPUT_STREAM (data->in_stream)))
+    error = g_error_new (G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                         "File checksum mismatch");
 
-    out_file = g_object_get_data (user_data, "file");
-    if (out_file)
-      g_object_ref (out_file);
-    g_task_return_pointer (task, out_file, g_object_unref);
-  }
+  /* Same directory, so this is a simple rename */
+  if (!error)
+    g_file_move (data->part_file, data->out_file, G_FILE_COPY_OVERWRITE,
+                 NULL, NULL, NULL, &error);
+
+  if (error)
+    {
+      utils_file_copy_failed (task, error);
+      return;
+    }
+
+  g_input_stream_close (data->in_stream, NULL, NULL);
+  g_task_return_pointer (task, g_object_ref (data->out_file), g_object_unref);
+}
+
+static void
+utils_file_write_cb (GObject      *obj,
+                     GAsyncResult *result,
+                     gpointer      user_data)
+{
+  g_autoptr(GTask) task = user_data;
+  FileCopyData *data;
+  GError *error = NULL;
+  gsize n_written = 0;
+
+  g_assert (G_IS_TASK (task));
+
+  data = g_task_get_task_data (task);
+  g_output_stream_write_all_finish (G_OUTPUT_STREAM (obj), result, &n_written, &error);
+
+  if (error)
+    {
+      utils_file_copy_failed (task, error);
+      return;
+    }
+
+  data->written += n_written;
+
+  if (data->progress_cb)
+    {
+      goffset total = 0;
+
+      if (CM_IS_INPUT_STREAM (data->in_stream))
+        total = cm_input_stream_get_size (CM_INPUT_STREAM (data->in_stream));
+
+      data->progress_cb (data->written, total, data->progress_user_data);
+    }
+
+  g_input_stream_read_async (data->in_stream, data->buffer, FILE_CHUNK_SIZE,
+                             G_PRIORITY_DEFAULT,
+                             g_task_get_cancellable (task),
+                             utils_file_read_cb,
+                             g_steal_pointer (&task));
+}
+
+static void
+utils_file_read_cb (GObject      *obj,
+                    GAsyncResult *result,
+                    gpointer      user_data)
+{
+  g_autoptr(GTask) task = user_data;
+  FileCopyData *data;
+  GError *error = NULL;
+  gssize n_read;
+
+  g_assert (G_IS_TASK (task));
+
+  data = g_task_get_task_data (task);
+  /* Decryption and checksumming of encrypted files are done in the
+   * read, which runs in a worker thread as CmInputStream isn't pollable */
+  n_read = g_input_stream_read_finish (G_INPUT_STREAM (obj), result, &error);
+
+  if (n_read < 0)
+    utils_file_copy_failed (task, error);
+  else if (n_read == 0)
+    g_output_stream_close_async (data->out_stream, G_PRIORITY_DEFAULT,
+                                 g_task_get_cancellable (task),
+                                 utils_file_close_cb,
+                                 g_steal_pointer (&task));
+  else
+    g_output_stream_write_all_async (data->out_stream, data->buffer, n_read,
+                                     G_PRIORITY_DEFAULT,
+                                     g_task_get_cancellable (task),
+                                     utils_file_write_cb,
+                                     g_steal_pointer (&task));
 }
 
 static void
@@ -1377,7 +1541,11 @@ get_file_cb (GObject      *object,
 {
   CmClient *client;
   g_autoptr(GTask) task = user_data;
+  g_autofree char *part_path = NULL;
   GInputStream *istream = NULL;
+  GOutputStream *out_stream;
+  FileCopyData *data;
+  const char *file_path;
   GError *error = NULL;
 
   g_assert (G_IS_TASK (task));
@@ -1388,48 +1556,41 @@ get_file_cb (GObject      *object,
   istream = cm_net_get_file_finish (CM_NET (object), result, &error);
 
   if (error)
-    g_task_return_error (task, error);
-  else
     {
-      GOutputStream *out_stream = NULL;
-      GFile *out_file = NULL;
-      const char *file_path;
+      g_task_return_error (task, error);
+      return;
+    }
 
-      file_path = g_object_get_data (user_data, "path");
-      out_file = g_file_new_for_path (file_path);
-      out_stream = (GOutputStream *)g_file_create (out_file, G_FILE_CREATE_NONE, NULL, &error);
+  file_path = g_object_get_data (user_data, "path");
+  part_path = g_strconcat (file_path, ".part", NULL);
 
-      if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_EXISTS))
-        {
-          GFileIOStream *io_stream;
-
-          g_clear_error (&error);
-          io_stream = g_file_open_readwrite (out_file, NULL, &error);
-          if (io_stream)
-            {
-              g_object_set_data_full (G_OBJECT (task), "io-stream", io_stream, g_object_unref);
-              out_stream = g_io_stream_get_output_stream (G_IO_STREAM (io_stream));
-            }
-        }
+  data = g_new0 (FileCopyData, 1);
+  data->in_stream = istream;
+  data->out_file = g_file_new_for_path (file_path);
+  data->part_file = g_file_new_for_path (part_path);
+  data->progress_cb = g_object_get_data (user_data, "progress-cb");
+  data->progress_user_data = g_object_get_data (user_data, "progress-cb-data");
+  g_task_set_task_data (task, data, file_copy_data_free);
 
-      if (out_stream)
-        {
-          g_object_set_data_full (G_OBJECT (task), "file", out_file, g_object_unref);
-          g_output_stream_splice_async (G_OUTPUT_STREAM (out_stream), istream,
-                                        G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE |
-                                        G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
-                                        0, NULL,
-                                        utils_file_stream_cb,
-                                        g_steal_pointer (&task));
-        }
-      else
-        {
-          if (error)
-            g_task_return_error (task, error);
-          else
-            g_task_return_boolean (task, FALSE);
-        }
+  out_stream = (GOutputStream *)g_file_replace (data->part_file, NULL, FALSE,
+                                                G_FILE_CREATE_REPLACE_DESTINATION,
+                                                NULL, &error);
+
+  if (!out_stream)
+    {
+      g_input_stream_close (istream, NULL, NULL);
+      g_task_return_error (task, error);
+      return;
     }
+
+  data->out_stream = out_stream;
+  data->buffer = g_malloc (FILE_CHUNK_SIZE);
+
+  g_input_stream_read_async (istream, data->buffer, FILE_CHUNK_SIZE,
+                             G_PRIORITY_DEFAULT,
+                             g_task_get_cancellable (task),
+                             utils_file_read_cb,
+                             g_steal_pointer (&task));
 }
 
 static void
@@ -8,8 +8,25 @@
 
 #include <gio/gio.h>
 
+#include "cm-enums.h"
+
 G_BEGIN_DECLS
 
+/**
+ * CmStatsFunc:
+ * @stat: The #CmStat measured
+ * @usec: The time taken in microseconds
+ * @user_data: The user data passed to cm_utils_set_stats_func()
+ *
+ * May be called from any thread.
+ */
+typedef void (*CmStatsFunc) (CmStat    stat,
+                             gint64    usec,
+                             gpointer  user_data);
+
+void          cm_utils_set_stats_func           (CmStatsFunc          func,
+                                                 gpointer             user_data);
+
 void          cm_utils_get_homeserver_async     (const char          *username,
                                                  uint                 timeout,
                                                  GCancellable        *cancellable,
@@ -31,7 +31,8 @@ struct _CmRoomMessageEvent
   char           *body;
   char           *file_path;    /* Local path to which file is saved */
   GFile          *file;
-  GInputStream   *file_istream;
+  /* The downloaded file, a new stream is opened for each request */
+  GFile          *downloaded_file;
   char           *mxc_uri;
 
   gboolean       downloading_file;
@@ -158,6 +159,8 @@ cm_room_message_event_finalize (GObject *object)
   g_free (self->body);
   g_free (self->mxc_uri);
   g_free (self->file_path);
+  g_clear_object (&self->file);
+  g_clear_object (&self->downloaded_file);
 
   G_OBJECT_CLASS (cm_room_message_event_parent_class)->finalize (object);
 }
@@ -285,6 +288,22 @@ cm_room_message_event_get_file_path (CmRoomMessageEvent *self)
   return self->file_path;
 }
 
+/**
+ * cm_room_message_event_get_file_url:
+ * @self: The room message event
+ *
+ * Get the mxc url the file of @self is downloaded from.
+ *
+ * Returns: (nullable): The file url
+ */
+const char *
+cm_room_message_event_get_file_url (CmRoomMessageEvent *self)
+{
+  g_return_val_if_fail (CM_IS_ROOM_MESSAGE_EVENT (self), NULL);
+
+  return self->mxc_uri;
+}
+
 void
 cm_room_message_event_set_file (CmRoomMessageEvent *self,
                                 const char         *body,
@@ -311,6 +330,40 @@ cm_room_message_event_get_file (CmRoomMessageEvent *self)
   return self->file;
 }
 
+static void message_download_file (CmRoomMessageEvent *self,
+                                   GTask              *task);
+
+static void
+message_file_read_cb (GObject      *obj,
+                      GAsyncResult *result,
+                      gpointer      user_data)
+{
+  CmRoomMessageEvent *self;
+  g_autoptr(GTask) task = user_data;
+  GFileInputStream *stream;
+  GError *error = NULL;
+
+  g_assert (G_IS_TASK (task));
+
+  self = g_task_get_source_object (task);
+  stream = g_file_read_finish (G_FILE (obj), result, &error);
+
+  /* The downloaded file may have been moved or removed by the application */
+  if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND) &&
+      self->downloaded_file && G_FILE (obj) == self->downloaded_file)
+    {
+      g_clear_error (&error);
+      g_clear_object (&self->downloaded_file);
+      message_download_file (self, g_steal_pointer (&task));
+      return;
+    }
+
+  if (error)
+    g_task_return_error (task, error);
+  else
+    g_task_return_pointer (task, stream, g_object_unref);
+}
+
 static void
 message_file_stream_cb (GObject      *obj,
                         GAsyncResult *result,
@@ -330,18 +383,50 @@ message_file_stream_cb (GObject      *obj,
   self->downloading_file = FALSE;
 
   if (error)
-    g_task_return_error (task, error);
+    {
+      g_task_return_error (task, error);
+    }
   else if (!out_file)
-    g_task_return_pointer (task, NULL, NULL);
+    {
+      g_task_return_pointer (task, NULL, NULL);
+    }
   else
     {
-      self->file_istream = (GInputStream *)g_file_read (out_file, NULL, NULL);
-      g_object_set_data_full (G_OBJECT (self->file_istream), "out-file",
-                              out_file, g_object_unref);
-      g_task_return_pointer (task, g_object_ref (self->file_istream), g_object_unref);
+      g_set_object (&self->downloaded_file, out_file);
+      g_file_read_async (out_file, G_PRIORITY_DEFAULT,
+                         g_task_get_cancellable (task),
+                         message_file_read_cb,
+                         g_steal_pointer (&task));
+      g_object_unref (out_file);
     }
 }
 
+/* @task is owned by the callee */
+static void
+message_download_file (CmRoomMessageEvent *self,
+                       GTask              *task)
+{
+  g_autofree char *file_name = NULL;
+  const char *path;
+  CmRoom *room;
+
+  self->downloading_file = TRUE;
+  room = cm_room_event_get_room (CM_ROOM_EVENT (self));
+
+  path = cm_matrix_get_data_dir ();
+  file_name = g_path_get_basename (self->mxc_uri);
+  g_free (self->file_path);
+  self->file_path = cm_utils_get_path_for_m_type (path, CM_M_ROOM_MESSAGE, FALSE, file_name);
+  cm_utils_save_url_to_path_async (cm_room_get_client (room),
+                                   self->mxc_uri,
+                                   g_strdup (self->file_path),
+                                   g_task_get_cancellable (task),
+                                   g_object_get_data (G_OBJECT (task), "progress-cb"),
+                                   g_object_get_data (G_OBJECT (task), "progress-cb-data"),
+                                   message_file_stream_cb,
+                                   task);
+}
+
 /**
  * cm_room_message_event_get_file_async:
  * @self: The room message event
@@ -351,7 +436,10 @@ message_file_stream_cb (GObject      *obj,
  * @callback: A #GAsyncReadyCallback
  * @user_data: The user data for @callback.
  *
- * Download a file asynchronously.
+ * Download a file asynchronously.  If the file is already
+ * downloaded, a new stream to the local file is opened.
+ * The stream isn't kept open by @self, so that the caller
+ * decides how long the file descriptor lives.
  *
  * Run [method@Client.get_homeserver_finish] to get an input stream.
  */
@@ -363,9 +451,6 @@ cm_room_message_event_get_file_async (CmRoomMessageEvent    *self,
                                       GAsyncReadyCallback    callback,
                                       gpointer               user_data)
 {
-  g_autofree char *file_name = NULL;
-  const char *path;
-  CmRoom *room;
   GTask *task;
 
   g_return_if_fail (CM_IS_ROOM_MESSAGE_EVENT (self));
@@ -385,30 +470,23 @@ cm_room_message_event_get_file_async (CmRoomMessageEvent    *self,
       return;
     }
 
-  if (self->file && !self->mxc_uri && !self->file_istream)
-    self->file_istream = (gpointer)g_file_read (self->file, NULL, NULL);
+  if (self->file && !self->mxc_uri)
+    {
+      g_file_read_async (self->file, G_PRIORITY_DEFAULT, cancellable,
+                         message_file_read_cb, task);
+      return;
+    }
 
-  if (self->file_istream)
+  if (self->downloaded_file)
     {
-      g_task_return_pointer (task, g_object_ref (self->file_istream), g_object_unref);
+      g_file_read_async (self->downloaded_file, G_PRIORITY_DEFAULT, cancellable,
+                         message_file_read_cb, task);
       return;
     }
 
   g_return_if_fail (self->mxc_uri);
 
-  self->downloading_file = TRUE;
-  room = cm_room_event_get_room (CM_ROOM_EVENT (self));
-
-  path = cm_matrix_get_data_dir ();
-  file_name = g_path_get_basename (self->mxc_uri);
-  self->file_path = cm_utils_get_path_for_m_type (path, CM_M_ROOM_MESSAGE, FALSE, file_name);
-  cm_utils_save_url_to_path_async (cm_room_get_client (room),
-                                   self->mxc_uri,
-                                   g_strdup (self->file_path),
-                                   cancellable,
-                                   NULL, NULL,
-                                   message_file_stream_cb,
-                                   g_steal_pointer (&task));
+  message_download_file (self, task);
 }
 
 /**
@@ -279,7 +279,9 @@ request_device_keys_from_queue (CmUserList *self)
                                   json_array_new ());
 
   g_debug ("(%p) Load user devices, users count: %u", users, users->len);
-  cm_net_send_json_async (cm_client_get_net (self->client), 0, object,
+  /* Encrypted messages can't be sent before the devices are known,
+   * so don't queue this behind background requests */
+  cm_net_send_json_async (cm_client_get_net (self->client), 2, object,
                           "/_matrix/client/r0/keys/query", SOUP_METHOD_POST,
                           NULL, cancellable, device_keys_query_cb, task);
 }
@@ -702,7 +704,7 @@ cm_user_list_claim_keys_async (CmUserList          *self,
 
   json_object_set_object_member (root, "one_time_keys", child);
 
-  cm_net_send_json_async (cm_client_get_net (self->client), 0, root,
+  cm_net_send_json_async (cm_client_get_net (self->client), 2, root,
                           "/_matrix/client/r0/keys/claim", SOUP_METHOD_POST,
                           NULL, NULL, claim_keys_cb,
                           g_steal_pointer (&task));
@@ -811,7 +813,7 @@ cm_user_list_upload_keys_async (CmUserList          *self,
   uri = g_strdup_printf ("/_matrix/client/r0/sendToDevice/m.room.encrypted/%s",
                          cm_event_get_txn_id (event));
   cm_net_send_json_async (cm_client_get_net (self->client),
-                          0, root, uri, SOUP_METHOD_PUT,
+                          2, root, uri, SOUP_METHOD_PUT,
                           NULL, NULL,
                           upload_group_keys_cb,
                           g_steal_pointer (&task));
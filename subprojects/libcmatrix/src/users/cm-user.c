@@ -402,10 +402,19 @@ cm_user_get_avatar_async (CmUser              *self,
         g_object_set_data_full (G_OBJECT (priv->avatar_file), "stream",
                                 istream, g_object_unref);
         g_task_return_pointer (task, g_object_ref (istream), g_object_unref);
-      } else
-        g_task_return_error (task, error);
+        return;
+      }
 
-      return;
+      /* The file may have been moved or removed by the application */
+      if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+        {
+          g_task_return_error (task, error);
+          return;
+        }
+
+      g_clear_error (&error);
+      g_clear_object (&priv->avatar_file);
+      priv->avatar_loaded = FALSE;
     }
 
   if (priv->avatar_loaded)
@@ -447,6 +456,25 @@ cm_user_get_avatar_async (CmUser              *self,
     g_task_return_pointer (task, NULL, NULL);
 }
 
+/**
+ * cm_user_get_avatar_file:
+ * @self: The user
+ *
+ * Get the local file the avatar of @self was
+ * last downloaded to, if any.
+ *
+ * Returns: (transfer none) (nullable): The avatar file
+ */
+GFile *
+cm_user_get_avatar_file (CmUser *self)
+{
+  CmUserPrivate *priv = cm_user_get_instance_private (self);
+
+  g_return_val_if_fail (CM_IS_USER (self), NULL);
+
+  return priv->avatar_file;
+}
+
 /**
  * cm_user_get_avatar_finish:
  * @self: The user
@@ -41,6 +41,7 @@ void          cm_user_get_avatar_async        (CmUser              *self,
 GInputStream *cm_user_get_avatar_finish       (CmUser              *self,
                                                GAsyncResult        *result,
                                                GError             **error);
+GFile        *cm_user_get_avatar_file         (CmUser              *self);
 void          cm_user_load_info_async         (CmUser              *self,
                                                GCancellable        *cancellable,
                                                GAsyncReadyCallback  callback,
@@ -0,0 +1,270 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* net.c
+ *
+ * Copyright 2024 Purism SPC
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#undef NDEBUG
+#undef G_DISABLE_ASSERT
+#undef G_DISABLE_CHECKS
+#undef G_DISABLE_CAST_CHECKS
+#undef G_LOG_DOMAIN
+
+#include "cm-net.c"
+
+#define N_BACKGROUND_REQUESTS 6
+
+/* A minimal mock homeserver */
+typedef struct {
+  SoupServer *server;
+  char       *homeserver;
+  /* Background requests held by the server */
+  GPtrArray  *held;
+  guint       running;
+  guint       max_running;
+  guint       n_background_done;
+  guint       n_cancelled;
+  gboolean    send_done;
+  gboolean    send_done_before_background;
+} MockServer;
+
+static void
+mock_server_respond (SoupServerMessage *msg)
+{
+  soup_server_message_set_status (msg, SOUP_STATUS_OK, NULL);
+  soup_server_message_set_response (msg, "application/json",
+                                    SOUP_MEMORY_STATIC, "{}", 2);
+}
+
+static void
+mock_server_background_cb (SoupServer        *server,
+                           SoupServerMessage *msg,
+                           const char        *path,
+                           GHashTable        *query,
+                           gpointer           user_data)
+{
+  MockServer *mock = user_data;
+
+  mock->running++;
+  mock->max_running = MAX (mock->max_running, mock->running);
+
+  /* Hold the request until the test releases it */
+  soup_server_message_pause (msg);
+  g_ptr_array_add (mock->held, msg);
+}
+
+static void
+mock_server_send_cb (SoupServer        *server,
+                     SoupServerMessage *msg,
+                     const char        *path,
+                     GHashTable        *query,
+                     gpointer           user_data)
+{
+  mock_server_respond (msg);
+}
+
+static void
+mock_server_release_held (MockServer *mock)
+{
+  for (guint i = 0; i < mock->held->len; i++)
+    {
+      SoupServerMessage *msg = mock->held->pdata[i];
+
+      g_assert (mock->running > 0);
+      mock->running--;
+      mock_server_respond (msg);
+      soup_server_message_unpause (msg);
+    }
+
+  g_ptr_array_set_size (mock->held, 0);
+}
+
+static void
+mock_server_init (MockServer *mock)
+{
+  GError *error = NULL;
+  GSList *uris;
+
+  mock->held = g_ptr_array_new ();
+  mock->server = soup_server_new (NULL, NULL);
+  soup_server_add_handler (mock->server, "/_matrix/client/r0/background",
+                           mock_server_background_cb, mock, NULL);
+  soup_server_add_handler (mock->server, "/_matrix/client/r0/send",
+                           mock_server_send_cb, mock, NULL);
+  soup_server_listen_local (mock->server, 0, SOUP_SERVER_LISTEN_IPV4_ONLY, &error);
+  g_assert_no_error (error);
+
+  uris = soup_server_get_uris (mock->server);
+  g_assert_nonnull (uris);
+  mock->homeserver = g_uri_to_string (uris->data);
+  g_slist_free_full (uris, (GDestroyNotify)g_uri_unref);
+}
+
+static void
+mock_server_clear (MockServer *mock)
+{
+  soup_server_disconnect (mock->server);
+  g_clear_object (&mock->server);
+  g_clear_pointer (&mock->held, g_ptr_array_unref);
+  g_clear_pointer (&mock->homeserver, g_free);
+}
+
+static void
+background_request_cb (GObject      *object,
+                       GAsyncResult *result,
+                       gpointer      user_data)
+{
+  g_autoptr(JsonObject) root = NULL;
+  MockServer *mock = user_data;
+  GError *error = NULL;
+
+  root = g_task_propagate_pointer (G_TASK (result), &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (root);
+
+  mock->n_background_done++;
+}
+
+static void
+cancelled_request_cb (GObject      *object,
+                      GAsyncResult *result,
+                      gpointer      user_data)
+{
+  g_autoptr(JsonObject) root = NULL;
+  MockServer *mock = user_data;
+  GError *error = NULL;
+
+  root = g_task_propagate_pointer (G_TASK (result), &error);
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+  g_assert_null (root);
+  g_clear_error (&error);
+
+  mock->n_cancelled++;
+}
+
+static void
+send_request_cb (GObject      *object,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+  g_autoptr(JsonObject) root = NULL;
+  MockServer *mock = user_data;
+  GError *error = NULL;
+
+  root = g_task_propagate_pointer (G_TASK (result), &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (root);
+
+  mock->send_done = TRUE;
+  mock->send_done_before_background = mock->n_background_done == 0;
+}
+
+static void
+test_net_priority_lanes (void)
+{
+  MockServer mock = { 0 };
+  CmNet *net;
+
+  mock_server_init (&mock);
+
+  net = cm_net_new ();
+  cm_net_set_homeserver (net, mock.homeserver);
+
+  for (guint i = 0; i < N_BACKGROUND_REQUESTS; i++)
+    cm_net_send_json_async (net, i % 2 ? 0 : -1, NULL,
+                            "/_matrix/client/r0/background", SOUP_METHOD_GET,
+                            NULL, NULL, background_request_cb, &mock);
+
+  /* Background requests beyond the limit shall be queued */
+  g_assert_cmpint (g_queue_get_length (net->background_queue), ==,
+                   N_BACKGROUND_REQUESTS - MAX_BACKGROUND_REQUESTS);
+
+  while (mock.held->len < MAX_BACKGROUND_REQUESTS)
+    g_main_context_iteration (NULL, TRUE);
+
+  /* A send shall not wait for the background requests */
+  cm_net_send_json_async (net, 2, json_object_new (),
+                          "/_matrix/client/r0/send", SOUP_METHOD_PUT,
+                          NULL, NULL, send_request_cb, &mock);
+
+  while (!mock.send_done)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_true (mock.send_done_before_background);
+  g_assert_cmpint (mock.held->len, ==, MAX_BACKGROUND_REQUESTS);
+
+  while (mock.n_background_done < N_BACKGROUND_REQUESTS)
+    {
+      mock_server_release_held (&mock);
+      g_main_context_iteration (NULL, TRUE);
+    }
+
+  g_assert_cmpint (mock.max_running, <=, MAX_BACKGROUND_REQUESTS);
+  g_assert_cmpint (net->background_running, ==, 0);
+  g_assert_true (g_queue_is_empty (net->background_queue));
+
+  g_assert_finalize_object (net);
+  mock_server_clear (&mock);
+}
+
+static void
+test_net_cancel_queued (void)
+{
+  g_autoptr(GCancellable) cancellable = NULL;
+  MockServer mock = { 0 };
+  CmNet *net;
+
+  mock_server_init (&mock);
+
+  net = cm_net_new ();
+  cm_net_set_homeserver (net, mock.homeserver);
+  cancellable = g_cancellable_new ();
+
+  for (guint i = 0; i < MAX_BACKGROUND_REQUESTS; i++)
+    cm_net_send_json_async (net, 0, NULL,
+                            "/_matrix/client/r0/background", SOUP_METHOD_GET,
+                            NULL, NULL, background_request_cb, &mock);
+
+  cm_net_send_json_async (net, 0, NULL,
+                          "/_matrix/client/r0/background", SOUP_METHOD_GET,
+                          NULL, cancellable, cancelled_request_cb, &mock);
+  g_assert_cmpint (g_queue_get_length (net->background_queue), ==, 1);
+
+  while (mock.held->len < MAX_BACKGROUND_REQUESTS)
+    g_main_context_iteration (NULL, TRUE);
+
+  /* A cancelled request shall return without waiting for its turn */
+  g_cancellable_cancel (cancellable);
+
+  while (!mock.n_cancelled)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_cmpint (mock.n_background_done, ==, 0);
+  g_assert_true (g_queue_is_empty (net->background_queue));
+
+  while (mock.n_background_done < MAX_BACKGROUND_REQUESTS)
+    {
+      mock_server_release_held (&mock);
+      g_main_context_iteration (NULL, TRUE);
+    }
+
+  g_assert_cmpint (mock.n_cancelled, ==, 1);
+  g_assert_cmpint (net->background_running, ==, 0);
+
+  g_assert_finalize_object (net);
+  mock_server_clear (&mock);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/net/priority-lanes", test_net_priority_lanes);
+  g_test_add_func ("/net/cancel-queued", test_net_cancel_queued);
+
+  return g_test_run ();
+}
@@ -0,0 +1,547 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* sync-replay.c
+ *
+ * Copyright 2024 Purism SPC
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#undef NDEBUG
+#undef G_DISABLE_ASSERT
+#undef G_DISABLE_CHECKS
+#undef G_DISABLE_CAST_CHECKS
+#undef G_LOG_DOMAIN
+
+/*
+ * Replay /sync responses from a local mock homeserver and time
+ * each step of handling them.
+ *
+ * By default the responses are generated, with the number of
+ * rooms, timeline events per room and syncs set by the
+ * CM_REPLAY_ROOMS, CM_REPLAY_EVENTS and CM_REPLAY_SYNCS
+ * environment variables.  Run with -m perf for larger defaults.
+ *
+ * To replay real traffic instead, run a client with
+ * CMATRIX_NET_RECORD_DIR set to record the responses it gets,
+ * and set CM_REPLAY_DIR to that directory.  The recorded /sync
+ * responses are replayed in the order they were received.
+ */
+
+#include <glib/gstdio.h>
+
+#include "cm-client.c"
+#include "cm-matrix.h"
+#include "cm-olm-private.h"
+#include "events/cm-room-event-list-private.h"
+
+#define SYNC_PATH "/_matrix/client/r0/sync"
+
+/* The /sync responses to replay, as GBytes */
+static GPtrArray *responses;
+static guint n_rooms, n_events;
+static gboolean recorded;
+
+typedef struct {
+  SoupServer *server;
+  char       *homeserver;
+  guint       next;
+} MockServer;
+
+static void
+mock_server_sync_cb (SoupServer        *server,
+                     SoupServerMessage *msg,
+                     const char        *path,
+                     GHashTable        *query,
+                     gpointer           user_data)
+{
+  MockServer *mock = user_data;
+  GBytes *bytes;
+
+  g_assert_cmpint (mock->next, <, responses->len);
+  bytes = responses->pdata[mock->next++];
+
+  soup_server_message_set_status (msg, SOUP_STATUS_OK, NULL);
+  soup_server_message_set_response (msg, "application/json", SOUP_MEMORY_COPY,
+                                    g_bytes_get_data (bytes, NULL),
+                                    g_bytes_get_size (bytes));
+}
+
+static void
+mock_server_init (MockServer *mock)
+{
+  GError *error = NULL;
+  GSList *uris;
+
+  mock->server = soup_server_new (NULL, NULL);
+  soup_server_add_handler (mock->server, SYNC_PATH,
+                           mock_server_sync_cb, mock, NULL);
+  soup_server_listen_local (mock->server, 0, SOUP_SERVER_LISTEN_IPV4_ONLY, &error);
+  g_assert_no_error (error);
+
+  uris = soup_server_get_uris (mock->server);
+  g_assert_nonnull (uris);
+  mock->homeserver = g_uri_to_string (uris->data);
+  g_slist_free_full (uris, (GDestroyNotify)g_uri_unref);
+}
+
+static void
+mock_server_clear (MockServer *mock)
+{
+  soup_server_disconnect (mock->server);
+  g_clear_object (&mock->server);
+  g_clear_pointer (&mock->homeserver, g_free);
+}
+
+static guint
+replay_get_count (const char *name,
+                  guint       quick_count,
+                  guint       perf_count)
+{
+  const char *value;
+
+  value = g_getenv (name);
+
+  if (value && *value)
+    return (guint)g_ascii_strtoull (value, NULL, 10);
+
+  return g_test_perf () ? perf_count : quick_count;
+}
+
+static GBytes *
+replay_generate_sync (guint sync)
+{
+  GString *str;
+
+  str = g_string_new (NULL);
+  g_string_append_printf (str, "{\"next_batch\":\"batch-%u\",\"rooms\":{\"join\":{", sync + 1);
+
+  for (guint room = 0; room < n_rooms; room++)
+    {
+      if (room)
+        g_string_append_c (str, ',');
+
+      g_string_append_printf (str, "\"!room%u:example.com\":{\"timeline\":{\"events\":[", room);
+
+      for (guint i = 0; i < n_events; i++)
+        {
+          guint id = (sync * n_rooms + room) * n_events + i;
+
+          if (i)
+            g_string_append_c (str, ',');
+
+          g_string_append_printf (str,
+                                  "{\"type\":\"m.room.message\",\"event_id\":\"$event%u\","
+                                  "\"sender\":\"@user%u:example.com\","
+                                  "\"origin_server_ts\":%" G_GINT64_FORMAT ","
+                                  "\"content\":{\"msgtype\":\"m.text\",\"body\":\"Message %u\"}}",
+                                  id, i % 8, (gint64)1700000000000 + id, id);
+        }
+
+      g_string_append (str, "],\"limited\":false}}");
+    }
+
+  g_string_append (str, "}}}");
+
+  return g_string_free_to_bytes (str);
+}
+
+static int
+compare_names (gconstpointer a,
+               gconstpointer b)
+{
+  return g_strcmp0 (*(const char **)a, *(const char **)b);
+}
+
+static void
+replay_load_recorded (const char *dir_name)
+{
+  g_autoptr(GPtrArray) names = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autoptr(GDir) dir = NULL;
+  const char *name;
+
+  dir = g_dir_open (dir_name, 0, &error);
+  g_assert_no_error (error);
+
+  names = g_ptr_array_new_with_free_func (g_free);
+
+  while ((name = g_dir_read_name (dir)))
+    if (g_str_has_suffix (name, "_sync.json"))
+      g_ptr_array_add (names, g_strdup (name));
+
+  /* The names are prefixed with the order they were received in */
+  g_ptr_array_sort (names, compare_names);
+
+  for (guint i = 0; i < names->len; i++)
+    {
+      g_autofree char *file_name = NULL;
+      char *content;
+      gsize size;
+
+      file_name = g_build_filename (dir_name, names->pdata[i], NULL);
+      g_file_get_contents (file_name, &content, &size, &error);
+      g_assert_no_error (error);
+      g_ptr_array_add (responses, g_bytes_new_take (content, size));
+    }
+
+  g_test_message ("Loaded %u /sync responses from %s", responses->len, dir_name);
+}
+
+static void
+replay_init (void)
+{
+  const char *dir;
+  guint n_syncs;
+
+  responses = g_ptr_array_new_with_free_func ((GDestroyNotify)g_bytes_unref);
+  dir = g_getenv ("CM_REPLAY_DIR");
+
+  if (dir && *dir)
+    {
+      recorded = TRUE;
+      replay_load_recorded (dir);
+      return;
+    }
+
+  n_rooms = replay_get_count ("CM_REPLAY_ROOMS", 4, 50);
+  n_events = replay_get_count ("CM_REPLAY_EVENTS", 10, 100);
+  n_syncs = replay_get_count ("CM_REPLAY_SYNCS", 3, 20);
+
+  for (guint i = 0; i < n_syncs; i++)
+    g_ptr_array_add (responses, replay_generate_sync (i));
+
+  g_test_message ("Generated %u /sync responses of %u rooms with %u events each",
+                  n_syncs, n_rooms, n_events);
+}
+
+static JsonObject *
+replay_parse_response (GBytes *bytes)
+{
+  g_autoptr(JsonParser) parser = NULL;
+  GError *error = NULL;
+  JsonNode *root;
+
+  parser = json_parser_new ();
+  json_parser_load_from_data (parser, g_bytes_get_data (bytes, NULL),
+                              g_bytes_get_size (bytes), &error);
+  g_assert_no_error (error);
+
+  root = json_parser_get_root (parser);
+  g_assert_true (JSON_NODE_HOLDS_OBJECT (root));
+
+  return json_node_dup_object (root);
+}
+
+static void
+finish_bool_cb (GObject      *object,
+                GAsyncResult *result,
+                gpointer      user_data)
+{
+  g_autoptr(GError) error = NULL;
+  GTask *task = user_data;
+  gboolean status;
+
+  g_assert_true (G_IS_TASK (task));
+
+  status = g_task_propagate_boolean (G_TASK (result), &error);
+  g_assert_no_error (error);
+  g_task_return_boolean (task, status);
+}
+
+static void
+sync_cb (GObject      *object,
+         GAsyncResult *result,
+         gpointer      user_data)
+{
+  JsonObject **root = user_data;
+  GError *error = NULL;
+
+  *root = g_task_propagate_pointer (G_TASK (result), &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (*root);
+}
+
+static void
+test_sync_replay_parse (void)
+{
+  MockServer mock = { 0 };
+  gsize n_bytes = 0;
+  CmNet *net;
+  double elapsed;
+
+  mock_server_init (&mock);
+
+  net = cm_net_new ();
+  cm_net_set_homeserver (net, mock.homeserver);
+
+  g_test_timer_start ();
+
+  for (guint i = 0; i < responses->len; i++)
+    {
+      g_autoptr(JsonObject) root = NULL;
+
+      cm_net_send_json_async (net, 2, NULL, SYNC_PATH, SOUP_METHOD_GET,
+                              NULL, NULL, sync_cb, &root);
+
+      while (!root)
+        g_main_context_iteration (NULL, TRUE);
+
+      g_assert_true (json_object_has_member (root, "next_batch"));
+      n_bytes += g_bytes_get_size (responses->pdata[i]);
+    }
+
+  elapsed = g_test_timer_elapsed ();
+  g_assert_cmpint (mock.next, ==, responses->len);
+  g_test_minimized_result (elapsed, "Fetched and parsed %u syncs (%" G_GSIZE_FORMAT " bytes) in %.3f s",
+                           responses->len, n_bytes, elapsed);
+
+  g_assert_finalize_object (net);
+  mock_server_clear (&mock);
+}
+
+static void
+test_sync_replay_event_list (void)
+{
+  g_autoptr(GHashTable) rooms = NULL;
+  g_autoptr(GPtrArray) roots = NULL;
+  g_autoptr(GPtrArray) events = NULL;
+  CmClient *client;
+  GHashTableIter iter;
+  gpointer list;
+  guint n_items = 0;
+  double elapsed = 0;
+
+  client = cm_client_new ();
+  g_object_set_data (G_OBJECT (client), "no-save", GINT_TO_POINTER (TRUE));
+  cm_client_set_user_id (client, "@alice:example.com");
+
+  /* Parse ahead, only the building of the event lists is timed */
+  roots = g_ptr_array_new_with_free_func ((GDestroyNotify)json_object_unref);
+  for (guint i = 0; i < responses->len; i++)
+    g_ptr_array_add (roots, replay_parse_response (responses->pdata[i]));
+
+  rooms = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
+  events = g_ptr_array_new_with_free_func (g_object_unref);
+
+  for (guint i = 0; i < roots->len; i++)
+    {
+      g_autoptr(GList) room_ids = NULL;
+      JsonObject *join;
+
+      join = cm_utils_json_object_get_object (roots->pdata[i], "rooms");
+      join = cm_utils_json_object_get_object (join, "join");
+
+      if (!join)
+        continue;
+
+      room_ids = json_object_get_members (join);
+
+      for (GList *room_id = room_ids; room_id; room_id = room_id->next)
+        {
+          CmRoomEventList *event_list;
+          JsonObject *room_data;
+
+          event_list = g_hash_table_lookup (rooms, room_id->data);
+
+          if (!event_list)
+            {
+              g_autoptr(CmRoom) room = NULL;
+
+              room = cm_room_new (room_id->data);
+              cm_room_set_client (room, client);
+              event_list = cm_room_event_list_new (room);
+              cm_room_event_list_set_client (event_list, client);
+              /* The event list keeps only a weak pointer to the room */
+              g_object_set_data_full (G_OBJECT (event_list), "room",
+                                      g_steal_pointer (&room), g_object_unref);
+              g_hash_table_insert (rooms, g_strdup (room_id->data), event_list);
+            }
+
+          room_data = cm_utils_json_object_get_object (join, room_id->data);
+          g_ptr_array_set_size (events, 0);
+
+          g_test_timer_start ();
+          cm_room_event_list_parse_events (event_list,
+                                           cm_utils_json_object_get_object (room_data, "state"),
+                                           NULL, FALSE);
+          cm_room_event_list_parse_events (event_list,
+                                           cm_utils_json_object_get_object (room_data, "timeline"),
+                                           events, FALSE);
+          elapsed += g_test_timer_elapsed ();
+        }
+    }
+
+  g_hash_table_iter_init (&iter, rooms);
+  while (g_hash_table_iter_next (&iter, NULL, &list))
+    n_items += g_list_model_get_n_items (cm_room_event_list_get_events (list));
+
+  if (!recorded)
+    {
+      g_assert_cmpint (g_hash_table_size (rooms), ==, n_rooms);
+      g_assert_cmpint (n_items, ==, n_rooms * n_events * responses->len);
+    }
+
+  g_test_minimized_result (elapsed, "Built event lists of %u rooms with %u events in %.3f s",
+                           g_hash_table_size (rooms), n_items, elapsed);
+
+  g_clear_pointer (&rooms, g_hash_table_unref);
+  g_object_unref (client);
+}
+
+static void
+test_sync_replay_handle (void)
+{
+  g_autoptr(GPtrArray) roots = NULL;
+  const char *file_name;
+  CmClient *client;
+  GTask *task;
+  CmDb *db;
+  double elapsed = 0, persist_elapsed;
+
+  file_name = g_test_get_filename (G_TEST_BUILT, "sync-replay.db", NULL);
+  g_remove (file_name);
+
+  db = cm_db_new ();
+  task = g_task_new (NULL, NULL, NULL, NULL);
+  cm_db_open_async (db, g_strdup (g_test_get_dir (G_TEST_BUILT)),
+                    "sync-replay.db", finish_bool_cb, task);
+
+  while (!g_task_get_completed (task))
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_true (g_task_propagate_boolean (task, NULL));
+  g_clear_object (&task);
+
+  client = cm_client_new ();
+  /* Mark client to not save changes to db */
+  g_object_set_data (G_OBJECT (client), "no-save", GINT_TO_POINTER (TRUE));
+  cm_client_set_user_id (client, "@alice:example.com");
+  cm_client_set_device_id (client, "AABBCCDD");
+
+  /* Rooms can be saved only for an account in the db */
+  task = g_task_new (NULL, NULL, NULL, NULL);
+  cm_db_save_client_async (db, client, NULL, finish_bool_cb, task);
+
+  while (!g_task_get_completed (task))
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_true (g_task_propagate_boolean (task, NULL));
+  g_clear_object (&task);
+
+  cm_client_set_db (client, db);
+
+  roots = g_ptr_array_new_with_free_func ((GDestroyNotify)json_object_unref);
+  for (guint i = 0; i < responses->len; i++)
+    {
+      JsonObject *root;
+
+      root = replay_parse_response (responses->pdata[i]);
+      /* There's no olm account to handle the keys sent to the device */
+      json_object_remove_member (root, "to_device");
+      g_ptr_array_add (roots, root);
+    }
+
+  /* Room events are saved to the db before handle_red_pill() returns */
+  for (guint i = 0; i < roots->len; i++)
+    {
+      g_test_timer_start ();
+      handle_red_pill (client, roots->pdata[i]);
+      elapsed += g_test_timer_elapsed ();
+    }
+
+  if (!recorded)
+    g_assert_cmpint (g_list_model_get_n_items (cm_client_get_joined_rooms (client)), ==, n_rooms);
+
+  g_test_minimized_result (elapsed, "Handled %u syncs in %.3f s", roots->len, elapsed);
+
+  /* The room details are saved in the background, wait for them */
+  g_test_timer_start ();
+  task = g_task_new (NULL, NULL, NULL, NULL);
+  cm_db_close_async (db, finish_bool_cb, task);
+
+  while (!g_task_get_completed (task))
+    g_main_context_iteration (NULL, TRUE);
+
+  persist_elapsed = g_test_timer_elapsed ();
+  g_assert_true (g_task_propagate_boolean (task, NULL));
+  g_clear_object (&task);
+
+  g_test_minimized_result (persist_elapsed, "Saved pending room details in %.3f s",
+                           persist_elapsed);
+
+  g_object_unref (client);
+  g_object_unref (db);
+  g_remove (file_name);
+}
+
+static void
+test_sync_replay_decrypt (void)
+{
+  g_autoptr(GPtrArray) messages = NULL;
+  g_autoptr(CmOlm) out_session = NULL;
+  g_autoptr(CmOlm) in_session = NULL;
+  const char *session_key;
+  guint n_messages;
+  double elapsed;
+
+  n_messages = MAX (1, n_rooms * n_events);
+
+  out_session = cm_olm_out_group_new ("sender-curve-key");
+  g_assert_nonnull (out_session);
+
+  session_key = cm_olm_get_session_key (out_session);
+  in_session = cm_olm_in_group_new (session_key, "sender-curve-key",
+                                    cm_olm_get_session_id (out_session));
+  g_assert_nonnull (in_session);
+
+  messages = g_ptr_array_new_with_free_func (g_free);
+  for (guint i = 0; i < n_messages; i++)
+    {
+      g_autofree char *body = NULL;
+
+      body = g_strdup_printf ("{\"type\":\"m.room.message\",\"content\":"
+                              "{\"msgtype\":\"m.text\",\"body\":\"Message %u\"}}", i);
+      g_ptr_array_add (messages, cm_olm_encrypt (out_session, body));
+    }
+
+  g_test_timer_start ();
+
+  for (guint i = 0; i < messages->len; i++)
+    {
+      g_autofree char *plain_text = NULL;
+
+      plain_text = cm_olm_decrypt (in_session, 0, messages->pdata[i]);
+      g_assert_nonnull (plain_text);
+    }
+
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed, "Decrypted %u megolm messages in %.3f s",
+                           messages->len, elapsed);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  g_autoptr(CmMatrix) matrix = NULL;
+  int ret;
+
+  g_test_init (&argc, &argv, NULL);
+
+  cm_init (TRUE);
+  matrix = cm_matrix_new (g_test_get_dir (G_TEST_BUILT),
+                          g_test_get_dir (G_TEST_BUILT),
+                          "org.example.CMatrix",
+                          FALSE);
+  replay_init ();
+
+  g_test_add_func ("/sync-replay/parse", test_sync_replay_parse);
+  g_test_add_func ("/sync-replay/event-list", test_sync_replay_event_list);
+  g_test_add_func ("/sync-replay/handle", test_sync_replay_handle);
+  g_test_add_func ("/sync-replay/decrypt", test_sync_replay_decrypt);
+
+  ret = g_test_run ();
+  g_clear_pointer (&responses, g_ptr_array_unref);
+
+  return ret;
+}
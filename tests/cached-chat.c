@@ -0,0 +1,100 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* cached-chat.c
+ *
+ * Copyright 2024 Purism SPC
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#undef NDEBUG
+#undef G_DISABLE_ASSERT
+#undef G_DISABLE_CHECKS
+#undef G_DISABLE_CAST_CHECKS
+#undef G_LOG_DOMAIN
+
+#include <glib/gstdio.h>
+
+#include "chatty-cached-chat.c"
+
+static void
+test_cached_chat_snapshot (void)
+{
+  g_autoptr(GListStore) chats = NULL;
+  g_autoptr(ChattyCachedChat) chat = NULL;
+  g_autoptr(GPtrArray) loaded = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree char *dir = NULL;
+  g_autofree char *path = NULL;
+  g_autofree char *key = NULL;
+  g_autofree char *loaded_key = NULL;
+  g_autofree char *cache_dir = NULL;
+  GStatBuf st;
+  gboolean saved;
+
+  dir = g_dir_make_tmp ("chatty-XXXXXX", &error);
+  g_assert_no_error (error);
+  path = g_build_filename (dir, "cache", "chat-list-snapshot", NULL);
+
+  /* No snapshot yet */
+  g_assert_null (chatty_cached_chat_load_snapshot (path));
+
+  chats = g_list_store_new (CHATTY_TYPE_CHAT);
+  chat = chatty_cached_chat_new (CHATTY_PROTOCOL_MMS_SMS, "SMS", "+1555123",
+                                 "Alice", "See you", 1700000000, 2);
+  g_list_store_append (chats, chat);
+  g_clear_object (&chat);
+  chat = chatty_cached_chat_new (CHATTY_PROTOCOL_MATRIX, "@bob:example.org", "!room:example.org",
+                                 "Room", "", 0, 0);
+  g_list_store_append (chats, chat);
+  g_clear_object (&chat);
+  chat = chatty_cached_chat_new (CHATTY_PROTOCOL_MATRIX, "@bob:example.org", "!old:example.org",
+                                 "Old", "", 0, 0);
+  g_list_store_append (chats, chat);
+  g_clear_object (&chat);
+
+  /* Only the first chats shall be saved */
+  saved = chatty_cached_chat_save_snapshot (G_LIST_MODEL (chats), 2, path, &error);
+  g_assert_no_error (error);
+  g_assert_true (saved);
+
+  /* The snapshot has message excerpts, so only the user shall read it */
+  g_assert_cmpint (g_stat (path, &st), ==, 0);
+  g_assert_cmpint (st.st_mode & 0777, ==, 0600);
+  cache_dir = g_path_get_dirname (path);
+  g_assert_cmpint (g_stat (cache_dir, &st), ==, 0);
+  g_assert_cmpint (st.st_mode & 0777, ==, 0700);
+
+  loaded = chatty_cached_chat_load_snapshot (path);
+  g_assert_nonnull (loaded);
+  g_assert_cmpint (loaded->len, ==, 2);
+
+  chat = g_list_model_get_item (G_LIST_MODEL (chats), 0);
+  key = chatty_cached_chat_get_key (CHATTY_CHAT (chat));
+  loaded_key = chatty_cached_chat_get_key (loaded->pdata[0]);
+  g_assert_cmpstr (key, ==, loaded_key);
+
+  g_assert_cmpstr (chatty_item_get_name (loaded->pdata[0]), ==, "Alice");
+  g_assert_cmpstr (chatty_chat_get_last_message (loaded->pdata[0]), ==, "See you");
+  g_assert_cmpint (chatty_chat_get_last_msg_time (loaded->pdata[0]), ==, 1700000000);
+  g_assert_cmpint (chatty_chat_get_unread_count (loaded->pdata[0]), ==, 2);
+  g_assert_cmpint (chatty_item_get_protocols (loaded->pdata[1]), ==, CHATTY_PROTOCOL_MATRIX);
+  g_assert_cmpstr (chatty_chat_get_chat_name (loaded->pdata[1]), ==, "!room:example.org");
+  g_assert_cmpint (chatty_chat_get_last_msg_time (loaded->pdata[1]), ==, 0);
+
+  g_assert_cmpint (g_unlink (path), ==, 0);
+  g_clear_pointer (&path, g_free);
+  path = g_build_filename (dir, "cache", NULL);
+  g_assert_cmpint (g_rmdir (path), ==, 0);
+  g_assert_cmpint (g_rmdir (dir), ==, 0);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/cached-chat/snapshot", test_cached_chat_snapshot);
+
+  return g_test_run ();
+}
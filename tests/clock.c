@@ -182,6 +182,80 @@ test_clock_human_time (void)
   g_assert_finalize_object (clock);
 }
 
+static void
+test_clock_next_change (void)
+{
+  struct {
+    const char *time_in;
+    const char *time_now;
+    gboolean    detailed;
+    const char *next_change;
+  } changes[] = {
+    { "2021-12-07 19:17:58+03:30", "2021-12-07 19:17:58+03:30", TRUE, "2021-12-07 19:18:58+03:30" },
+    { "2021-12-07 19:17:58+03:30", "2021-12-07 19:20:59+03:30", TRUE, "2021-12-07 19:21:58+03:30" },
+    { "2021-12-07 19:17:58+03:30", "2021-12-07 20:30:00+03:30", TRUE, "2021-12-08 00:00:00+03:30" },
+    { "2021-12-07 19:17:58+03:30", "2021-12-07 19:20:59+03:30", FALSE, "2021-12-08 00:00:00+03:30" },
+    { "2021-12-07 19:18:02+03:30", "2021-12-07 19:17:50+03:30", FALSE, "2021-12-07 19:17:57+03:30" },
+    { "2021-12-01 10:00:00+03:30", "2021-12-20 10:00:00+03:30", TRUE, NULL },
+  };
+
+  for (guint i = 0; i < G_N_ELEMENTS (changes); i++) {
+    g_autoptr(GDateTime) time = NULL;
+    g_autoptr(GDateTime) now = NULL;
+    gint64 expected = 0;
+
+    now = g_date_time_new_from_iso8601 (changes[i].time_now, NULL);
+    time = g_date_time_new_from_iso8601 (changes[i].time_in, NULL);
+
+    if (changes[i].next_change) {
+      g_autoptr(GDateTime) next_change = NULL;
+
+      next_change = g_date_time_new_from_iso8601 (changes[i].next_change, NULL);
+      expected = g_date_time_to_unix (next_change);
+    }
+
+    g_assert_cmpint (clock_get_next_change (now, time, changes[i].detailed), ==, expected);
+  }
+}
+
+static void
+watch_changed_cb (gpointer user_data)
+{
+  guint *count = user_data;
+
+  (*count)++;
+}
+
+static void
+test_clock_watch (void)
+{
+  ChattyClock *clock;
+  guint id, count = 0;
+
+  clock = chatty_clock_get_default ();
+  g_assert (CHATTY_IS_CLOCK (clock));
+
+  /* Labels from a long time ago never change */
+  id = chatty_clock_add_watch (clock, 1000, TRUE, watch_changed_cb, &count);
+  g_assert_cmpint (id, >, 0);
+  g_assert_cmpint (g_sequence_get_length (clock->watches), ==, 0);
+
+  clock_run_watches (clock, TRUE);
+  g_assert_cmpint (count, ==, 1);
+
+  chatty_clock_remove_watch (clock, id);
+  clock_run_watches (clock, TRUE);
+  g_assert_cmpint (count, ==, 1);
+
+  /* Recent ones are scheduled */
+  id = chatty_clock_add_watch (clock, time (NULL), TRUE, watch_changed_cb, &count);
+  g_assert_cmpint (g_sequence_get_length (clock->watches), ==, 1);
+  chatty_clock_remove_watch (clock, id);
+  g_assert_cmpint (g_sequence_get_length (clock->watches), ==, 0);
+
+  g_assert_finalize_object (clock);
+}
+
 static void
 test_clock_new (void)
 {
@@ -204,6 +278,8 @@ main (int   argc,
 
   g_test_add_func ("/clock/new", test_clock_new);
   g_test_add_func ("/clock/human-time", test_clock_human_time);
+  g_test_add_func ("/clock/next-change", test_clock_next_change);
+  g_test_add_func ("/clock/watch", test_clock_watch);
 
   return g_test_run ();
 }
@@ -90,6 +90,23 @@ finish_bool_cb (GObject      *object,
   g_task_return_boolean (task, status);
 }
 
+static void
+finish_int_cb (GObject      *object,
+               GAsyncResult *result,
+               gpointer      user_data)
+{
+  g_autoptr(GError) error = NULL;
+  GTask *task = user_data;
+  gssize value;
+
+  g_assert_true (G_IS_TASK (task));
+
+  value = g_task_propagate_int (G_TASK (result), &error);
+  g_assert_no_error (error);
+
+  g_task_return_int (task, value);
+}
+
 static int
 history_db_get_int (sqlite3    *db,
                     const char *statement)
@@ -148,7 +165,7 @@ compare_table (sqlite3    *db,
 static void
 compare_db_new_columns (sqlite3 *db)
 {
-  g_assert (HISTORY_VERSION == 4);
+  g_assert (HISTORY_VERSION == 6);
 
   /* TO REMOVE */
   compare_table (db,
@@ -189,6 +206,37 @@ compare_db_new_columns (sqlite3 *db)
                  ");",
                  history_db_get_int (db, "SELECT COUNT(*) FROM main.message_files;"),
                  history_db_get_int (db, "SELECT COUNT(*) FROM test.message_files;"));
+
+  compare_table (db,
+                 "SELECT COUNT (*) FROM ("
+                 "SELECT checksum,path,size,evictable,last_access,url FROM main.media_cache "
+                 "UNION "
+                 "SELECT checksum,path,size,evictable,last_access,url FROM test.media_cache "
+                 ");",
+                 history_db_get_int (db, "SELECT COUNT(*) FROM main.media_cache;"),
+                 history_db_get_int (db, "SELECT COUNT(*) FROM test.media_cache;"));
+
+  compare_table (db,
+                 "SELECT COUNT (*) FROM ("
+                 "SELECT f.url,c.checksum FROM main.files AS f "
+                 "INNER JOIN main.media_cache AS c ON c.id=f.cache_id "
+                 "UNION "
+                 "SELECT f.url,c.checksum FROM test.files AS f "
+                 "INNER JOIN test.media_cache AS c ON c.id=f.cache_id "
+                 ");",
+                 history_db_get_int (db, "SELECT COUNT(*) FROM main.files WHERE cache_id IS NOT NULL;"),
+                 history_db_get_int (db, "SELECT COUNT(*) FROM test.files WHERE cache_id IS NOT NULL;"));
+
+  compare_table (db,
+                 "SELECT COUNT (*) FROM ("
+                 "SELECT m.uid,number,device_id,attempts,next_attempt FROM main.sms_queue "
+                 "INNER JOIN main.messages AS m ON m.id=sms_queue.message_id "
+                 "UNION "
+                 "SELECT m.uid,number,device_id,attempts,next_attempt FROM test.sms_queue "
+                 "INNER JOIN test.messages AS m ON m.id=sms_queue.message_id "
+                 ");",
+                 history_db_get_int (db, "SELECT COUNT(*) FROM main.sms_queue;"),
+                 history_db_get_int (db, "SELECT COUNT(*) FROM test.sms_queue;"));
 }
 
 static void
@@ -776,6 +824,98 @@ test_history_message (void)
   g_ptr_array_unref (msg_array);
 }
 
+static GPtrArray *
+get_sms_queue (ChattyHistory *history)
+{
+  GPtrArray *items;
+  GTask *task;
+
+  task = g_task_new (NULL, NULL, NULL, NULL);
+  chatty_history_get_sms_queue_async (history, finish_pointer_cb, task);
+
+  while (!g_task_get_completed (task))
+    g_main_context_iteration (NULL, TRUE);
+
+  items = g_task_propagate_pointer (task, NULL);
+  g_assert_finalize_object (task);
+  g_assert_nonnull (items);
+
+  return items;
+}
+
+static void
+test_history_sms_queue (void)
+{
+  g_autoptr(ChattyHistory) history = NULL;
+  g_autoptr(ChattyMessage) message = NULL;
+  g_autoptr(GPtrArray) items = NULL;
+  ChattySmsQueueItem *item;
+  ChattyChat *chat;
+  GTask *task;
+  int id[2], when;
+
+  g_remove (g_test_get_filename (G_TEST_BUILT, "test-history.db", NULL));
+
+  history = chatty_history_new ();
+  chatty_history_open (history, g_test_get_dir (G_TEST_BUILT), "test-history.db");
+
+  chat = chatty_chat_new ("test-account@example.com", "buddy@example.org", FALSE);
+  g_object_set (G_OBJECT (chat), "protocols", CHATTY_PROTOCOL_XMPP, NULL);
+
+  when = time (NULL);
+  message = chatty_message_new (NULL, "Queued message", "queued-message-uid", when,
+                                CHATTY_MESSAGE_TEXT, CHATTY_DIRECTION_OUT,
+                                CHATTY_STATUS_SENDING);
+
+  /* The same message queued to two numbers */
+  for (guint i = 0; i < G_N_ELEMENTS (id); i++) {
+    const char *number = i ? "+15555550101" : "+15555550100";
+    const char *device_id = i ? NULL : "490154203237518";
+
+    task = g_task_new (NULL, NULL, NULL, NULL);
+    chatty_history_queue_sms_async (history, chat, message, number, device_id,
+                                    finish_int_cb, task);
+
+    while (!g_task_get_completed (task))
+      g_main_context_iteration (NULL, TRUE);
+
+    id[i] = g_task_propagate_int (task, NULL);
+    g_assert_cmpint (id[i], >, 0);
+    g_assert_finalize_object (task);
+  }
+
+  g_assert_cmpint (id[0], !=, id[1]);
+
+  items = get_sms_queue (history);
+  g_assert_cmpint (items->len, ==, 2);
+
+  item = items->pdata[0];
+  g_assert_cmpint (item->id, ==, id[0]);
+  g_assert_cmpstr (item->chat_name, ==, "buddy@example.org");
+  g_assert_cmpstr (item->number, ==, "+15555550100");
+  g_assert_cmpstr (item->device_id, ==, "490154203237518");
+  g_assert_cmpint (item->attempts, ==, 0);
+  compare_chat_message (message, item->message);
+  g_clear_pointer (&items, g_ptr_array_unref);
+
+  /* Retry state shall be kept, and sent ones removed */
+  chatty_history_update_sms_queue (history, id[1], 2, when + 60);
+  chatty_history_remove_queued_sms (history, id[0]);
+
+  items = get_sms_queue (history);
+  g_assert_cmpint (items->len, ==, 1);
+
+  item = items->pdata[0];
+  g_assert_cmpint (item->id, ==, id[1]);
+  g_assert_null (item->device_id);
+  g_assert_cmpint (item->attempts, ==, 2);
+  g_assert_cmpint (item->next_attempt, ==, when + 60);
+  g_clear_pointer (&items, g_ptr_array_unref);
+
+  chatty_history_close (history);
+  g_assert_finalize_object (chat);
+}
+
 static void
 test_history_raw_message (void)
 {
@@ -1119,7 +1259,7 @@ test_history_migration_db (void)
     sqlite3_close (db);
 
     /* Export migrated version sql file */
-    expected_file = g_strdelimit (g_strdup (name), "0123", '4');
+    expected_file = g_strdelimit (g_strdup (name), "012345", '6');
     export_sql_file (path, expected_file, &db);
 
     /* Open history with old db, which will result in db migration */
@@ -1153,6 +1293,7 @@ main (int   argc,
   g_test_add_func ("/history/new", test_history_new);
   g_test_add_func ("/history/message", test_history_message);
   g_test_add_func ("/history/raw_message", test_history_raw_message);
+  g_test_add_func ("/history/sms_queue", test_history_sms_queue);
   g_test_add_func ("/history/db", test_history_db);
   g_test_add_func ("/history/db_migration", test_history_migration_db);
 
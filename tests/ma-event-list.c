@@ -0,0 +1,196 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* ma-event-list.c
+ *
+ * Copyright 2024 Purism SPC
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#undef NDEBUG
+#undef G_DISABLE_ASSERT
+#undef G_DISABLE_CHECKS
+#undef G_DISABLE_CAST_CHECKS
+#undef G_LOG_DOMAIN
+
+#include "chatty-ma-event-list.c"
+#include "events/cm-event-private.h"
+#include "events/cm-room-message-event-private.h"
+
+static ChattyItem *
+sender_func (CmUser  *user,
+             GObject *owner)
+{
+  /* Only the index is tested, no message is ever created */
+  g_assert_not_reached ();
+
+  return NULL;
+}
+
+/* A message event if @event_id is set, an event that's not a message otherwise */
+static CmEvent *
+new_event (const char *event_id)
+{
+  CmEvent *event;
+
+  if (!event_id)
+    return cm_event_new (CM_M_UNKNOWN);
+
+  event = CM_EVENT (cm_room_message_event_new (CM_CONTENT_TYPE_TEXT));
+  cm_event_set_id (event, event_id);
+
+  return event;
+}
+
+/* @ids is a space separated list of event ids, with "-" for events that aren't messages */
+static void
+store_splice (GListStore *store,
+              guint       position,
+              guint       n_removals,
+              const char *ids)
+{
+  g_autoptr(GPtrArray) events = NULL;
+  g_auto(GStrv) strv = NULL;
+
+  events = g_ptr_array_new_with_free_func (g_object_unref);
+  strv = g_strsplit (ids, " ", -1);
+
+  for (guint i = 0; strv[i]; i++) {
+    if (!*strv[i])
+      continue;
+
+    g_ptr_array_add (events, new_event (g_str_equal (strv[i], "-") ? NULL : strv[i]));
+  }
+
+  g_list_store_splice (store, position, n_removals, events->pdata, events->len);
+}
+
+/* Check that every message in @layout is found by id at its position in @events */
+static void
+assert_layout (ChattyMaEventList *self,
+               GListModel        *events,
+               const char        *layout)
+{
+  g_auto(GStrv) strv = NULL;
+  guint n_items = 0, n_messages = 0;
+
+  strv = g_strsplit (layout, " ", -1);
+
+  for (guint i = 0; strv[i]; i++) {
+    g_autoptr(CmEvent) event = NULL;
+    CmEvent *found;
+    guint index;
+
+    if (!*strv[i])
+      continue;
+
+    event = g_list_model_get_item (events, n_items);
+    g_assert_nonnull (event);
+
+    if (g_str_equal (strv[i], "-")) {
+      g_assert_false (event_is_message (event));
+      n_items++;
+      continue;
+    }
+
+    g_assert_cmpstr (cm_event_get_id (event), ==, strv[i]);
+
+    found = g_hash_table_lookup (self->event_ids, strv[i]);
+    g_assert_true (found == event);
+    g_assert_true (g_ptr_array_find (self->index_events, found, &index));
+    g_assert_cmpint (index, ==, n_messages);
+    g_assert_cmpint (g_array_index (self->index, guint, index), ==, n_items);
+
+    n_items++;
+    n_messages++;
+  }
+
+  g_assert_cmpint (g_list_model_get_n_items (events), ==, n_items);
+  g_assert_cmpint (g_list_model_get_n_items (G_LIST_MODEL (self)), ==, n_messages);
+  g_assert_cmpint (self->index->len, ==, n_messages);
+  g_assert_cmpint (self->index_events->len, ==, n_messages);
+  g_assert_cmpint (g_hash_table_size (self->event_ids), ==, n_messages);
+}
+
+static void
+assert_removed (ChattyMaEventList *self,
+                const char        *ids)
+{
+  g_auto(GStrv) strv = NULL;
+
+  strv = g_strsplit (ids, " ", -1);
+
+  for (guint i = 0; strv[i]; i++) {
+    g_assert_false (g_hash_table_contains (self->event_ids, strv[i]));
+    g_assert_null (chatty_ma_event_list_find_message (self, strv[i]));
+  }
+}
+
+static void
+test_ma_event_list_index (void)
+{
+  g_autoptr(ChattyMaEventList) list = NULL;
+  g_autoptr(GListStore) store = NULL;
+  g_autoptr(GObject) owner = NULL;
+  GListModel *events;
+
+  store = g_list_store_new (CM_TYPE_EVENT);
+  events = G_LIST_MODEL (store);
+  owner = g_object_new (G_TYPE_OBJECT, NULL);
+
+  /* Events already in the store when the list is created */
+  store_splice (store, 0, 0, "$a - $b");
+  list = chatty_ma_event_list_new (events, sender_func, owner);
+  g_assert_true (CHATTY_IS_MA_EVENT_LIST (list));
+  assert_layout (list, events, "$a - $b");
+
+  /* Insert at the start */
+  store_splice (store, 0, 0, "- $c");
+  assert_layout (list, events, "- $c $a - $b");
+
+  /* Insert in the middle */
+  store_splice (store, 3, 0, "$d");
+  assert_layout (list, events, "- $c $a $d - $b");
+
+  /* Remove a message */
+  store_splice (store, 2, 1, "");
+  assert_layout (list, events, "- $c $d - $b");
+  assert_removed (list, "$a");
+
+  /* Replace messages and other events with more items */
+  store_splice (store, 1, 3, "$e - $f");
+  assert_layout (list, events, "- $e - $f $b");
+  assert_removed (list, "$c $d");
+
+  /* Replace an event that's not a message, shifting the messages after it */
+  store_splice (store, 2, 1, "- -");
+  assert_layout (list, events, "- $e - - $f $b");
+
+  /* Append at the end */
+  store_splice (store, 6, 0, "$g");
+  assert_layout (list, events, "- $e - - $f $b $g");
+
+  /* Replace the tail with fewer items */
+  store_splice (store, 4, 3, "- $h");
+  assert_layout (list, events, "- $e - - - $h");
+  assert_removed (list, "$f $b $g");
+
+  /* Remove everything */
+  store_splice (store, 0, 6, "");
+  assert_layout (list, events, "");
+  assert_removed (list, "$e $h");
+
+  /* Ids of removed events can come back */
+  store_splice (store, 0, 0, "$a - $e");
+  assert_layout (list, events, "$a - $e");
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/ma-event-list/index", test_ma_event_list_index);
+
+  return g_test_run ();
+}
@@ -0,0 +1,367 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* media-cache.c
+ *
+ * Copyright 2024 Purism SPC
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#undef NDEBUG
+#undef G_DISABLE_ASSERT
+#undef G_DISABLE_CHECKS
+#undef G_DISABLE_CAST_CHECKS
+#undef G_LOG_DOMAIN
+
+#include <glib/gstdio.h>
+
+#include "chatty-media-cache.c"
+
+typedef struct {
+  ChattyHistory    *history;
+  ChattyMediaCache *cache;
+  char             *dir;
+} Fixture;
+
+typedef struct {
+  GFile    *file;
+  gboolean  done;
+} LookupData;
+
+static void
+fixture_setup (Fixture       *fixture,
+               gconstpointer  user_data)
+{
+  g_autoptr(GError) error = NULL;
+
+  fixture->dir = g_dir_make_tmp ("chatty-XXXXXX", &error);
+  g_assert_no_error (error);
+
+  fixture->history = chatty_history_new ();
+  chatty_history_open (fixture->history, fixture->dir, "history.db");
+  g_assert_false (chatty_history_is_closed (fixture->history));
+
+  fixture->cache = chatty_media_cache_new (fixture->history, fixture->dir);
+}
+
+static void
+remove_dir (const char *path)
+{
+  g_autoptr(GDir) dir = NULL;
+  const char *name;
+
+  dir = g_dir_open (path, 0, NULL);
+  g_assert_nonnull (dir);
+
+  while ((name = g_dir_read_name (dir))) {
+    g_autofree char *child = NULL;
+
+    child = g_build_filename (path, name, NULL);
+
+    if (g_file_test (child, G_FILE_TEST_IS_DIR))
+      remove_dir (child);
+    else
+      g_assert_cmpint (g_remove (child), ==, 0);
+  }
+
+  g_assert_cmpint (g_rmdir (path), ==, 0);
+}
+
+static void
+fixture_teardown (Fixture       *fixture,
+                  gconstpointer  user_data)
+{
+  g_clear_object (&fixture->cache);
+  chatty_history_close (fixture->history);
+  g_clear_object (&fixture->history);
+  remove_dir (fixture->dir);
+  g_free (fixture->dir);
+}
+
+static GFile *
+create_file (Fixture    *fixture,
+             const char *name,
+             const char *content)
+{
+  g_autoptr(GError) error = NULL;
+  g_autofree char *dir = NULL;
+  g_autofree char *path = NULL;
+
+  dir = g_build_filename (fixture->dir, "incoming", NULL);
+  g_mkdir_with_parents (dir, 0700);
+  path = g_build_filename (dir, name, NULL);
+  g_file_set_contents (path, content, -1, &error);
+  g_assert_no_error (error);
+
+  return g_file_new_for_path (path);
+}
+
+static GFile *
+get_cached_file (Fixture    *fixture,
+                 const char *path)
+{
+  return g_file_new_build_filename (fixture->dir, path, NULL);
+}
+
+static void
+cache_add_cb (GObject      *object,
+              GAsyncResult *result,
+              gpointer      user_data)
+{
+  g_autoptr(GError) error = NULL;
+  char **path = user_data;
+
+  *path = chatty_media_cache_add_finish (CHATTY_MEDIA_CACHE (object), result, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (*path);
+}
+
+static char *
+cache_add (Fixture    *fixture,
+           GFile      *file,
+           const char *url,
+           gboolean    evictable)
+{
+  char *path = NULL;
+
+  chatty_media_cache_add_async (fixture->cache, file, url, evictable, NULL,
+                                cache_add_cb, &path);
+
+  while (!path)
+    g_main_context_iteration (NULL, TRUE);
+
+  return path;
+}
+
+static void
+cache_lookup_cb (GObject      *object,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+  g_autoptr(GError) error = NULL;
+  LookupData *data = user_data;
+
+  data->file = chatty_media_cache_lookup_finish (CHATTY_MEDIA_CACHE (object), result, &error);
+  g_assert_no_error (error);
+  data->done = TRUE;
+}
+
+static GFile *
+cache_lookup (Fixture    *fixture,
+              const char *url)
+{
+  LookupData data = { 0 };
+
+  chatty_media_cache_lookup_async (fixture->cache, url, NULL,
+                                   cache_lookup_cb, &data);
+
+  while (!data.done)
+    g_main_context_iteration (NULL, TRUE);
+
+  return data.file;
+}
+
+static void
+test_media_cache_add (Fixture       *fixture,
+                      gconstpointer  user_data)
+{
+  g_autoptr(GFile) file = NULL;
+  g_autoptr(GFile) copy = NULL;
+  g_autoptr(GFile) cached = NULL;
+  g_autoptr(GFile) found = NULL;
+  g_autofree char *content = NULL;
+  g_autofree char *path = NULL;
+  g_autofree char *copy_path = NULL;
+
+  file = create_file (fixture, "image.png", "image content");
+  path = cache_add (fixture, file, "mxc://example.org/image", TRUE);
+
+  g_assert_true (g_str_has_prefix (path, "media" G_DIR_SEPARATOR_S));
+  g_assert_true (g_str_has_suffix (path, ".png"));
+  g_assert_false (g_file_query_exists (file, NULL));
+
+  cached = get_cached_file (fixture, path);
+  g_assert_true (g_file_load_contents (cached, NULL, &content, NULL, NULL, NULL));
+  g_assert_cmpstr (content, ==, "image content");
+
+  /* The same content is stored once */
+  copy = create_file (fixture, "copy.png", "image content");
+  copy_path = cache_add (fixture, copy, NULL, TRUE);
+  g_assert_cmpstr (copy_path, ==, path);
+  g_assert_false (g_file_query_exists (copy, NULL));
+  g_assert_true (g_file_query_exists (cached, NULL));
+
+  found = cache_lookup (fixture, "mxc://example.org/image");
+  g_assert_nonnull (found);
+  g_assert_true (g_file_equal (found, cached));
+
+  g_assert_null (cache_lookup (fixture, "mxc://example.org/unknown"));
+}
+
+static void
+test_media_cache_eviction (Fixture       *fixture,
+                           gconstpointer  user_data)
+{
+  g_autoptr(GFile) file_a = NULL;
+  g_autoptr(GFile) file_b = NULL;
+  g_autoptr(GFile) file_c = NULL;
+  g_autoptr(GFile) file_d = NULL;
+  g_autoptr(GFile) found = NULL;
+  g_autofree char *path_a = NULL;
+  g_autofree char *path_b = NULL;
+  g_autofree char *path_c = NULL;
+  g_autofree char *path_d = NULL;
+
+  /* Room for three of the four files */
+  chatty_media_cache_set_max_size (fixture->cache, 12);
+
+  file_a = create_file (fixture, "a.txt", "aaaa");
+  path_a = cache_add (fixture, file_a, "mxc://example.org/a", TRUE);
+  g_clear_object (&file_a);
+  file_b = create_file (fixture, "b.txt", "bbbb");
+  path_b = cache_add (fixture, file_b, "mxc://example.org/b", TRUE);
+  g_clear_object (&file_b);
+  file_c = create_file (fixture, "c.txt", "cccc");
+  path_c = cache_add (fixture, file_c, "mxc://example.org/c", TRUE);
+  g_clear_object (&file_c);
+
+  file_a = get_cached_file (fixture, path_a);
+  file_b = get_cached_file (fixture, path_b);
+  file_c = get_cached_file (fixture, path_c);
+  g_assert_true (g_file_query_exists (file_a, NULL));
+  g_assert_true (g_file_query_exists (file_b, NULL));
+  g_assert_true (g_file_query_exists (file_c, NULL));
+
+  /* A lookup makes 'a' the most recently used */
+  found = cache_lookup (fixture, "mxc://example.org/a");
+  g_assert_nonnull (found);
+
+  /* So 'b' is the least recently used one */
+  file_d = create_file (fixture, "d.txt", "dddd");
+  path_d = cache_add (fixture, file_d, "mxc://example.org/d", TRUE);
+  g_clear_object (&file_d);
+  file_d = get_cached_file (fixture, path_d);
+
+  /* Evicted files are deleted before the add finishes */
+  g_assert_false (g_file_query_exists (file_b, NULL));
+  g_assert_true (g_file_query_exists (file_a, NULL));
+  g_assert_true (g_file_query_exists (file_c, NULL));
+  g_assert_true (g_file_query_exists (file_d, NULL));
+  g_assert_null (cache_lookup (fixture, "mxc://example.org/b"));
+
+  g_clear_object (&found);
+  found = cache_lookup (fixture, "mxc://example.org/c");
+  g_assert_nonnull (found);
+}
+
+static void
+test_media_cache_pin (Fixture       *fixture,
+                      gconstpointer  user_data)
+{
+  g_autoptr(GFile) pinned = NULL;
+  g_autoptr(GFile) file_a = NULL;
+  g_autoptr(GFile) file_b = NULL;
+  g_autoptr(GFile) file_c = NULL;
+  g_autoptr(GFile) file = NULL;
+  g_autofree char *pinned_path = NULL;
+  g_autofree char *path_a = NULL;
+  g_autofree char *path_b = NULL;
+  g_autofree char *path_c = NULL;
+  g_autofree char *path = NULL;
+
+  /* Room for two evictable files */
+  chatty_media_cache_set_max_size (fixture->cache, 8);
+
+  /* Pinned files don't count against the budget, even if they exceed it */
+  file = create_file (fixture, "mms.jpg", "mms-mms-mms");
+  pinned_path = cache_add (fixture, file, NULL, FALSE);
+  g_clear_object (&file);
+  pinned = get_cached_file (fixture, pinned_path);
+
+  /* Adding the pinned content as evictable doesn't unpin it */
+  file = create_file (fixture, "forwarded.jpg", "mms-mms-mms");
+  path = cache_add (fixture, file, "mxc://example.org/forwarded", TRUE);
+  g_clear_object (&file);
+  g_assert_cmpstr (path, ==, pinned_path);
+
+  file = create_file (fixture, "a.txt", "aaaa");
+  path_a = cache_add (fixture, file, "mxc://example.org/a", TRUE);
+  g_clear_object (&file);
+  file_a = get_cached_file (fixture, path_a);
+
+  file = create_file (fixture, "b.txt", "bbbb");
+  path_b = cache_add (fixture, file, "mxc://example.org/b", TRUE);
+  g_clear_object (&file);
+  file_b = get_cached_file (fixture, path_b);
+
+  g_assert_true (g_file_query_exists (pinned, NULL));
+  g_assert_true (g_file_query_exists (file_a, NULL));
+  g_assert_true (g_file_query_exists (file_b, NULL));
+
+  /* Only the least recently used evictable file goes */
+  file = create_file (fixture, "c.txt", "cccc");
+  path_c = cache_add (fixture, file, "mxc://example.org/c", TRUE);
+  g_clear_object (&file);
+  file_c = get_cached_file (fixture, path_c);
+
+  g_assert_false (g_file_query_exists (file_a, NULL));
+  g_assert_true (g_file_query_exists (pinned, NULL));
+  g_assert_true (g_file_query_exists (file_b, NULL));
+  g_assert_true (g_file_query_exists (file_c, NULL));
+}
+
+static void
+test_media_cache_readd (Fixture       *fixture,
+                        gconstpointer  user_data)
+{
+  g_autoptr(GFile) file_a = NULL;
+  g_autoptr(GFile) file_b = NULL;
+  g_autoptr(GFile) file = NULL;
+  g_autofree char *path_a = NULL;
+  g_autofree char *path_b = NULL;
+  g_autofree char *path = NULL;
+
+  /* Room for one file only */
+  chatty_media_cache_set_max_size (fixture->cache, 4);
+
+  file = create_file (fixture, "a.txt", "aaaa");
+  path_a = cache_add (fixture, file, "mxc://example.org/a", TRUE);
+  g_clear_object (&file);
+  file_a = get_cached_file (fixture, path_a);
+
+  /* Adding 'b' evicts 'a' while the same content is added again */
+  file = create_file (fixture, "b.txt", "bbbb");
+  chatty_media_cache_add_async (fixture->cache, file, "mxc://example.org/b", TRUE, NULL,
+                                cache_add_cb, &path_b);
+  g_clear_object (&file);
+  file = create_file (fixture, "a-again.txt", "aaaa");
+  chatty_media_cache_add_async (fixture->cache, file, "mxc://example.org/a", TRUE, NULL,
+                                cache_add_cb, &path);
+  g_clear_object (&file);
+
+  while (!path_b || !path)
+    g_main_context_iteration (NULL, TRUE);
+
+  /* The content added last is kept, and 'b' is evicted in turn */
+  g_assert_cmpstr (path, ==, path_a);
+  g_assert_true (g_file_query_exists (file_a, NULL));
+  file_b = get_cached_file (fixture, path_b);
+  g_assert_false (g_file_query_exists (file_b, NULL));
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add ("/media-cache/add", Fixture, NULL,
+              fixture_setup, test_media_cache_add, fixture_teardown);
+  g_test_add ("/media-cache/eviction", Fixture, NULL,
+              fixture_setup, test_media_cache_eviction, fixture_teardown);
+  g_test_add ("/media-cache/pin", Fixture, NULL,
+              fixture_setup, test_media_cache_pin, fixture_teardown);
+  g_test_add ("/media-cache/readd", Fixture, NULL,
+              fixture_setup, test_media_cache_readd, fixture_teardown);
+
+  return g_test_run ();
+}
@@ -0,0 +1,221 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* message-list.c
+ *
+ * Copyright 2024 Purism SPC
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#undef NDEBUG
+#undef G_DISABLE_ASSERT
+#undef G_DISABLE_CHECKS
+#undef G_DISABLE_CAST_CHECKS
+#undef G_LOG_DOMAIN
+
+#include "chatty-message-list.c"
+
+typedef struct {
+  guint position;
+  guint removed;
+  guint added;
+  guint n_emissions;
+} ChangeData;
+
+static void
+items_changed_cb (GListModel *model,
+                  guint       position,
+                  guint       removed,
+                  guint       added,
+                  ChangeData *data)
+{
+  data->position = position;
+  data->removed = removed;
+  data->added = added;
+  data->n_emissions++;
+}
+
+static ChattyMessage *
+new_message (const char *uid,
+             time_t      time)
+{
+  return chatty_message_new (NULL, uid, uid, time, CHATTY_MESSAGE_TEXT,
+                             CHATTY_DIRECTION_IN, 0);
+}
+
+static void
+assert_order (GListModel *model,
+              const char *uids)
+{
+  g_auto(GStrv) strv = NULL;
+
+  strv = g_strsplit (uids, " ", -1);
+  g_assert_cmpint (g_list_model_get_n_items (model), ==, g_strv_length (strv));
+
+  for (guint i = 0; strv[i]; i++) {
+    g_autoptr(ChattyMessage) message = NULL;
+
+    message = g_list_model_get_item (model, i);
+    g_assert_cmpstr (chatty_message_get_uid (message), ==, strv[i]);
+  }
+}
+
+static void
+test_message_list_add (void)
+{
+  g_autoptr(ChattyMessageList) list = NULL;
+  g_autoptr(ChattyMessage) message = NULL;
+  ChangeData data = { 0 };
+
+  list = chatty_message_list_new ();
+  g_signal_connect (list, "items-changed", G_CALLBACK (items_changed_cb), &data);
+  g_assert_cmpint (g_list_model_get_n_items (G_LIST_MODEL (list)), ==, 0);
+
+  message = new_message ("a", 100);
+  chatty_message_list_add (list, message);
+  g_clear_object (&message);
+  g_assert_cmpint (data.position, ==, 0);
+  g_assert_cmpint (data.added, ==, 1);
+
+  message = new_message ("c", 300);
+  chatty_message_list_add (list, message);
+  g_clear_object (&message);
+  g_assert_cmpint (data.position, ==, 1);
+
+  /* An out of order message shall be placed by time */
+  message = new_message ("b", 200);
+  chatty_message_list_add (list, message);
+  g_clear_object (&message);
+  g_assert_cmpint (data.position, ==, 1);
+  g_assert_cmpint (data.removed, ==, 0);
+  g_assert_cmpint (data.added, ==, 1);
+
+  /* Messages with the same time keep the order they were added */
+  message = new_message ("b2", 200);
+  chatty_message_list_add (list, message);
+  g_clear_object (&message);
+  g_assert_cmpint (data.position, ==, 2);
+
+  assert_order (G_LIST_MODEL (list), "a b b2 c");
+  g_assert_cmpint (data.n_emissions, ==, 4);
+
+  g_assert_cmpint (chatty_message_list_find_time (list, 0), ==, 0);
+  g_assert_cmpint (chatty_message_list_find_time (list, 200), ==, 1);
+  g_assert_cmpint (chatty_message_list_find_time (list, 201), ==, 3);
+  g_assert_cmpint (chatty_message_list_find_time (list, 400), ==, 4);
+
+  message = g_object_ref (chatty_message_list_find_uid (list, "b2"));
+  g_assert_cmpint (chatty_message_get_time (message), ==, 200);
+  g_assert_null (chatty_message_list_find_uid (list, "d"));
+
+  chatty_message_list_remove (list, message);
+  g_assert_cmpint (data.position, ==, 2);
+  g_assert_cmpint (data.removed, ==, 1);
+  g_assert_null (chatty_message_list_find_uid (list, "b2"));
+  assert_order (G_LIST_MODEL (list), "a b c");
+
+  chatty_message_list_remove_all (list);
+  g_assert_cmpint (data.removed, ==, 3);
+  g_assert_cmpint (g_list_model_get_n_items (G_LIST_MODEL (list)), ==, 0);
+  g_assert_null (chatty_message_list_find_uid (list, "a"));
+}
+
+static void
+test_message_list_add_many (void)
+{
+  g_autoptr(ChattyMessageList) list = NULL;
+  g_autoptr(GPtrArray) messages = NULL;
+  ChangeData data = { 0 };
+
+  list = chatty_message_list_new ();
+  g_signal_connect (list, "items-changed", G_CALLBACK (items_changed_cb), &data);
+
+  messages = g_ptr_array_new_with_free_func (g_object_unref);
+  g_ptr_array_add (messages, new_message ("e", 500));
+  g_ptr_array_add (messages, new_message ("f", 600));
+  chatty_message_list_add_many (list, messages);
+  g_assert_cmpint (data.n_emissions, ==, 1);
+
+  /* Older history shall be prepended in one go */
+  g_ptr_array_set_size (messages, 0);
+  g_ptr_array_add (messages, new_message ("c", 300));
+  g_ptr_array_add (messages, new_message ("d", 400));
+  chatty_message_list_add_many (list, messages);
+  g_assert_cmpint (data.n_emissions, ==, 2);
+  g_assert_cmpint (data.position, ==, 0);
+  g_assert_cmpint (data.added, ==, 2);
+
+  /* And newer messages appended in one go */
+  g_ptr_array_set_size (messages, 0);
+  g_ptr_array_add (messages, new_message ("g", 700));
+  g_ptr_array_add (messages, new_message ("h", 800));
+  chatty_message_list_add_many (list, messages);
+  g_assert_cmpint (data.n_emissions, ==, 3);
+  g_assert_cmpint (data.position, ==, 4);
+  g_assert_cmpint (data.added, ==, 2);
+
+  /* Messages that overlap are added one by one at their place */
+  g_ptr_array_set_size (messages, 0);
+  g_ptr_array_add (messages, new_message ("b", 200));
+  g_ptr_array_add (messages, new_message ("e2", 550));
+  chatty_message_list_add_many (list, messages);
+  g_assert_cmpint (data.n_emissions, ==, 5);
+
+  assert_order (G_LIST_MODEL (list), "b c d e e2 f g h");
+}
+
+static void
+test_message_list_trim (void)
+{
+  g_autoptr(ChattyMessageList) list = NULL;
+  g_autoptr(GPtrArray) messages = NULL;
+  g_autoptr(ChattyMessage) message = NULL;
+  ChangeData data = { 0 };
+
+  list = chatty_message_list_new ();
+  messages = g_ptr_array_new_with_free_func (g_object_unref);
+  g_ptr_array_add (messages, new_message ("a", 100));
+  g_ptr_array_add (messages, new_message ("b", 200));
+  g_ptr_array_add (messages, new_message ("c", 300));
+  g_ptr_array_add (messages, new_message ("d", 400));
+  chatty_message_list_add_many (list, messages);
+
+  g_signal_connect (list, "items-changed", G_CALLBACK (items_changed_cb), &data);
+
+  g_assert_cmpint (chatty_message_list_trim (list, 4), ==, 0);
+  g_assert_cmpint (data.n_emissions, ==, 0);
+
+  /* Only the newest messages are kept */
+  g_assert_cmpint (chatty_message_list_trim (list, 2), ==, 2);
+  g_assert_cmpint (data.n_emissions, ==, 1);
+  g_assert_cmpint (data.position, ==, 0);
+  g_assert_cmpint (data.removed, ==, 2);
+  g_assert_cmpint (data.added, ==, 0);
+  assert_order (G_LIST_MODEL (list), "c d");
+  g_assert_null (chatty_message_list_find_uid (list, "a"));
+  g_assert_nonnull (chatty_message_list_find_uid (list, "c"));
+
+  /* Evicted messages can be loaded again */
+  g_ptr_array_set_size (messages, 0);
+  g_ptr_array_add (messages, new_message ("a", 100));
+  g_ptr_array_add (messages, new_message ("b", 200));
+  chatty_message_list_add_many (list, messages);
+  assert_order (G_LIST_MODEL (list), "a b c d");
+
+  g_assert_cmpint (chatty_message_list_trim (list, 1), ==, 3);
+  assert_order (G_LIST_MODEL (list), "d");
+  message = g_list_model_get_item (G_LIST_MODEL (list), 0);
+  g_assert_true (chatty_message_list_find_uid (list, "d") == message);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/message-list/add", test_message_list_add);
+  g_test_add_func ("/message-list/add-many", test_message_list_add_many);
+  g_test_add_func ("/message-list/trim", test_message_list_trim);
+
+  return g_test_run ();
+}
@@ -0,0 +1,91 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+/* stats.c
+ *
+ * Copyright 2024 Purism SPC
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#undef NDEBUG
+#undef G_DISABLE_ASSERT
+#undef G_DISABLE_CHECKS
+#undef G_DISABLE_CAST_CHECKS
+#undef G_LOG_DOMAIN
+
+#include "chatty-stats.c"
+
+static void
+test_stats_record (void)
+{
+  StatData *data = &stats[CHATTY_STAT_HISTORY_TASK];
+  g_autofree char *str = NULL;
+
+  chatty_stats_reset ();
+  g_assert_cmpint (data->count, ==, 0);
+
+  for (guint i = 1; i <= 100; i++)
+    chatty_stats_record (CHATTY_STAT_HISTORY_TASK, i * 10);
+
+  g_assert_cmpint (data->count, ==, 100);
+  g_assert_cmpint (data->sum, ==, 50500);
+  g_assert_cmpint (data->max, ==, 1000);
+
+  /* Percentiles are rounded up to the bucket bounds */
+  g_assert_cmpint (stats_get_percentile (data, data->count, 0.5), ==, 511);
+  g_assert_cmpint (stats_get_percentile (data, data->count, 0.99), ==, 1000);
+
+  /* Negative values are clamped */
+  chatty_stats_record (CHATTY_STAT_HISTORY_TASK, -5);
+  g_assert_cmpint (data->count, ==, 101);
+  g_assert_cmpint (data->buckets[1], ==, 1);
+
+  chatty_stats_record (CHATTY_STAT_CHAT_COMPARE, 1);
+  str = chatty_stats_to_string ();
+  g_assert_nonnull (strstr (str, "history-task"));
+  g_assert_nonnull (strstr (str, "chat-compare"));
+
+  chatty_stats_reset ();
+  g_assert_cmpint (data->count, ==, 0);
+  g_assert_cmpint (data->max, ==, 0);
+  g_assert_cmpint (stats[CHATTY_STAT_CHAT_COMPARE].count, ==, 0);
+}
+
+static gpointer
+record_thread (gpointer user_data)
+{
+  for (guint i = 0; i < 10000; i++)
+    chatty_stats_record (CHATTY_STAT_IMAGE_DECODE, i);
+
+  return NULL;
+}
+
+static void
+test_stats_threads (void)
+{
+  StatData *data = &stats[CHATTY_STAT_IMAGE_DECODE];
+  GThread *threads[4];
+
+  chatty_stats_reset ();
+
+  for (guint i = 0; i < G_N_ELEMENTS (threads); i++)
+    threads[i] = g_thread_new ("stats", record_thread, NULL);
+
+  for (guint i = 0; i < G_N_ELEMENTS (threads); i++)
+    g_thread_join (threads[i]);
+
+  g_assert_cmpint (data->count, ==, 40000);
+  g_assert_cmpint (data->sum, ==, 4 * (9999 * 10000 / 2));
+  g_assert_cmpint (data->max, ==, 9999);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/stats/record", test_stats_record);
+  g_test_add_func ("/stats/threads", test_stats_threads);
+
+  return g_test_run ();
+}